@@ -0,0 +1,75 @@
+#include "AllocationCounter.h"
+
+#if defined(PHYSICS_COUNT_ALLOCATIONS)
+
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+static std::atomic<unsigned long long> s_iAllocationCount(0);
+
+void* operator new(size_t size)
+{
+	s_iAllocationCount.fetch_add(1, std::memory_order_relaxed);
+
+	void* p = malloc(size > 0 ? size : 1);
+	if (p == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+	free(p);
+}
+
+//Returns : True if allocations are being counted in this build
+bool IsAllocationCountingEnabled()
+{
+	return true;
+}
+
+//Returns : Number of calls to operator new (on any thread) since the program started
+unsigned long long GetAllocationCount()
+{
+	return s_iAllocationCount.load(std::memory_order_relaxed);
+}
+
+#else
+
+//Returns : True if allocations are being counted in this build
+bool IsAllocationCountingEnabled()
+{
+	return false;
+}
+
+//Returns : Number of calls to operator new (on any thread) since the program started
+unsigned long long GetAllocationCount()
+{
+	return 0;
+}
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef _ALLOCATION_COUNTER_H_
+#define _ALLOCATION_COUNTER_H_
+
+
+//Heap allocation counting, for checking a step makes no allocations once warmed up.
+//Only active when the program is built with PHYSICS_COUNT_ALLOCATIONS defined, which
+//replaces the global operator new and delete. Otherwise nothing is counted.
+//It's compiled into the program rather than the physics library (see Tests/AllocationTest),
+//a replacement operator new in a static library is dropped by the linker if nothing calls it.
+//A step still allocates when it needs more room than any step before it: new bodies,
+//more contacts or islands than ever, or more collisions in one chunk than any chunk has had.
+//Those buffers double, so a world that has settled stops allocating altogether.
+
+//Returns : True if allocations are being counted in this build
+bool IsAllocationCountingEnabled();
+
+//Returns : Number of calls to operator new (on any thread) since the program started
+unsigned long long GetAllocationCount();
+
+#endif
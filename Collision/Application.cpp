@@ -11,10 +11,6 @@ const int CAMERA_MAX = 2;
 
 const int DEBUG_FRAME_COUNT = 30;
 
-std::vector<Sphere*> m_pSphereArray;
-
-HeightMap** m_heightMapArray;
-
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
@@ -23,6 +19,8 @@ bool Application::HandleStart()
 	s_pApp = this;
 	m_frameCount = 0;
 
+	m_random.Seed(RANDOM_SEED);
+
 	m_pSphereMesh = CommonMesh::NewSphereMesh(this, 1.0f, 16, 16);
 
 	m_bWireframe = true;
@@ -36,18 +34,18 @@ bool Application::HandleStart()
 
 	m_pPhysicsWorld = new PhysicsWorld(m_pActiveHeightMap);
 
+	//Rendering reads the bodies from snapshots while the next step runs
+	m_pPhysicsWorld->SetSnapshotsEnabled(true);
+
+	//Spheres wait in the world's pool until they're dropped, so only dropped ones are simulated
 	for (int i = 0; i < MAX_OBJECTS; i++)
 	{
 		m_pSphereArray.push_back(new Sphere(m_pSphereMesh, 1.0f));
-		m_pSphereArray[i]->SetPosition(GetRandomPosition());
-		m_pSphereArray[i]->SetActive(false);
-		m_pPhysicsWorld->AddBody(m_pSphereArray[i]);
+		m_pPhysicsWorld->AddToPool(m_pSphereArray[i]);
 	}
 
-	m_pSphereArray[0]->SetActive(true);
-	m_pSphereArray[0]->SetPosition(GetRandomPosition());
-
-	m_iCurrentSphereIndx = 0;
+	m_iSphereCount = 1;
+	m_sphereHandles.push_back(m_pPhysicsWorld->SpawnBody(GetRandomPosition(), XMVectorSet(0, 0, 0, 0)));
 
 	m_bDebugMode = false;
 
@@ -72,6 +70,9 @@ bool Application::HandleStart()
 
 void Application::HandleStop()
 {
+	//The world may still be stepping against the heightmaps
+	m_pPhysicsWorld->WaitForUpdate();
+
 	m_pActiveHeightMap = nullptr;
 	delete m_heightMapArr[0];
 	delete m_heightMapArr[1];
@@ -84,6 +85,15 @@ void Application::HandleStop()
 		m_pPhysicsWorld = nullptr;
 	}
 
+	//The world only borrows the spheres, so they go once it has
+	for (auto sphere : m_pSphereArray)
+	{
+		delete sphere;
+	}
+
+	m_pSphereArray.clear();
+	m_sphereHandles.clear();
+
 	this->CommonApp::HandleStop();
 }
 
@@ -97,11 +107,16 @@ void Application::ReloadShaders()
 	if (m_pActiveHeightMap->ReloadShader() == false)
 		this->SetWindowTitle("Reload Failed - see Visual Studio output window. Press F5 to try again.");
 	else
-		this->SetWindowTitle("Collision: Zoom / Rotate Q, A / O, P, Camera C, Drop Sphere R, U, I and D,  Wire W, Change HeightMap M");
+		this->SetWindowTitle("Collision: Zoom / Rotate Q, A / O, P, Camera C, Drop Sphere R, U, I and D,  Wire W, Change HeightMap M, Deterministic T");
 }
 
 void Application::HandleUpdate()
 {
+	//The last step ran alongside the last render. Finish it before input touches the world,
+	//and upload its collision colours from this thread, which owns the device
+	m_pPhysicsWorld->WaitForUpdate();
+	UploadHeightMaps();
+
 	HandleCameraInput();
 	HandleDebugInput();
 	HandleSphereInput();
@@ -116,19 +131,53 @@ void Application::HandleUpdate()
 
 			toggleHole = !toggleHole;
 
-			if (toggleHole)
+			for (int i = 0; i < MAX_HEIGHTMAPS; i++)
 			{
-				m_pActiveHeightMap->DisableBelowLevel(3.0f);
+				//Only the active map is in the world unless it's tiled
+				if (!m_bTiledWorld && m_heightMapArr[i] != m_pActiveHeightMap)
+				{
+					continue;
+				}
+
+				if (toggleHole)
+				{
+					m_heightMapArr[i]->DisableBelowLevel(3.0f);
+				}
+				else
+				{
+					m_heightMapArr[i]->EnableAll();
+				}
 			}
-			else
+
+			//Bodies resting on the terrain need to notice the holes
+			m_pPhysicsWorld->WakeAllBodies();
+		}
+	}
+	else
+	{
+		dbH = false;
+	}
+
+	static bool dbT = false;
+	if (IsKeyPressed('T'))
+	{
+		if (dbT == false)
+		{
+			dbT = true;
+
+			//Restart the random positions too, so the next drops match every other deterministic run
+			bool deterministic = !m_pPhysicsWorld->GetDeterministic();
+			if (deterministic)
 			{
-				m_pActiveHeightMap->EnableAll();
+				m_random.Seed(RANDOM_SEED);
 			}
+
+			m_pPhysicsWorld->SetDeterministic(deterministic);
 		}
 	}
 	else
 	{
-		dbH = false;
+		dbT = false;
 	}
 
 	static bool dbM = false;
@@ -138,15 +187,27 @@ void Application::HandleUpdate()
 		{
 			dbM = true;
 
+			//Cycle through each heightmap on its own, then all of them tiled together
 			m_iCurrentHeightMapIndx++;
-			if (m_iCurrentHeightMapIndx >= MAX_HEIGHTMAPS)
+			if (m_iCurrentHeightMapIndx > MAX_HEIGHTMAPS)
 			{
 				m_iCurrentHeightMapIndx = 0;
 			}
 
-			m_pActiveHeightMap = m_heightMapArr[m_iCurrentHeightMapIndx];
+			m_bTiledWorld = (m_iCurrentHeightMapIndx == MAX_HEIGHTMAPS);
+
+			if (m_bTiledWorld)
+			{
+				m_pActiveHeightMap = m_heightMapArr[0];
+				BuildTiledWorld();
+			}
+			else
+			{
+				m_pActiveHeightMap = m_heightMapArr[m_iCurrentHeightMapIndx];
+				m_pActiveHeightMap->SetWorldOffset(XMFLOAT3(0.0f, 0.0f, 0.0f));
 
-			m_pPhysicsWorld->SetHeightMapPtr(m_pActiveHeightMap);
+				m_pPhysicsWorld->SetHeightMapPtr(m_pActiveHeightMap);
+			}
 		}
 	}
 	else
@@ -158,27 +219,17 @@ void Application::HandleUpdate()
 
 	if (!m_bDebugMode)
 	{
-		m_pPhysicsWorld->UpdateWorld();
-		for (auto sphere : m_pSphereArray)
-		{
-			if (sphere->GetActive())
-			{
-				sphere->Update();
-			}
-		}
+		//Step while the frame renders from the last published snapshot
+		m_pPhysicsWorld->UpdateWorldAsync();
 	}
 	else
 	{
+		//Real time isn't accumulated while slowed down, single steps are run instead
+		m_pPhysicsWorld->ResetClock();
+
 		if ((int)m_frameCount % DEBUG_FRAME_COUNT == 0)
 		{
-			m_pPhysicsWorld->UpdateWorld();
-			for (auto sphere : m_pSphereArray)
-			{
-				if (sphere->GetActive())
-				{
-					sphere->Update();
-				}
-			}
+			m_pPhysicsWorld->Step(m_pPhysicsWorld->GetFixedTimeStep());
 		}
 	}
 }
@@ -221,17 +272,34 @@ void Application::HandleRender()
 	worldMtx = XMMatrixTranslation(mSpherePos.x, mSpherePos.y, mSpherePos.z);
 
 	SetDepthStencilState(false, true);
-	m_pActiveHeightMap->Draw(m_frameCount);
+	if (m_bTiledWorld)
+	{
+		for (int i = 0; i < MAX_HEIGHTMAPS; i++)
+		{
+			m_heightMapArr[i]->Draw(m_frameCount);
+		}
+	}
+	else
+	{
+		m_pActiveHeightMap->Draw(m_frameCount);
+	}
 
 	this->SetWorldMatrix(worldMtx);
 	SetDepthStencilState(true, true);
 
-	for (auto sphere : m_pSphereArray)
+	//Only the snapshot is read, the world may be stepping on another thread.
+	//Spheres are blended between the last two steps, so they move smoothly above the step rate
+	const BodySnapshot& snapshot = m_pPhysicsWorld->AcquireSnapshot();
+
+	m_sphereMatrices.resize(snapshot.GetCount());
+	snapshot.BuildWorldMatrices(m_sphereMatrices.data());
+
+	for (int i = 0; i < snapshot.GetCount(); i++)
 	{
-		if (sphere->GetActive())
-		{
-			sphere->Draw();
-		}
+		Sphere* sphere = (Sphere*)snapshot.views[i];
+
+		sphere->Update(m_sphereMatrices[i]);
+		sphere->Draw();
 	}
 
 	m_frameCount++;
@@ -358,12 +426,15 @@ void Application::HandleSphereInput()
 		{
 			dbR = true;
 
-			for (int i = 0; i <= m_iCurrentSphereIndx; i++)
+			//Drop every wanted sphere again, respawning any that fell out of the world
+			for (int i = 0; i < m_iSphereCount; i++)
 			{
-				Sphere* s = m_pSphereArray[i];
-				s->SetActive(true);
-				s->SetPosition(GetRandomPosition());
-				s->SetVelocity(XMVectorSet(0, 0, 0, 0));
+				Sphere* s = GetDebugSphere(i);
+				if (s != nullptr)
+				{
+					s->SetPosition(GetRandomPosition());
+					s->SetVelocity(XMVectorSet(0, 0, 0, 0));
+				}
 			}
 		}
 	}
@@ -396,8 +467,12 @@ void Application::HandleSphereInput()
 
 			newPos.y += 10.0f;
 
-			m_pSphereArray[0]->SetPosition(XMVectorSet(newPos.x, newPos.y, newPos.z, 1));
-			m_pSphereArray[0]->SetVelocity(XMVectorSet(0, 0, 0, 0));
+			Sphere* s = GetDebugSphere(0);
+			if (s != nullptr)
+			{
+				s->SetPosition(XMVectorSet(newPos.x, newPos.y, newPos.z, 1));
+				s->SetVelocity(XMVectorSet(0, 0, 0, 0));
+			}
 
 			dbU = true;
 		}
@@ -428,8 +503,12 @@ void Application::HandleSphereInput()
 
 			newPos.y += 10.0f;
 
-			m_pSphereArray[0]->SetPosition(XMVectorSet(newPos.x, newPos.y, newPos.z, 1));
-			m_pSphereArray[0]->SetVelocity(XMVectorSet(0, 0, 0, 0));
+			Sphere* s = GetDebugSphere(0);
+			if (s != nullptr)
+			{
+				s->SetPosition(XMVectorSet(newPos.x, newPos.y, newPos.z, 1));
+				s->SetVelocity(XMVectorSet(0, 0, 0, 0));
+			}
 
 			dbI = true;
 		}
@@ -460,8 +539,12 @@ void Application::HandleSphereInput()
 
 			newPos.y += 10.0f;
 
-			m_pSphereArray[0]->SetPosition(XMVectorSet(newPos.x, newPos.y, newPos.z, 1));
-			m_pSphereArray[0]->SetVelocity(XMVectorSet(0, 0, 0, 0));
+			Sphere* s = GetDebugSphere(0);
+			if (s != nullptr)
+			{
+				s->SetPosition(XMVectorSet(newPos.x, newPos.y, newPos.z, 1));
+				s->SetVelocity(XMVectorSet(0, 0, 0, 0));
+			}
 
 		}
 	}
@@ -479,16 +562,19 @@ void Application::HandleSphereInput()
 		{
 			dbF = true;
 
-			if(m_iCurrentSphereIndx == 0)
-			{
-				AddSphere();
-			}
+			m_iSphereCount = max(m_iSphereCount, 2);
 
-			m_pSphereArray[0]->SetPosition(XMVectorSet(15, 20, 0, 0));
-			m_pSphereArray[0]->SetVelocity(XMVectorSet(0, 0, 0, 0));
+			Sphere* a = GetDebugSphere(0);
+			Sphere* b = GetDebugSphere(1);
 
-			m_pSphereArray[1]->SetPosition(XMVectorSet(-15, 20, 0, 0));
-			m_pSphereArray[1]->SetVelocity(XMVectorSet(0, 0, 0, 0));
+			if (a != nullptr && b != nullptr)
+			{
+				a->SetPosition(XMVectorSet(15, 20, 0, 0));
+				a->SetVelocity(XMVectorSet(0, 0, 0, 0));
+
+				b->SetPosition(XMVectorSet(-15, 20, 0, 0));
+				b->SetVelocity(XMVectorSet(0, 0, 0, 0));
+			}
 		}
 	}
 	else
@@ -499,28 +585,107 @@ void Application::HandleSphereInput()
 
 void Application::AddSphere()
 {
-	if (m_iCurrentSphereIndx < MAX_OBJECTS)
+	if (m_iSphereCount < MAX_OBJECTS)
 	{
-		m_iCurrentSphereIndx++;
-		m_pSphereArray[m_iCurrentSphereIndx]->SetActive(true);
-		m_pSphereArray[m_iCurrentSphereIndx]->SetPosition(GetRandomPosition());
-		m_pSphereArray[m_iCurrentSphereIndx]->SetVelocity(XMVectorSet(0, 0, 0, 0));
+		m_iSphereCount++;
+
+		BodyHandle handle = m_pPhysicsWorld->SpawnBody(GetRandomPosition(), XMVectorSet(0, 0, 0, 0));
+		if (handle != INVALID_BODY_HANDLE)
+		{
+			m_sphereHandles.push_back(handle);
+		}
 	}
 
 }
 
 void Application::RemoveSphere()
 {
-	if (m_iCurrentSphereIndx != 0)
+	if (m_iSphereCount > 1)
+	{
+		m_iSphereCount--;
+
+		//Newest first, any that already fell out of the world count towards the removal
+		PruneSpheres();
+		while ((int)m_sphereHandles.size() > m_iSphereCount)
+		{
+			m_pPhysicsWorld->DespawnBody(m_sphereHandles.back());
+			m_sphereHandles.pop_back();
+		}
+	}
+}
+
+void Application::PruneSpheres()
+{
+	size_t live = 0;
+
+	for (size_t i = 0; i < m_sphereHandles.size(); i++)
+	{
+		if (m_pPhysicsWorld->IsBodyValid(m_sphereHandles[i]))
+		{
+			m_sphereHandles[live++] = m_sphereHandles[i];
+		}
+	}
+
+	m_sphereHandles.resize(live);
+}
+
+Sphere* Application::GetDebugSphere(int index)
+{
+	PruneSpheres();
+
+	while ((int)m_sphereHandles.size() <= index)
+	{
+		BodyHandle handle = m_pPhysicsWorld->SpawnBody(GetRandomPosition(), XMVectorSet(0, 0, 0, 0));
+		if (handle == INVALID_BODY_HANDLE)
+		{
+			return nullptr;
+		}
+
+		m_sphereHandles.push_back(handle);
+	}
+
+	return (Sphere*)m_pPhysicsWorld->GetBody(m_sphereHandles[index]);
+}
+
+void Application::BuildTiledWorld()
+{
+	//All the heightmaps are the same size, so use the first for the tile spacing
+	float minX, minZ, maxX, maxZ;
+	m_heightMapArr[0]->SetWorldOffset(XMFLOAT3(0.0f, 0.0f, 0.0f));
+	m_heightMapArr[0]->GetWorldBoundsXZ(minX, minZ, maxX, maxZ);
+
+	float tileWidth = maxX - minX;
+	float tileLength = maxZ - minZ;
+
+	int tilesPerRow = (int)ceilf(sqrtf((float)MAX_HEIGHTMAPS));
+	int tileRows = (MAX_HEIGHTMAPS + tilesPerRow - 1) / tilesPerRow;
+
+	m_pPhysicsWorld->ClearHeightMaps();
+
+	for (int i = 0; i < MAX_HEIGHTMAPS; i++)
 	{
-		m_pSphereArray[m_iCurrentSphereIndx]->SetActive(false);
-		m_iCurrentSphereIndx--;
+		float x = ((i % tilesPerRow) - ((tilesPerRow - 1) * 0.5f)) * tileWidth;
+		float z = ((i / tilesPerRow) - ((tileRows - 1) * 0.5f)) * tileLength;
+
+		m_pPhysicsWorld->AddHeightMap(m_heightMapArr[i], XMFLOAT3(x, 0.0f, z));
+	}
+}
+
+void Application::UploadHeightMaps()
+{
+	for (int i = 0; i < MAX_HEIGHTMAPS; i++)
+	{
+		//Only the active map is in the world unless it's tiled
+		if (m_bTiledWorld || m_heightMapArr[i] == m_pActiveHeightMap)
+		{
+			m_heightMapArr[i]->RebuildVertexData();
+		}
 	}
 }
 
 XMVECTOR Application::GetRandomPosition()
 {
-	XMFLOAT3 newPos = XMFLOAT3((float)((rand() % 24 - 12.0f) - 0.5), 22.0f, (float)((rand() % 24 - 12.0f) - 0.5));
+	XMFLOAT3 newPos = XMFLOAT3((float)((m_random.NextInt(24) - 12.0f) - 0.5), 22.0f, (float)((m_random.NextInt(24) - 12.0f) - 0.5));
 	return XMVectorSet(newPos.x, newPos.y, newPos.z, 1);
 }
 
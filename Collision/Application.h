@@ -6,6 +6,7 @@
 #include <assert.h>
 
 #include <stdio.h>
+#include <vector>
 #include <windows.h>
 #include <d3d11.h>
 
@@ -15,6 +16,9 @@
 #include "CommonApp.h"
 #include "CommonMesh.h"
 
+#include "Random.h"
+#include "BodyHandle.h"
+
 class HeightMap;
 class PhysicsWorld;
 class Sphere;
@@ -54,8 +58,28 @@ private:
 	void AddSphere();
 	void RemoveSphere();
 
+	//Drops the handles of spheres the world has despawned (fallen out of the world)
+	void PruneSpheres();
+
+	//Gets a live sphere for the debug keys, spawning more if there aren't enough
+	//Params : Index of the sphere in spawn order
+	//Returns : The sphere, nullptr if the pool has run out
+	Sphere* GetDebugSphere(int index);
+
 	XMVECTOR GetRandomPosition();
 
+	//Seeded generator for sphere positions, reseeded when deterministic mode is turned on
+	Random m_random;
+
+	//Interpolated world matrix of each sphere in the snapshot being drawn
+	std::vector<XMMATRIX> m_sphereMatrices;
+
+	//Places every heightmap as a tile in a square grid centred on the origin
+	void BuildTiledWorld();
+
+	//Uploads the vertex changes (edits and collision colours) of the heightmaps in the world
+	void UploadHeightMaps();
+
 private:
 
 
@@ -73,13 +97,21 @@ private:
 
 	PhysicsWorld* m_pPhysicsWorld;
 
-	int m_iCurrentSphereIndx = 0;
+	//Every sphere the world can spawn, owned here and lent to the world's pool
+	std::vector<Sphere*> m_pSphereArray;
+
+	//Number of spheres wanted in the world, and the handles of those currently spawned, oldest first
+	int m_iSphereCount = 1;
+	std::vector<BodyHandle> m_sphereHandles;
 
 	HeightMap *m_heightMapArr[MAX_HEIGHTMAPS];
 	HeightMap* m_pActiveHeightMap;
 
 	int m_iCurrentHeightMapIndx = 0;
 
+	//Whether all heightmaps are placed side by side as tiles of one world
+	bool m_bTiledWorld = false;
+
 	XMFLOAT3 mSpherePos;
 	XMFLOAT3 mSphereVel;
 	float mSphereSpeed;
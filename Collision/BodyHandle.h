@@ -0,0 +1,22 @@
+#ifndef _BODY_HANDLE_H_
+#define _BODY_HANDLE_H_
+
+
+//Stable reference to a body in a BodyStore, unaffected by other bodies being removed.
+//The low 32 bits are the slot in the store's handle table and the high 32 bits the
+//generation of that slot, which goes up each time the slot is freed. A handle kept
+//after its body was removed no longer matches the slot, so it can be detected
+typedef unsigned long long BodyHandle;
+
+static const BodyHandle INVALID_BODY_HANDLE = ~0ULL;
+
+//Most slots a handle table can have, which is the most bodies a world can hold at once.
+//Contact keys have room for slots below this and no more (see ContactSolver::MakeStaticKey)
+static const int MAX_BODY_SLOTS = 1 << 24;
+
+//Splits a handle into its slot and generation
+inline int GetHandleSlot(BodyHandle handle) { return (int)(handle & 0xFFFFFFFFULL); }
+inline unsigned int GetHandleGeneration(BodyHandle handle) { return (unsigned int)(handle >> 32); }
+inline BodyHandle MakeBodyHandle(int slot, unsigned int generation) { return ((BodyHandle)generation << 32) | (unsigned int)slot; }
+
+#endif
@@ -0,0 +1,684 @@
+#include "BodyStore.h"
+#include "WorldSnapshot.h"
+
+#include <immintrin.h>
+#include <algorithm>
+#include <string.h>
+
+
+BodyStore::BodyStore()
+{
+	m_eSimdLevel = GetSupportedSimdLevel();
+}
+
+BodyStore::~BodyStore()
+{
+}
+
+//Adds a body to the store
+//Params : View the body belongs to, initial position and velocity, inverse mass, radius, whether it's active
+//Returns : Handle of the new body
+BodyHandle BodyStore::Add(DynamicBody* view, const XMVECTOR& position, const XMVECTOR& velocity, float invMass, float radius, bool active)
+{
+	int slot;
+
+	if (!m_freeSlots.empty())
+	{
+		slot = m_freeSlots.back();
+		m_freeSlots.pop_back();
+	}
+	else
+	{
+		slot = (int)m_slotIndex.size();
+		m_slotIndex.push_back(-1);
+		m_slotGeneration.push_back(0);
+
+		//Every slot can end up free, so the free list has room for them all and removing never allocates
+		ReserveGrowth(m_freeSlots, m_slotIndex.size());
+	}
+
+	m_slotIndex[slot] = GetCount();
+
+	BodyHandle handle = MakeBodyHandle(slot, m_slotGeneration[slot]);
+
+	m_posX.push_back(XMVectorGetX(position));
+	m_posY.push_back(XMVectorGetY(position));
+	m_posZ.push_back(XMVectorGetZ(position));
+
+	m_prevX.push_back(XMVectorGetX(position));
+	m_prevY.push_back(XMVectorGetY(position));
+	m_prevZ.push_back(XMVectorGetZ(position));
+
+	m_velX.push_back(XMVectorGetX(velocity));
+	m_velY.push_back(XMVectorGetY(velocity));
+	m_velZ.push_back(XMVectorGetZ(velocity));
+
+	m_forceX.push_back(0.0f);
+	m_forceY.push_back(0.0f);
+	m_forceZ.push_back(0.0f);
+
+	m_invMass.push_back(invMass);
+	m_radius.push_back(radius);
+	m_sleepTime.push_back(0.0f);
+	m_flags.push_back(active ? BODY_ACTIVE : 0);
+
+	m_handles.push_back(handle);
+	m_views.push_back(view);
+
+	return handle;
+}
+
+//Removes a body, moving the last body into its slot
+//Params : Handle of the body to remove
+//Returns : Dense index the body was at (the last body now lives there), -1 if the handle was invalid or stale
+int BodyStore::Remove(BodyHandle handle)
+{
+	int index = GetIndex(handle);
+
+	if (index < 0)
+	{
+		return -1;
+	}
+
+	int last = GetCount() - 1;
+
+	//Swap the last body into the gap, then drop the end of every array
+	m_posX[index] = m_posX[last];
+	m_posY[index] = m_posY[last];
+	m_posZ[index] = m_posZ[last];
+
+	m_prevX[index] = m_prevX[last];
+	m_prevY[index] = m_prevY[last];
+	m_prevZ[index] = m_prevZ[last];
+
+	m_velX[index] = m_velX[last];
+	m_velY[index] = m_velY[last];
+	m_velZ[index] = m_velZ[last];
+
+	m_forceX[index] = m_forceX[last];
+	m_forceY[index] = m_forceY[last];
+	m_forceZ[index] = m_forceZ[last];
+
+	m_invMass[index] = m_invMass[last];
+	m_radius[index] = m_radius[last];
+	m_sleepTime[index] = m_sleepTime[last];
+	m_flags[index] = m_flags[last];
+
+	m_handles[index] = m_handles[last];
+	m_views[index] = m_views[last];
+
+	m_slotIndex[GetHandleSlot(m_handles[index])] = index;
+
+	//Bumping the generation makes any copies of the handle stale
+	int slot = GetHandleSlot(handle);
+	m_slotIndex[slot] = -1;
+	m_slotGeneration[slot]++;
+	m_freeSlots.push_back(slot);
+
+	m_posX.pop_back();
+	m_posY.pop_back();
+	m_posZ.pop_back();
+
+	m_prevX.pop_back();
+	m_prevY.pop_back();
+	m_prevZ.pop_back();
+
+	m_velX.pop_back();
+	m_velY.pop_back();
+	m_velZ.pop_back();
+
+	m_forceX.pop_back();
+	m_forceY.pop_back();
+	m_forceZ.pop_back();
+
+	m_invMass.pop_back();
+	m_radius.pop_back();
+	m_sleepTime.pop_back();
+	m_flags.pop_back();
+
+	m_handles.pop_back();
+	m_views.pop_back();
+
+	return index;
+}
+
+//Removes every body
+void BodyStore::Clear()
+{
+	while (GetCount() > 0)
+	{
+		Remove(m_handles.back());
+	}
+}
+
+//Converts between handles and dense indices
+//Returns : -1 (or INVALID_BODY_HANDLE) if there isn't one, or the handle is stale
+int BodyStore::GetIndex(BodyHandle handle) const
+{
+	int slot = GetHandleSlot(handle);
+
+	if (slot < 0 || slot >= (int)m_slotIndex.size() || m_slotGeneration[slot] != GetHandleGeneration(handle))
+	{
+		return -1;
+	}
+
+	return m_slotIndex[slot];
+}
+
+//Adds the accumulated force and gravity onto the velocity of every active, awake body in a range and resets the forces
+//Params : Length of the step in seconds, gravity force applied to every body, first body, one past the last body
+void BodyStore::IntegrateVelocities(float dt, const XMFLOAT3& gravity, int begin, int end)
+{
+	int done = begin;
+
+	if (m_eSimdLevel == SIMD_AVX512)
+	{
+		done = IntegrateVelocitiesAVX512(begin, end, dt, gravity);
+	}
+	else if (m_eSimdLevel == SIMD_AVX2)
+	{
+		done = IntegrateVelocitiesAVX2(begin, end, dt, gravity);
+	}
+
+	IntegrateVelocitiesScalar(done, end, dt, gravity);
+}
+
+//Moves every active, awake body in a range along its velocity, deactivating any that end up below the kill plane
+//Params : Length of the step in seconds, height below which bodies are deactivated, first body, one past the last body
+//Returns : Number of bodies deactivated
+int BodyStore::IntegratePositions(float dt, float killPlaneY, int begin, int end)
+{
+	int done = begin;
+	int killed = 0;
+
+	if (m_eSimdLevel == SIMD_AVX512)
+	{
+		done = IntegratePositionsAVX512(begin, end, dt, killPlaneY, killed);
+	}
+	else if (m_eSimdLevel == SIMD_AVX2)
+	{
+		done = IntegratePositionsAVX2(begin, end, dt, killPlaneY, killed);
+	}
+
+	return killed + IntegratePositionsScalar(done, end, dt, killPlaneY);
+}
+
+void BodyStore::IntegrateVelocitiesScalar(int begin, int end, float dt, const XMFLOAT3& gravity)
+{
+	for (int i = begin; i < end; i++)
+	{
+		if (!IsAwake(i))
+		{
+			continue;
+		}
+
+		//REFERENCE NOTE : FROM GAMEDEVTUTS.COM
+		//NUMERICAL INTEGRATION, SPRING ENERGY
+		float scale = m_invMass[i] * dt;
+
+		m_velX[i] += (m_forceX[i] + gravity.x) * scale;
+		m_velY[i] += (m_forceY[i] + gravity.y) * scale;
+		m_velZ[i] += (m_forceZ[i] + gravity.z) * scale;
+
+		m_forceX[i] = m_forceY[i] = m_forceZ[i] = 0.0f;
+	}
+}
+
+//Same operations in the same order as the scalar loop, with the awake test as a lane mask
+SIMD_TARGET_AVX2
+int BodyStore::IntegrateVelocitiesAVX2(int begin, int end, float dt, const XMFLOAT3& gravity)
+{
+	end = begin + ((end - begin) & ~7);
+
+	__m256 dtV = _mm256_set1_ps(dt);
+	__m256 gravityX = _mm256_set1_ps(gravity.x);
+	__m256 gravityY = _mm256_set1_ps(gravity.y);
+	__m256 gravityZ = _mm256_set1_ps(gravity.z);
+	__m256i stateBits = _mm256_set1_epi32(BODY_ACTIVE | BODY_SLEEPING);
+	__m256i awakeState = _mm256_set1_epi32(BODY_ACTIVE);
+
+	for (int i = begin; i < end; i += 8)
+	{
+		__m256i flags = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)&m_flags[i]));
+		__m256 awake = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(flags, stateBits), awakeState));
+
+		__m256 scale = _mm256_mul_ps(_mm256_loadu_ps(&m_invMass[i]), dtV);
+
+		__m256 forceX = _mm256_loadu_ps(&m_forceX[i]);
+		__m256 forceY = _mm256_loadu_ps(&m_forceY[i]);
+		__m256 forceZ = _mm256_loadu_ps(&m_forceZ[i]);
+
+		__m256 velX = _mm256_loadu_ps(&m_velX[i]);
+		__m256 velY = _mm256_loadu_ps(&m_velY[i]);
+		__m256 velZ = _mm256_loadu_ps(&m_velZ[i]);
+
+		velX = _mm256_blendv_ps(velX, _mm256_add_ps(velX, _mm256_mul_ps(_mm256_add_ps(forceX, gravityX), scale)), awake);
+		velY = _mm256_blendv_ps(velY, _mm256_add_ps(velY, _mm256_mul_ps(_mm256_add_ps(forceY, gravityY), scale)), awake);
+		velZ = _mm256_blendv_ps(velZ, _mm256_add_ps(velZ, _mm256_mul_ps(_mm256_add_ps(forceZ, gravityZ), scale)), awake);
+
+		_mm256_storeu_ps(&m_velX[i], velX);
+		_mm256_storeu_ps(&m_velY[i], velY);
+		_mm256_storeu_ps(&m_velZ[i], velZ);
+
+		//Forces are reset on awake bodies only
+		_mm256_storeu_ps(&m_forceX[i], _mm256_andnot_ps(awake, forceX));
+		_mm256_storeu_ps(&m_forceY[i], _mm256_andnot_ps(awake, forceY));
+		_mm256_storeu_ps(&m_forceZ[i], _mm256_andnot_ps(awake, forceZ));
+	}
+
+	return end;
+}
+
+SIMD_TARGET_AVX512
+int BodyStore::IntegrateVelocitiesAVX512(int begin, int end, float dt, const XMFLOAT3& gravity)
+{
+	end = begin + ((end - begin) & ~15);
+
+	__m512 dtV = _mm512_set1_ps(dt);
+	__m512 gravityX = _mm512_set1_ps(gravity.x);
+	__m512 gravityY = _mm512_set1_ps(gravity.y);
+	__m512 gravityZ = _mm512_set1_ps(gravity.z);
+	__m512i stateBits = _mm512_set1_epi32(BODY_ACTIVE | BODY_SLEEPING);
+	__m512i awakeState = _mm512_set1_epi32(BODY_ACTIVE);
+
+	for (int i = begin; i < end; i += 16)
+	{
+		__m512i flags = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)&m_flags[i]));
+		__mmask16 awake = _mm512_cmpeq_epi32_mask(_mm512_and_si512(flags, stateBits), awakeState);
+
+		__m512 scale = _mm512_mul_ps(_mm512_loadu_ps(&m_invMass[i]), dtV);
+
+		__m512 forceX = _mm512_loadu_ps(&m_forceX[i]);
+		__m512 forceY = _mm512_loadu_ps(&m_forceY[i]);
+		__m512 forceZ = _mm512_loadu_ps(&m_forceZ[i]);
+
+		__m512 velX = _mm512_loadu_ps(&m_velX[i]);
+		__m512 velY = _mm512_loadu_ps(&m_velY[i]);
+		__m512 velZ = _mm512_loadu_ps(&m_velZ[i]);
+
+		velX = _mm512_mask_add_ps(velX, awake, velX, _mm512_mul_ps(_mm512_add_ps(forceX, gravityX), scale));
+		velY = _mm512_mask_add_ps(velY, awake, velY, _mm512_mul_ps(_mm512_add_ps(forceY, gravityY), scale));
+		velZ = _mm512_mask_add_ps(velZ, awake, velZ, _mm512_mul_ps(_mm512_add_ps(forceZ, gravityZ), scale));
+
+		_mm512_storeu_ps(&m_velX[i], velX);
+		_mm512_storeu_ps(&m_velY[i], velY);
+		_mm512_storeu_ps(&m_velZ[i], velZ);
+
+		//Forces are reset on awake bodies only
+		__mmask16 keep = (__mmask16)~awake;
+		_mm512_storeu_ps(&m_forceX[i], _mm512_maskz_mov_ps(keep, forceX));
+		_mm512_storeu_ps(&m_forceY[i], _mm512_maskz_mov_ps(keep, forceY));
+		_mm512_storeu_ps(&m_forceZ[i], _mm512_maskz_mov_ps(keep, forceZ));
+	}
+
+	return end;
+}
+
+int BodyStore::IntegratePositionsScalar(int begin, int end, float dt, float killPlaneY)
+{
+	int killed = 0;
+
+	for (int i = begin; i < end; i++)
+	{
+		if (!IsAwake(i))
+		{
+			continue;
+		}
+
+		m_posX[i] += m_velX[i] * dt;
+		m_posY[i] += m_velY[i] * dt;
+		m_posZ[i] += m_velZ[i] * dt;
+
+		if (m_posY[i] < killPlaneY)
+		{
+			m_flags[i] = (m_flags[i] & ~BODY_ACTIVE) | BODY_KILLED;
+			killed++;
+		}
+	}
+
+	return killed;
+}
+
+SIMD_TARGET_AVX2
+int BodyStore::IntegratePositionsAVX2(int begin, int end, float dt, float killPlaneY, int& killed)
+{
+	end = begin + ((end - begin) & ~7);
+
+	__m256 dtV = _mm256_set1_ps(dt);
+	__m256 killY = _mm256_set1_ps(killPlaneY);
+	__m256i stateBits = _mm256_set1_epi32(BODY_ACTIVE | BODY_SLEEPING);
+	__m256i awakeState = _mm256_set1_epi32(BODY_ACTIVE);
+
+	for (int i = begin; i < end; i += 8)
+	{
+		__m256i flags = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)&m_flags[i]));
+		__m256 awake = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(flags, stateBits), awakeState));
+
+		__m256 posX = _mm256_loadu_ps(&m_posX[i]);
+		__m256 posY = _mm256_loadu_ps(&m_posY[i]);
+		__m256 posZ = _mm256_loadu_ps(&m_posZ[i]);
+
+		posX = _mm256_blendv_ps(posX, _mm256_add_ps(posX, _mm256_mul_ps(_mm256_loadu_ps(&m_velX[i]), dtV)), awake);
+		posY = _mm256_blendv_ps(posY, _mm256_add_ps(posY, _mm256_mul_ps(_mm256_loadu_ps(&m_velY[i]), dtV)), awake);
+		posZ = _mm256_blendv_ps(posZ, _mm256_add_ps(posZ, _mm256_mul_ps(_mm256_loadu_ps(&m_velZ[i]), dtV)), awake);
+
+		_mm256_storeu_ps(&m_posX[i], posX);
+		_mm256_storeu_ps(&m_posY[i], posY);
+		_mm256_storeu_ps(&m_posZ[i], posZ);
+
+		//Kill plane as a lane mask, rarely anything to do
+		unsigned int below = (unsigned int)_mm256_movemask_ps(_mm256_and_ps(awake, _mm256_cmp_ps(posY, killY, _CMP_LT_OQ)));
+
+		if (below != 0)
+		{
+			killed += DeactivateLanes(i, below);
+		}
+	}
+
+	return end;
+}
+
+SIMD_TARGET_AVX512
+int BodyStore::IntegratePositionsAVX512(int begin, int end, float dt, float killPlaneY, int& killed)
+{
+	end = begin + ((end - begin) & ~15);
+
+	__m512 dtV = _mm512_set1_ps(dt);
+	__m512 killY = _mm512_set1_ps(killPlaneY);
+	__m512i stateBits = _mm512_set1_epi32(BODY_ACTIVE | BODY_SLEEPING);
+	__m512i awakeState = _mm512_set1_epi32(BODY_ACTIVE);
+
+	for (int i = begin; i < end; i += 16)
+	{
+		__m512i flags = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)&m_flags[i]));
+		__mmask16 awake = _mm512_cmpeq_epi32_mask(_mm512_and_si512(flags, stateBits), awakeState);
+
+		__m512 posX = _mm512_loadu_ps(&m_posX[i]);
+		__m512 posY = _mm512_loadu_ps(&m_posY[i]);
+		__m512 posZ = _mm512_loadu_ps(&m_posZ[i]);
+
+		posX = _mm512_mask_add_ps(posX, awake, posX, _mm512_mul_ps(_mm512_loadu_ps(&m_velX[i]), dtV));
+		posY = _mm512_mask_add_ps(posY, awake, posY, _mm512_mul_ps(_mm512_loadu_ps(&m_velY[i]), dtV));
+		posZ = _mm512_mask_add_ps(posZ, awake, posZ, _mm512_mul_ps(_mm512_loadu_ps(&m_velZ[i]), dtV));
+
+		_mm512_storeu_ps(&m_posX[i], posX);
+		_mm512_storeu_ps(&m_posY[i], posY);
+		_mm512_storeu_ps(&m_posZ[i], posZ);
+
+		//Kill plane as a lane mask, rarely anything to do
+		__mmask16 below = _mm512_mask_cmp_ps_mask(awake, posY, killY, _CMP_LT_OQ);
+
+		if (below != 0)
+		{
+			killed += DeactivateLanes(i, below);
+		}
+	}
+
+	return end;
+}
+
+//Remembers the current position of every body as its previous position, called at the start of each step
+void BodyStore::SavePreviousPositions()
+{
+	std::copy(m_posX.begin(), m_posX.end(), m_prevX.begin());
+	std::copy(m_posY.begin(), m_posY.end(), m_prevY.begin());
+	std::copy(m_posZ.begin(), m_posZ.end(), m_prevZ.begin());
+}
+
+//Hashes the position, velocity, state and handle of every body, in dense order.
+//Bit exact, so two runs only match if every float matches
+//Returns : 64 bit hash of the store
+uint64_t BodyStore::ComputeStateHash() const
+{
+	//FNV-1a, a 32 bit word at a time rather than a byte
+	const uint64_t prime = 0x100000001B3ULL;
+	uint64_t hash = 0xCBF29CE484222325ULL;
+
+	int count = GetCount();
+	const std::vector<float>* arrays[] = { &m_posX, &m_posY, &m_posZ, &m_velX, &m_velY, &m_velZ };
+
+	for (auto values : arrays)
+	{
+		const uint32_t* words = (const uint32_t*)values->data();
+
+		for (int i = 0; i < count; i++)
+		{
+			hash = (hash ^ words[i]) * prime;
+		}
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		hash = (hash ^ m_handles[i]) * prime;
+		hash = (hash ^ m_flags[i]) * prime;
+	}
+
+	return hash;
+}
+
+//Deactivates the bodies picked out by a lane mask
+//Params : First body of the batch, one bit per lane
+//Returns : Number of bodies deactivated
+int BodyStore::DeactivateLanes(int begin, unsigned int lanes)
+{
+	int killed = 0;
+
+	for (int lane = 0; lanes != 0; lane++, lanes >>= 1)
+	{
+		if (lanes & 1)
+		{
+			m_flags[begin + lane] = (m_flags[begin + lane] & ~BODY_ACTIVE) | BODY_KILLED;
+			killed++;
+		}
+	}
+
+	return killed;
+}
+
+//Set/Get the instruction set used by the batch loops (clamped to what the CPU supports)
+void BodyStore::SetSimdLevel(SimdLevel level)
+{
+	m_eSimdLevel = min(level, GetSupportedSimdLevel());
+}
+
+//Gets every per body float array, in the order snapshots store them
+//Params : Array of SNAPSHOT_FLOAT_ARRAYS pointers to fill in
+void BodyStore::GetFloatArrays(std::vector<float>** arrays)
+{
+	std::vector<float>* all[SNAPSHOT_FLOAT_ARRAYS] = {
+		&m_posX, &m_posY, &m_posZ,
+		&m_prevX, &m_prevY, &m_prevZ,
+		&m_velX, &m_velY, &m_velZ,
+		&m_forceX, &m_forceY, &m_forceZ,
+		&m_invMass, &m_radius, &m_sleepTime
+	};
+
+	memcpy(arrays, all, sizeof(all));
+}
+
+//Copies a snapshot section over an array, resizing it to fit
+template<typename T>
+static void ReadArray(std::vector<T>& array, const T* data, size_t count)
+{
+	array.resize(count);
+
+	if (count > 0)
+	{
+		memcpy(array.data(), data, count * sizeof(T));
+	}
+}
+
+//Adds every body array and the handle table to a world snapshot. Views aren't saved, the
+//world records which of its bodies each one is
+void BodyStore::WriteSnapshot(SnapshotWriter& writer) const
+{
+	std::vector<float>* floats[SNAPSHOT_FLOAT_ARRAYS];
+	const_cast<BodyStore*>(this)->GetFloatArrays(floats);
+
+	for (int a = 0; a < SNAPSHOT_FLOAT_ARRAYS; a++)
+	{
+		writer.AddSection(SNAPSHOT_BODY_FLOATS, a, floats[a]->data(), sizeof(float), floats[a]->size());
+	}
+
+	writer.AddSection(SNAPSHOT_BODY_FLAGS, 0, m_flags.data(), sizeof(unsigned char), m_flags.size());
+	writer.AddSection(SNAPSHOT_BODY_HANDLES, 0, m_handles.data(), sizeof(BodyHandle), m_handles.size());
+
+	writer.AddSection(SNAPSHOT_BODY_SLOTS, 0, m_slotIndex.data(), sizeof(int), m_slotIndex.size());
+	writer.AddSection(SNAPSHOT_BODY_SLOTS, 1, m_slotGeneration.data(), sizeof(unsigned int), m_slotGeneration.size());
+	writer.AddSection(SNAPSHOT_BODY_SLOTS, 2, m_freeSlots.data(), sizeof(int), m_freeSlots.size());
+}
+
+//Checks a snapshot holds a complete body store whose handle table agrees with its bodies
+//Returns : Number of bodies in it, -1 if anything is missing or inconsistent
+int BodyStore::CheckSnapshot(const SnapshotReader& reader) const
+{
+	uint64_t count = 0;
+	const BodyHandle* handles = (const BodyHandle*)reader.FindSection(SNAPSHOT_BODY_HANDLES, 0, sizeof(BodyHandle), count);
+
+	if (handles == nullptr || count > 0x7FFFFFFF || reader.FindArray<unsigned char>(SNAPSHOT_BODY_FLAGS, 0, count) == nullptr)
+	{
+		return -1;
+	}
+
+	for (int a = 0; a < SNAPSHOT_FLOAT_ARRAYS; a++)
+	{
+		if (reader.FindArray<float>(SNAPSHOT_BODY_FLOATS, a, count) == nullptr)
+		{
+			return -1;
+		}
+	}
+
+	uint64_t slotCount = 0;
+	uint64_t freeCount = 0;
+	const int* slotIndex = (const int*)reader.FindSection(SNAPSHOT_BODY_SLOTS, 0, sizeof(int), slotCount);
+	const unsigned int* slotGeneration = reader.FindArray<unsigned int>(SNAPSHOT_BODY_SLOTS, 1, slotCount);
+	const int* freeSlots = (const int*)reader.FindSection(SNAPSHOT_BODY_SLOTS, 2, sizeof(int), freeCount);
+
+	if (slotIndex == nullptr || slotGeneration == nullptr || freeSlots == nullptr || slotCount < count || slotCount > MAX_BODY_SLOTS)
+	{
+		return -1;
+	}
+
+	//Every body's handle has to lead back to it, and every free slot has to be empty
+	for (uint64_t i = 0; i < count; i++)
+	{
+		uint64_t slot = (uint64_t)GetHandleSlot(handles[i]);
+
+		if (slot >= slotCount || slotIndex[slot] != (int)i || slotGeneration[slot] != GetHandleGeneration(handles[i]))
+		{
+			return -1;
+		}
+	}
+
+	for (uint64_t f = 0; f < freeCount; f++)
+	{
+		if (freeSlots[f] < 0 || (uint64_t)freeSlots[f] >= slotCount || slotIndex[freeSlots[f]] != -1)
+		{
+			return -1;
+		}
+	}
+
+	return (int)count;
+}
+
+//Replaces every body with those in a snapshot that passed CheckSnapshot, a memcpy per array.
+//The views are left empty for the world to fill in with SetView
+void BodyStore::ReadSnapshot(const SnapshotReader& reader)
+{
+	uint64_t count = 0;
+	uint64_t slotCount = 0;
+	uint64_t freeCount = 0;
+
+	const BodyHandle* handles = (const BodyHandle*)reader.FindSection(SNAPSHOT_BODY_HANDLES, 0, sizeof(BodyHandle), count);
+	const int* slotIndex = (const int*)reader.FindSection(SNAPSHOT_BODY_SLOTS, 0, sizeof(int), slotCount);
+	const int* freeSlots = (const int*)reader.FindSection(SNAPSHOT_BODY_SLOTS, 2, sizeof(int), freeCount);
+
+	std::vector<float>* floats[SNAPSHOT_FLOAT_ARRAYS];
+	GetFloatArrays(floats);
+
+	for (int a = 0; a < SNAPSHOT_FLOAT_ARRAYS; a++)
+	{
+		ReadArray(*floats[a], reader.FindArray<float>(SNAPSHOT_BODY_FLOATS, a, count), (size_t)count);
+	}
+
+	ReadArray(m_flags, reader.FindArray<unsigned char>(SNAPSHOT_BODY_FLAGS, 0, count), (size_t)count);
+	ReadArray(m_handles, handles, (size_t)count);
+
+	ReadArray(m_slotIndex, slotIndex, (size_t)slotCount);
+	ReadArray(m_slotGeneration, reader.FindArray<unsigned int>(SNAPSHOT_BODY_SLOTS, 1, slotCount), (size_t)slotCount);
+	ReadArray(m_freeSlots, freeSlots, (size_t)freeCount);
+
+	m_views.assign((size_t)count, nullptr);
+}
+
+//Puts the body to sleep, stopping it until it's woken
+void BodyStore::Sleep(int index)
+{
+	m_flags[index] |= BODY_SLEEPING;
+
+	m_velX[index] = m_velY[index] = m_velZ[index] = 0.0f;
+	m_forceX[index] = m_forceY[index] = m_forceZ[index] = 0.0f;
+}
+
+//Wakes the body and restarts its sleep timer
+void BodyStore::Wake(int index)
+{
+	m_flags[index] &= ~BODY_SLEEPING;
+	m_sleepTime[index] = 0.0f;
+}
+
+//Adds to the time the body has been moving slower than the threshold, or resets it
+//Params : Dense index, length of the step in seconds, speed below which the body counts as resting
+//Returns : Time in seconds the body has been resting
+float BodyStore::UpdateSleepTime(int index, float dt, float sleepSpeed)
+{
+	float speedSq = (m_velX[index] * m_velX[index]) + (m_velY[index] * m_velY[index]) + (m_velZ[index] * m_velZ[index]);
+
+	if (speedSq < sleepSpeed * sleepSpeed)
+	{
+		m_sleepTime[index] += dt;
+	}
+	else
+	{
+		m_sleepTime[index] = 0.0f;
+	}
+
+	return m_sleepTime[index];
+}
+
+//*********************** Getters / Setters ************************************
+
+void BodyStore::SetPosition(int index, const XMVECTOR& position)
+{
+	m_posX[index] = m_prevX[index] = XMVectorGetX(position);
+	m_posY[index] = m_prevY[index] = XMVectorGetY(position);
+	m_posZ[index] = m_prevZ[index] = XMVectorGetZ(position);
+}
+
+void BodyStore::SetVelocity(int index, const XMVECTOR& velocity)
+{
+	m_velX[index] = XMVectorGetX(velocity);
+	m_velY[index] = XMVectorGetY(velocity);
+	m_velZ[index] = XMVectorGetZ(velocity);
+}
+
+void BodyStore::AddForce(int index, const XMVECTOR& force)
+{
+	m_forceX[index] += XMVectorGetX(force);
+	m_forceY[index] += XMVectorGetY(force);
+	m_forceZ[index] += XMVectorGetZ(force);
+}
+
+void BodyStore::SetActive(int index, bool active)
+{
+	if (active)
+	{
+		m_flags[index] = (m_flags[index] | BODY_ACTIVE) & ~BODY_KILLED;
+	}
+	else
+	{
+		m_flags[index] &= ~BODY_ACTIVE;
+	}
+}
+
+//******************************************************************************
@@ -0,0 +1,221 @@
+#ifndef _BODY_STORE_H_
+#define _BODY_STORE_H_
+
+#include <vector>
+#include <stdint.h>
+
+#include "VectorMath.h"
+#include "Macros.h"
+#include "CpuFeatures.h"
+#include "BodyHandle.h"
+
+class DynamicBody;
+class SnapshotWriter;
+class SnapshotReader;
+
+
+//Per body state flags
+enum BodyFlags
+{
+	BODY_ACTIVE = 1,
+	BODY_SLEEPING = 2,
+
+	//Deactivated by the kill plane rather than by hand
+	BODY_KILLED = 4
+};
+
+//**********************************************************************************
+// Class : BodyStore
+// Description : Holds the simulation state of every body in a physics world as
+// structure of arrays, so the hot loops (integration, broadphase) stream through
+// contiguous memory. Bodies are kept densely packed and removed by swapping the last
+// body into the gap, so handles go through an indirection table to stay valid. Adding
+// and removing are O(1), freed slots of the table are recycled with a new generation.
+// Integration runs 8 or 16 bodies at a time with AVX2/AVX-512 when the CPU has
+// them, giving exactly the same results as the scalar loop.
+//**********************************************************************************
+class BodyStore
+{
+public:
+
+	BodyStore();
+	~BodyStore();
+
+	//Adds a body to the store
+	//Params : View the body belongs to, initial position and velocity, inverse mass, radius, whether it's active
+	//Returns : Handle of the new body
+	BodyHandle Add(DynamicBody* view, const XMVECTOR& position, const XMVECTOR& velocity, float invMass, float radius, bool active);
+
+	//Removes a body, moving the last body into its slot
+	//Params : Handle of the body to remove
+	//Returns : Dense index the body was at (the last body now lives there), -1 if the handle was invalid or stale
+	int Remove(BodyHandle handle);
+
+	//Returns : True if the handle refers to a body still in the store
+	bool IsValid(BodyHandle handle) const { return GetIndex(handle) >= 0; }
+
+	//Removes every body
+	void Clear();
+
+	//Number of bodies in the store
+	int GetCount() const { return (int)m_handles.size(); }
+
+	//Converts between handles and dense indices
+	//Returns : -1 (or INVALID_BODY_HANDLE) if there isn't one, or the handle is stale
+	int GetIndex(BodyHandle handle) const;
+	BodyHandle GetHandle(int index) const { return m_handles[index]; }
+
+	//Gets the view of the body at a dense index
+	DynamicBody* GetView(int index) const { return m_views[index]; }
+
+	//Adds the accumulated force and gravity onto the velocity of every active, awake body in a range and resets the forces
+	//Params : Length of the step in seconds, gravity force applied to every body, first body, one past the last body
+	void IntegrateVelocities(float dt, const XMFLOAT3& gravity, int begin, int end);
+
+	//Moves every active, awake body in a range along its velocity, deactivating any that end up below the kill plane
+	//Params : Length of the step in seconds, height below which bodies are deactivated, first body, one past the last body
+	//Returns : Number of bodies deactivated
+	int IntegratePositions(float dt, float killPlaneY, int begin, int end);
+
+	//Hashes the position, velocity, state and handle of every body, in dense order.
+	//Bit exact, so two runs only match if every float matches
+	//Returns : 64 bit hash of the store
+	uint64_t ComputeStateHash() const;
+
+	//Remembers the current position of every body as its previous position, called at the start of each step
+	void SavePreviousPositions();
+
+	//Set/Get the instruction set used by the batch loops (clamped to what the CPU supports)
+	void SetSimdLevel(SimdLevel level);
+	SimdLevel GetSimdLevel() const { return m_eSimdLevel; }
+
+	//Adds every body array and the handle table to a world snapshot. Views aren't saved, the
+	//world records which of its bodies each one is
+	void WriteSnapshot(SnapshotWriter& writer) const;
+
+	//Checks a snapshot holds a complete body store whose handle table agrees with its bodies
+	//Returns : Number of bodies in it, -1 if anything is missing or inconsistent
+	int CheckSnapshot(const SnapshotReader& reader) const;
+
+	//Replaces every body with those in a snapshot that passed CheckSnapshot, a memcpy per array.
+	//The views are left empty for the world to fill in with SetView
+	void ReadSnapshot(const SnapshotReader& reader);
+
+	//Sets the view of the body at a dense index, when restoring a snapshot
+	void SetView(int index, DynamicBody* view) { m_views[index] = view; }
+
+//*********************** Getters / Setters ************************************
+
+	//Per body state, by dense index. Setting the position also sets the previous position, so teleports aren't interpolated
+	XMVECTOR GetPosition(int index) const { return XMVectorSet(m_posX[index], m_posY[index], m_posZ[index], 0.0f); }
+	void SetPosition(int index, const XMVECTOR& position);
+
+	//Position at the start of the last step
+	XMVECTOR GetPreviousPosition(int index) const { return XMVectorSet(m_prevX[index], m_prevY[index], m_prevZ[index], 0.0f); }
+
+	XMVECTOR GetVelocity(int index) const { return XMVectorSet(m_velX[index], m_velY[index], m_velZ[index], 0.0f); }
+	void SetVelocity(int index, const XMVECTOR& velocity);
+
+	XMVECTOR GetForce(int index) const { return XMVectorSet(m_forceX[index], m_forceY[index], m_forceZ[index], 0.0f); }
+	void AddForce(int index, const XMVECTOR& force);
+
+	float GetInverseMass(int index) const { return m_invMass[index]; }
+	void SetInverseMass(int index, float invMass) { m_invMass[index] = invMass; }
+
+	float GetRadius(int index) const { return m_radius[index]; }
+	void SetRadius(int index, float radius) { m_radius[index] = radius; }
+
+	bool IsActive(int index) const { return (m_flags[index] & BODY_ACTIVE) != 0; }
+	void SetActive(int index, bool active);
+
+	//Whether the body is active and not asleep, i.e. should be simulated
+	bool IsAwake(int index) const { return (m_flags[index] & (BODY_ACTIVE | BODY_SLEEPING)) == BODY_ACTIVE; }
+
+	bool IsSleeping(int index) const { return (m_flags[index] & BODY_SLEEPING) != 0; }
+
+	//Whether the body was deactivated by falling below the kill plane (cleared by SetActive)
+	bool WasKilled(int index) const { return (m_flags[index] & BODY_KILLED) != 0; }
+
+	//Puts the body to sleep, stopping it until it's woken
+	void Sleep(int index);
+
+	//Wakes the body and restarts its sleep timer
+	void Wake(int index);
+
+	//Adds to the time the body has been moving slower than the threshold, or resets it
+	//Params : Dense index, length of the step in seconds, speed below which the body counts as resting
+	//Returns : Time in seconds the body has been resting
+	float UpdateSleepTime(int index, float dt, float sleepSpeed);
+
+	//Raw arrays, for loops over every body
+	const float* GetPositionX() const { return m_posX.data(); }
+	const float* GetPositionY() const { return m_posY.data(); }
+	const float* GetPositionZ() const { return m_posZ.data(); }
+	const float* GetPreviousPositionX() const { return m_prevX.data(); }
+	const float* GetPreviousPositionY() const { return m_prevY.data(); }
+	const float* GetPreviousPositionZ() const { return m_prevZ.data(); }
+	const float* GetRadii() const { return m_radius.data(); }
+	const unsigned char* GetFlags() const { return m_flags.data(); }
+
+//******************************************************************************
+
+private:
+
+	//Batch loop implementations. The scalar versions also finish off the bodies left
+	//over after the SIMD versions, which return where they stopped
+	void IntegrateVelocitiesScalar(int begin, int end, float dt, const XMFLOAT3& gravity);
+	int IntegrateVelocitiesAVX2(int begin, int end, float dt, const XMFLOAT3& gravity);
+	int IntegrateVelocitiesAVX512(int begin, int end, float dt, const XMFLOAT3& gravity);
+
+	int IntegratePositionsScalar(int begin, int end, float dt, float killPlaneY);
+	int IntegratePositionsAVX2(int begin, int end, float dt, float killPlaneY, int& killed);
+	int IntegratePositionsAVX512(int begin, int end, float dt, float killPlaneY, int& killed);
+
+	//Number of per body float arrays
+	static const int SNAPSHOT_FLOAT_ARRAYS = 15;
+
+	//Gets every per body float array, in the order snapshots store them
+	//Params : Array of SNAPSHOT_FLOAT_ARRAYS pointers to fill in
+	void GetFloatArrays(std::vector<float>** arrays);
+
+	//Deactivates the bodies picked out by a lane mask
+	//Params : First body of the batch, one bit per lane
+	//Returns : Number of bodies deactivated
+	int DeactivateLanes(int begin, unsigned int lanes);
+
+	//Body state, one entry per body, densely packed
+	std::vector<float> m_posX;
+	std::vector<float> m_posY;
+	std::vector<float> m_posZ;
+
+	//Positions at the start of the last step, for interpolating between steps
+	std::vector<float> m_prevX;
+	std::vector<float> m_prevY;
+	std::vector<float> m_prevZ;
+
+	std::vector<float> m_velX;
+	std::vector<float> m_velY;
+	std::vector<float> m_velZ;
+
+	std::vector<float> m_forceX;
+	std::vector<float> m_forceY;
+	std::vector<float> m_forceZ;
+
+	std::vector<float> m_invMass;
+	std::vector<float> m_radius;
+	std::vector<float> m_sleepTime;
+	std::vector<unsigned char> m_flags;
+
+	//Handle and view of the body in each dense slot
+	std::vector<BodyHandle> m_handles;
+	std::vector<DynamicBody*> m_views;
+
+	//Dense index (-1 if free) and generation of each handle slot, and the slots free for reuse
+	std::vector<int> m_slotIndex;
+	std::vector<unsigned int> m_slotGeneration;
+	std::vector<int> m_freeSlots;
+
+	SimdLevel m_eSimdLevel;
+};
+
+#endif
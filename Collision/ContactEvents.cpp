@@ -0,0 +1,110 @@
+#include "ContactEvents.h"
+
+#include <algorithm>
+
+
+//Events held when no capacity is set
+static const int DEFAULT_EVENT_CAPACITY = 4096;
+
+ContactEventBuffer::ContactEventBuffer()
+{
+	m_iTypeFilter = CONTACT_ALL_EVENTS;
+	m_iTotalOverflowCount = 0;
+
+	SetCapacity(DEFAULT_EVENT_CAPACITY);
+}
+
+ContactEventBuffer::~ContactEventBuffer()
+{
+}
+
+//Drops every event and the overflow count of the last update, keeping the memory
+void ContactEventBuffer::Clear()
+{
+	m_types.clear();
+	m_steps.clear();
+	m_bodiesA.clear();
+	m_bodiesB.clear();
+	m_tiles.clear();
+	m_faces.clear();
+	m_impulses.clear();
+
+	m_iOverflowCount = 0;
+}
+
+//Records an event, unless it's filtered out or the buffer is full
+//Params : Event type, step it happened in, bodies in contact (bodyA is INVALID_BODY_HANDLE for the terrain),
+//terrain tile and face (-1 for body vs body), impulse the solver applied along the normal
+void ContactEventBuffer::Push(ContactEventType type, unsigned long long step, BodyHandle bodyA, BodyHandle bodyB, int tile, int face, float impulse)
+{
+	if ((m_iTypeFilter & type) == 0 || !PassesBodyFilter(bodyA, bodyB))
+	{
+		return;
+	}
+
+	//Never grows past the capacity, so recording doesn't allocate
+	if (GetCount() >= m_iCapacity)
+	{
+		m_iOverflowCount++;
+		m_iTotalOverflowCount++;
+		return;
+	}
+
+	m_types.push_back((unsigned char)type);
+	m_steps.push_back(step);
+	m_bodiesA.push_back(bodyA);
+	m_bodiesB.push_back(bodyB);
+	m_tiles.push_back(tile);
+	m_faces.push_back(face);
+	m_impulses.push_back(impulse);
+}
+
+//Set/Get the most events held at once, allocated up front. Clears the buffer
+void ContactEventBuffer::SetCapacity(int capacity)
+{
+	m_iCapacity = capacity > 0 ? capacity : 0;
+
+	Clear();
+
+	m_types.reserve(m_iCapacity);
+	m_steps.reserve(m_iCapacity);
+	m_bodiesA.reserve(m_iCapacity);
+	m_bodiesB.reserve(m_iCapacity);
+	m_tiles.reserve(m_iCapacity);
+	m_faces.reserve(m_iCapacity);
+	m_impulses.reserve(m_iCapacity);
+}
+
+//Only records events involving the bodies added here, every body if there are none
+//Params : Handle of the body
+void ContactEventBuffer::AddBodyFilter(BodyHandle handle)
+{
+	auto it = std::lower_bound(m_bodyFilter.begin(), m_bodyFilter.end(), handle);
+
+	if (it == m_bodyFilter.end() || *it != handle)
+	{
+		m_bodyFilter.insert(it, handle);
+	}
+}
+
+void ContactEventBuffer::RemoveBodyFilter(BodyHandle handle)
+{
+	auto it = std::lower_bound(m_bodyFilter.begin(), m_bodyFilter.end(), handle);
+
+	if (it != m_bodyFilter.end() && *it == handle)
+	{
+		m_bodyFilter.erase(it);
+	}
+}
+
+//Returns : True if an event between two bodies passes the body filter
+bool ContactEventBuffer::PassesBodyFilter(BodyHandle bodyA, BodyHandle bodyB) const
+{
+	if (m_bodyFilter.empty())
+	{
+		return true;
+	}
+
+	return std::binary_search(m_bodyFilter.begin(), m_bodyFilter.end(), bodyA) ||
+		std::binary_search(m_bodyFilter.begin(), m_bodyFilter.end(), bodyB);
+}
@@ -0,0 +1,101 @@
+#ifndef _CONTACT_EVENTS_H_
+#define _CONTACT_EVENTS_H_
+
+#include <vector>
+
+#include "BodyHandle.h"
+
+
+//Kinds of contact event, as bits so they can be combined into a filter
+enum ContactEventType
+{
+	//Bodies touched this step and didn't the step before
+	CONTACT_BEGIN = 1,
+
+	//Bodies touched this step and the step before
+	CONTACT_PERSIST = 2,
+
+	//Bodies touched the step before and don't any more (or one of them left the world)
+	CONTACT_END = 4,
+
+	CONTACT_ALL_EVENTS = CONTACT_BEGIN | CONTACT_PERSIST | CONTACT_END
+};
+
+//**********************************************************************************
+// Class : ContactEventBuffer
+// Description : Contact events from the steps of one world update, stored as
+// structure of arrays so consumers loop over exactly the fields they need once the
+// update has finished, rather than being called back per event. Holds at most a
+// fixed number of events, any more are dropped and counted. Events can be filtered
+// by type and by body as they're recorded, so uninteresting ones never take space.
+//**********************************************************************************
+class ContactEventBuffer
+{
+public:
+
+	ContactEventBuffer();
+	~ContactEventBuffer();
+
+	//Drops every event and the overflow count of the last update, keeping the memory
+	void Clear();
+
+	//Records an event, unless it's filtered out or the buffer is full
+	//Params : Event type, step it happened in, bodies in contact (bodyA is INVALID_BODY_HANDLE for the terrain),
+	//terrain tile and face (-1 for body vs body), impulse the solver applied along the normal
+	void Push(ContactEventType type, unsigned long long step, BodyHandle bodyA, BodyHandle bodyB, int tile, int face, float impulse);
+
+	//Set/Get the most events held at once, allocated up front. Clears the buffer
+	void SetCapacity(int capacity);
+	int GetCapacity() const { return m_iCapacity; }
+
+	//Set/Get the types of event recorded, a combination of ContactEventType bits
+	void SetTypeFilter(unsigned int types) { m_iTypeFilter = types; }
+	unsigned int GetTypeFilter() const { return m_iTypeFilter; }
+
+	//Only records events involving the bodies added here, every body if there are none
+	//Params : Handle of the body
+	void AddBodyFilter(BodyHandle handle);
+	void RemoveBodyFilter(BodyHandle handle);
+	void ClearBodyFilter() { m_bodyFilter.clear(); }
+
+	//Number of events held
+	int GetCount() const { return (int)m_types.size(); }
+
+	//Events that didn't fit since the last Clear, and in total
+	int GetOverflowCount() const { return m_iOverflowCount; }
+	unsigned long long GetTotalOverflowCount() const { return m_iTotalOverflowCount; }
+
+	//Raw arrays, GetCount() long, event i being entry i of each
+	const unsigned char* GetTypes() const { return m_types.data(); }
+	const unsigned long long* GetSteps() const { return m_steps.data(); }
+	const BodyHandle* GetBodiesA() const { return m_bodiesA.data(); }
+	const BodyHandle* GetBodiesB() const { return m_bodiesB.data(); }
+	const int* GetTiles() const { return m_tiles.data(); }
+	const int* GetFaces() const { return m_faces.data(); }
+	const float* GetImpulses() const { return m_impulses.data(); }
+
+private:
+
+	//Returns : True if an event between two bodies passes the body filter
+	bool PassesBodyFilter(BodyHandle bodyA, BodyHandle bodyB) const;
+
+	//Event data, one entry per event
+	std::vector<unsigned char> m_types;
+	std::vector<unsigned long long> m_steps;
+	std::vector<BodyHandle> m_bodiesA;
+	std::vector<BodyHandle> m_bodiesB;
+	std::vector<int> m_tiles;
+	std::vector<int> m_faces;
+	std::vector<float> m_impulses;
+
+	//Bodies events are recorded for, kept sorted for searching
+	std::vector<BodyHandle> m_bodyFilter;
+
+	unsigned int m_iTypeFilter;
+	int m_iCapacity;
+
+	int m_iOverflowCount;
+	unsigned long long m_iTotalOverflowCount;
+};
+
+#endif
@@ -0,0 +1,596 @@
+#include "ContactSolver.h"
+#include "WorldSnapshot.h"
+
+#include <math.h>
+#include <chrono>
+#include <string.h>
+
+//Closing speed below which contacts don't bounce, stops resting bodies jittering
+static const float RESTITUTION_THRESHOLD = 1.0f;
+
+//Fraction of last step's impulse used to warm start a persisting contact
+static const float WARM_START_FACTOR = 0.9f;
+
+//Number of colours a contact can be given before going into the serial overflow batch
+static const int MAX_COLOURS = 64;
+
+//Batches smaller than this aren't worth splitting across threads, and islands smaller
+//than this are solved whole on one thread rather than coloured
+static const int MIN_PARALLEL_BATCH = 128;
+
+//Bits of a terrain contact's key holding the face, the body's slot goes above them
+static const int STATIC_KEY_FACE_BITS = 39;
+
+
+ContactSolver::ContactSolver()
+{
+	m_iIterations = 10;
+	m_fTolerance = 0.0001f;
+	m_fRestitution = 0.6f;
+	m_fCorrectionPercent = 0.2f;
+	m_fCorrectionSlop = 0.01f;
+
+	m_iLastIterations = 0;
+	m_fLastMaxDelta = 0.0f;
+	m_dLastSolveTime = 0.0;
+
+	m_iBatchCount = 0;
+	m_iOverflowCount = 0;
+	m_iIslandOverflowCount = 0;
+	m_iTaskBatchBegin = 0;
+	m_pJobSystem = nullptr;
+	m_batchStart.push_back(0);
+}
+
+ContactSolver::~ContactSolver()
+{
+}
+
+//Clears the contacts from the last solve and sizes the body array
+//Params : Number of bodies that contacts can refer to
+void ContactSolver::Begin(int bodyCount)
+{
+	m_contacts.clear();
+	ReserveGrowth(m_bodies, bodyCount);
+	m_bodies.resize(bodyCount);
+
+	//Everything is one island unless the caller says otherwise
+	for (auto& body : m_bodies)
+	{
+		body.island = 0;
+	}
+}
+
+//Adds a contact to be solved
+//Params : Key used for warm starting, body indices (bodyA -1 for the terrain), normal from A to B, penetration depth
+void ContactSolver::AddContact(unsigned long long key, int bodyA, int bodyB, const XMVECTOR& normal, float penetration)
+{
+	SolverContact contact;
+	contact.key = key;
+	contact.bodyA = bodyA;
+	contact.bodyB = bodyB;
+	XMStoreFloat3(&contact.normal, normal);
+	contact.penetration = penetration;
+	contact.normalMass = 0.0f;
+	contact.velocityBias = 0.0f;
+	contact.accumulatedImpulse = 0.0f;
+
+	m_contacts.push_back(contact);
+}
+
+//Keys for terrain contacts: top bit set, then the body's slot (24 bits, see MAX_BODY_SLOTS) and the
+//face's index among the faces of every tile (39 bits, more faces than could ever be held in memory)
+unsigned long long ContactSolver::MakeStaticKey(int body, unsigned long long worldFace)
+{
+	return (1ULL << 63) | ((unsigned long long)body << STATIC_KEY_FACE_BITS) | worldFace;
+}
+
+//Keys for body vs body contacts: lower index first so the order of the pair doesn't matter
+unsigned long long ContactSolver::MakeDynamicKey(int bodyA, int bodyB)
+{
+	unsigned int lo = (unsigned int)min(bodyA, bodyB);
+	unsigned int hi = (unsigned int)max(bodyA, bodyB);
+
+	return ((unsigned long long)lo << 32) | hi;
+}
+
+//Gets the impulse a contact finished the last solve with
+//Params : Key of the contact
+//Returns : Total impulse along the normal, 0 if the contact wasn't in the last solve
+float ContactSolver::GetSolvedImpulse(unsigned long long key) const
+{
+	//The cache is stored in key order at the end of every solve
+	auto it = std::lower_bound(m_impulseCache.begin(), m_impulseCache.end(), key, [](const CachedImpulse& cached, unsigned long long k)
+	{
+		return cached.key < k;
+	});
+
+	if (it != m_impulseCache.end() && it->key == key)
+	{
+		return it->impulse;
+	}
+
+	return 0.0f;
+}
+
+//Adds the impulses kept for warm starting to a world snapshot
+void ContactSolver::WriteSnapshot(SnapshotWriter& writer) const
+{
+	writer.AddSection(SNAPSHOT_SOLVER_IMPULSES, 0, m_impulseCache.data(), sizeof(CachedImpulse), m_impulseCache.size());
+}
+
+//Checks a snapshot's impulse cache is there and in key order
+bool ContactSolver::CheckSnapshot(const SnapshotReader& reader) const
+{
+	uint64_t count = 0;
+	const CachedImpulse* cache = (const CachedImpulse*)reader.FindSection(SNAPSHOT_SOLVER_IMPULSES, 0, sizeof(CachedImpulse), count);
+
+	if (cache == nullptr)
+	{
+		return false;
+	}
+
+	//The warm start merge and GetSolvedImpulse both rely on the order
+	for (uint64_t i = 1; i < count; i++)
+	{
+		if (cache[i - 1].key > cache[i].key)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//Replaces the impulse cache with one from a snapshot that passed CheckSnapshot
+void ContactSolver::ReadSnapshot(const SnapshotReader& reader)
+{
+	uint64_t count = 0;
+	const void* cache = reader.FindSection(SNAPSHOT_SOLVER_IMPULSES, 0, sizeof(CachedImpulse), count);
+
+	m_impulseCache.resize((size_t)count);
+
+	if (count > 0)
+	{
+		memcpy(m_impulseCache.data(), cache, (size_t)count * sizeof(CachedImpulse));
+	}
+}
+
+//Solves all contacts added since Begin, updating the solver body velocities
+//Params : Length of the step in seconds
+void ContactSolver::Solve(float dt)
+{
+	std::chrono::high_resolution_clock::time_point startTime = std::chrono::high_resolution_clock::now();
+
+	//Sorting gives a solve order that doesn't depend on how the contacts were found,
+	//and lets the impulse cache be merged in one walk
+	std::sort(m_contacts.begin(), m_contacts.end(), [](const SolverContact& a, const SolverContact& b)
+	{
+		return a.key < b.key;
+	});
+
+	//Restitution needs the closing speed from before any impulses are applied
+	PrepareContacts(dt);
+	WarmStart();
+
+	//Grouping keeps key order within each island, so the result is the same every run
+	GroupIslands();
+
+	m_iLastIterations = 0;
+	m_fLastMaxDelta = 0.0f;
+	m_iBatchCount = 0;
+	m_iOverflowCount = 0;
+
+	//Small islands are handed out whole to the workers, each converging on its own
+	if (!m_smallIslands.empty())
+	{
+		int workers = GetWorkerCount();
+		int islandCount = (int)m_smallIslands.size();
+
+		m_workerIterations.assign(workers, 0);
+		m_workerMaxDelta.assign(workers, 0.0f);
+
+		if (m_pJobSystem != nullptr)
+		{
+			//A few chunks per worker leaves room for stealing when island sizes vary
+			m_pJobSystem->ParallelFor("SolveIslands", islandCount, max(islandCount / (workers * 4), 1), SolveIslandsTask, this);
+		}
+		else
+		{
+			SolveIslandsTask(this, 0, islandCount, 0);
+		}
+
+		for (int w = 0; w < workers; w++)
+		{
+			m_iLastIterations = max(m_iLastIterations, m_workerIterations[w]);
+			m_fLastMaxDelta = max(m_fLastMaxDelta, m_workerMaxDelta[w]);
+		}
+	}
+
+	//Large islands are solved one at a time, with their colour batches split across the workers
+	for (int island : m_largeIslands)
+	{
+		int begin = m_islandStart[island];
+		int end = m_islandStart[island + 1];
+
+		//Colouring walks the contacts in key order, so the batches are the same every run
+		ColourContacts(begin, end);
+
+		m_iBatchCount += (int)m_batchStart.size() - 1;
+		m_iOverflowCount += m_iIslandOverflowCount;
+
+		int iterations = 0;
+		float maxDelta = 0.0f;
+
+		for (int i = 0; i < m_iIterations; i++)
+		{
+			maxDelta = SolvePass();
+			iterations++;
+
+			//Converged, further passes wouldn't change anything noticeably
+			if (maxDelta < m_fTolerance)
+			{
+				break;
+			}
+		}
+
+		m_iLastIterations = max(m_iLastIterations, iterations);
+		m_fLastMaxDelta = max(m_fLastMaxDelta, maxDelta);
+	}
+
+	StoreImpulses();
+
+	m_dLastSolveTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+}
+
+//Picks up the impulses cached from the last solve for contacts that persist
+void ContactSolver::WarmStart()
+{
+	//Both lists are sorted so they can be merged in one walk
+	size_t cached = 0;
+
+	for (auto& contact : m_contacts)
+	{
+		while (cached < m_impulseCache.size() && m_impulseCache[cached].key < contact.key)
+		{
+			cached++;
+		}
+
+		if (cached < m_impulseCache.size() && m_impulseCache[cached].key == contact.key)
+		{
+			contact.accumulatedImpulse = m_impulseCache[cached].impulse * WARM_START_FACTOR;
+			ApplyImpulse(contact, contact.accumulatedImpulse);
+		}
+	}
+}
+
+//Works out the effective mass and velocity bias of each contact
+void ContactSolver::PrepareContacts(float dt)
+{
+	float invDt = dt > 0.0f ? 1.0f / dt : 0.0f;
+
+	for (auto& contact : m_contacts)
+	{
+		float invMassA = contact.bodyA >= 0 ? m_bodies[contact.bodyA].invMass : 0.0f;
+		float invMassB = m_bodies[contact.bodyB].invMass;
+		float invMassSum = invMassA + invMassB;
+
+		contact.normalMass = invMassSum > 0.0f ? 1.0f / invMassSum : 0.0f;
+
+		//Relative velocity along the normal before solving (negative when closing)
+		const XMFLOAT3& vB = m_bodies[contact.bodyB].velocity;
+		XMFLOAT3 vA = contact.bodyA >= 0 ? m_bodies[contact.bodyA].velocity : XMFLOAT3(0.0f, 0.0f, 0.0f);
+
+		float closingSpeed = -(((vB.x - vA.x) * contact.normal.x) + ((vB.y - vA.y) * contact.normal.y) + ((vB.z - vA.z) * contact.normal.z));
+
+		float bounce = closingSpeed > RESTITUTION_THRESHOLD ? m_fRestitution * closingSpeed : 0.0f;
+		float correction = m_fCorrectionPercent * max(contact.penetration - m_fCorrectionSlop, 0.0f) * invDt;
+
+		contact.velocityBias = max(bounce, correction);
+	}
+}
+
+//Groups contacts by the island of their bodies and sorts the islands into
+//ones small enough to solve whole on a worker and ones worth colouring
+void ContactSolver::GroupIslands()
+{
+	int contactCount = (int)m_contacts.size();
+	int islandCount = 0;
+
+	for (auto& body : m_bodies)
+	{
+		islandCount = max(islandCount, body.island + 1);
+	}
+
+	//Both bodies of a dynamic contact are in the same island, so body B decides
+	ReserveGrowth(m_islandStart, islandCount + 1);
+	m_islandStart.assign(islandCount + 1, 0);
+
+	for (auto& contact : m_contacts)
+	{
+		m_islandStart[m_bodies[contact.bodyB].island + 1]++;
+	}
+
+	for (int i = 0; i < islandCount; i++)
+	{
+		m_islandStart[i + 1] += m_islandStart[i];
+	}
+
+	//Stable counting sort, contacts keep key order within an island
+	std::vector<int>& writeIndex = m_contactColours;
+	ReserveGrowth(writeIndex, islandCount);
+	writeIndex.assign(m_islandStart.begin(), m_islandStart.end() - 1);
+
+	ReserveGrowth(m_colouredContacts, contactCount);
+	m_colouredContacts.resize(contactCount);
+
+	for (int i = 0; i < contactCount; i++)
+	{
+		m_colouredContacts[writeIndex[m_bodies[m_contacts[i].bodyB].island]++] = m_contacts[i];
+	}
+
+	m_contacts.swap(m_colouredContacts);
+
+	m_smallIslands.clear();
+	m_largeIslands.clear();
+
+	for (int i = 0; i < islandCount; i++)
+	{
+		int size = m_islandStart[i + 1] - m_islandStart[i];
+
+		if (size >= MIN_PARALLEL_BATCH)
+		{
+			m_largeIslands.push_back(i);
+		}
+		else if (size > 0)
+		{
+			m_smallIslands.push_back(i);
+		}
+	}
+}
+
+//Job entry point, solves a run of small islands to convergence
+void ContactSolver::SolveIslandsTask(void* context, int begin, int end, int worker)
+{
+	ContactSolver* solver = (ContactSolver*)context;
+
+	int iterations = 0;
+	float maxDelta = 0.0f;
+
+	for (int i = begin; i < end; i++)
+	{
+		int island = solver->m_smallIslands[i];
+		int contactBegin = solver->m_islandStart[island];
+		int contactEnd = solver->m_islandStart[island + 1];
+
+		int islandIterations = 0;
+		float islandDelta = 0.0f;
+
+		for (int j = 0; j < solver->m_iIterations; j++)
+		{
+			islandDelta = solver->SolveRange(contactBegin, contactEnd);
+			islandIterations++;
+
+			if (islandDelta < solver->m_fTolerance)
+			{
+				break;
+			}
+		}
+
+		iterations = max(iterations, islandIterations);
+		maxDelta = max(maxDelta, islandDelta);
+	}
+
+	//A worker can run several chunks
+	solver->m_workerIterations[worker] = max(solver->m_workerIterations[worker], iterations);
+	solver->m_workerMaxDelta[worker] = max(solver->m_workerMaxDelta[worker], maxDelta);
+}
+
+//Groups a range of contacts into batches where no body appears twice, the last batch
+//holds contacts that didn't fit any colour and is solved serially
+//Params : First contact, one past the last contact
+void ContactSolver::ColourContacts(int begin, int end)
+{
+	int contactCount = end - begin;
+
+	ReserveGrowth(m_bodyColours, m_bodies.size());
+	m_bodyColours.assign(m_bodies.size(), 0);
+
+	ReserveGrowth(m_contactColours, contactCount);
+	m_contactColours.resize(contactCount);
+
+	//One count per colour plus the overflow batch
+	int batchSizes[MAX_COLOURS + 1] = { 0 };
+	int colourCount = 0;
+
+	//Greedy colouring, each contact takes the lowest colour neither body has used yet.
+	//The terrain isn't a body that gets written to, so it never blocks a colour
+	for (int i = 0; i < contactCount; i++)
+	{
+		const SolverContact& contact = m_contacts[begin + i];
+
+		unsigned long long used = m_bodyColours[contact.bodyB];
+		if (contact.bodyA >= 0)
+		{
+			used |= m_bodyColours[contact.bodyA];
+		}
+
+		int colour = MAX_COLOURS;
+
+		if (used != ~0ULL)
+		{
+			colour = 0;
+			while (used & (1ULL << colour))
+			{
+				colour++;
+			}
+
+			m_bodyColours[contact.bodyB] |= 1ULL << colour;
+			if (contact.bodyA >= 0)
+			{
+				m_bodyColours[contact.bodyA] |= 1ULL << colour;
+			}
+
+			colourCount = max(colourCount, colour + 1);
+		}
+
+		m_contactColours[i] = colour;
+		batchSizes[colour]++;
+	}
+
+	m_iIslandOverflowCount = batchSizes[MAX_COLOURS];
+
+	//Batch offsets, the overflow batch goes last (it may be empty)
+	ReserveGrowth(m_batchStart, colourCount + 2);
+	m_batchStart.resize(colourCount + 2);
+	m_batchStart[0] = begin;
+
+	for (int c = 0; c < colourCount; c++)
+	{
+		m_batchStart[c + 1] = m_batchStart[c] + batchSizes[c];
+	}
+	m_batchStart[colourCount + 1] = m_batchStart[colourCount] + m_iIslandOverflowCount;
+
+	//Stable counting sort into batch order, contacts keep key order within a batch
+	int writeIndex[MAX_COLOURS + 1];
+
+	for (int c = 0; c < colourCount; c++)
+	{
+		writeIndex[c] = m_batchStart[c];
+	}
+	writeIndex[MAX_COLOURS] = m_batchStart[colourCount];
+
+	ReserveGrowth(m_colouredContacts, m_contacts.size());
+	m_colouredContacts.resize(m_contacts.size());
+
+	for (int i = 0; i < contactCount; i++)
+	{
+		m_colouredContacts[writeIndex[m_contactColours[i]]++] = m_contacts[begin + i];
+	}
+
+	std::copy(m_colouredContacts.begin() + begin, m_colouredContacts.begin() + end, m_contacts.begin() + begin);
+}
+
+//Runs one pass over all contacts, batch by batch
+//Returns : Largest absolute impulse change in the pass
+float ContactSolver::SolvePass()
+{
+	float maxDelta = 0.0f;
+	int batchCount = (int)m_batchStart.size() - 1;
+
+	for (int b = 0; b < batchCount; b++)
+	{
+		int begin = m_batchStart[b];
+		int end = m_batchStart[b + 1];
+
+		//The overflow batch can share bodies so always runs on this thread
+		bool overflow = b == batchCount - 1;
+
+		if (!overflow && GetWorkerCount() > 1 && end - begin >= MIN_PARALLEL_BATCH)
+		{
+			m_iTaskBatchBegin = begin;
+			m_workerMaxDelta.assign(GetWorkerCount(), 0.0f);
+
+			int grainSize = max((end - begin) / (GetWorkerCount() * 4), MIN_PARALLEL_BATCH / 4);
+			m_pJobSystem->ParallelFor("SolveBatch", end - begin, grainSize, SolveBatchTask, this);
+
+			for (float workerDelta : m_workerMaxDelta)
+			{
+				maxDelta = max(maxDelta, workerDelta);
+			}
+		}
+		else
+		{
+			maxDelta = max(maxDelta, SolveRange(begin, end));
+		}
+	}
+
+	return maxDelta;
+}
+
+//Job entry point, solves part of the current batch
+void ContactSolver::SolveBatchTask(void* context, int begin, int end, int worker)
+{
+	ContactSolver* solver = (ContactSolver*)context;
+
+	solver->m_workerMaxDelta[worker] = max(solver->m_workerMaxDelta[worker], solver->SolveRange(solver->m_iTaskBatchBegin + begin, solver->m_iTaskBatchBegin + end));
+}
+
+//Solves a range of contacts once
+//Params : First contact, one past the last contact
+//Returns : Largest absolute impulse change in the range
+float ContactSolver::SolveRange(int begin, int end)
+{
+	float maxDelta = 0.0f;
+
+	for (int i = begin; i < end; i++)
+	{
+		SolverContact& contact = m_contacts[i];
+
+		const XMFLOAT3& vB = m_bodies[contact.bodyB].velocity;
+		XMFLOAT3 vA = contact.bodyA >= 0 ? m_bodies[contact.bodyA].velocity : XMFLOAT3(0.0f, 0.0f, 0.0f);
+
+		float relativeNormalVelocity = ((vB.x - vA.x) * contact.normal.x) + ((vB.y - vA.y) * contact.normal.y) + ((vB.z - vA.z) * contact.normal.z);
+
+		//Impulse needed to reach the target separating velocity, clamped so the total never pulls bodies together
+		float impulse = contact.normalMass * (contact.velocityBias - relativeNormalVelocity);
+		float newImpulse = max(contact.accumulatedImpulse + impulse, 0.0f);
+
+		impulse = newImpulse - contact.accumulatedImpulse;
+		contact.accumulatedImpulse = newImpulse;
+
+		ApplyImpulse(contact, impulse);
+
+		maxDelta = max(maxDelta, fabsf(impulse));
+	}
+
+	return maxDelta;
+}
+
+//Stores the final impulses for warm starting the next solve
+void ContactSolver::StoreImpulses()
+{
+	ReserveGrowth(m_impulseCache, m_contacts.size());
+	m_impulseCache.resize(m_contacts.size());
+
+	for (size_t i = 0; i < m_contacts.size(); i++)
+	{
+		m_impulseCache[i].key = m_contacts[i].key;
+		m_impulseCache[i].impulse = m_contacts[i].accumulatedImpulse;
+		m_impulseCache[i].unused = 0;
+	}
+
+	//Contacts are in island/colour order now, the cache needs to be in key order for the next merge
+	std::sort(m_impulseCache.begin(), m_impulseCache.end(), [](const CachedImpulse& a, const CachedImpulse& b)
+	{
+		return a.key < b.key;
+	});
+}
+
+//Applies an impulse along a contact normal to both bodies
+void ContactSolver::ApplyImpulse(const SolverContact& contact, float impulse)
+{
+	SolverBody& bodyB = m_bodies[contact.bodyB];
+
+	bodyB.velocity.x += contact.normal.x * impulse * bodyB.invMass;
+	bodyB.velocity.y += contact.normal.y * impulse * bodyB.invMass;
+	bodyB.velocity.z += contact.normal.z * impulse * bodyB.invMass;
+
+	if (contact.bodyA >= 0)
+	{
+		SolverBody& bodyA = m_bodies[contact.bodyA];
+
+		bodyA.velocity.x -= contact.normal.x * impulse * bodyA.invMass;
+		bodyA.velocity.y -= contact.normal.y * impulse * bodyA.invMass;
+		bodyA.velocity.z -= contact.normal.z * impulse * bodyA.invMass;
+	}
+}
+
+//*********************** Getters / Setters ************************************
+
+void ContactSolver::SetIterations(int iterations)
+{
+	m_iIterations = max(iterations, 1);
+}
+
+//******************************************************************************
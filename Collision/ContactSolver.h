@@ -0,0 +1,240 @@
+#ifndef _CONTACT_SOLVER_H_
+#define _CONTACT_SOLVER_H_
+
+#include <vector>
+#include <algorithm>
+
+#include "JobSystem.h"
+#include "VectorMath.h"
+#include "Macros.h"
+
+class SnapshotWriter;
+class SnapshotReader;
+
+//**********************************************************************************
+// Struct : SolverBody
+// Description : Velocity and inverse mass of a body, copied in by the physics world
+// before a solve and copied back out afterwards. Keeps the inner solver loop on a
+// small contiguous array rather than chasing body pointers.
+//**********************************************************************************
+struct SolverBody
+{
+	XMFLOAT3 velocity;
+	float invMass;
+
+	//Island the body belongs to, contacts in different islands never share a body
+	int island;
+};
+
+//**********************************************************************************
+// Struct : SolverContact
+// Description : A single non-penetration constraint between two bodies, or between
+// a body and the terrain (bodyA = -1). The normal points from A to B and the
+// accumulated impulse is carried between steps (warm starting) using the key.
+//**********************************************************************************
+struct SolverContact
+{
+	//Identifies the same contact from one step to the next
+	unsigned long long key;
+
+	//Indices into the solver body array, bodyA is -1 for the terrain
+	int bodyA;
+	int bodyB;
+
+	//Contact normal from A to B
+	XMFLOAT3 normal;
+
+	//Penetration depth when the contact was generated
+	float penetration;
+
+	//Effective mass along the normal (1 / sum of inverse masses)
+	float normalMass;
+
+	//Target separating velocity from restitution and position correction
+	float velocityBias;
+
+	//Total impulse applied along the normal so far, never negative
+	float accumulatedImpulse;
+};
+
+//**********************************************************************************
+// Class : ContactSolver
+// Description : Iterative sequential impulse solver. Each contact's impulse is
+// accumulated and clamped (rather than each contact being resolved once), relative
+// velocity of both bodies is used, and penetration is corrected with a velocity bias.
+// Iterations stop early once the largest impulse change in a pass drops below the
+// tolerance.
+// Contacts are grouped by island. Small islands are solved whole on separate threads,
+// large ones are coloured into batches where no body appears twice so a batch can be
+// split across threads without locks. The result doesn't depend on the thread count.
+//**********************************************************************************
+class ContactSolver
+{
+public:
+
+	ContactSolver();
+	~ContactSolver();
+
+	//Clears the contacts from the last solve and sizes the body array
+	//Params : Number of bodies that contacts can refer to
+	void Begin(int bodyCount);
+
+	//Gets a body to fill in before solving, or read back afterwards
+	//Params : Index of the body
+	SolverBody& GetBody(int index) { return m_bodies[index]; }
+
+	//Adds a contact to be solved
+	//Params : Key used for warm starting, body indices (bodyA -1 for the terrain), normal from A to B, penetration depth
+	void AddContact(unsigned long long key, int bodyA, int bodyB, const XMVECTOR& normal, float penetration);
+
+	//Solves all contacts added since Begin, updating the solver body velocities
+	//Params : Length of the step in seconds
+	void Solve(float dt);
+
+	//Gets the impulse a contact finished the last solve with
+	//Params : Key of the contact
+	//Returns : Total impulse along the normal, 0 if the contact wasn't in the last solve
+	float GetSolvedImpulse(unsigned long long key) const;
+
+	//Keys for terrain and body vs body contacts
+	//Params : Body slots (below MAX_BODY_SLOTS), and for the terrain the face's index counting the faces of the tiles before it
+	static unsigned long long MakeStaticKey(int body, unsigned long long worldFace);
+	static unsigned long long MakeDynamicKey(int bodyA, int bodyB);
+
+	//Adds the impulses kept for warm starting to a world snapshot
+	void WriteSnapshot(SnapshotWriter& writer) const;
+
+	//Checks a snapshot's impulse cache is there and in key order
+	bool CheckSnapshot(const SnapshotReader& reader) const;
+
+	//Replaces the impulse cache with one from a snapshot that passed CheckSnapshot
+	void ReadSnapshot(const SnapshotReader& reader);
+
+//*********************** Getters / Setters ************************************
+
+	//Set/Get the maximum number of iterations per solve
+	void SetIterations(int iterations);
+	int GetIterations() const { return m_iIterations; }
+
+	//Set/Get the largest impulse change (per pass) at which the solve stops early
+	void SetTolerance(float tolerance) { m_fTolerance = tolerance; }
+	float GetTolerance() const { return m_fTolerance; }
+
+	//Set/Get the coefficient of restitution
+	void SetRestitution(float restitution) { m_fRestitution = restitution; }
+	float GetRestitution() const { return m_fRestitution; }
+
+	//Set the fraction of penetration (above the slop) corrected per step
+	void SetPositionCorrection(float percent, float slop) { m_fCorrectionPercent = percent; m_fCorrectionSlop = slop; }
+
+	//Set/Get the job system islands and batches are spread across (nullptr to solve on the calling thread)
+	void SetJobSystem(JobSystem* pJobSystem) { m_pJobSystem = pJobSystem; }
+	JobSystem* GetJobSystem() const { return m_pJobSystem; }
+
+	//Number of workers contacts are solved across
+	int GetWorkerCount() const { return m_pJobSystem != nullptr ? m_pJobSystem->GetWorkerCount() : 1; }
+
+	//Stats from the last solve
+	int GetContactCount() const { return (int)m_contacts.size(); }
+	int GetLastIterationCount() const { return m_iLastIterations; }
+	float GetLastMaxImpulseDelta() const { return m_fLastMaxDelta; }
+	double GetLastSolveTime() const { return m_dLastSolveTime; }
+	int GetBatchCount() const { return m_iBatchCount; }
+	int GetOverflowContactCount() const { return m_iOverflowCount; }
+
+//******************************************************************************
+
+private:
+
+	//Picks up the impulses cached from the last solve for contacts that persist
+	void WarmStart();
+
+	//Works out the effective mass and velocity bias of each contact
+	void PrepareContacts(float dt);
+
+	//Groups contacts by the island of their bodies and sorts the islands into
+	//ones small enough to solve whole on a worker and ones worth colouring
+	void GroupIslands();
+
+	//Job entry point, solves a run of small islands to convergence
+	static void SolveIslandsTask(void* context, int begin, int end, int worker);
+
+	//Groups a range of contacts into batches where no body appears twice, the last batch
+	//holds contacts that didn't fit any colour and is solved serially
+	//Params : First contact, one past the last contact
+	void ColourContacts(int begin, int end);
+
+	//Runs one pass over all contacts, batch by batch
+	//Returns : Largest absolute impulse change in the pass
+	float SolvePass();
+
+	//Solves a range of contacts once
+	//Params : First contact, one past the last contact
+	//Returns : Largest absolute impulse change in the range
+	float SolveRange(int begin, int end);
+
+	//Job entry point, solves part of the current batch
+	static void SolveBatchTask(void* context, int begin, int end, int worker);
+
+	//Stores the final impulses for warm starting the next solve
+	void StoreImpulses();
+
+	//Applies an impulse along a contact normal to both bodies
+	void ApplyImpulse(const SolverContact& contact, float impulse);
+
+private:
+
+	//Key and impulse of a contact from the last solve, kept sorted by key. The padding is
+	//spelled out so snapshots, which store the cache as it is, never pick up stray bytes
+	struct CachedImpulse
+	{
+		unsigned long long key;
+		float impulse;
+		unsigned int unused;
+	};
+
+	std::vector<SolverBody> m_bodies;
+	std::vector<SolverContact> m_contacts;
+	std::vector<CachedImpulse> m_impulseCache;
+
+	//Colours used by the contacts of each body so far, one bit per colour
+	std::vector<unsigned long long> m_bodyColours;
+
+	//Colour of each contact, and the contacts reordered by colour
+	std::vector<int> m_contactColours;
+	std::vector<SolverContact> m_colouredContacts;
+
+	//First contact of each island, plus one past the end
+	std::vector<int> m_islandStart;
+
+	//Islands with contacts, split by whether they're worth colouring
+	std::vector<int> m_smallIslands;
+	std::vector<int> m_largeIslands;
+
+	//First contact of each batch of the island being solved, plus one past the end
+	std::vector<int> m_batchStart;
+	int m_iIslandOverflowCount;
+
+	//Totals over all coloured islands in the last solve
+	int m_iBatchCount;
+	int m_iOverflowCount;
+
+	JobSystem* m_pJobSystem;
+
+	//Batch being solved by the job system and each worker's largest change and iterations
+	int m_iTaskBatchBegin;
+	std::vector<float> m_workerMaxDelta;
+	std::vector<int> m_workerIterations;
+
+	int m_iIterations;
+	float m_fTolerance;
+	float m_fRestitution;
+	float m_fCorrectionPercent;
+	float m_fCorrectionSlop;
+
+	int m_iLastIterations;
+	float m_fLastMaxDelta;
+	double m_dLastSolveTime;
+};
+
+#endif
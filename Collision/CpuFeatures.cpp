@@ -0,0 +1,69 @@
+#include "CpuFeatures.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+
+//Checks CPUID and that the OS saves the wider registers on a context switch
+//Returns : Highest supported SIMD level
+static SimdLevel DetectSimdLevel()
+{
+#if defined(_MSC_VER)
+	int info[4];
+
+	__cpuid(info, 0);
+	if (info[0] < 7)
+	{
+		return SIMD_SCALAR;
+	}
+
+	//OSXSAVE and AVX
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+	{
+		return SIMD_SCALAR;
+	}
+
+	unsigned long long xcr0 = _xgetbv(0);
+
+	//XMM and YMM state
+	if ((xcr0 & 0x6) != 0x6)
+	{
+		return SIMD_SCALAR;
+	}
+
+	__cpuidex(info, 7, 0);
+
+	bool avx2 = (info[1] & (1 << 5)) != 0;
+	bool avx512 = (info[1] & (1 << 16)) != 0;
+
+	//Opmask and ZMM state
+	if (avx2 && avx512 && (xcr0 & 0xE6) == 0xE6)
+	{
+		return SIMD_AVX512;
+	}
+
+	return avx2 ? SIMD_AVX2 : SIMD_SCALAR;
+#else
+	//These check the OS support as well
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2"))
+	{
+		return SIMD_AVX512;
+	}
+
+	return __builtin_cpu_supports("avx2") ? SIMD_AVX2 : SIMD_SCALAR;
+#endif
+}
+
+//Gets the highest instruction set both the CPU and OS support, detected once
+//Returns : Supported SIMD level
+SimdLevel GetSupportedSimdLevel()
+{
+	static SimdLevel level = DetectSimdLevel();
+
+	return level;
+}
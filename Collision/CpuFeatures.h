@@ -0,0 +1,28 @@
+#ifndef _CPU_FEATURES_H_
+#define _CPU_FEATURES_H_
+
+
+//Instruction sets the batch loops can use, in increasing order
+enum SimdLevel
+{
+	SIMD_SCALAR,
+	SIMD_AVX2,
+	SIMD_AVX512
+};
+
+//Functions using intrinsics beyond the build's baseline are marked with these, so
+//they compile without raising the minimum CPU for the whole program. MSVC allows
+//the intrinsics anywhere, GCC/Clang need the target per function.
+#if defined(_MSC_VER)
+#define SIMD_TARGET_AVX2
+#define SIMD_TARGET_AVX512
+#else
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#define SIMD_TARGET_AVX512 __attribute__((target("avx2,avx512f")))
+#endif
+
+//Gets the highest instruction set both the CPU and OS support, detected once
+//Returns : Supported SIMD level
+SimdLevel GetSupportedSimdLevel();
+
+#endif
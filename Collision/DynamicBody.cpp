@@ -2,7 +2,7 @@
 
 
 DynamicBody::DynamicBody()
-	: m_pMesh(nullptr), m_massData(1), m_fRadius(0)
+	: m_pMesh(nullptr), m_pStore(nullptr), m_iHandle(INVALID_BODY_HANDLE), m_iWorldId(-1), m_massData(1), m_fRadius(0), m_bIsActive(false)
 {
 	m_vPosition = XMVectorSet(0, 0, 0, 0);
 	m_vVelocity = XMVectorSet(0, 0, 0, 0);
@@ -10,7 +10,7 @@ DynamicBody::DynamicBody()
 }
 
 DynamicBody::DynamicBody(CommonMesh * mMesh, float mRadius)
-	: m_massData(1.0f)
+	: m_pStore(nullptr), m_iHandle(INVALID_BODY_HANDLE), m_iWorldId(-1), m_massData(1.0f), m_bIsActive(false)
 {
 	m_vPosition = XMVectorSet(0, 0, 0, 0);
 	m_vVelocity = XMVectorSet(0, 0, 0, 0);
@@ -20,86 +20,66 @@ DynamicBody::DynamicBody(CommonMesh * mMesh, float mRadius)
 	m_fRadius = mRadius;
 }
 
+//Bodies should be removed from their physics world before being deleted
 DynamicBody::~DynamicBody()
 {
 	//Delete mesh
 	m_pMesh = nullptr;
 }
 
-void DynamicBody::IntegratePosition()
-{
-	float dTime = Application::s_pApp->m_fDTime;
-
-	//REFERENCE NOTE : FROM GAMEDEVTUTS.COM
-	//NUMERICAL INTEGRATION, SPRING ENERGY
-
-	//Add all forces onto current velocity (multiplying by dTime to smooth movement over different fps)
-	m_vVelocity += (m_massData.inv_mass * m_vForce) * dTime;
-
-	//Increment position by overall velocity
-	m_vPosition += m_vVelocity * dTime;
-
-	//Reset force after every frame
-	m_vForce = XMVectorSet(0, 0, 0, 0);
-}
-
-
-//Apply a force to the body (Adds force onto m_vForce)
+//Apply a force to the body (Adds force onto the accumulated force)
 //Params : XMVECTOR of force to be added
 void DynamicBody::ApplyForce(const XMVECTOR & mForce)
 {
-	m_vForce += mForce;
+	if (m_pStore != nullptr)
+	{
+		m_pStore->AddForce(m_pStore->GetIndex(m_iHandle), mForce);
+	}
+	else
+	{
+		m_vForce += mForce;
+	}
 }
 
-//REFERENCE NOTE : FROM GAMEDEVTUTS.COM
-
-//Calculate impulse velocity when passed a collision normal
-//Params : XMVECTOR of collision normal (must be normalized)
-void DynamicBody::ResolveCollision(const XMVECTOR& mCollisionNormal)
+//Moves the body's state into a store, after which it's read and written there
+//Params : Store to move into
+void DynamicBody::Attach(BodyStore* pStore)
 {
-	//Calculate negative velocity (opposite movement)
-	XMVECTOR relativeVelocity = -m_vVelocity;
+	Detach();
 
-	//Calculate dot product between relative velocity and collision normal
-	XMVECTOR velAlongNormal = XMVector3Dot(relativeVelocity, mCollisionNormal);
+	m_pStore = pStore;
+	m_iHandle = pStore->Add(this, m_vPosition, m_vVelocity, m_massData.inv_mass, m_fRadius, m_bIsActive);
+	pStore->AddForce(pStore->GetIndex(m_iHandle), m_vForce);
+}
 
-	//If the dot product < 0 (i.e object is moving away from normal)
-	//Then return out and don't resolve
-	if (XMVectorGetX(velAlongNormal) < 0)
+//Copies the body's state back out of its store and removes it from the store
+void DynamicBody::Detach()
+{
+	if (m_pStore == nullptr)
 	{
 		return;
 	}
 
-	//Coefficent of restitution
-	float e = 0.6f;
+	int index = m_pStore->GetIndex(m_iHandle);
 
-	//Calculate amount of impulse
-	float j = -(1 + e) * XMVectorGetX(velAlongNormal);
+	m_vPosition = m_pStore->GetPosition(index);
+	m_vVelocity = m_pStore->GetVelocity(index);
+	m_vForce = m_pStore->GetForce(index);
+	m_fRadius = m_pStore->GetRadius(index);
+	m_bIsActive = m_pStore->IsActive(index);
 
-	//Calculate velocity
-	XMVECTOR impulse = j * mCollisionNormal;
+	m_pStore->Remove(m_iHandle);
 
-	//Modify velocity by this impulse velocty
-	m_vVelocity -= impulse;
+	m_pStore = nullptr;
+	m_iHandle = INVALID_BODY_HANDLE;
 }
 
-//REFERENCE NOTE : FROM GAMEDEVTUTS.COM
-
-//Calculate position correction when colliding with the heightmap
-//Params : Penetration depth between body and heightmap, XMVECTOR of collision normal
-void DynamicBody::PositionalCorrectionHeightmap(float mPenetration, const XMVECTOR& mCollisionNormal)
+//Points the view at a body a snapshot restored straight into a store, without moving any state
+//Params : Store the body now lives in and its handle there (nullptr and INVALID_BODY_HANDLE to leave it detached)
+void DynamicBody::Rebind(BodyStore* pStore, BodyHandle handle)
 {
-	//Percent to move position (high percent causes more jitter but stops overlap)
-	const float percent = 0.2f;
-	
-	//If penetration is less than slop value then don't correct
-	const float slop = 0.01f;
-
-	//Calulcate positional correction vector
-	XMVECTOR correction = max(mPenetration - slop, 0.0f) * percent * mCollisionNormal;
-
-	//Modify position based on correction calculated
-	m_vPosition += correction;
+	m_pStore = pStore;
+	m_iHandle = handle;
 }
 
 //*********************** Getters / Setters ************************************
@@ -111,43 +91,128 @@ void DynamicBody::SetMesh(CommonMesh * mMesh)
 
 void DynamicBody::SetPosition(const XMVECTOR& mPos)
 {
-	m_vPosition = mPos;
+	if (m_pStore != nullptr)
+	{
+		int index = m_pStore->GetIndex(m_iHandle);
+
+		m_pStore->SetPosition(index, mPos);
+
+		//Moved from outside the simulation, it may not be resting any more
+		m_pStore->Wake(index);
+	}
+	else
+	{
+		m_vPosition = mPos;
+	}
 }
 
 XMVECTOR DynamicBody::GetPosition()
 {
+	if (m_pStore != nullptr)
+	{
+		return m_pStore->GetPosition(m_pStore->GetIndex(m_iHandle));
+	}
+
 	return m_vPosition;
 }
 
 void DynamicBody::SetVelocity(const XMVECTOR & mVelocity)
 {
-	m_vVelocity = mVelocity;
+	if (m_pStore != nullptr)
+	{
+		m_pStore->SetVelocity(m_pStore->GetIndex(m_iHandle), mVelocity);
+	}
+	else
+	{
+		m_vVelocity = mVelocity;
+	}
 }
 
 XMVECTOR DynamicBody::GetVelocity()
 {
+	if (m_pStore != nullptr)
+	{
+		return m_pStore->GetVelocity(m_pStore->GetIndex(m_iHandle));
+	}
+
 	return m_vVelocity;
 }
 
 float DynamicBody::GetRadius()
 {
+	if (m_pStore != nullptr)
+	{
+		return m_pStore->GetRadius(m_pStore->GetIndex(m_iHandle));
+	}
+
 	return m_fRadius;
 }
 
 void DynamicBody::SetRadius(float mRadius)
 {
-	m_fRadius = mRadius;
+	if (m_pStore != nullptr)
+	{
+		m_pStore->SetRadius(m_pStore->GetIndex(m_iHandle), mRadius);
+	}
+	else
+	{
+		m_fRadius = mRadius;
+	}
 }
 
 bool DynamicBody::GetActive()
 {
+	if (m_pStore != nullptr)
+	{
+		return m_pStore->IsActive(m_pStore->GetIndex(m_iHandle));
+	}
+
 	return m_bIsActive;
 }
 
 void DynamicBody::SetActive(bool isActive)
 {
-	m_bIsActive = isActive;
+	if (m_pStore != nullptr)
+	{
+		int index = m_pStore->GetIndex(m_iHandle);
+
+		m_pStore->SetActive(index, isActive);
+		m_pStore->Wake(index);
+	}
+	else
+	{
+		m_bIsActive = isActive;
+	}
 }
 
-//******************************************************************************
+float DynamicBody::GetInverseMass()
+{
+	if (m_pStore != nullptr)
+	{
+		return m_pStore->GetInverseMass(m_pStore->GetIndex(m_iHandle));
+	}
 
+	return m_massData.inv_mass;
+}
+
+bool DynamicBody::GetSleeping()
+{
+	if (m_pStore != nullptr)
+	{
+		return m_pStore->IsSleeping(m_pStore->GetIndex(m_iHandle));
+	}
+
+	return false;
+}
+
+int DynamicBody::GetWorldIndex()
+{
+	if (m_pStore != nullptr)
+	{
+		return m_pStore->GetIndex(m_iHandle);
+	}
+
+	return -1;
+}
+
+//******************************************************************************
@@ -1,10 +1,13 @@
 #ifndef _DYNAMIC_BODY_H_
 #define _DYNAMIC_BODY_H_
 
-#include "Application.h"
+#include "VectorMath.h"
+#include "Macros.h"
+#include "BodyStore.h"
 
 
 class PhysicsWorld;
+class CommonMesh;
 
 
 //**********************************************************************************
@@ -34,9 +37,10 @@ struct MassData
 
 //**********************************************************************************
 // Class : DynamicBody
-// Description : Holds all relevant data to do with a singular dynamic body including
-// position, current velocity, mass etc.
-// Also holds functionality to resolve it's own collisions and integrate position
+// Description : A single dynamic body, position, current velocity, mass etc.
+// Once added to a physics world the body's state lives in the world's BodyStore and
+// this becomes a thin view over it, found through a stable handle. Until then (and
+// after it's removed) the state is held here.
 //**********************************************************************************
 XMALIGN class DynamicBody
 {
@@ -46,20 +50,23 @@ public:
 	DynamicBody(CommonMesh* mMesh, float mRadius);
 	~DynamicBody();
 
-	//Move the position of the body by applying a velocity
-	void IntegratePosition();
-
-	//Apply a force to the body (Adds force onto m_vForce)
+	//Apply a force to the body (Adds force onto the accumulated force)
 	//Params : XMVECTOR of force to be added
 	void ApplyForce(const XMVECTOR& mForce);
-	
-	//Calculate impulse velocity when passed a collision normal
-	//Params : XMVECTOR of collision normal
-	void ResolveCollision(const XMVECTOR& mCollisionNormal);
 
-	//Calculate position correction when colliding with the heightmap
-	//Params : Penetration depth between body and heightmap, XMVECTOR of collision normal
-	void PositionalCorrectionHeightmap(float mPenetration, const XMVECTOR& mCollisionNormal);
+	//Moves the body's state into a store, after which it's read and written there
+	//Params : Store to move into
+	void Attach(BodyStore* pStore);
+
+	//Copies the body's state back out of its store and removes it from the store
+	void Detach();
+
+	//Whether the body currently lives in a store
+	bool IsAttached() const { return m_pStore != nullptr; }
+
+	//Points the view at a body a snapshot restored straight into a store, without moving any state
+	//Params : Store the body now lives in and its handle there (nullptr and INVALID_BODY_HANDLE to leave it detached)
+	void Rebind(BodyStore* pStore, BodyHandle handle);
 
 //*********************** Getters / Setters ************************************
 	void SetMesh(CommonMesh* mMesh);
@@ -80,6 +87,22 @@ public:
 	bool GetActive();
 	void SetActive(bool isActive);
 
+	//Get inverse mass (0 for immovable bodies)
+	float GetInverseMass();
+
+	//Get whether the body is asleep
+	bool GetSleeping();
+
+	//Get the handle of the body in its store (INVALID_BODY_HANDLE if not attached)
+	BodyHandle GetHandle() const { return m_iHandle; }
+
+	//Get the index of the body within the physics world (-1 if not in a world)
+	int GetWorldIndex();
+
+	//Set/Get the body's place among every body given to its physics world, which names it in world snapshots (-1 if none)
+	void SetWorldId(int id) { m_iWorldId = id; }
+	int GetWorldId() const { return m_iWorldId; }
+
 //******************************************************************************
 
 protected:
@@ -87,6 +110,15 @@ protected:
 	//Pointer to the mesh associated with this body
 	CommonMesh* m_pMesh;
 
+	//Store the body lives in, and its handle there (nullptr/INVALID_BODY_HANDLE if not attached)
+	BodyStore* m_pStore;
+	BodyHandle m_iHandle;
+
+	//Place among the bodies of the physics world it was given to, -1 if it hasn't been
+	int m_iWorldId;
+
+	//State used while the body isn't attached to a store
+
 	//Mass data associated with this body (mass and inv_mass)
 	MassData m_massData;
 
@@ -113,4 +145,3 @@ XMDELETE
 };
 
 #endif
-
@@ -0,0 +1,1352 @@
+//**********************************************************************
+// File:			HeadlessRunner.cpp
+// Description:		Runs a physics scenario without a window or GPU and steps it
+//					as fast as it will go, then prints the steps per second and
+//					how long each phase of a step took. Spheres are dropped in
+//					layers over a heightmap (or a square of heightmap tiles).
+//					With --worlds it builds many independent copies of the
+//					scenario instead, steps them all at once across a pool of
+//					threads and prints the combined world steps per second.
+//					With --solver-scaling it steps the same state again with
+//					more and more workers and prints how the solver speeds up.
+//					With --hash-trace it writes the state hash of every step
+//					to a file, and with --hash-check it checks a run steps
+//					through the same hashes as one written before.
+//					With --snapshot it also times saving and restoring the
+//					world once the run is done, with --raycast and --queries
+//					it times raycasts and scene queries into it, and with
+//					--brush it times stamping brushes into the terrain. With
+//					--churn it times removing bodies and adding them back,
+//					and prints the memory the process holds as it goes.
+//					Built by the standalone CMake build, run with --help for the
+//					scenario parameters.
+//**********************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+#include "PhysicsWorld.h"
+#include "HeightMap.h"
+#include "Random.h"
+#include "JobSystem.h"
+#include "WorldSnapshot.h"
+#include "Constants.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__linux__)
+#include <unistd.h>
+#endif
+
+#if !defined(PHYSICS_STANDALONE)
+#error "The headless runner needs the standalone build (PHYSICS_STANDALONE), the D3D build of HeightMap creates GPU resources"
+#endif
+
+//**********************************************************************************
+// Struct : RunnerOptions
+// Description : Scenario parameters, read from the command line.
+//**********************************************************************************
+struct RunnerOptions
+{
+	std::string heightMapFile = "Resources/heightmap_0.bmp";
+
+	//Vertices along each side of rolling terrain to generate and use instead of the heightmap file, 0 for none
+	int generateSize = 0;
+
+	float gridSize = 2.0f;
+	float heightRange = 0.75f;
+
+	//Tiles along each side of the square of heightmaps
+	int tiles = 1;
+
+	int spheres = 1000;
+	float radius = 1.0f;
+
+	//Drop every sphere onto one square pile in the middle of the terrain, instead of spread over all of it
+	bool pile = false;
+
+	//Steps run before timing starts, and steps timed
+	int warmupSteps = 60;
+	int steps = 600;
+
+	float stepTime = 1.0f / PHYSICS_STEP_RATE;
+
+	//Job system workers of each world, 0 for one per core with a single world and 1 in a batch
+	int workers = 0;
+
+	//Independent worlds stepped side by side, and the threads they're spread over (0 for one per core)
+	int worlds = 1;
+	int threads = 0;
+
+	int iterations = 0;
+	unsigned int seed = RANDOM_SEED;
+
+	bool sleeping = true;
+	bool deterministic = false;
+	bool distanceField = false;
+
+	//File the state hash of every step is written to, and one a run's hashes are checked against
+	//(a single world only, both turn on deterministic mode)
+	std::string hashTraceFile;
+	std::string hashCheckFile;
+
+	//Time saving and restoring a snapshot of the world after the run, optionally through a file
+	bool snapshot = false;
+	std::string snapshotFile;
+
+	//Rays cast into the world after the run to time Raycast and RaycastBatch, 0 for none
+	int raycasts = 0;
+
+	//Queries of each kind run after the run to time OverlapSphere, OverlapAABB and KNearest, 0 for none
+	int queries = 0;
+
+	//Most threads the queries are run from at once, doubling from 1, 0 for one per core
+	int queryThreads = 0;
+
+	//Brush stamps timed at each radius after the run, 0 for none
+	int brushStamps = 0;
+
+	//Bodies removed and added back in each round of churn after the run, 0 for none
+	int churn = 0;
+
+	//Most workers the solver is timed with from the same state after the warmup, doubling from 1, 0 for none
+	int solverScaling = 0;
+};
+
+//Prints the command line parameters and their defaults
+static void PrintUsage(const char* program)
+{
+	RunnerOptions defaults;
+
+	printf("Usage: %s [options]\n", program);
+	printf("  --heightmap <file>      Heightmap bitmap (%s)\n", defaults.heightMapFile.c_str());
+	printf("  --generate <n>          Generate n x n rolling terrain (rounded up to a multiple of 4) into generated_<n>.bmp and use it\n");
+	printf("  --grid-size <size>      Grid spacing of the heightmap (%g)\n", defaults.gridSize);
+	printf("  --height-range <range>  Height scale of the heightmap (%g)\n", defaults.heightRange);
+	printf("  --tiles <n>             Lay n x n copies of the heightmap side by side (%d)\n", defaults.tiles);
+	printf("  --spheres <n>           Number of spheres dropped (%d)\n", defaults.spheres);
+	printf("  --radius <r>            Sphere radius (%g)\n", defaults.radius);
+	printf("  --pile                  Drop the spheres onto one square pile in the middle instead of over the whole terrain\n");
+	printf("  --warmup <n>            Steps run before timing starts (%d)\n", defaults.warmupSteps);
+	printf("  --steps <n>             Steps timed (%d)\n", defaults.steps);
+	printf("  --dt <seconds>          Length of a step (%g)\n", defaults.stepTime);
+	printf("  --workers <n>           Worker threads of each world, 0 for one per core (1 with --worlds) (%d)\n", defaults.workers);
+	printf("  --worlds <n>            Step n independent worlds at once, each seeded differently (%d)\n", defaults.worlds);
+	printf("  --threads <n>           Threads the worlds are spread over, 0 for one per core (%d)\n", defaults.threads);
+	printf("  --iterations <n>        Contact solver iterations, 0 for the solver's default (%d)\n", defaults.iterations);
+	printf("  --seed <n>              Seed for the sphere radii jitter and drop order (%u)\n", defaults.seed);
+	printf("  --no-sleep              Never put resting islands to sleep\n");
+	printf("  --deterministic         Hash the worlds after every step and print the final hash\n");
+	printf("  --hash-trace <file>     As --deterministic, also writing the hash of every step to a file\n");
+	printf("  --hash-check <file>     As --deterministic, exiting with 1 unless every step's hash matches a --hash-trace file\n");
+	printf("  --distance-field        Collide spheres with the baked distance field instead of the triangles\n");
+	printf("  --snapshot              Time saving and restoring a snapshot of the world after the run\n");
+	printf("  --snapshot-file <file>  As --snapshot, also writing the snapshot to a file and reading it back\n");
+	printf("  --brush <n>             Time stamping n brushes into the terrain after the run, at each radius from 1 to 32 cells\n");
+	printf("  --churn <n>             Time removing n bodies and adding them back after the run, over rounds with a step between\n");
+	printf("  --solver-scaling <n>    After the warmup, time the steps from the same state with 1, 2, 4... n workers\n");
+	printf("  --raycast <n>           Time casting n rays into the world after the run, one at a time and batched\n");
+	printf("  --queries <n>           Time n queries of each kind into the world after the run, from 1, 2, 4... threads at once\n");
+	printf("  --query-threads <n>     Most threads --queries reads from at once, 0 for one per core (%d)\n", defaults.queryThreads);
+}
+
+//Reads the command line into the options
+//Returns : False if an option isn't recognised or is missing its value
+static bool ParseOptions(int argc, char** argv, RunnerOptions& options)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* option = argv[i];
+
+		//Flags
+		if (strcmp(option, "--no-sleep") == 0)
+		{
+			options.sleeping = false;
+			continue;
+		}
+
+		if (strcmp(option, "--deterministic") == 0)
+		{
+			options.deterministic = true;
+			continue;
+		}
+
+		if (strcmp(option, "--distance-field") == 0)
+		{
+			options.distanceField = true;
+			continue;
+		}
+
+		if (strcmp(option, "--snapshot") == 0)
+		{
+			options.snapshot = true;
+			continue;
+		}
+
+		if (strcmp(option, "--pile") == 0)
+		{
+			options.pile = true;
+			continue;
+		}
+
+		//Everything else takes a value
+		if (i + 1 >= argc)
+		{
+			fprintf(stderr, "Unknown option %s, or it is missing its value\n", option);
+			return false;
+		}
+
+		const char* value = argv[++i];
+
+		if (strcmp(option, "--heightmap") == 0)
+			options.heightMapFile = value;
+		else if (strcmp(option, "--generate") == 0)
+			options.generateSize = (max(atoi(value), 4) + 3) & ~3;
+		else if (strcmp(option, "--grid-size") == 0)
+			options.gridSize = (float)atof(value);
+		else if (strcmp(option, "--height-range") == 0)
+			options.heightRange = (float)atof(value);
+		else if (strcmp(option, "--tiles") == 0)
+			options.tiles = max(atoi(value), 1);
+		else if (strcmp(option, "--spheres") == 0)
+			options.spheres = max(atoi(value), 0);
+		else if (strcmp(option, "--radius") == 0)
+			options.radius = (float)atof(value);
+		else if (strcmp(option, "--warmup") == 0)
+			options.warmupSteps = max(atoi(value), 0);
+		else if (strcmp(option, "--steps") == 0)
+			options.steps = max(atoi(value), 1);
+		else if (strcmp(option, "--dt") == 0)
+			options.stepTime = (float)atof(value);
+		else if (strcmp(option, "--workers") == 0)
+			options.workers = max(atoi(value), 0);
+		else if (strcmp(option, "--worlds") == 0)
+			options.worlds = max(atoi(value), 1);
+		else if (strcmp(option, "--threads") == 0)
+			options.threads = max(atoi(value), 0);
+		else if (strcmp(option, "--iterations") == 0)
+			options.iterations = max(atoi(value), 0);
+		else if (strcmp(option, "--seed") == 0)
+			options.seed = (unsigned int)strtoul(value, NULL, 10);
+		else if (strcmp(option, "--raycast") == 0)
+			options.raycasts = max(atoi(value), 0);
+		else if (strcmp(option, "--brush") == 0)
+			options.brushStamps = max(atoi(value), 0);
+		else if (strcmp(option, "--churn") == 0)
+			options.churn = max(atoi(value), 0);
+		else if (strcmp(option, "--solver-scaling") == 0)
+			options.solverScaling = max(atoi(value), 0);
+		else if (strcmp(option, "--queries") == 0)
+			options.queries = max(atoi(value), 0);
+		else if (strcmp(option, "--query-threads") == 0)
+			options.queryThreads = max(atoi(value), 0);
+		else if (strcmp(option, "--hash-trace") == 0)
+		{
+			options.deterministic = true;
+			options.hashTraceFile = value;
+		}
+		else if (strcmp(option, "--hash-check") == 0)
+		{
+			options.deterministic = true;
+			options.hashCheckFile = value;
+		}
+		else if (strcmp(option, "--snapshot-file") == 0)
+		{
+			options.snapshot = true;
+			options.snapshotFile = value;
+		}
+		else
+		{
+			fprintf(stderr, "Unknown option %s\n", option);
+			return false;
+		}
+	}
+
+	return options.radius > 0.0f && options.stepTime > 0.0f && options.gridSize > 0.0f;
+}
+
+//Drops the spheres in layers over the terrain, each layer a grid of columns one and a half
+//diameters apart, starting a diameter above the ground under each column
+//Params : World to spawn into (its pool must hold enough bodies), heightmap tiles, options, seed for the jitter
+static void SpawnSpheres(PhysicsWorld& world, const std::vector<HeightMap*>& tiles, const RunnerOptions& options, unsigned int seed)
+{
+	float minX = FLT_MAX, minZ = FLT_MAX, maxX = -FLT_MAX, maxZ = -FLT_MAX;
+
+	for (HeightMap* tile : tiles)
+	{
+		float tileMinX, tileMinZ, tileMaxX, tileMaxZ;
+		tile->GetWorldBoundsXZ(tileMinX, tileMinZ, tileMaxX, tileMaxZ);
+
+		minX = min(minX, tileMinX);
+		minZ = min(minZ, tileMinZ);
+		maxX = max(maxX, tileMaxX);
+		maxZ = max(maxZ, tileMaxZ);
+	}
+
+	float spacing = options.radius * 3.0f;
+	int columnsX = max((int)((maxX - minX) / spacing), 1);
+	int columnsZ = max((int)((maxZ - minZ) / spacing), 1);
+
+	//A pile packs the columns close together in a square about 20 layers deep, centred on the terrain
+	float columnSpacing = spacing;
+
+	if (options.pile)
+	{
+		columnSpacing = options.radius * 2.2f;
+
+		int side = max((int)ceilf(sqrtf(options.spheres / 20.0f)), 1);
+		columnsX = min(side, max((int)((maxX - minX) / columnSpacing), 1));
+		columnsZ = min(side, max((int)((maxZ - minZ) / columnSpacing), 1));
+
+		float centreX = (minX + maxX) * 0.5f;
+		float centreZ = (minZ + maxZ) * 0.5f;
+		minX = centreX - (columnsX * columnSpacing * 0.5f);
+		minZ = centreZ - (columnsZ * columnSpacing * 0.5f);
+	}
+
+	int columnCount = columnsX * columnsZ;
+
+	//Ground height under every column, the top of the tallest tile there
+	std::vector<float> columnX(columnCount), columnZ(columnCount), columnY(columnCount), tileY(columnCount);
+
+	for (int c = 0; c < columnCount; ++c)
+	{
+		columnX[c] = minX + ((c % columnsX) + 0.5f) * columnSpacing;
+		columnZ[c] = minZ + ((c / columnsX) + 0.5f) * columnSpacing;
+		columnY[c] = -FLT_MAX;
+	}
+
+	for (HeightMap* tile : tiles)
+	{
+		tile->SampleHeights(columnX.data(), columnZ.data(), tileY.data(), nullptr, columnCount);
+
+		for (int c = 0; c < columnCount; ++c)
+		{
+			columnY[c] = max(columnY[c], tileY[c]);
+		}
+	}
+
+	//A little jitter so the layers don't stack perfectly and balance on each other
+	Random random(seed);
+	float jitter = options.radius * 0.25f;
+
+	for (int i = 0; i < options.spheres; ++i)
+	{
+		int column = i % columnCount;
+		int layer = i / columnCount;
+
+		float x = columnX[column] + random.NextRange(-jitter, jitter);
+		float y = columnY[column] + (options.radius * 2.0f) + (layer * spacing);
+		float z = columnZ[column] + random.NextRange(-jitter, jitter);
+
+		world.SpawnBody(XMVectorSet(x, y, z, 0.0f), XMVectorZero());
+	}
+}
+
+//A world and the heightmaps and bodies it was given, which belong to it alone
+struct ScenarioWorld
+{
+	PhysicsWorld* world = nullptr;
+	std::vector<HeightMap*> tiles;
+	std::vector<DynamicBody*> bodies;
+};
+
+//Builds a world with the scenario's terrain and spheres
+//Params : World to fill in, options, seed for the sphere jitter, job system workers of the world
+static void BuildScenario(ScenarioWorld& scenario, const RunnerOptions& options, unsigned int seed, int workers)
+{
+	scenario.world = new PhysicsWorld();
+	scenario.world->SetWorkerCount(workers);
+	scenario.world->SetSleepingEnabled(options.sleeping);
+	scenario.world->SetDeterministic(options.deterministic);
+
+	//Only the final state is looked at, so skip recording contact events
+	scenario.world->SetContactEventsEnabled(false);
+
+	if (options.iterations > 0)
+	{
+		scenario.world->GetContactSolver().SetIterations(options.iterations);
+	}
+
+	//Square of tiles centred on the origin, like the application's tiled world
+	std::vector<char> fileName(options.heightMapFile.begin(), options.heightMapFile.end());
+	fileName.push_back('\0');
+
+	for (int t = 0; t < options.tiles * options.tiles; ++t)
+	{
+		HeightMap* tile = new HeightMap(fileName.data(), options.gridSize, options.heightRange);
+
+		if (options.distanceField)
+		{
+			tile->SetContactMode(HeightMap::CONTACT_DISTANCE_FIELD, 2, &scenario.world->GetJobSystem());
+		}
+
+		float minX, minZ, maxX, maxZ;
+		tile->GetWorldBoundsXZ(minX, minZ, maxX, maxZ);
+
+		float sizeX = maxX - minX;
+		float sizeZ = maxZ - minZ;
+		float x = ((t % options.tiles) - ((options.tiles - 1) * 0.5f)) * sizeX;
+		float z = ((t / options.tiles) - ((options.tiles - 1) * 0.5f)) * sizeZ;
+
+		scenario.world->AddHeightMap(tile, XMFLOAT3(x, 0.0f, z));
+		scenario.tiles.push_back(tile);
+	}
+
+	for (int i = 0; i < options.spheres; ++i)
+	{
+		DynamicBody* body = new DynamicBody();
+		body->SetRadius(options.radius);
+
+		scenario.world->AddToPool(body);
+		scenario.bodies.push_back(body);
+	}
+
+	SpawnSpheres(*scenario.world, scenario.tiles, options, seed);
+}
+
+//Deletes the world first, then the heightmaps and bodies it was using
+static void DestroyScenario(ScenarioWorld& scenario)
+{
+	delete scenario.world;
+	scenario.world = nullptr;
+
+	for (DynamicBody* body : scenario.bodies)
+	{
+		delete body;
+	}
+
+	for (HeightMap* tile : scenario.tiles)
+	{
+		delete tile;
+	}
+
+	scenario.bodies.clear();
+	scenario.tiles.clear();
+}
+
+//Running totals and worst cases of the step timings
+struct PhaseStats
+{
+	const char* name;
+	double StepTimings::* field;
+	double total;
+	double worst;
+};
+
+//Milliseconds since a point in time
+static double MillisecondsSince(std::chrono::high_resolution_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+//Saves and restores a snapshot of the world, raw and compressed, and prints how long each took and
+//how big the blobs are. The restored world is stepped on and its hash checked against the original's
+//Params : World, options
+static void RunSnapshot(PhysicsWorld& world, const RunnerOptions& options)
+{
+	//The first save sizes the blob and scratch space, time the ones after as a long running world would
+	const int repeats = 3;
+	const int checkSteps = 10;
+
+	std::vector<unsigned char> blobs[2];
+	double saveTimes[2] = { DBL_MAX, DBL_MAX };
+	double restoreTimes[2] = { DBL_MAX, DBL_MAX };
+
+	for (int c = 0; c < 2; ++c)
+	{
+		for (int r = 0; r <= repeats; ++r)
+		{
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+			world.SaveSnapshot(blobs[c], c == 1);
+
+			if (r > 0)
+			{
+				saveTimes[c] = min(saveTimes[c], MillisecondsSince(start));
+			}
+		}
+	}
+
+	//Where the world should get to from the snapshot
+	for (int s = 0; s < checkSteps; ++s)
+	{
+		world.Step(options.stepTime);
+	}
+
+	unsigned long long expected = world.GetBodyStore().ComputeStateHash();
+	bool matches = true;
+
+	for (int c = 0; c < 2; ++c)
+	{
+		for (int r = 0; r < repeats; ++r)
+		{
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+			if (!world.RestoreSnapshot(blobs[c].data(), blobs[c].size()))
+			{
+				fprintf(stderr, "Restoring the %s snapshot failed\n", c == 1 ? "compressed" : "raw");
+				return;
+			}
+
+			restoreTimes[c] = min(restoreTimes[c], MillisecondsSince(start));
+		}
+
+		for (int s = 0; s < checkSteps; ++s)
+		{
+			world.Step(options.stepTime);
+		}
+
+		matches = matches && world.GetBodyStore().ComputeStateHash() == expected;
+	}
+
+	printf("\nSnapshot of %d bodies (%d registered):\n", world.GetBodyStore().GetCount(), world.GetRegisteredBodyCount());
+
+	for (int c = 0; c < 2; ++c)
+	{
+		double megabytes = blobs[c].size() / (1024.0 * 1024.0);
+
+		printf("  %-10s %10.2f MB  save %8.3f ms (%7.1f MB/s)  restore %8.3f ms (%7.1f MB/s)\n", c == 1 ? "compressed" : "raw",
+			megabytes, saveTimes[c], megabytes * 1000.0 / saveTimes[c], restoreTimes[c], megabytes * 1000.0 / restoreTimes[c]);
+	}
+
+	printf("  ratio %.2f, restored worlds %s the original after %d steps\n", (double)blobs[0].size() / blobs[1].size(),
+		matches ? "match" : "DON'T match", checkSteps);
+
+	if (options.snapshotFile.empty())
+	{
+		return;
+	}
+
+	//One write and one read of the compressed blob, then restore what was read
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	if (!WriteSnapshotFile(options.snapshotFile.c_str(), blobs[1]))
+	{
+		fprintf(stderr, "Can't write snapshot file %s\n", options.snapshotFile.c_str());
+		return;
+	}
+
+	double writeTime = MillisecondsSince(start);
+
+	std::vector<unsigned char> read;
+	start = std::chrono::high_resolution_clock::now();
+
+	if (!ReadSnapshotFile(options.snapshotFile.c_str(), read))
+	{
+		fprintf(stderr, "Can't read snapshot file %s\n", options.snapshotFile.c_str());
+		return;
+	}
+
+	double readTime = MillisecondsSince(start);
+
+	start = std::chrono::high_resolution_clock::now();
+	bool restored = world.RestoreSnapshot(read.data(), read.size());
+	double restoreTime = MillisecondsSince(start);
+
+	printf("  file %s: write %.3f ms, read %.3f ms, restore %.3f ms%s\n", options.snapshotFile.c_str(),
+		writeTime, readTime, restoreTime, restored ? "" : " (FAILED)");
+}
+
+//Casts rays down into the world from above the terrain at random angles, one at a time and then split
+//across the job system with RaycastBatch, and prints how many of each kind went per second
+//Params : World, its heightmap tiles, options
+static void RunRaycast(PhysicsWorld& world, const std::vector<HeightMap*>& tiles, const RunnerOptions& options)
+{
+	float minX = FLT_MAX, minZ = FLT_MAX, maxX = -FLT_MAX, maxZ = -FLT_MAX;
+
+	for (HeightMap* tile : tiles)
+	{
+		float tileMinX, tileMinZ, tileMaxX, tileMaxZ;
+		tile->GetWorldBoundsXZ(tileMinX, tileMinZ, tileMaxX, tileMaxZ);
+
+		minX = min(minX, tileMinX);
+		minZ = min(minZ, tileMinZ);
+		maxX = max(maxX, tileMaxX);
+		maxZ = max(maxZ, tileMaxZ);
+	}
+
+	const float maxDistance = 1000.0f;
+
+	Random random(options.seed);
+	std::vector<XMFLOAT3> origins(options.raycasts), directions(options.raycasts);
+
+	for (int r = 0; r < options.raycasts; ++r)
+	{
+		origins[r] = XMFLOAT3(random.NextRange(minX, maxX), random.NextRange(20.0f, 100.0f), random.NextRange(minZ, maxZ));
+		directions[r] = XMFLOAT3(random.NextRange(-1.0f, 1.0f), -1.0f, random.NextRange(-1.0f, 1.0f));
+	}
+
+	std::vector<RaycastHit> hits(options.raycasts);
+	int singleHits = 0, bodyHits = 0;
+
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	for (int r = 0; r < options.raycasts; ++r)
+	{
+		singleHits += world.Raycast(XMLoadFloat3(&origins[r]), XMLoadFloat3(&directions[r]), maxDistance, hits[r]) ? 1 : 0;
+	}
+
+	double singleTime = MillisecondsSince(start);
+
+	for (const RaycastHit& hit : hits)
+	{
+		bodyHits += hit.body != INVALID_BODY_HANDLE ? 1 : 0;
+	}
+
+	start = std::chrono::high_resolution_clock::now();
+	int batchHits = world.RaycastBatch(origins.data(), directions.data(), options.raycasts, maxDistance, hits.data());
+	double batchTime = MillisecondsSince(start);
+
+	printf("\nRaycasts into %d bodies: %d rays, %d hits (%d bodies, %d terrain)%s\n", world.GetBodyStore().GetCount(), options.raycasts,
+		singleHits, bodyHits, singleHits - bodyHits, batchHits == singleHits ? "" : ", BATCH HITS DIFFER");
+	printf("  %-8s %10.3f ms %10.3f Mrays/s\n", "single", singleTime, options.raycasts / (singleTime * 1000.0));
+	printf("  %-8s %10.3f ms %10.3f Mrays/s (%d workers)\n", "batched", batchTime, options.raycasts / (batchTime * 1000.0),
+		world.GetWorkerCount());
+}
+
+//Query kinds timed by RunQueries
+enum QueryKind
+{
+	QUERY_SPHERE,
+	QUERY_AABB,
+	QUERY_NEAREST,
+	QUERY_KIND_COUNT
+};
+
+//Runs every query of one kind, starting part way through so threads aren't all reading the same bodies at once
+//Params : World, kind, query points, first query, results buffer (and its size), distances for KNearest
+//Returns : Bodies found by all the queries
+static long long RunQueryKind(const PhysicsWorld& world, QueryKind kind, const std::vector<XMFLOAT3>& points, int first,
+	BodyHandle* results, int maxResults, float* distances)
+{
+	const float radius = 3.0f;
+	const int k = 8;
+	int count = (int)points.size();
+	long long found = 0;
+
+	for (int n = 0; n < count; ++n)
+	{
+		const XMFLOAT3& point = points[(first + n) % count];
+
+		switch (kind)
+		{
+		case QUERY_SPHERE:
+			found += world.OverlapSphere(XMLoadFloat3(&point), radius, results, maxResults);
+			break;
+		case QUERY_AABB:
+			found += world.OverlapAABB(XMFLOAT3(point.x - radius, point.y - radius, point.z - radius),
+				XMFLOAT3(point.x + radius, point.y + radius, point.z + radius), results, maxResults);
+			break;
+		default:
+			found += world.KNearest(XMLoadFloat3(&point), k, results, distances);
+			break;
+		}
+	}
+
+	return found;
+}
+
+//Runs queries of each kind around random points over the terrain, from one thread and then more at once, each
+//thread running all of them, and prints the queries per second and how well concurrent readers scale
+//Params : World, its heightmap tiles, options
+static void RunQueries(PhysicsWorld& world, const std::vector<HeightMap*>& tiles, const RunnerOptions& options)
+{
+	float minX = FLT_MAX, minZ = FLT_MAX, maxX = -FLT_MAX, maxZ = -FLT_MAX;
+
+	for (HeightMap* tile : tiles)
+	{
+		float tileMinX, tileMinZ, tileMaxX, tileMaxZ;
+		tile->GetWorldBoundsXZ(tileMinX, tileMinZ, tileMaxX, tileMaxZ);
+
+		minX = min(minX, tileMinX);
+		minZ = min(minZ, tileMinZ);
+		maxX = max(maxX, tileMaxX);
+		maxZ = max(maxZ, tileMaxZ);
+	}
+
+	Random random(options.seed);
+	std::vector<XMFLOAT3> points(options.queries);
+
+	for (int q = 0; q < options.queries; ++q)
+	{
+		points[q] = XMFLOAT3(random.NextRange(minX, maxX), random.NextRange(0.0f, 20.0f), random.NextRange(minZ, maxZ));
+	}
+
+	int maxThreads = options.queryThreads > 0 ? options.queryThreads : max((int)std::thread::hardware_concurrency(), 1);
+	const char* kindNames[QUERY_KIND_COUNT] = { "sphere", "AABB", "k nearest" };
+	const int maxResults = 256;
+
+	printf("\nScene queries into %d bodies: %d of each kind per thread, radius 3, k 8\n", world.GetBodyStore().GetCount(), options.queries);
+	printf("  %-10s %8s %12s %10s %8s\n", "kind", "threads", "ms", "Mqueries/s", "speedup");
+
+	for (int kind = 0; kind < QUERY_KIND_COUNT; ++kind)
+	{
+		double singleRate = 0.0;
+		long long singleFound = 0;
+
+		//Doubling from 1, then the most threads if that isn't a power of two
+		for (int threads = 1; ; threads = min(threads * 2, maxThreads))
+		{
+			std::vector<long long> found(threads, 0);
+			std::vector<std::thread> readers;
+
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+			for (int t = 0; t < threads; ++t)
+			{
+				readers.push_back(std::thread([&world, &points, &found, kind, t, threads, maxResults]()
+				{
+					std::vector<BodyHandle> results(maxResults);
+					std::vector<float> distances(maxResults);
+
+					found[t] = RunQueryKind(world, (QueryKind)kind, points, (t * (int)points.size()) / threads, results.data(), maxResults, distances.data());
+				}));
+			}
+
+			for (std::thread& reader : readers)
+			{
+				reader.join();
+			}
+
+			double time = MillisecondsSince(start);
+			double rate = ((double)options.queries * threads) / (time * 1000.0);
+
+			if (threads == 1)
+			{
+				singleRate = rate;
+				singleFound = found[0];
+			}
+
+			//Every thread runs the same queries, so each should find as many bodies as a lone thread
+			bool same = true;
+
+			for (int t = 0; t < threads; ++t)
+			{
+				same = same && found[t] == singleFound;
+			}
+
+			printf("  %-10s %8d %12.3f %10.3f %7.2fx%s\n", kindNames[kind], threads, time, rate, rate / singleRate, same ? "" : " RESULTS DIFFER");
+
+			if (threads == maxThreads)
+			{
+				break;
+			}
+		}
+	}
+}
+
+//Stamps brushes at random points on the first tile, raising and lowering it in turn so it doesn't drift, at
+//radii doubling from one grid cell to 32. Prints how many stamps of each size went per second against the
+//10k a second interactive digging needs. The world wakes the bodies over the edits at its next step
+//Params : World, its heightmap tiles, options
+static void RunBrush(PhysicsWorld& world, const std::vector<HeightMap*>& tiles, const RunnerOptions& options)
+{
+	const double targetRate = 10000.0;
+
+	HeightMap* tile = tiles[0];
+
+	float minX, minZ, maxX, maxZ;
+	tile->GetWorldBoundsXZ(minX, minZ, maxX, maxZ);
+
+	Random random(options.seed);
+	std::vector<XMFLOAT3> centres(options.brushStamps);
+
+	printf("\nBrush stamps into a %g x %g tile: %d stamps at each radius\n", maxX - minX, maxZ - minZ, options.brushStamps);
+	printf("  %8s %8s %12s %12s\n", "radius", "cells", "ms", "stamps/s");
+
+	for (int cells = 1; cells <= 32; cells *= 2)
+	{
+		float radius = cells * options.gridSize;
+
+		for (int b = 0; b < options.brushStamps; ++b)
+		{
+			centres[b] = XMFLOAT3(random.NextRange(minX, maxX), 0.0f, random.NextRange(minZ, maxZ));
+		}
+
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+		for (int b = 0; b < options.brushStamps; ++b)
+		{
+			tile->ApplyBrush(XMLoadFloat3(&centres[b]), radius, (b & 1) != 0 ? -0.5f : 0.5f);
+		}
+
+		double time = MillisecondsSince(start);
+		double rate = options.brushStamps / (time / 1000.0);
+
+		printf("  %8g %8d %12.3f %12.0f%s\n", radius, cells, time, rate, rate >= targetRate ? "" : " (under 10k/s)");
+	}
+
+	//Wakes the bodies over everything stamped, so the edits cost the world what they would in a game
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	world.Step(options.stepTime);
+
+	printf("  next step, waking the bodies over the edits: %.3f ms\n", MillisecondsSince(start));
+}
+
+//Returns : Bytes of memory the process has resident, 0 where that can't be read
+static size_t GetResidentBytes()
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+	{
+		return counters.WorkingSetSize;
+	}
+#elif defined(__linux__)
+	FILE* file = fopen("/proc/self/statm", "r");
+
+	if (file != NULL)
+	{
+		unsigned long pages = 0, resident = 0;
+		int read = fscanf(file, "%lu %lu", &pages, &resident);
+		fclose(file);
+
+		if (read == 2)
+		{
+			return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+		}
+	}
+#endif
+
+	return 0;
+}
+
+//Removes bodies picked at random from the world and adds them straight back, in rounds with a step between
+//each. Prints how many adds and removes went per second against the 100k a second a spawning game needs,
+//and the memory the process holds after each round, which should stay flat once the first round has grown
+//the world's buffers. Handles of the removed bodies are checked to stay stale once their slots are reused
+//Params : World, options
+//Returns : False if a stale handle still found a body
+static bool RunChurn(PhysicsWorld& world, const RunnerOptions& options)
+{
+	const double targetRate = 100000.0;
+	const int rounds = 10;
+
+	BodyStore& store = world.GetBodyStore();
+	int churn = min(options.churn, store.GetCount());
+
+	if (churn == 0)
+	{
+		printf("\nChurn: no bodies in the world to remove\n");
+		return true;
+	}
+
+	Random random(options.seed);
+	std::vector<BodyHandle> removed(churn);
+	std::vector<DynamicBody*> bodies(churn);
+	int stale = 0;
+	size_t firstMemory = 0;
+
+	printf("\nChurn of %d bodies: %d removed and added back in each of %d rounds\n", store.GetCount(), churn, rounds);
+	printf("  %8s %12s %12s %12s\n", "round", "ms", "ops/s", "memory KB");
+
+	for (int r = 0; r < rounds; ++r)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+		//A removed body leaves the store, so each pick is a different body
+		for (int b = 0; b < churn; ++b)
+		{
+			removed[b] = store.GetHandle(random.NextInt(store.GetCount()));
+			bodies[b] = world.GetBody(removed[b]);
+			world.RemoveBody(removed[b]);
+		}
+
+		for (int b = 0; b < churn; ++b)
+		{
+			world.AddBody(bodies[b]);
+		}
+
+		double time = MillisecondsSince(start);
+		double rate = (2.0 * churn) / (time / 1000.0);
+
+		for (int b = 0; b < churn; ++b)
+		{
+			stale += world.IsBodyValid(removed[b]) || world.GetBody(removed[b]) != nullptr ? 1 : 0;
+		}
+
+		world.Step(options.stepTime);
+
+		size_t memory = GetResidentBytes();
+		firstMemory = r == 0 ? memory : firstMemory;
+
+		printf("  %8d %12.3f %12.0f %12zu%s\n", r, time, rate, memory / 1024, rate >= targetRate ? "" : " (under 100k/s)");
+	}
+
+	if (firstMemory > 0)
+	{
+		printf("  memory after the first round %+lld KB\n", ((long long)GetResidentBytes() - (long long)firstMemory) / 1024);
+	}
+
+	if (stale > 0)
+	{
+		printf("  %d STALE HANDLES STILL FOUND A BODY\n", stale);
+	}
+
+	return stale == 0;
+}
+
+//Writes the state hash of every step to a file, one "step hash" line each after a comment with the scenario
+//Params : File name, hashes in step order (warmup included), options
+//Returns : False if the file can't be written
+static bool WriteHashTrace(const std::string& fileName, const std::vector<uint64_t>& hashes, const RunnerOptions& options)
+{
+	FILE* file = fopen(fileName.c_str(), "w");
+
+	if (file == NULL)
+	{
+		fprintf(stderr, "Can't write hash trace %s\n", fileName.c_str());
+		return false;
+	}
+
+	fprintf(file, "# %d spheres (radius %g) on %d x %d tiles of %s, seed %u, dt %g, %d steps\n", options.spheres, options.radius,
+		options.tiles, options.tiles, options.heightMapFile.c_str(), options.seed, options.stepTime, (int)hashes.size());
+
+	for (size_t s = 0; s < hashes.size(); ++s)
+	{
+		fprintf(file, "%d %016llx\n", (int)s + 1, (unsigned long long)hashes[s]);
+	}
+
+	bool written = ferror(file) == 0;
+	fclose(file);
+
+	printf("Hash trace of %d steps written to %s\n", (int)hashes.size(), fileName.c_str());
+
+	return written;
+}
+
+//Checks a run's state hashes step by step against a file written by WriteHashTrace, and prints the first step they differ at
+//Params : File name, hashes in step order (warmup included)
+//Returns : True if the file has the same hash for every step, and no more steps
+static bool CheckHashTrace(const std::string& fileName, const std::vector<uint64_t>& hashes)
+{
+	FILE* file = fopen(fileName.c_str(), "r");
+
+	if (file == NULL)
+	{
+		fprintf(stderr, "Can't read hash trace %s\n", fileName.c_str());
+		return false;
+	}
+
+	std::vector<uint64_t> expected;
+	char line[512];
+
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		int step;
+		unsigned long long hash;
+
+		if (line[0] != '#' && sscanf(line, "%d %llx", &step, &hash) == 2)
+		{
+			expected.push_back(hash);
+		}
+	}
+
+	fclose(file);
+
+	for (size_t s = 0; s < hashes.size() && s < expected.size(); ++s)
+	{
+		if (hashes[s] != expected[s])
+		{
+			printf("Hash trace DIFFERS from %s at step %d: %016llx, expected %016llx\n", fileName.c_str(), (int)s + 1,
+				(unsigned long long)hashes[s], (unsigned long long)expected[s]);
+			return false;
+		}
+	}
+
+	if (hashes.size() != expected.size())
+	{
+		printf("Hash trace DIFFERS from %s: %d steps run, %d in the file\n", fileName.c_str(), (int)hashes.size(), (int)expected.size());
+		return false;
+	}
+
+	printf("Hash trace matches %s for all %d steps\n", fileName.c_str(), (int)hashes.size());
+
+	return true;
+}
+
+//Steps one world as fast as it will go and prints where the time went
+//Params : Options
+//Returns : False if the hash trace couldn't be written or didn't match the one checked against
+static bool RunSingle(const RunnerOptions& options)
+{
+	int workers = options.workers > 0 ? options.workers : max((int)std::thread::hardware_concurrency(), 1);
+
+	ScenarioWorld scenario;
+	BuildScenario(scenario, options, options.seed, workers);
+
+	PhysicsWorld& world = *scenario.world;
+
+	printf("Headless run: %d spheres (radius %g) on %d x %d tiles of %s, %d workers, dt %g, sleeping %s, %s contacts\n",
+		options.spheres, options.radius, options.tiles, options.tiles, options.heightMapFile.c_str(), workers,
+		options.stepTime, options.sleeping ? "on" : "off", options.distanceField ? "distance field" : "triangle");
+
+	//Hash of every step, warmup included, kept in memory so the file isn't written while timing
+	bool tracing = !options.hashTraceFile.empty() || !options.hashCheckFile.empty();
+	std::vector<uint64_t> stepHashes;
+	stepHashes.reserve(tracing ? options.warmupSteps + options.steps : 0);
+
+	for (int s = 0; s < options.warmupSteps; ++s)
+	{
+		world.Step(options.stepTime);
+
+		if (tracing)
+		{
+			stepHashes.push_back(world.GetStateHash());
+		}
+	}
+
+	PhaseStats phases[] = {
+		{ "collision", &StepTimings::collision, 0.0, 0.0 },
+		{ "  terrain", &StepTimings::staticCollision, 0.0, 0.0 },
+		{ "  bodies", &StepTimings::dynamicCollision, 0.0, 0.0 },
+		{ "  islands", &StepTimings::buildIslands, 0.0, 0.0 },
+		{ "integrate velocities", &StepTimings::integrateVelocities, 0.0, 0.0 },
+		{ "solve", &StepTimings::solve, 0.0, 0.0 },
+		{ "contact events", &StepTimings::contactEvents, 0.0, 0.0 },
+		{ "integrate positions", &StepTimings::integratePositions, 0.0, 0.0 },
+		{ "sleeping", &StepTimings::sleeping, 0.0, 0.0 },
+		{ "despawn", &StepTimings::despawn, 0.0, 0.0 },
+		{ "broadphase sort", &StepTimings::broadphase, 0.0, 0.0 },
+		{ "total", &StepTimings::total, 0.0, 0.0 },
+	};
+
+	const int phaseCount = sizeof(phases) / sizeof(phases[0]);
+	long long contacts = 0;
+
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	for (int s = 0; s < options.steps; ++s)
+	{
+		world.Step(options.stepTime);
+
+		if (tracing)
+		{
+			stepHashes.push_back(world.GetStateHash());
+		}
+
+		const StepTimings& timings = world.GetStepTimings();
+
+		for (int p = 0; p < phaseCount; ++p)
+		{
+			double milliseconds = timings.*phases[p].field;
+
+			phases[p].total += milliseconds;
+			phases[p].worst = max(phases[p].worst, milliseconds);
+		}
+
+		contacts += world.GetContactSolver().GetContactCount();
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	printf("\n%d steps in %.3f s: %.1f steps/s, %.1fx real time, %.3f ms/step\n",
+		options.steps, seconds, options.steps / seconds, (options.steps * options.stepTime) / seconds, (seconds * 1000.0) / options.steps);
+
+	printf("\n%-22s %10s %10s %7s\n", "phase", "avg ms", "max ms", "share");
+
+	double totalTime = phases[phaseCount - 1].total;
+
+	for (int p = 0; p < phaseCount; ++p)
+	{
+		printf("%-22s %10.4f %10.4f %6.1f%%\n", phases[p].name, phases[p].total / options.steps, phases[p].worst,
+			totalTime > 0.0 ? (100.0 * phases[p].total) / totalTime : 0.0);
+	}
+
+	int awake = 0;
+	for (int i = 0; i < world.GetBodyStore().GetCount(); ++i)
+	{
+		awake += world.GetBodyStore().IsAwake(i) ? 1 : 0;
+	}
+
+	printf("\n%.1f contacts/step, %d bodies in the world (%d awake), %d despawned, %d islands (%d asleep)\n",
+		(double)contacts / options.steps, world.GetBodyStore().GetCount(), awake, world.GetPooledBodyCount(),
+		world.GetIslandCount(), world.GetSleepingIslandCount());
+
+	if (options.deterministic)
+	{
+		printf("State hash %016llx\n", (unsigned long long)world.GetStateHash());
+	}
+
+	bool passed = true;
+
+	if (!options.hashTraceFile.empty())
+	{
+		passed = WriteHashTrace(options.hashTraceFile, stepHashes, options) && passed;
+	}
+
+	if (!options.hashCheckFile.empty())
+	{
+		passed = CheckHashTrace(options.hashCheckFile, stepHashes) && passed;
+	}
+
+	if (options.raycasts > 0)
+	{
+		RunRaycast(world, scenario.tiles, options);
+	}
+
+	if (options.queries > 0)
+	{
+		RunQueries(world, scenario.tiles, options);
+	}
+
+	if (options.brushStamps > 0)
+	{
+		RunBrush(world, scenario.tiles, options);
+	}
+
+	if (options.churn > 0)
+	{
+		passed = RunChurn(world, options) && passed;
+	}
+
+	if (options.snapshot)
+	{
+		RunSnapshot(world, options);
+	}
+
+	DestroyScenario(scenario);
+
+	return passed;
+}
+
+//Warms one world up, saves it, then steps it from that same state with 1, 2, 4... workers, and prints how long
+//the solve phase and the whole step took at each count and the speedup over one worker
+//Params : Options
+static void RunSolverScaling(const RunnerOptions& options)
+{
+	ScenarioWorld scenario;
+	BuildScenario(scenario, options, options.seed, 1);
+
+	PhysicsWorld& world = *scenario.world;
+
+	printf("Solver scaling: %d spheres (radius %g)%s on %d x %d tiles of %s, %d warmup steps then %d timed, sleeping %s\n",
+		options.spheres, options.radius, options.pile ? " in a pile" : "", options.tiles, options.tiles, options.heightMapFile.c_str(),
+		options.warmupSteps, options.steps, options.sleeping ? "on" : "off");
+
+	for (int s = 0; s < options.warmupSteps; ++s)
+	{
+		world.Step(options.stepTime);
+	}
+
+	std::vector<unsigned char> start;
+	world.SaveSnapshot(start);
+
+	printf("\n%8s %10s %8s %10s %8s %12s  %-16s\n", "workers", "solve ms", "speedup", "step ms", "speedup", "contacts", "state hash");
+
+	double singleSolve = 0.0, singleTotal = 0.0;
+
+	//Doubling from 1, then the most workers if that isn't a power of two
+	for (int workers = 1; ; workers = min(workers * 2, options.solverScaling))
+	{
+		world.RestoreSnapshot(start.data(), start.size());
+		world.SetWorkerCount(workers);
+
+		double solve = 0.0, total = 0.0;
+		long long contacts = 0;
+
+		for (int s = 0; s < options.steps; ++s)
+		{
+			world.Step(options.stepTime);
+
+			solve += world.GetStepTimings().solve;
+			total += world.GetStepTimings().total;
+			contacts += world.GetContactSolver().GetContactCount();
+		}
+
+		solve /= options.steps;
+		total /= options.steps;
+
+		if (workers == 1)
+		{
+			singleSolve = solve;
+			singleTotal = total;
+		}
+
+		//The hash only has to match between runs with the same number of workers
+		printf("%8d %10.3f %7.2fx %10.3f %7.2fx %12.1f  %016llx\n", workers, solve, singleSolve / solve, total, singleTotal / total,
+			(double)contacts / options.steps, (unsigned long long)world.GetBodyStore().ComputeStateHash());
+
+		if (workers >= options.solverScaling)
+		{
+			break;
+		}
+	}
+
+	DestroyScenario(scenario);
+}
+
+//Worlds of a batch and what the pool's tasks do to them
+struct BatchContext
+{
+	const RunnerOptions* options;
+	std::vector<ScenarioWorld>* worlds;
+	int steps;
+};
+
+//Job entry points, build, step or destroy a run of the batch's worlds. Each world is only
+//ever touched by the thread running its task, and its own job system runs inline there
+static void BuildWorldsTask(void* context, int begin, int end, int worker)
+{
+	BatchContext* batch = (BatchContext*)context;
+	int workers = max(batch->options->workers, 1);
+
+	for (int w = begin; w < end; ++w)
+	{
+		BuildScenario((*batch->worlds)[w], *batch->options, batch->options->seed + w, workers);
+	}
+}
+
+static void StepWorldsTask(void* context, int begin, int end, int worker)
+{
+	BatchContext* batch = (BatchContext*)context;
+
+	for (int w = begin; w < end; ++w)
+	{
+		PhysicsWorld* world = (*batch->worlds)[w].world;
+
+		for (int s = 0; s < batch->steps; ++s)
+		{
+			world->Step(batch->options->stepTime);
+		}
+	}
+}
+
+static void DestroyWorldsTask(void* context, int begin, int end, int worker)
+{
+	BatchContext* batch = (BatchContext*)context;
+
+	for (int w = begin; w < end; ++w)
+	{
+		DestroyScenario((*batch->worlds)[w]);
+	}
+}
+
+//Steps many independent worlds at once, one world per task on a shared job system
+//Params : Options
+static void RunBatch(const RunnerOptions& options)
+{
+	int threads = options.threads > 0 ? options.threads : max((int)std::thread::hardware_concurrency(), 1);
+
+	JobSystem pool;
+	pool.SetWorkerCount(threads);
+
+	std::vector<ScenarioWorld> worlds(options.worlds);
+
+	BatchContext batch;
+	batch.options = &options;
+	batch.worlds = &worlds;
+	batch.steps = options.warmupSteps;
+
+	printf("Batch run: %d worlds of %d spheres (radius %g) on %d x %d tiles of %s, %d threads, %d workers per world, dt %g\n",
+		options.worlds, options.spheres, options.radius, options.tiles, options.tiles, options.heightMapFile.c_str(),
+		threads, max(options.workers, 1), options.stepTime);
+
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	pool.ParallelFor("BuildWorlds", options.worlds, 1, BuildWorldsTask, &batch);
+
+	double buildSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	pool.ParallelFor("WarmUpWorlds", options.worlds, 1, StepWorldsTask, &batch);
+
+	batch.steps = options.steps;
+	start = std::chrono::high_resolution_clock::now();
+
+	pool.ParallelFor("StepWorlds", options.worlds, 1, StepWorldsTask, &batch);
+
+	double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	double worldSteps = (double)options.worlds * options.steps;
+
+	int bodies = 0;
+	for (const ScenarioWorld& scenario : worlds)
+	{
+		bodies += scenario.world->GetBodyStore().GetCount();
+	}
+
+	printf("\nBuilt in %.3f s, %.0f world steps in %.3f s: %.1f world steps/s, %.3f thread ms per world step, %.0f body steps/s\n",
+		buildSeconds, worldSteps, seconds, worldSteps / seconds, (seconds * 1000.0 * threads) / worldSteps,
+		(bodies * (double)options.steps) / seconds);
+
+	printf("%d bodies left in the worlds (%.1f per world)\n", bodies, (double)bodies / options.worlds);
+
+	//The worlds' hashes folded together in world order, the same for any thread count
+	if (options.deterministic)
+	{
+		unsigned long long hash = 14695981039346656037ull;
+
+		for (const ScenarioWorld& scenario : worlds)
+		{
+			hash = (hash ^ scenario.world->GetStateHash()) * 1099511628211ull;
+		}
+
+		printf("Combined state hash %016llx\n", hash);
+	}
+
+	pool.ParallelFor("DestroyWorlds", options.worlds, 1, DestroyWorldsTask, &batch);
+}
+
+int main(int argc, char** argv)
+{
+	RunnerOptions options;
+
+	if (!ParseOptions(argc, argv, options))
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	if (options.generateSize > 0)
+	{
+		std::vector<unsigned char> heights((size_t)options.generateSize * options.generateSize);
+		HeightMap::GenerateRollingHeights(heights.data(), options.generateSize, options.generateSize);
+
+		options.heightMapFile = "generated_" + std::to_string(options.generateSize) + ".bmp";
+
+		if (!HeightMap::SaveHeightMapBitmap(options.heightMapFile.c_str(), heights.data(), options.generateSize, options.generateSize))
+		{
+			fprintf(stderr, "Can't write %s\n", options.heightMapFile.c_str());
+			return 1;
+		}
+	}
+
+	//HeightMap doesn't report a missing file, so check it can be read first
+	FILE* file = fopen(options.heightMapFile.c_str(), "rb");
+	if (file == NULL)
+	{
+		fprintf(stderr, "Can't open heightmap %s\n", options.heightMapFile.c_str());
+		return 1;
+	}
+	fclose(file);
+
+	if ((!options.hashTraceFile.empty() || !options.hashCheckFile.empty()) && (options.worlds > 1 || options.solverScaling > 0))
+	{
+		fprintf(stderr, "--hash-trace and --hash-check only trace a single world, not --worlds or --solver-scaling\n");
+		return 1;
+	}
+
+	if (options.solverScaling > 0)
+	{
+		RunSolverScaling(options);
+	}
+	else if (options.worlds > 1)
+	{
+		RunBatch(options);
+	}
+	else if (!RunSingle(options))
+	{
+		return 1;
+	}
+
+	return 0;
+}
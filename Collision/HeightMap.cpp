@@ -1,5 +1,15 @@
 #include "HeightMap.h"
 #include "PhysicsWorld.h"
+#include "WorldSnapshot.h"
+
+#include <algorithm>
+#include <float.h>
+#include <string.h>
+
+#include <immintrin.h>
+
+//Distance field rows per job when baking
+static const int DISTANCE_FIELD_GRAIN = 16;
 
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
@@ -8,10 +18,23 @@ HeightMap::HeightMap(char* filename, float gridSize, float heightRange)
 {
 	LoadHeightMap(filename, gridSize, heightRange);
 
+#if !defined(PHYSICS_STANDALONE)
 	m_pHeightMapBuffer = NULL;
+#endif
 
+	m_vWorldOffset = XMFLOAT3(0.0f, 0.0f, 0.0f);
+
+	m_eContactMode = CONTACT_TRIANGLES;
+	m_eSimdLevel = GetSupportedSimdLevel();
+	m_pDistanceField = NULL;
+	m_iFieldSamplesPerCell = 0;
+	m_iFieldWidth = m_iFieldLength = 0;
+	m_fFieldSpacing = 0.0f;
+
+#if !defined(PHYSICS_STANDALONE)
 	m_pPSCBuffer = NULL;
 	m_pVSCBuffer = NULL;
+#endif
 
 	m_HeightMapFaceCount = (m_HeightMapLength - 1)*(m_HeightMapWidth - 1) * 2;
 
@@ -19,13 +42,34 @@ HeightMap::HeightMap(char* filename, float gridSize, float heightRange)
 
 	for (int f = 0; f < m_HeightMapFaceCount; ++f)
 	{
-		m_pFaceData[f].m_bDisabled = false;
 		m_pFaceData[f].m_bCollided = false;
-
 	}
 
+	m_iHoleMaskWords = (m_HeightMapFaceCount + 63) / 64;
+	m_pHoleMask = new uint64_t[m_iHoleMaskWords];
+	memset(m_pHoleMask, 0, sizeof(uint64_t) * m_iHoleMaskWords);
+	m_iDisabledFaceCount = 0;
+
 	m_HeightMapVtxCount = m_HeightMapFaceCount * 3;
 
+#if !defined(PHYSICS_STANDALONE)
+	//CPU-side copy of the vertex buffer so edits only rebuild the cells they touch
+	m_pMapVtxs = new Vertex_Pos3fColour4ubNormal3fTex2f[m_HeightMapVtxCount];
+#endif
+
+	int cellCount = m_HeightMapFaceCount / 2;
+	m_pCellDirty = new unsigned char[cellCount];
+	memset(m_pCellDirty, 0, cellCount);
+	m_bAllCellsDirty = true;
+
+	m_bEdited = false;
+	m_iEditedCellX0 = m_iEditedCellZ0 = m_iEditedCellX1 = m_iEditedCellZ1 = 0;
+
+	m_iBlockCountX = (m_HeightMapWidth - 1 + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	m_iBlockCountZ = (m_HeightMapLength - 1 + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	m_pBlockMinMax = new XMFLOAT2[m_iBlockCountX * m_iBlockCountZ];
+
+#if !defined(PHYSICS_STANDALONE)
 	for (size_t i = 0; i < NUM_TEXTURE_FILES; ++i)
 	{
 		m_pTextures[i] = NULL;
@@ -35,10 +79,12 @@ HeightMap::HeightMap(char* filename, float gridSize, float heightRange)
 	m_pSamplerState = NULL;
 
 	m_pHeightMapBuffer = CreateDynamicVertexBuffer(Application::s_pApp->GetDevice(), sizeof Vertex_Pos3fColour4ubNormal3fTex2f * m_HeightMapVtxCount, 0);
+#endif
 
 	BuildCollisionData();
 	RebuildVertexData();
 
+#if !defined(PHYSICS_STANDALONE)
 	for (size_t i = 0; i < NUM_TEXTURE_FILES; ++i)
 	{
 		LoadTextureFromFile(Application::s_pApp->GetDevice(), g_aTextureFileNames[i], &m_pTextures[i], &m_pTextureViews[i], &m_pSamplerState);
@@ -46,69 +92,303 @@ HeightMap::HeightMap(char* filename, float gridSize, float heightRange)
 
 
 	ReloadShader(); // This compiles the shader
+#endif
 }
 
 
 void HeightMap::BuildCollisionData(void)
 {
-	int mapIndex = 0;
-	int faceIndex = 0;
+	// This is the unstripped method, I wouldn't recommend changing this to the stripped method for the collision assignment
+	for (int l = 0; l < m_HeightMapLength - 1; ++l)
+	{
+		for (int w = 0; w < m_HeightMapWidth - 1; ++w)
+		{
+			BuildCellCollisionData(w, l);
+		}
+	}
+
+	m_iFaceCount = m_HeightMapFaceCount;
+
+	for (int bz = 0; bz < m_iBlockCountZ; ++bz)
+	{
+		for (int bx = 0; bx < m_iBlockCountX; ++bx)
+		{
+			UpdateBlockBounds(bx, bz);
+		}
+	}
+}
 
+//Rebuilds the two faces of a single grid cell from the current heights
+void HeightMap::BuildCellCollisionData(int w, int l)
+{
 	XMVECTOR v0, v1, v2, v3;
 	int i0, i1, i2, i3;
 
-	// This is the unstripped method, I wouldn't recommend changing this to the stripped method for the collision assignment
-	for (int l = 0; l < m_HeightMapLength; ++l)
+	int mapIndex = (l * m_HeightMapWidth) + w;
+	int faceIndex = ((l * (m_HeightMapWidth - 1)) + w) * 2;
+
+	i0 = mapIndex;
+	i1 = mapIndex + m_HeightMapWidth;
+	i2 = mapIndex + 1;
+	i3 = mapIndex + m_HeightMapWidth + 1;
+
+	v0 = XMLoadFloat4(&m_pHeightMap[i0]);
+	v1 = XMLoadFloat4(&m_pHeightMap[i1]);
+	v2 = XMLoadFloat4(&m_pHeightMap[i2]);
+	v3 = XMLoadFloat4(&m_pHeightMap[i3]);
+
+	XMVECTOR vA = v0 - v1;
+	XMVECTOR vB = v1 - v2;
+	XMVECTOR vC = v3 - v1;
+
+	XMVECTOR vN1, vN2;
+	vN1 = XMVector3Cross(vA, vB);
+	vN1 = XMVector3Normalize(vN1);
+
+	vN2 = XMVector3Cross(vB, vC);
+	vN2 = XMVector3Normalize(vN2);
+
+	XMStoreFloat3(&m_pFaceData[faceIndex + 0].m_v0, v0);
+	XMStoreFloat3(&m_pFaceData[faceIndex + 0].m_v1, v1);
+	XMStoreFloat3(&m_pFaceData[faceIndex + 0].m_v2, v2);
+	XMStoreFloat3(&m_pFaceData[faceIndex + 0].m_vNormal, vN1);
+
+	XMVECTOR centre = (v0 + v1 + v2) / 3;
+	XMStoreFloat3(&m_pFaceData[faceIndex].m_vCentre, centre);
+
+	XMStoreFloat3(&m_pFaceData[faceIndex + 1].m_v0, v2);
+	XMStoreFloat3(&m_pFaceData[faceIndex + 1].m_v1, v1);
+	XMStoreFloat3(&m_pFaceData[faceIndex + 1].m_v2, v3);
+	XMStoreFloat3(&m_pFaceData[faceIndex + 1].m_vNormal, vN2);
+
+	centre = (v2 + v1 + v3) / 3;
+	XMStoreFloat3(&m_pFaceData[faceIndex + 1].m_vCentre, centre);
+}
+
+//Recomputes the min/max height of a single block from the vertices of its faces
+void HeightMap::UpdateBlockBounds(int bx, int bz)
+{
+	int cx0 = bx * BLOCK_SIZE;
+	int cz0 = bz * BLOCK_SIZE;
+	int cx1 = min(cx0 + BLOCK_SIZE, m_HeightMapWidth - 1);
+	int cz1 = min(cz0 + BLOCK_SIZE, m_HeightMapLength - 1);
+
+	float minY = FLT_MAX;
+	float maxY = -FLT_MAX;
+
+	//The faces are built from these vertices, read here as they're an eighth the size of the two
+	//faces of a cell. Every brush stamp rescans the blocks it touches, so this bounds its cost
+	for (int l = cz0; l <= cz1; ++l)
 	{
-		for (int w = 0; w < m_HeightMapWidth; ++w)
+		const XMFLOAT4* row = &m_pHeightMap[(l * m_HeightMapWidth) + cx0];
+
+		for (int w = 0; w <= cx1 - cx0; ++w)
 		{
-			if (w < m_HeightMapWidth - 1 && l < m_HeightMapLength - 1)
-			{
-				i0 = mapIndex;
-				i1 = mapIndex + m_HeightMapWidth;
-				i2 = mapIndex + 1;
-				i3 = mapIndex + m_HeightMapWidth + 1;
+			minY = min(minY, row[w].y);
+			maxY = max(maxY, row[w].y);
+		}
+	}
+
+	m_pBlockMinMax[(bz * m_iBlockCountX) + bx] = XMFLOAT2(minY, maxY);
+}
+
+//Rebuilds the faces, block bounds and dirty flags for a rectangle of cells (inclusive)
+void HeightMap::RebuildCollisionRegion(int cx0, int cz0, int cx1, int cz1)
+{
+	cx0 = max(cx0, 0);
+	cz0 = max(cz0, 0);
+	cx1 = min(cx1, m_HeightMapWidth - 2);
+	cz1 = min(cz1, m_HeightMapLength - 2);
+
+	if (cx0 > cx1 || cz0 > cz1)
+	{
+		return;
+	}
+
+	for (int l = cz0; l <= cz1; ++l)
+	{
+		for (int w = cx0; w <= cx1; ++w)
+		{
+			BuildCellCollisionData(w, l);
+			MarkCellDirty((l * (m_HeightMapWidth - 1)) + w);
+		}
+	}
+
+	for (int bz = cz0 / BLOCK_SIZE; bz <= cz1 / BLOCK_SIZE; ++bz)
+	{
+		for (int bx = cx0 / BLOCK_SIZE; bx <= cx1 / BLOCK_SIZE; ++bx)
+		{
+			UpdateBlockBounds(bx, bz);
+		}
+	}
+
+	if (m_pDistanceField != NULL)
+	{
+		BakeDistanceFieldRegion(cx0, cz0, cx1, cz1);
+	}
+
+	//Grown to cover every edit until the world takes it
+	if (!m_bEdited)
+	{
+		m_iEditedCellX0 = cx0;
+		m_iEditedCellZ0 = cz0;
+		m_iEditedCellX1 = cx1;
+		m_iEditedCellZ1 = cz1;
+		m_bEdited = true;
+	}
+	else
+	{
+		m_iEditedCellX0 = min(m_iEditedCellX0, cx0);
+		m_iEditedCellZ0 = min(m_iEditedCellZ0, cz0);
+		m_iEditedCellX1 = max(m_iEditedCellX1, cx1);
+		m_iEditedCellZ1 = max(m_iEditedCellZ1, cz1);
+	}
+}
 
-				v0 = XMLoadFloat4(&m_pHeightMap[i0]);
-				v1 = XMLoadFloat4(&m_pHeightMap[i1]);
-				v2 = XMLoadFloat4(&m_pHeightMap[i2]);
-				v3 = XMLoadFloat4(&m_pHeightMap[i3]);
+//Gets the world space X/Z rectangle covering every face rebuilt by an edit since the last call, and forgets it
+//Returns : False if nothing has been edited since the last call
+bool HeightMap::TakeEditedBoundsXZ(float& minX, float& minZ, float& maxX, float& maxZ)
+{
+	if (!m_bEdited)
+	{
+		return false;
+	}
 
-				XMVECTOR vA = v0 - v1;
-				XMVECTOR vB = v1 - v2;
-				XMVECTOR vC = v3 - v1;
+	const XMFLOAT4& first = m_pHeightMap[0];
 
-				XMVECTOR vN1, vN2;
-				vN1 = XMVector3Cross(vA, vB);
-				vN1 = XMVector3Normalize(vN1);
+	minX = first.x + m_vWorldOffset.x + (m_iEditedCellX0 * m_fGridSize);
+	minZ = first.z + m_vWorldOffset.z + (m_iEditedCellZ0 * m_fGridSize);
+	maxX = first.x + m_vWorldOffset.x + ((m_iEditedCellX1 + 1) * m_fGridSize);
+	maxZ = first.z + m_vWorldOffset.z + ((m_iEditedCellZ1 + 1) * m_fGridSize);
 
-				vN2 = XMVector3Cross(vB, vC);
-				vN2 = XMVector3Normalize(vN2);
+	m_bEdited = false;
 
-				XMStoreFloat3(&m_pFaceData[faceIndex + 0].m_v0, v0);
-				XMStoreFloat3(&m_pFaceData[faceIndex + 0].m_v1, v1);
-				XMStoreFloat3(&m_pFaceData[faceIndex + 0].m_v2, v2);
-				XMStoreFloat3(&m_pFaceData[faceIndex + 0].m_vNormal, vN1);
+	return true;
+}
 
-				XMVECTOR centre = (v0 + v1 + v2) / 3;
-				XMStoreFloat3(&m_pFaceData[faceIndex].m_vCentre, centre);
+//Modifies the heights of a rectangular region of vertices (inclusive grid coordinates)
+//Only the faces touching the region have their collision data rebuilt and are marked for upload
+//Params : Min/max vertex column, min/max vertex row, height value, how to combine the value
+void HeightMap::ModifyHeights(int x0, int z0, int x1, int z1, float value, HeightEditMode mode)
+{
+	x0 = max(x0, 0);
+	z0 = max(z0, 0);
+	x1 = min(x1, m_HeightMapWidth - 1);
+	z1 = min(z1, m_HeightMapLength - 1);
 
-				XMStoreFloat3(&m_pFaceData[faceIndex + 1].m_v0, v2);
-				XMStoreFloat3(&m_pFaceData[faceIndex + 1].m_v1, v1);
-				XMStoreFloat3(&m_pFaceData[faceIndex + 1].m_v2, v3);
-				XMStoreFloat3(&m_pFaceData[faceIndex + 1].m_vNormal, vN2);
+	if (x0 > x1 || z0 > z1)
+	{
+		return;
+	}
 
-				centre = (v2 + v1 + v3) / 3;
-				XMStoreFloat3(&m_pFaceData[faceIndex + 1].m_vCentre, centre);
+	for (int z = z0; z <= z1; ++z)
+	{
+		for (int x = x0; x <= x1; ++x)
+		{
+			XMFLOAT4& vertex = m_pHeightMap[(z * m_HeightMapWidth) + x];
 
-				faceIndex += 2;
+			if (mode == HEIGHT_EDIT_SET)
+			{
+				vertex.y = value;
+			}
+			else
+			{
+				vertex.y += value;
 			}
+		}
+	}
+
+	//A vertex is shared by the cells on either side of it
+	RebuildCollisionRegion(x0 - 1, z0 - 1, x1, z1);
+}
+
+//Raises (positive strength) or lowers (negative strength) the terrain with a smooth falloff brush
+//Params : World position of the brush centre (only X and Z are used), brush radius, height change at the centre
+void HeightMap::ApplyBrush(const XMVECTOR& centre, float radius, float strength)
+{
+	float originX = m_pHeightMap[0].x;
+	float originZ = m_pHeightMap[0].z;
+
+	float cx = XMVectorGetX(centre) - m_vWorldOffset.x;
+	float cz = XMVectorGetZ(centre) - m_vWorldOffset.z;
+
+	int x0 = max((int)ceilf((cx - radius - originX) / m_fGridSize), 0);
+	int z0 = max((int)ceilf((cz - radius - originZ) / m_fGridSize), 0);
+	int x1 = min((int)floorf((cx + radius - originX) / m_fGridSize), m_HeightMapWidth - 1);
+	int z1 = min((int)floorf((cz + radius - originZ) / m_fGridSize), m_HeightMapLength - 1);
 
-			mapIndex++;
+	if (x0 > x1 || z0 > z1)
+	{
+		return;
+	}
+
+	float invRadiusSq = 1.0f / (radius * radius);
+
+	for (int z = z0; z <= z1; ++z)
+	{
+		for (int x = x0; x <= x1; ++x)
+		{
+			XMFLOAT4& vertex = m_pHeightMap[(z * m_HeightMapWidth) + x];
+
+			float dx = vertex.x - cx;
+			float dz = vertex.z - cz;
+			float t = 1.0f - ((dx * dx) + (dz * dz)) * invRadiusSq;
+
+			if (t > 0.0f)
+			{
+				//Smooth falloff so stamps don't leave a hard edge
+				vertex.y += strength * t * t;
+			}
 		}
 	}
 
-	m_iFaceCount = faceIndex;
+	RebuildCollisionRegion(x0 - 1, z0 - 1, x1, z1);
+}
+
+//Flags a cell so its vertices are rebuilt on the next RebuildVertexData
+void HeightMap::MarkCellDirty(int cellIndex)
+{
+	if (!m_pCellDirty[cellIndex])
+	{
+		m_pCellDirty[cellIndex] = 1;
+		m_dirtyCells.push_back(cellIndex);
+	}
+}
+
+//Sets the debug collision colour on a face and remembers it for ResetVertexColours
+void HeightMap::MarkFaceCollided(int faceIndex)
+{
+	if (!m_pFaceData[faceIndex].m_bCollided)
+	{
+		m_pFaceData[faceIndex].m_bCollided = true;
+		m_collidedFaces.push_back(faceIndex);
+		MarkCellDirty(faceIndex / 2);
+	}
+}
+
+//Converts a local space X/Z rectangle into an inclusive, clamped range of cells
+//Returns : False if the rectangle doesn't overlap the heightmap at all
+bool HeightMap::GetCellRange(float minX, float minZ, float maxX, float maxZ, int& cx0, int& cz0, int& cx1, int& cz1)
+{
+	float originX = m_pHeightMap[0].x;
+	float originZ = m_pHeightMap[0].z;
+
+	cx0 = (int)floorf((minX - originX) / m_fGridSize);
+	cz0 = (int)floorf((minZ - originZ) / m_fGridSize);
+	cx1 = (int)floorf((maxX - originX) / m_fGridSize);
+	cz1 = (int)floorf((maxZ - originZ) / m_fGridSize);
+
+	if (cx1 < 0 || cz1 < 0 || cx0 > m_HeightMapWidth - 2 || cz0 > m_HeightMapLength - 2)
+	{
+		return false;
+	}
+
+	cx0 = max(cx0, 0);
+	cz0 = max(cz0, 0);
+	cx1 = min(cx1, m_HeightMapWidth - 2);
+	cz1 = min(cz1, m_HeightMapLength - 2);
+
+	return true;
 }
 
 XMFLOAT3 HeightMap::GetFaceNormal(int faceIndex, int offset)
@@ -123,85 +403,244 @@ XMFLOAT3 HeightMap::GetAveragedVertexNormal(int index, int row)
 
 
 
+//Writes the six vertices of a cell into the CPU-side vertex copy
+void HeightMap::BuildCellVertices(int cellIndex)
+{
+#if !defined(PHYSICS_STANDALONE)
+	static VertexColour STANDARD_COLOUR(255, 255, 255, 255);
+	static VertexColour COLLISION_COLOUR(255, 0, 0, 255);
+
+	int f = cellIndex * 2;
+	int vtxIndex = cellIndex * 6;
+
+	XMVECTOR v0, v1, v2, v3, v4, v5;
+	float tX0, tY0, tX1, tY1, tX2, tY2, tX3, tY3;
+
+	VertexColour c0, c1;
+	XMVECTOR vN1, vN2;
+
+	v0 = XMLoadFloat3(&m_pFaceData[f + 0].m_v0);
+	v1 = XMLoadFloat3(&m_pFaceData[f + 0].m_v1);
+	v2 = XMLoadFloat3(&m_pFaceData[f + 0].m_v2);
+	v3 = XMLoadFloat3(&m_pFaceData[f + 1].m_v0);
+	v4 = XMLoadFloat3(&m_pFaceData[f + 1].m_v1);
+	v5 = XMLoadFloat3(&m_pFaceData[f + 1].m_v2);
+
+	if (IsFaceDisabled(f + 0))
+		v0 = v1 = v2 = XMVectorZero();
+
+	if (IsFaceDisabled(f + 1))
+		v3 = v4 = v5 = XMVectorZero();
+
+	vN1 = XMLoadFloat3(&m_pFaceData[f + 0].m_vNormal);
+	vN2 = XMLoadFloat3(&m_pFaceData[f + 1].m_vNormal);
+
+	tX0 = 0.0f;
+	tY0 = 0.0f;
+	tX1 = 0.0f;
+	tY1 = 1.0f;
+	tX2 = 1.0f;
+	tY2 = 0.0f;
+	tX3 = 1.0f;
+	tY3 = 1.0f;
+
+	c0 = m_pFaceData[f + 0].m_bCollided ? COLLISION_COLOUR : STANDARD_COLOUR;
+	c1 = m_pFaceData[f + 1].m_bCollided ? COLLISION_COLOUR : STANDARD_COLOUR;
+
+	m_pMapVtxs[vtxIndex + 0] = Vertex_Pos3fColour4ubNormal3fTex2f(v0, c0, vN1, XMFLOAT2(tX0, tY0));
+	m_pMapVtxs[vtxIndex + 1] = Vertex_Pos3fColour4ubNormal3fTex2f(v1, c0, vN1, XMFLOAT2(tX1, tY1));
+	m_pMapVtxs[vtxIndex + 2] = Vertex_Pos3fColour4ubNormal3fTex2f(v2, c0, vN1, XMFLOAT2(tX2, tY2));
+	m_pMapVtxs[vtxIndex + 3] = Vertex_Pos3fColour4ubNormal3fTex2f(v3, c1, vN2, XMFLOAT2(tX2, tY2));
+	m_pMapVtxs[vtxIndex + 4] = Vertex_Pos3fColour4ubNormal3fTex2f(v4, c1, vN2, XMFLOAT2(tX1, tY1));
+	m_pMapVtxs[vtxIndex + 5] = Vertex_Pos3fColour4ubNormal3fTex2f(v5, c1, vN2, XMFLOAT2(tX3, tY3));
+#endif
+}
+
 void HeightMap::RebuildVertexData(void)
 {
-	D3D11_MAPPED_SUBRESOURCE map;
+	//Nothing edited or recoloured since the last upload, the buffer is already up to date
+	if (!m_bAllCellsDirty && m_dirtyCells.empty())
+	{
+		return;
+	}
 
-	if (SUCCEEDED(Application::s_pApp->GetDeviceContext()->Map(m_pHeightMapBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &map)))
+	// This is the unstripped method, I wouldn't recommend changing this to the stripped method for the collision assignment
+	if (m_bAllCellsDirty)
 	{
-		Vertex_Pos3fColour4ubNormal3fTex2f* pMapVtxs = (Vertex_Pos3fColour4ubNormal3fTex2f*)map.pData;
+		for (int c = 0; c < m_HeightMapFaceCount / 2; ++c)
+		{
+			BuildCellVertices(c);
+			m_pCellDirty[c] = 0;
+		}
 
-		int vtxIndex = 0;
-		int mapIndex = 0;
+		m_dirtyCells.clear();
+		m_bAllCellsDirty = false;
 
-		XMVECTOR v0, v1, v2, v3, v4, v5;
-		float tX0, tY0, tX1, tY1, tX2, tY2, tX3, tY3;
+#if !defined(PHYSICS_STANDALONE)
+		D3D11_MAPPED_SUBRESOURCE map;
 
-		VertexColour c0, c1, c2, c3;
-		XMVECTOR vN1, vN2;
+		//WRITE_DISCARD leaves the buffer contents undefined, so the whole CPU copy goes up in one memcpy
+		if (SUCCEEDED(Application::s_pApp->GetDeviceContext()->Map(m_pHeightMapBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &map)))
+		{
+			memcpy(map.pData, m_pMapVtxs, sizeof(Vertex_Pos3fColour4ubNormal3fTex2f) * m_HeightMapVtxCount);
 
-		static VertexColour STANDARD_COLOUR(255, 255, 255, 255);
-		static VertexColour COLLISION_COLOUR(255, 0, 0, 255);
+			Application::s_pApp->GetDeviceContext()->Unmap(m_pHeightMapBuffer, 0);
+		}
+#endif
+		return;
+	}
 
-		VertexColour CUBE_COLOUR;
+	//Only the cells touched by edits or collision colouring since the last upload, in order so
+	//neighbouring cells join up into runs of vertices
+	std::sort(m_dirtyCells.begin(), m_dirtyCells.end());
 
-		// This is the unstripped method, I wouldn't recommend changing this to the stripped method for the collision assignment
-		for (int f = 0; f < m_HeightMapFaceCount; f += 2)
-		{
-			v0 = XMLoadFloat3(&m_pFaceData[f + 0].m_v0);
-			v1 = XMLoadFloat3(&m_pFaceData[f + 0].m_v1);
-			v2 = XMLoadFloat3(&m_pFaceData[f + 0].m_v2);
-			v3 = XMLoadFloat3(&m_pFaceData[f + 1].m_v0);
-			v4 = XMLoadFloat3(&m_pFaceData[f + 1].m_v1);
-			v5 = XMLoadFloat3(&m_pFaceData[f + 1].m_v2);
+	for (auto c : m_dirtyCells)
+	{
+		BuildCellVertices(c);
+		m_pCellDirty[c] = 0;
+	}
 
-			if (m_pFaceData[f + 0].m_bDisabled)
-				v0 = v1 = v2 = XMVectorZero();
+#if !defined(PHYSICS_STANDALONE)
+	D3D11_MAPPED_SUBRESOURCE map;
 
-			if (m_pFaceData[f + 1].m_bDisabled)
-				v3 = v4 = v5 = XMVectorZero();
+	//WRITE_NO_OVERWRITE keeps the rest of the buffer as it was, so only the dirty runs are copied up
+	if (SUCCEEDED(Application::s_pApp->GetDeviceContext()->Map(m_pHeightMapBuffer, 0, D3D11_MAP_WRITE_NO_OVERWRITE, 0, &map)))
+	{
+		Vertex_Pos3fColour4ubNormal3fTex2f* pVtxs = (Vertex_Pos3fColour4ubNormal3fTex2f*)map.pData;
 
-			vN1 = XMLoadFloat3(&m_pFaceData[f + 0].m_vNormal);
-			vN2 = XMLoadFloat3(&m_pFaceData[f + 1].m_vNormal);
+		for (size_t i = 0; i < m_dirtyCells.size(); )
+		{
+			//Extend the run over consecutive cells, each cell is six vertices
+			size_t j = i + 1;
 
-			tX0 = 0.0f;
-			tY0 = 0.0f;
-			tX1 = 0.0f;
-			tY1 = 1.0f;
-			tX2 = 1.0f;
-			tY2 = 0.0f;
-			tX3 = 1.0f;
-			tY3 = 1.0f;
+			while (j < m_dirtyCells.size() && m_dirtyCells[j] == m_dirtyCells[j - 1] + 1)
+			{
+				j++;
+			}
 
-			c0 = m_pFaceData[f + 0].m_bCollided ? COLLISION_COLOUR : STANDARD_COLOUR;
-			c1 = m_pFaceData[f + 1].m_bCollided ? COLLISION_COLOUR : STANDARD_COLOUR;
+			int firstVtx = m_dirtyCells[i] * 6;
+			int vtxCount = (int)(j - i) * 6;
 
-			pMapVtxs[vtxIndex + 0] = Vertex_Pos3fColour4ubNormal3fTex2f(v0, c0, vN1, XMFLOAT2(tX0, tY0));
-			pMapVtxs[vtxIndex + 1] = Vertex_Pos3fColour4ubNormal3fTex2f(v1, c0, vN1, XMFLOAT2(tX1, tY1));
-			pMapVtxs[vtxIndex + 2] = Vertex_Pos3fColour4ubNormal3fTex2f(v2, c0, vN1, XMFLOAT2(tX2, tY2));
-			pMapVtxs[vtxIndex + 3] = Vertex_Pos3fColour4ubNormal3fTex2f(v3, c1, vN2, XMFLOAT2(tX2, tY2));
-			pMapVtxs[vtxIndex + 4] = Vertex_Pos3fColour4ubNormal3fTex2f(v4, c1, vN2, XMFLOAT2(tX1, tY1));
-			pMapVtxs[vtxIndex + 5] = Vertex_Pos3fColour4ubNormal3fTex2f(v5, c1, vN2, XMFLOAT2(tX3, tY3));
+			memcpy(pVtxs + firstVtx, m_pMapVtxs + firstVtx, sizeof(Vertex_Pos3fColour4ubNormal3fTex2f) * vtxCount);
 
-			vtxIndex += 6;
+			i = j;
 		}
+
+		Application::s_pApp->GetDeviceContext()->Unmap(m_pHeightMapBuffer, 0);
+	}
+#endif
+
+	m_dirtyCells.clear();
+}
+
+
+
+//Counts the set bits in a mask word
+static int CountBits(uint64_t v)
+{
+	v = v - ((v >> 1) & 0x5555555555555555ULL);
+	v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+	v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return (int)((v * 0x0101010101010101ULL) >> 56);
+}
+
+//Sets or clears the hole bits for a contiguous run of faces (inclusive), a whole mask word at a time
+//Returns : Number of faces whose state changed
+int HeightMap::SetFaceRangeDisabled(int firstFace, int lastFace, bool disabled)
+{
+	int nChanged = 0;
+
+	for (int word = firstFace >> 6; word <= (lastFace >> 6); ++word)
+	{
+		//Build the mask of bits inside [firstFace, lastFace] for this word
+		int lo = max(firstFace, word << 6) & 63;
+		int hi = min(lastFace, (word << 6) + 63) & 63;
+		uint64_t bits = (~0ULL >> (63 - hi)) & (~0ULL << lo);
+
+		uint64_t old = m_pHoleMask[word];
+		m_pHoleMask[word] = disabled ? (old | bits) : (old & ~bits);
+
+		nChanged += CountBits(old ^ m_pHoleMask[word]);
 	}
 
-	Application::s_pApp->GetDeviceContext()->Unmap(m_pHeightMapBuffer, 0);
+	m_iDisabledFaceCount += disabled ? nChanged : -nChanged;
+
+	return nChanged;
 }
 
+//Disables (punches a hole in) or re-enables every face in a rectangle of cells (inclusive grid coordinates)
+//Params : Min/max cell column, min/max cell row, whether the faces should be disabled
+//Returns : Number of faces whose state changed
+int HeightMap::SetRegionDisabled(int cx0, int cz0, int cx1, int cz1, bool disabled)
+{
+	cx0 = max(cx0, 0);
+	cz0 = max(cz0, 0);
+	cx1 = min(cx1, m_HeightMapWidth - 2);
+	cz1 = min(cz1, m_HeightMapLength - 2);
+
+	int nChanged = 0;
+
+	for (int l = cz0; l <= cz1; ++l)
+	{
+		int rowCell = l * (m_HeightMapWidth - 1);
+
+		nChanged += SetFaceRangeDisabled((rowCell + cx0) * 2, ((rowCell + cx1) * 2) + 1, disabled);
+
+		for (int w = cx0; w <= cx1; ++w)
+		{
+			MarkCellDirty(rowCell + w);
+		}
+	}
 
+	return nChanged;
+}
 
 int HeightMap::DisableBelowLevel(float fYLevel)
 {
 	int nHidden = 0;
 
-	for (int f = 0; f < m_HeightMapFaceCount; ++f)
+	//Use the block bounds to avoid visiting faces that can't qualify (block min at or above the level),
+	//and to disable whole blocks at once when every face qualifies (block max below the level)
+	for (int bz = 0; bz < m_iBlockCountZ; ++bz)
 	{
-		if (m_pFaceData[f].m_v0.y < fYLevel && m_pFaceData[f].m_v1.y < fYLevel && m_pFaceData[f].m_v2.y < fYLevel)
+		for (int bx = 0; bx < m_iBlockCountX; ++bx)
 		{
-			m_pFaceData[f].m_bDisabled = true;
-			nHidden++;
+			const XMFLOAT2& bounds = m_pBlockMinMax[(bz * m_iBlockCountX) + bx];
+
+			if (bounds.x >= fYLevel)
+			{
+				continue;
+			}
+
+			int cx0 = bx * BLOCK_SIZE;
+			int cz0 = bz * BLOCK_SIZE;
+			int cx1 = min(cx0 + BLOCK_SIZE, m_HeightMapWidth - 1) - 1;
+			int cz1 = min(cz0 + BLOCK_SIZE, m_HeightMapLength - 1) - 1;
+
+			if (bounds.y < fYLevel)
+			{
+				SetRegionDisabled(cx0, cz0, cx1, cz1, true);
+				nHidden += (cx1 - cx0 + 1) * (cz1 - cz0 + 1) * 2;
+				continue;
+			}
+
+			for (int l = cz0; l <= cz1; ++l)
+			{
+				for (int w = cx0; w <= cx1; ++w)
+				{
+					int cellIndex = (l * (m_HeightMapWidth - 1)) + w;
+
+					for (int f = cellIndex * 2; f < (cellIndex * 2) + 2; ++f)
+					{
+						if (m_pFaceData[f].m_v0.y < fYLevel && m_pFaceData[f].m_v1.y < fYLevel && m_pFaceData[f].m_v2.y < fYLevel)
+						{
+							SetFaceRangeDisabled(f, f, true);
+							MarkCellDirty(cellIndex);
+							nHidden++;
+						}
+					}
+				}
+			}
 		}
 	}
 
@@ -210,18 +649,449 @@ int HeightMap::DisableBelowLevel(float fYLevel)
 
 int HeightMap::EnableAll(void)
 {
-	int nHidden = 0;
+	int nHidden = m_iDisabledFaceCount;
 
-	for (int f = 0; f < m_HeightMapFaceCount; ++f)
+	if (nHidden > 0)
 	{
-		if (m_pFaceData[f].m_bDisabled == true)
+		memset(m_pHoleMask, 0, sizeof(uint64_t) * m_iHoleMaskWords);
+		m_iDisabledFaceCount = 0;
+		m_bAllCellsDirty = true;
+	}
+
+	return nHidden;
+}
+
+//Adds the hole mask to a world snapshot
+//Params : Writer, index of the heightmap's tile in the world
+void HeightMap::WriteSnapshot(SnapshotWriter& writer, int tile) const
+{
+	writer.AddSection(SNAPSHOT_TERRAIN_HOLES, tile, m_pHoleMask, sizeof(uint64_t), m_iHoleMaskWords);
+}
+
+//Checks a snapshot has a hole mask the size of this heightmap's for a tile
+bool HeightMap::CheckSnapshot(const SnapshotReader& reader, int tile) const
+{
+	return reader.FindArray<uint64_t>(SNAPSHOT_TERRAIN_HOLES, tile, m_iHoleMaskWords) != nullptr;
+}
+
+//Replaces the hole mask with a tile's from a snapshot that passed CheckSnapshot. Holes are only
+//looked up when colliding, so the mask is all there is to restore (plus redrawing every cell)
+void HeightMap::ReadSnapshot(const SnapshotReader& reader, int tile)
+{
+	memcpy(m_pHoleMask, reader.FindArray<uint64_t>(SNAPSHOT_TERRAIN_HOLES, tile, m_iHoleMaskWords), sizeof(uint64_t) * m_iHoleMaskWords);
+
+	//Bits past the last face aren't faces
+	int spareBits = (m_iHoleMaskWords * 64) - m_HeightMapFaceCount;
+
+	if (spareBits > 0)
+	{
+		m_pHoleMask[m_iHoleMaskWords - 1] &= ~0ULL >> spareBits;
+	}
+
+	m_iDisabledFaceCount = 0;
+
+	for (int word = 0; word < m_iHoleMaskWords; ++word)
+	{
+		m_iDisabledFaceCount += CountBits(m_pHoleMask[word]);
+	}
+
+	m_bAllCellsDirty = true;
+}
+
+//Places the heightmap in the world. All collision queries and drawing take world space
+//positions and are translated by this offset
+//Params : World position of the heightmap's centre
+void HeightMap::SetWorldOffset(const XMFLOAT3& offset)
+{
+	m_vWorldOffset = offset;
+}
+
+//Gets the world space X/Z extents covered by the heightmap
+void HeightMap::GetWorldBoundsXZ(float& minX, float& minZ, float& maxX, float& maxZ) const
+{
+	const XMFLOAT4& first = m_pHeightMap[0];
+	const XMFLOAT4& last = m_pHeightMap[(m_HeightMapWidth * m_HeightMapLength) - 1];
+
+	minX = first.x + m_vWorldOffset.x;
+	minZ = first.z + m_vWorldOffset.z;
+	maxX = last.x + m_vWorldOffset.x;
+	maxZ = last.z + m_vWorldOffset.z;
+}
+
+//Selects the sphere contact test. Selecting the distance field bakes it from the current heights.
+//Params : Contact mode, distance field samples along each side of a cell, job system the rows are baked
+//across (nullptr to bake on this thread)
+void HeightMap::SetContactMode(ContactMode mode, int samplesPerCell, JobSystem* pJobSystem)
+{
+	m_eContactMode = mode;
+
+	//Clamped here, so asking again with the same out of range density doesn't bake again
+	samplesPerCell = max(samplesPerCell, 1);
+
+	if (mode == CONTACT_DISTANCE_FIELD)
+	{
+		if (m_pDistanceField == NULL || m_iFieldSamplesPerCell != samplesPerCell)
 		{
-			m_pFaceData[f].m_bDisabled = false;
-			nHidden++;
+			BakeDistanceField(samplesPerCell, pJobSystem);
 		}
 	}
+	else
+	{
+		delete[] m_pDistanceField;
+		m_pDistanceField = NULL;
+		m_iFieldSamplesPerCell = 0;
+	}
+}
 
-	return nHidden;
+//Returns : Bytes used by the baked distance field (0 if not baked)
+size_t HeightMap::GetDistanceFieldMemory() const
+{
+	return m_pDistanceField != NULL ? sizeof(XMFLOAT3) * m_iFieldWidth * m_iFieldLength : 0;
+}
+
+size_t HeightMap::GetFaceDataMemory() const
+{
+	return sizeof(FaceCollisionData) * m_HeightMapFaceCount;
+}
+
+//Height of the terrain surface inside a cell, using the same triangle split as BuildCollisionData
+//Params : Cell column and row, position inside the cell (0-1 on each axis)
+float HeightMap::InterpolateHeight(int w, int l, float u, float v) const
+{
+	int i0 = (l * m_HeightMapWidth) + w;
+
+	float h00 = m_pHeightMap[i0].y;
+	float h10 = m_pHeightMap[i0 + 1].y;
+	float h01 = m_pHeightMap[i0 + m_HeightMapWidth].y;
+	float h11 = m_pHeightMap[i0 + m_HeightMapWidth + 1].y;
+
+	//Faces split along the diagonal from (w + 1, l) to (w, l + 1)
+	if (u + v <= 1.0f)
+	{
+		return h00 + (u * (h10 - h00)) + (v * (h01 - h00));
+	}
+
+	return h11 + ((1.0f - u) * (h01 - h11)) + ((1.0f - v) * (h10 - h11));
+}
+
+//Bakes the whole distance field, splitting the rows across a job system's workers
+//Params : Samples along each side of a cell, job system (nullptr to bake on this thread)
+void HeightMap::BakeDistanceField(int samplesPerCell, JobSystem* pJobSystem)
+{
+	delete[] m_pDistanceField;
+
+	m_iFieldSamplesPerCell = samplesPerCell;
+	m_iFieldWidth = ((m_HeightMapWidth - 1) * samplesPerCell) + 1;
+	m_iFieldLength = ((m_HeightMapLength - 1) * samplesPerCell) + 1;
+	m_fFieldSpacing = m_fGridSize / samplesPerCell;
+	m_pDistanceField = new XMFLOAT3[m_iFieldWidth * m_iFieldLength];
+
+	//Slopes read neighbouring heights, so every height has to be finished before any slope is baked
+	if (pJobSystem != nullptr)
+	{
+		pJobSystem->ParallelFor("BakeFieldHeights", m_iFieldLength, DISTANCE_FIELD_GRAIN, BakeHeightsTask, this);
+		pJobSystem->ParallelFor("BakeFieldSlopes", m_iFieldLength, DISTANCE_FIELD_GRAIN, BakeSlopesTask, this);
+	}
+	else
+	{
+		BakeDistanceFieldHeights(0, m_iFieldLength - 1);
+		BakeDistanceFieldSlopes(0, m_iFieldLength - 1);
+	}
+}
+
+//Job entry points, bake the heights or slopes of a run of distance field rows
+void HeightMap::BakeHeightsTask(void* context, int begin, int end, int worker)
+{
+	((HeightMap*)context)->BakeDistanceFieldHeights(begin, end - 1);
+}
+
+void HeightMap::BakeSlopesTask(void* context, int begin, int end, int worker)
+{
+	((HeightMap*)context)->BakeDistanceFieldSlopes(begin, end - 1);
+}
+
+//Bakes the heights of a range of distance field rows (inclusive)
+void HeightMap::BakeDistanceFieldHeights(int z0, int z1)
+{
+	float invSamples = 1.0f / m_iFieldSamplesPerCell;
+
+	for (int z = z0; z <= z1; z++)
+	{
+		int l = min(z / m_iFieldSamplesPerCell, m_HeightMapLength - 2);
+		float v = (z - (l * m_iFieldSamplesPerCell)) * invSamples;
+
+		for (int x = 0; x < m_iFieldWidth; x++)
+		{
+			int w = min(x / m_iFieldSamplesPerCell, m_HeightMapWidth - 2);
+			float u = (x - (w * m_iFieldSamplesPerCell)) * invSamples;
+
+			m_pDistanceField[(z * m_iFieldWidth) + x].x = InterpolateHeight(w, l, u, v);
+		}
+	}
+}
+
+//Bakes the slopes of a range of distance field rows (inclusive) from the baked heights
+void HeightMap::BakeDistanceFieldSlopes(int z0, int z1)
+{
+	for (int z = z0; z <= z1; z++)
+	{
+		//Central differences, one sided on the edges
+		int zm = max(z - 1, 0);
+		int zp = min(z + 1, m_iFieldLength - 1);
+
+		for (int x = 0; x < m_iFieldWidth; x++)
+		{
+			int xm = max(x - 1, 0);
+			int xp = min(x + 1, m_iFieldWidth - 1);
+
+			XMFLOAT3& sample = m_pDistanceField[(z * m_iFieldWidth) + x];
+
+			sample.y = (m_pDistanceField[(z * m_iFieldWidth) + xp].x - m_pDistanceField[(z * m_iFieldWidth) + xm].x) / ((xp - xm) * m_fFieldSpacing);
+			sample.z = (m_pDistanceField[(zp * m_iFieldWidth) + x].x - m_pDistanceField[(zm * m_iFieldWidth) + x].x) / ((zp - zm) * m_fFieldSpacing);
+		}
+	}
+}
+
+//Rebakes the part of the distance field covering a rectangle of cells after an edit
+void HeightMap::BakeDistanceFieldRegion(int cx0, int cz0, int cx1, int cz1)
+{
+	//Edits are small, so this runs on the calling thread. Whole rows are rebaked to keep it simple,
+	//and the slopes one sample further out as they read the changed heights
+	int z0 = cz0 * m_iFieldSamplesPerCell;
+	int z1 = min((cz1 + 1) * m_iFieldSamplesPerCell, m_iFieldLength - 1);
+
+	BakeDistanceFieldHeights(z0, z1);
+	BakeDistanceFieldSlopes(max(z0 - 1, 0), min(z1 + 1, m_iFieldLength - 1));
+}
+
+//Sphere contact from a bilinear sample of the distance field
+//Params : Local space sphere centre and radius, collision to fill in
+//Returns : True if the sphere touches the surface
+bool HeightMap::SphereDistanceField(const XMVECTOR& centre, float radius, PhysicsStaticCollision& collision)
+{
+	float fx = (XMVectorGetX(centre) - m_pHeightMap[0].x) / m_fFieldSpacing;
+	float fz = (XMVectorGetZ(centre) - m_pHeightMap[0].z) / m_fFieldSpacing;
+
+	//The field only covers the area over the heightmap
+	if (fx < 0.0f || fz < 0.0f || fx > (float)(m_iFieldWidth - 1) || fz > (float)(m_iFieldLength - 1))
+	{
+		return false;
+	}
+
+	int ix = min((int)fx, m_iFieldWidth - 2);
+	int iz = min((int)fz, m_iFieldLength - 2);
+	float tx = fx - ix;
+	float tz = fz - iz;
+
+	//Faces under a hole don't collide, same as the triangle path
+	int w = min(ix / m_iFieldSamplesPerCell, m_HeightMapWidth - 2);
+	int l = min(iz / m_iFieldSamplesPerCell, m_HeightMapLength - 2);
+	float u = (fx / m_iFieldSamplesPerCell) - w;
+	float v = (fz / m_iFieldSamplesPerCell) - l;
+	int faceIndex = (((l * (m_HeightMapWidth - 1)) + w) * 2) + (u + v <= 1.0f ? 0 : 1);
+
+	if (IsFaceDisabled(faceIndex))
+	{
+		return false;
+	}
+
+	const XMFLOAT3& s00 = m_pDistanceField[(iz * m_iFieldWidth) + ix];
+	const XMFLOAT3& s10 = m_pDistanceField[(iz * m_iFieldWidth) + ix + 1];
+	const XMFLOAT3& s01 = m_pDistanceField[((iz + 1) * m_iFieldWidth) + ix];
+	const XMFLOAT3& s11 = m_pDistanceField[((iz + 1) * m_iFieldWidth) + ix + 1];
+
+	float w00 = (1.0f - tx) * (1.0f - tz);
+	float w10 = tx * (1.0f - tz);
+	float w01 = (1.0f - tx) * tz;
+	float w11 = tx * tz;
+
+	float height = (s00.x * w00) + (s10.x * w10) + (s01.x * w01) + (s11.x * w11);
+	float slopeX = (s00.y * w00) + (s10.y * w10) + (s01.y * w01) + (s11.y * w11);
+	float slopeZ = (s00.z * w00) + (s10.z * w10) + (s01.z * w01) + (s11.z * w11);
+
+	//The gradient of (y - height) gives the surface normal, and projecting the vertical
+	//clearance onto it gives the distance to the local tangent plane
+	XMVECTOR normal = XMVector3Normalize(XMVectorSet(-slopeX, 1.0f, -slopeZ, 0.0f));
+	float distance = (XMVectorGetY(centre) - height) * XMVectorGetY(normal);
+
+	if (distance > radius)
+	{
+		return false;
+	}
+
+	collision.faceIndex = faceIndex;
+	collision.collisionNormal = normal;
+	collision.collisionPosition = centre - (normal * distance);
+	collision.penetrationDepth = radius - distance;
+
+	return true;
+}
+
+//Samples the terrain height and surface normal under many points, on the same triangle split as the
+//collision faces. Points off the heightmap are clamped to its edge
+//Params : World space X and Z of each point, heights to fill in, normals to fill in (nullptr to skip), number of points
+void HeightMap::SampleHeights(const float* xs, const float* zs, float* outY, XMFLOAT3* outN, int count) const
+{
+	int done = 0;
+
+	if (m_eSimdLevel >= SIMD_AVX2)
+	{
+		done = SampleHeightsAVX2(0, count, xs, zs, outY, outN);
+	}
+
+	SampleHeightsScalar(done, count, xs, zs, outY, outN);
+}
+
+//Set/Get the instruction set SampleHeights uses (clamped to what the CPU supports)
+void HeightMap::SetSimdLevel(SimdLevel level)
+{
+	m_eSimdLevel = min(level, GetSupportedSimdLevel());
+}
+
+void HeightMap::SampleHeightsScalar(int begin, int end, const float* xs, const float* zs, float* outY, XMFLOAT3* outN) const
+{
+	int cellsX = m_HeightMapWidth - 1;
+	int cellsZ = m_HeightMapLength - 1;
+
+	float originX = m_pHeightMap[0].x + m_vWorldOffset.x;
+	float originZ = m_pHeightMap[0].z + m_vWorldOffset.z;
+	float invGridSize = 1.0f / m_fGridSize;
+
+	for (int i = begin; i < end; i++)
+	{
+		//Position in cells, clamped to the heightmap
+		float fx = min(max((xs[i] - originX) * invGridSize, 0.0f), (float)cellsX);
+		float fz = min(max((zs[i] - originZ) * invGridSize, 0.0f), (float)cellsZ);
+
+		int w = min((int)floorf(fx), cellsX - 1);
+		int l = min((int)floorf(fz), cellsZ - 1);
+
+		float u = fx - (float)w;
+		float v = fz - (float)l;
+
+		int i0 = (l * m_HeightMapWidth) + w;
+
+		float h00 = m_pHeightMap[i0].y;
+		float h10 = m_pHeightMap[i0 + 1].y;
+		float h01 = m_pHeightMap[i0 + m_HeightMapWidth].y;
+		float h11 = m_pHeightMap[i0 + m_HeightMapWidth + 1].y;
+
+		//Height and its change across the cell along X and Z, on whichever side of the
+		//diagonal from (w + 1, l) to (w, l + 1) the point is (see InterpolateHeight)
+		float height, slopeX, slopeZ;
+
+		if (u + v <= 1.0f)
+		{
+			slopeX = h10 - h00;
+			slopeZ = h01 - h00;
+			height = h00 + (u * slopeX) + (v * slopeZ);
+		}
+		else
+		{
+			slopeX = h11 - h01;
+			slopeZ = h11 - h10;
+			height = h11 + ((1.0f - u) * (h01 - h11)) + ((1.0f - v) * (h10 - h11));
+		}
+
+		outY[i] = height + m_vWorldOffset.y;
+
+		if (outN != nullptr)
+		{
+			float nx = -slopeX * invGridSize;
+			float nz = -slopeZ * invGridSize;
+			float invLength = 1.0f / sqrtf((nx * nx) + 1.0f + (nz * nz));
+
+			outN[i] = XMFLOAT3(nx * invLength, invLength, nz * invLength);
+		}
+	}
+}
+
+//Same operations in the same order as the scalar loop, the four corner heights are gathered
+//and the triangle is picked with a lane mask
+SIMD_TARGET_AVX2
+int HeightMap::SampleHeightsAVX2(int begin, int end, const float* xs, const float* zs, float* outY, XMFLOAT3* outN) const
+{
+	int cellsX = m_HeightMapWidth - 1;
+	int cellsZ = m_HeightMapLength - 1;
+
+	__m256 originX = _mm256_set1_ps(m_pHeightMap[0].x + m_vWorldOffset.x);
+	__m256 originZ = _mm256_set1_ps(m_pHeightMap[0].z + m_vWorldOffset.z);
+	__m256 invGridSize = _mm256_set1_ps(1.0f / m_fGridSize);
+	__m256 offsetY = _mm256_set1_ps(m_vWorldOffset.y);
+	__m256 zero = _mm256_setzero_ps();
+	__m256 one = _mm256_set1_ps(1.0f);
+	__m256 signBit = _mm256_set1_ps(-0.0f);
+	__m256 maxX = _mm256_set1_ps((float)cellsX);
+	__m256 maxZ = _mm256_set1_ps((float)cellsZ);
+	__m256i lastCellX = _mm256_set1_epi32(cellsX - 1);
+	__m256i lastCellZ = _mm256_set1_epi32(cellsZ - 1);
+	__m256i width = _mm256_set1_epi32(m_HeightMapWidth);
+	__m256i nextRow = _mm256_set1_epi32(m_HeightMapWidth * 4);
+	__m256i nextColumn = _mm256_set1_epi32(4);
+
+	//Heights are the y of each XMFLOAT4, so indices are in floats from the first y
+	const float* heights = &m_pHeightMap[0].y;
+
+	int i = begin;
+
+	for (; i + 8 <= end; i += 8)
+	{
+		__m256 fx = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&xs[i]), originX), invGridSize), zero), maxX);
+		__m256 fz = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&zs[i]), originZ), invGridSize), zero), maxZ);
+
+		__m256i w = _mm256_min_epi32(_mm256_cvttps_epi32(_mm256_floor_ps(fx)), lastCellX);
+		__m256i l = _mm256_min_epi32(_mm256_cvttps_epi32(_mm256_floor_ps(fz)), lastCellZ);
+
+		__m256 u = _mm256_sub_ps(fx, _mm256_cvtepi32_ps(w));
+		__m256 v = _mm256_sub_ps(fz, _mm256_cvtepi32_ps(l));
+
+		__m256i i00 = _mm256_slli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(l, width), w), 2);
+		__m256i i10 = _mm256_add_epi32(i00, nextColumn);
+		__m256i i01 = _mm256_add_epi32(i00, nextRow);
+		__m256i i11 = _mm256_add_epi32(i01, nextColumn);
+
+		__m256 h00 = _mm256_i32gather_ps(heights, i00, 4);
+		__m256 h10 = _mm256_i32gather_ps(heights, i10, 4);
+		__m256 h01 = _mm256_i32gather_ps(heights, i01, 4);
+		__m256 h11 = _mm256_i32gather_ps(heights, i11, 4);
+
+		__m256 lower = _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ);
+
+		__m256 lowerSlopeX = _mm256_sub_ps(h10, h00);
+		__m256 lowerSlopeZ = _mm256_sub_ps(h01, h00);
+		__m256 lowerHeight = _mm256_add_ps(_mm256_add_ps(h00, _mm256_mul_ps(u, lowerSlopeX)), _mm256_mul_ps(v, lowerSlopeZ));
+
+		__m256 upperSlopeX = _mm256_sub_ps(h11, h01);
+		__m256 upperSlopeZ = _mm256_sub_ps(h11, h10);
+		__m256 upperHeight = _mm256_add_ps(_mm256_add_ps(h11, _mm256_mul_ps(_mm256_sub_ps(one, u), _mm256_sub_ps(h01, h11))), _mm256_mul_ps(_mm256_sub_ps(one, v), _mm256_sub_ps(h10, h11)));
+
+		__m256 height = _mm256_blendv_ps(upperHeight, lowerHeight, lower);
+		_mm256_storeu_ps(&outY[i], _mm256_add_ps(height, offsetY));
+
+		if (outN != nullptr)
+		{
+			__m256 slopeX = _mm256_blendv_ps(upperSlopeX, lowerSlopeX, lower);
+			__m256 slopeZ = _mm256_blendv_ps(upperSlopeZ, lowerSlopeZ, lower);
+
+			//Negated by flipping the sign bit, as the scalar loop does, so flat cells get -0
+			__m256 nx = _mm256_mul_ps(_mm256_xor_ps(slopeX, signBit), invGridSize);
+			__m256 nz = _mm256_mul_ps(_mm256_xor_ps(slopeZ, signBit), invGridSize);
+			__m256 invLength = _mm256_div_ps(one, _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, nx), one), _mm256_mul_ps(nz, nz))));
+
+			//Normals are stored as XMFLOAT3s, so the lanes are written out one at a time
+			float normalX[8], normalY[8], normalZ[8];
+			_mm256_storeu_ps(normalX, _mm256_mul_ps(nx, invLength));
+			_mm256_storeu_ps(normalY, invLength);
+			_mm256_storeu_ps(normalZ, _mm256_mul_ps(nz, invLength));
+
+			for (int lane = 0; lane < 8; lane++)
+			{
+				outN[i + lane] = XMFLOAT3(normalX[lane], normalY[lane], normalZ[lane]);
+			}
+		}
+	}
+
+	return i;
 }
 
 XMFLOAT3 HeightMap::GetPositionOnFace(int faceIndex, int vertIndex)
@@ -244,6 +1114,10 @@ XMFLOAT3 HeightMap::GetPositionOnFace(int faceIndex, int vertIndex)
 		break;
 	}
 
+	returnPos.x += m_vWorldOffset.x;
+	returnPos.y += m_vWorldOffset.y;
+	returnPos.z += m_vWorldOffset.z;
+
 	return returnPos;
 }
 
@@ -254,7 +1128,16 @@ XMFLOAT3 HeightMap::GetPositionOnFace(int faceIndex, int vertIndex)
 HeightMap::~HeightMap()
 {
 	if (m_pHeightMap)
-		delete m_pHeightMap;
+		delete[] m_pHeightMap;
+
+	delete[] m_pFaceData;
+	delete[] m_pCellDirty;
+	delete[] m_pBlockMinMax;
+	delete[] m_pHoleMask;
+	delete[] m_pDistanceField;
+
+#if !defined(PHYSICS_STANDALONE)
+	delete[] m_pMapVtxs;
 
 	for (size_t i = 0; i < NUM_TEXTURE_FILES; ++i)
 	{
@@ -265,16 +1148,18 @@ HeightMap::~HeightMap()
 	Release(m_pHeightMapBuffer);
 
 	DeleteShader();
+#endif
 }
 
+#if !defined(PHYSICS_STANDALONE)
+
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
 void HeightMap::Draw(float frameCount)
 {
 
-	D3DXMATRIX worldMtx;
-	D3DXMatrixIdentity(&worldMtx);
+	XMMATRIX worldMtx = XMMatrixTranslation(m_vWorldOffset.x, m_vWorldOffset.y, m_vWorldOffset.z);
 
 	ID3D11DeviceContext* pContext = Application::s_pApp->GetDeviceContext();
 
@@ -432,11 +1317,32 @@ void HeightMap::DeleteShader()
 	m_shader.Reset();
 }
 
+#endif
+
 void HeightMap::ResetVertexColours()
 {
-	// This resets the collision colouring
-	for (int f = 0; f < m_HeightMapFaceCount; ++f)
+	// This resets the collision colouring, only visiting the faces that were actually coloured
+	for (auto f : m_collidedFaces)
+	{
 		m_pFaceData[f].m_bCollided = false;
+		MarkCellDirty(f / 2);
+	}
+
+	m_collidedFaces.clear();
+}
+
+//Size of the BMP file header (14 bytes) and info header (40 bytes) at the start of the file,
+//and the byte offsets of the fields LoadHeightMap needs. They're read straight from the
+//bytes so loading doesn't need the Windows headers
+static const int BITMAP_HEADERS_SIZE = 54;
+static const int BITMAP_DATA_OFFSET = 10;
+static const int BITMAP_WIDTH_OFFSET = 18;
+static const int BITMAP_HEIGHT_OFFSET = 22;
+
+//Reads a little endian 32 bit field of a BMP header
+static int ReadBitmapInt(const unsigned char* headers, int offset)
+{
+	return (int)((uint32_t)headers[offset] | ((uint32_t)headers[offset + 1] << 8) | ((uint32_t)headers[offset + 2] << 16) | ((uint32_t)headers[offset + 3] << 24));
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -448,37 +1354,37 @@ bool HeightMap::LoadHeightMap(char* filename, float gridSize, float heightRange)
 	FILE* filePtr;
 	int error;
 	int count;
-	BITMAPFILEHEADER bitmapFileHeader;
-	BITMAPINFOHEADER bitmapInfoHeader;
+	unsigned char bitmapHeaders[BITMAP_HEADERS_SIZE];
 	int imageSize, i, j, k, index;
 	unsigned char* bitmapImage;
 	unsigned char height;
 
 
 	// Open the height map file in binary.
+#if defined(_MSC_VER)
 	error = fopen_s(&filePtr, filename, "rb");
+#else
+	filePtr = fopen(filename, "rb");
+	error = filePtr ? 0 : 1;
+#endif
 	if (error != 0)
 	{
 		return false;
 	}
 
-	// Read in the file header.
-	count = fread(&bitmapFileHeader, sizeof(BITMAPFILEHEADER), 1, filePtr);
-	if (count != 1)
-	{
-		return false;
-	}
-
-	// Read in the bitmap info header.
-	count = fread(&bitmapInfoHeader, sizeof(BITMAPINFOHEADER), 1, filePtr);
+	// Read in the file header and the bitmap info header.
+	count = fread(bitmapHeaders, sizeof(bitmapHeaders), 1, filePtr);
 	if (count != 1)
 	{
 		return false;
 	}
 
 	// Save the dimensions of the terrain.
-	m_HeightMapWidth = bitmapInfoHeader.biWidth;
-	m_HeightMapLength = bitmapInfoHeader.biHeight;
+	m_HeightMapWidth = ReadBitmapInt(bitmapHeaders, BITMAP_WIDTH_OFFSET);
+	m_HeightMapLength = ReadBitmapInt(bitmapHeaders, BITMAP_HEIGHT_OFFSET);
+
+	m_fGridSize = gridSize;
+	m_fHeightRange = heightRange;
 
 	// Calculate the size of the bitmap image data.
 	imageSize = m_HeightMapWidth * m_HeightMapLength * 3;
@@ -491,7 +1397,7 @@ bool HeightMap::LoadHeightMap(char* filename, float gridSize, float heightRange)
 	}
 
 	// Move to the beginning of the bitmap data.
-	fseek(filePtr, bitmapFileHeader.bfOffBits, SEEK_SET);
+	fseek(filePtr, ReadBitmapInt(bitmapHeaders, BITMAP_DATA_OFFSET), SEEK_SET);
 
 	// Read in the bitmap image data.
 	count = fread(bitmapImage, 1, imageSize, filePtr);
@@ -545,6 +1451,81 @@ bool HeightMap::LoadHeightMap(char* filename, float gridSize, float heightRange)
 	return true;
 }
 
+//Writes a little endian 32 bit field of a BMP header
+static void WriteBitmapInt(unsigned char* headers, int offset, int value)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		headers[offset + i] = (unsigned char)((uint32_t)value >> (i * 8));
+	}
+}
+
+//Writes heights as a greyscale 24 bit BMP that LoadHeightMap can read back, for generating terrain
+//Params : File name, one height (0-255) per vertex in rows, vertices along each side (width a multiple of 4,
+//LoadHeightMap doesn't skip row padding)
+//Returns : False if the file couldn't be written
+bool HeightMap::SaveHeightMapBitmap(const char* filename, const unsigned char* heights, int width, int length)
+{
+	int imageSize = width * length * 3;
+
+	unsigned char headers[BITMAP_HEADERS_SIZE] = { 0 };
+	headers[0] = 'B';
+	headers[1] = 'M';
+	WriteBitmapInt(headers, 2, BITMAP_HEADERS_SIZE + imageSize);
+	WriteBitmapInt(headers, BITMAP_DATA_OFFSET, BITMAP_HEADERS_SIZE);
+	WriteBitmapInt(headers, 14, 40);
+	WriteBitmapInt(headers, BITMAP_WIDTH_OFFSET, width);
+	WriteBitmapInt(headers, BITMAP_HEIGHT_OFFSET, length);
+	headers[26] = 1;
+	headers[28] = 24;
+	WriteBitmapInt(headers, 34, imageSize);
+
+	std::vector<unsigned char> image((size_t)imageSize);
+
+	for (int i = 0; i < width * length; i++)
+	{
+		image[(i * 3) + 0] = image[(i * 3) + 1] = image[(i * 3) + 2] = heights[i];
+	}
+
+	FILE* filePtr;
+#if defined(_MSC_VER)
+	if (fopen_s(&filePtr, filename, "wb") != 0)
+	{
+		return false;
+	}
+#else
+	filePtr = fopen(filename, "wb");
+	if (filePtr == NULL)
+	{
+		return false;
+	}
+#endif
+
+	bool written = fwrite(headers, sizeof(headers), 1, filePtr) == 1 && fwrite(image.data(), 1, image.size(), filePtr) == image.size();
+
+	return fclose(filePtr) == 0 && written;
+}
+
+//Fills heights with a few crossed sine waves, long ones for hills and a short one for bumps on them
+//Params : Heights to fill (width * length), vertices along each side
+void HeightMap::GenerateRollingHeights(unsigned char* heights, int width, int length)
+{
+	const float twoPi = 6.28318530718f;
+
+	for (int l = 0; l < length; l++)
+	{
+		for (int w = 0; w < width; w++)
+		{
+			float hills = sinf(w * twoPi / 97.0f) * cosf(l * twoPi / 131.0f);
+			float ridges = sinf((w + l) * twoPi / 53.0f);
+			float bumps = sinf(w * twoPi / 17.0f) * sinf(l * twoPi / 19.0f);
+
+			float height = 0.5f + (0.3f * hills) + (0.12f * ridges) + (0.05f * bumps);
+			heights[(l * width) + w] = (unsigned char)(min(max(height, 0.0f), 1.0f) * 255.0f);
+		}
+	}
+}
+
 
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
@@ -559,18 +1540,181 @@ bool HeightMap::PointOverQuad(XMVECTOR& vPos, XMVECTOR& v0, XMVECTOR& v1, XMVECT
 	return false;
 }
 
-int g_badIndex = 0;
+//Narrows [tEnter, tExit] to the part of a ray between two planes on one axis
+//Params : Ray start and direction on the axis, planes, interval to narrow
+//Returns : False if nothing of the interval is left
+static bool ClipRaySlab(float origin, float direction, float slabMin, float slabMax, float& tEnter, float& tExit)
+{
+	if (direction == 0.0f)
+	{
+		return origin >= slabMin && origin <= slabMax;
+	}
+
+	float t0 = (slabMin - origin) / direction;
+	float t1 = (slabMax - origin) / direction;
+
+	tEnter = max(tEnter, min(t0, t1));
+	tExit = min(tExit, max(t0, t1));
 
-bool HeightMap::RayCollision(XMVECTOR& rayPos, XMVECTOR rayDir, float raySpeed, XMVECTOR& colPos, XMVECTOR& colNormN)
+	return tEnter <= tExit;
+}
+
+//Finds the nearest face a ray hits, walking only the cells under the ray and skipping those where it
+//passes above or below the cell's block. Only reads the heightmap, so several threads can call it at once
+//Params : World space ray start and normalised direction, furthest distance to look, distance along the
+//ray, world position, normal and index of the face hit to fill in
+//Returns : True if a face was hit within the distance
+bool HeightMap::Raycast(const XMVECTOR& origin, const XMVECTOR& direction, float maxDistance, float& hitDistance, XMVECTOR& hitPosition, XMVECTOR& hitNormal, int& hitFace) const
 {
+	XMVECTOR offset = XMLoadFloat3(&m_vWorldOffset);
+
+	XMFLOAT3 o, d;
+	XMStoreFloat3(&o, origin - offset);
+	XMStoreFloat3(&d, direction);
+
+	float originX = m_pHeightMap[0].x;
+	float originZ = m_pHeightMap[0].z;
+	int cellsX = m_HeightMapWidth - 1;
+	int cellsZ = m_HeightMapLength - 1;
+
+	//Only the part of the ray over the heightmap can hit it
+	float tEnter = 0.0f;
+	float tExit = maxDistance;
+
+	if (!ClipRaySlab(o.x, d.x, originX, originX + (cellsX * m_fGridSize), tEnter, tExit) ||
+		!ClipRaySlab(o.z, d.z, originZ, originZ + (cellsZ * m_fGridSize), tEnter, tExit))
+	{
+		return false;
+	}
+
+	//Walk the cells the ray crosses in order (Amanatides & Woo), so the first hit is the nearest
+	int cx = min(max((int)floorf((o.x + (d.x * tEnter) - originX) / m_fGridSize), 0), cellsX - 1);
+	int cz = min(max((int)floorf((o.z + (d.z * tEnter) - originZ) / m_fGridSize), 0), cellsZ - 1);
+
+	int stepX = d.x > 0.0f ? 1 : -1;
+	int stepZ = d.z > 0.0f ? 1 : -1;
+
+	float tDeltaX = d.x != 0.0f ? m_fGridSize / fabsf(d.x) : FLT_MAX;
+	float tDeltaZ = d.z != 0.0f ? m_fGridSize / fabsf(d.z) : FLT_MAX;
+
+	float tNextX = d.x != 0.0f ? (originX + ((cx + (stepX > 0 ? 1 : 0)) * m_fGridSize) - o.x) / d.x : FLT_MAX;
+	float tNextZ = d.z != 0.0f ? (originZ + ((cz + (stepZ > 0 ? 1 : 0)) * m_fGridSize) - o.z) / d.z : FLT_MAX;
+
+	float t = tEnter;
+
+	while (t <= tExit)
+	{
+		float tCellExit = min(min(tNextX, tNextZ), tExit);
+
+		//Skip the cell if the ray is wholly above or below its block while over it
+		float y0 = o.y + (d.y * t);
+		float y1 = o.y + (d.y * tCellExit);
+		const XMFLOAT2& bounds = m_pBlockMinMax[((cz / BLOCK_SIZE) * m_iBlockCountX) + (cx / BLOCK_SIZE)];
+
+		if (min(y0, y1) <= bounds.y && max(y0, y1) >= bounds.x)
+		{
+			int cellFace = ((cz * cellsX) + cx) * 2;
+			float bestDistance = FLT_MAX;
+			int bestFace = -1;
+
+			for (int f = cellFace; f < cellFace + 2; ++f)
+			{
+				float distance;
+
+				if (!IsFaceDisabled(f) && RayFace(f, o, d, distance) && distance <= maxDistance && distance < bestDistance)
+				{
+					bestDistance = distance;
+					bestFace = f;
+				}
+			}
+
+			if (bestFace >= 0)
+			{
+				hitDistance = bestDistance;
+				hitPosition = origin + (direction * bestDistance);
+				hitNormal = XMLoadFloat3(&m_pFaceData[bestFace].m_vNormal);
+				hitFace = bestFace;
+				return true;
+			}
+		}
+
+		//Step into whichever neighbouring cell the ray reaches first
+		if (tNextX < tNextZ)
+		{
+			cx += stepX;
+			t = tNextX;
+			tNextX += tDeltaX;
+		}
+		else
+		{
+			cz += stepZ;
+			t = tNextZ;
+			tNextZ += tDeltaZ;
+		}
+
+		if (cx < 0 || cx >= cellsX || cz < 0 || cz >= cellsZ)
+		{
+			break;
+		}
+	}
+
+	return false;
+}
+
+//Two sided ray vs face test (Moller-Trumbore)
+//Params : Face, local space ray start and normalised direction, distance along the ray to fill in
+//Returns : True if the ray hits the face in front of its start
+bool HeightMap::RayFace(int faceIndex, const XMFLOAT3& origin, const XMFLOAT3& direction, float& distance) const
+{
+	const FaceCollisionData& face = m_pFaceData[faceIndex];
+
+	XMVECTOR v0 = XMLoadFloat3(&face.m_v0);
+	XMVECTOR edge1 = XMLoadFloat3(&face.m_v1) - v0;
+	XMVECTOR edge2 = XMLoadFloat3(&face.m_v2) - v0;
+	XMVECTOR dir = XMLoadFloat3(&direction);
+
+	XMVECTOR p = XMVector3Cross(dir, edge2);
+	float det = XMVectorGetX(XMVector3Dot(edge1, p));
+
+	//Ray parallel to the face
+	if (fabsf(det) < 1e-8f)
+	{
+		return false;
+	}
+
+	float invDet = 1.0f / det;
+	XMVECTOR s = XMLoadFloat3(&origin) - v0;
+
+	float u = XMVectorGetX(XMVector3Dot(s, p)) * invDet;
+	if (u < 0.0f || u > 1.0f)
+	{
+		return false;
+	}
+
+	XMVECTOR q = XMVector3Cross(s, edge1);
+
+	float v = XMVectorGetX(XMVector3Dot(dir, q)) * invDet;
+	if (v < 0.0f || u + v > 1.0f)
+	{
+		return false;
+	}
+
+	distance = XMVectorGetX(XMVector3Dot(edge2, q)) * invDet;
+
+	return distance >= 0.0f;
+}
+
+bool HeightMap::RayCollision(XMVECTOR& worldRayPos, XMVECTOR rayDir, float raySpeed, XMVECTOR& colPos, XMVECTOR& colNormN)
+{
+	XMVECTOR offset = XMLoadFloat3(&m_vWorldOffset);
+	XMVECTOR rayPos = worldRayPos - offset;
 
 	XMVECTOR v0, v1, v2, v3;
 	int i0, i1, i2, i3;
 	float colDist = 0.0f;
 
 	// This resets the collision colouring
-	for (int f = 0; f < m_HeightMapFaceCount; ++f)
-		m_pFaceData[f].m_bCollided = false;
+	ResetVertexColours();
 
 #ifdef COLOURTEST
 	// This is just a piece of test code for the map colouring
@@ -591,17 +1735,31 @@ bool HeightMap::RayCollision(XMVECTOR& rayPos, XMVECTOR rayDir, float raySpeed,
 
 
 	// This is a brute force solution that checks against every triangle in the heightmap
-	for (int f = 0; f < m_HeightMapFaceCount; ++f)
+	for (int f = 0; f < m_HeightMapFaceCount; )
 	{
-		//012 213
-		if (!m_pFaceData[f].m_bDisabled && RayTriangle(f, rayPos, rayDir, colPos, colNormN, colDist))
+		//Skip 64 faces at a time through fully disabled runs of the hole mask
+		uint64_t holes = m_pHoleMask[f >> 6];
+		int wordEnd = min(m_HeightMapFaceCount, (f | 63) + 1);
+
+		if (holes == ~0ULL)
+		{
+			f = wordEnd;
+			continue;
+		}
+
+		for (; f < wordEnd; ++f)
 		{
-			// Needs to be >=0 
-			if (colDist <= raySpeed && colDist >= 0.0f)
+			//012 213
+			if (!((holes >> (f & 63)) & 1) && RayTriangle(f, rayPos, rayDir, colPos, colNormN, colDist))
 			{
-				m_pFaceData[f].m_bCollided = true;
-				RebuildVertexData();
-				return true;
+				// Needs to be >=0 
+				if (colDist <= raySpeed && colDist >= 0.0f)
+				{
+					colPos += offset;
+					MarkFaceCollided(f);
+					RebuildVertexData();
+					return true;
+				}
 			}
 		}
 	}
@@ -680,7 +1838,7 @@ bool HeightMap::RayTriangle(int nFaceIndex, const XMVECTOR& rayPos, const XMVECT
 	XMVECTOR rDir = XMVector3Normalize(rayDir);
 	XMVECTOR denom = XMVector3Dot(colNormN, rDir);
 
-	if (denom.m128_f32[0] == 0)
+	if (XMVectorGetX(denom) == 0)
 	{
 		return false;
 	}
@@ -694,7 +1852,7 @@ bool HeightMap::RayTriangle(int nFaceIndex, const XMVECTOR& rayPos, const XMVECT
 
 	XMVECTOR coldist = numer / denom;
 
-	if (coldist.m128_f32[0] < 0)
+	if (XMVectorGetX(coldist) < 0)
 		return false;
 
 	XMStoreFloat(&colDist, coldist);
@@ -746,21 +1904,33 @@ bool HeightMap::RayTriangle(int nFaceIndex, const XMVECTOR& rayPos, const XMVECT
 	return true;
 }
 
-bool HeightMap::SphereTriangle(const XMVECTOR & centre, const float radius, XMVECTOR & colPos, XMVECTOR & colNormN, float & colDist)
+bool HeightMap::SphereTriangle(const XMVECTOR & worldCentre, const float radius, XMVECTOR & colPos, XMVECTOR & colNormN, float & colDist)
 {
+	XMVECTOR offset = XMLoadFloat3(&m_vWorldOffset);
+	XMVECTOR centre = worldCentre - offset;
 	// This resets the collision colouring
-	for (int f = 0; f < m_HeightMapFaceCount; ++f)
-		m_pFaceData[f].m_bCollided = false;
+	ResetVertexColours();
 
 	// This is a brute force solution that checks against every triangle in the heightmap
-	for (int f = 0; f < m_HeightMapFaceCount; ++f)
+	for (int f = 0; f < m_HeightMapFaceCount; )
 	{
-		//012 213
-		if (!m_pFaceData[f].m_bDisabled)
+		//Skip 64 faces at a time through fully disabled runs of the hole mask
+		uint64_t holes = m_pHoleMask[f >> 6];
+		int wordEnd = min(m_HeightMapFaceCount, (f | 63) + 1);
+
+		if (holes == ~0ULL)
 		{
-			if (TestSphereTriangle(centre, radius, f, colPos, colNormN))
+			f = wordEnd;
+			continue;
+		}
+
+		for (; f < wordEnd; ++f)
+		{
+			//012 213
+			if (!((holes >> (f & 63)) & 1) && TestSphereTriangle(centre, radius, f, colPos, colNormN))
 			{
-				m_pFaceData[f].m_bCollided = true;
+				colPos += offset;
+				MarkFaceCollided(f);
 				RebuildVertexData();
 				return true;
 			}
@@ -818,31 +1988,101 @@ bool HeightMap::PointPlane(const XMVECTOR& vert0, const XMVECTOR& vert1, const X
 }
 
 //TODO : Move this into PhysicsWorld
-std::vector<PhysicsStaticCollision> HeightMap::SphereHeightmap(DynamicBody * body)
+//Finds the faces a sphere is touching. Only reads the heightmap, so several threads can
+//call it at once. The faces aren't marked as collided, see MarkFaceCollided
+//Params : Body store index of the sphere, world position of its centre, radius, list to append a
+//collision to for each face touched (reused by the caller, so nothing is allocated once it's grown)
+//Returns : Number of collisions appended
+int HeightMap::SphereHeightmap(int body, const XMVECTOR& position, float radius, std::vector<PhysicsStaticCollision>& collisionList)
 {
-	std::vector<PhysicsStaticCollision> collisionList;
+	size_t firstCollision = collisionList.size();
 
-	// This is a brute force solution that checks against every triangle in the heightmap
-	for (int f = 0; f < m_HeightMapFaceCount; ++f)
+	//Work in the heightmap's local space
+	XMVECTOR offset = XMLoadFloat3(&m_vWorldOffset);
+	XMVECTOR centre = position - offset;
+
+	//A single lookup replaces the per face tests when the distance field is selected
+	if (m_eContactMode == CONTACT_DISTANCE_FIELD)
 	{
 		PhysicsStaticCollision collision(body);
 
-		//012 213
-		if (!m_pFaceData[f].m_bDisabled)
-		{	
-			if (TestSphereTriangle(body->GetPosition(), body->GetRadius(), f, collision.collisionPosition, collision.collisionNormal))
+		if (SphereDistanceField(centre, radius, collision))
+		{
+			collision.collisionPosition += offset;
+			collisionList.push_back(collision);
+		}
+
+		return (int)(collisionList.size() - firstCollision);
+	}
+
+	//The grid is regular, so only the cells under the sphere's footprint can be touched
+	int cx0, cz0, cx1, cz1;
+	if (!GetCellRange(XMVectorGetX(centre) - radius, XMVectorGetZ(centre) - radius, XMVectorGetX(centre) + radius, XMVectorGetZ(centre) + radius, cx0, cz0, cx1, cz1))
+	{
+		return 0;
+	}
+
+	float sphereMinY = XMVectorGetY(centre) - radius;
+	float sphereMaxY = XMVectorGetY(centre) + radius;
+
+	for (int bz = cz0 / BLOCK_SIZE; bz <= cz1 / BLOCK_SIZE; ++bz)
+	{
+		for (int bx = cx0 / BLOCK_SIZE; bx <= cx1 / BLOCK_SIZE; ++bx)
+		{
+			//Skip whole blocks that the sphere is above or below
+			const XMFLOAT2& bounds = m_pBlockMinMax[(bz * m_iBlockCountX) + bx];
+			if (sphereMinY > bounds.y || sphereMaxY < bounds.x)
 			{
-				m_pFaceData[f].m_bCollided = true;
+				continue;
+			}
 
-				collision.penetrationDepth = -(XMVectorGetX(XMVector3Length(collision.collisionPosition - body->GetPosition())) - body->GetRadius());
+			int l1 = min(cz1, (bz * BLOCK_SIZE) + BLOCK_SIZE - 1);
+			int w1 = min(cx1, (bx * BLOCK_SIZE) + BLOCK_SIZE - 1);
 
-				bool repeat = false;
-				collisionList.push_back(collision);
+			for (int l = max(cz0, bz * BLOCK_SIZE); l <= l1; ++l)
+			{
+				//The faces of a cell row are contiguous, so walk them a mask word at a time
+				int rowFace = l * (m_HeightMapWidth - 1) * 2;
+				int lastFace = rowFace + (w1 * 2) + 1;
+
+				for (int f = rowFace + (max(cx0, bx * BLOCK_SIZE) * 2); f <= lastFace; )
+				{
+					uint64_t holes = m_pHoleMask[f >> 6];
+					int wordEnd = min(lastFace, f | 63);
+
+					//Fully disabled run, skip up to 64 faces at once
+					if (holes == ~0ULL)
+					{
+						f = wordEnd + 1;
+						continue;
+					}
+
+					//012 213
+					for (; f <= wordEnd; ++f)
+					{
+						if ((holes >> (f & 63)) & 1)
+						{
+							continue;
+						}
+
+						PhysicsStaticCollision collision(body);
+
+						if (TestSphereTriangle(centre, radius, f, collision.collisionPosition, collision.collisionNormal))
+						{
+							collision.faceIndex = f;
+
+							collision.penetrationDepth = -(XMVectorGetX(XMVector3Length(collision.collisionPosition - centre)) - radius);
+							collision.collisionPosition += offset;
+
+							collisionList.push_back(collision);
+						}
+					}
+				}
 			}
 		}
 	}
 
-	return collisionList;
+	return (int)(collisionList.size() - firstCollision);
 }
 
 
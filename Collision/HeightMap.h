@@ -9,8 +9,19 @@
 // Notes:			
 //**********************************************************************
 
-#include "Application.h"
+#include <stdint.h>
+#include <vector>
+
 #include "PhysicsWorld.h"
+#include "CpuFeatures.h"
+
+class SnapshotWriter;
+class SnapshotReader;
+
+//Standalone builds (PHYSICS_STANDALONE) have only the collision data, the vertex
+//buffer, textures and shader need the D3D application
+#if !defined(PHYSICS_STANDALONE)
+#include "Application.h"
 
 static const char *const g_aTextureFileNames[] = {
 	"Resources/Intersection.dds",       
@@ -20,6 +31,7 @@ static const char *const g_aTextureFileNames[] = {
 };
 
 static const size_t NUM_TEXTURE_FILES = sizeof g_aTextureFileNames / sizeof g_aTextureFileNames[0];
+#endif
 
 class HeightMap
 {
@@ -27,26 +39,136 @@ public:
 	HeightMap( char* filename, float gridSize, float heightRange );
 	~HeightMap();
 
+#if !defined(PHYSICS_STANDALONE)
 	void Draw( float frameCount );
 	bool ReloadShader();
 	void DeleteShader();
+#endif
 
 	void ResetVertexColours();
 	void RebuildVertexData(void);
 
-	std::vector<PhysicsStaticCollision> SphereHeightmap(DynamicBody* body);
+	//How a height edit combines with the existing heights
+	enum HeightEditMode
+	{
+		HEIGHT_EDIT_SET,
+		HEIGHT_EDIT_ADD,
+	};
+
+	//Modifies the heights of a rectangular region of vertices (inclusive grid coordinates)
+	//Only the faces touching the region have their collision data rebuilt and are marked for upload.
+	//A PhysicsWorld the heightmap is in wakes the bodies over the edit at its next step
+	//Params : Min/max vertex column, min/max vertex row, height value, how to combine the value
+	void ModifyHeights(int x0, int z0, int x1, int z1, float value, HeightEditMode mode);
+
+	//Raises (positive strength) or lowers (negative strength) the terrain with a smooth falloff brush.
+	//As with ModifyHeights, a world the heightmap is in wakes the bodies over it at its next step
+	//Params : World position of the brush centre (only X and Z are used), brush radius, height change at the centre
+	void ApplyBrush(const XMVECTOR& centre, float radius, float strength);
+
+	//Gets the world space X/Z rectangle covering every face rebuilt by an edit since the last call, and
+	//forgets it. PhysicsWorld takes it each step so bodies asleep on edited ground wake up
+	//Returns : False if nothing has been edited since the last call
+	bool TakeEditedBoundsXZ(float& minX, float& minZ, float& maxX, float& maxZ);
+
+	//Finds the faces a sphere is touching. Only reads the heightmap, so several threads can
+	//call it at once. The faces aren't marked as collided, see MarkFaceCollided
+	//Params : Body store index of the sphere, world position of its centre, radius, list to append a
+	//collision to for each face touched (reused by the caller, so nothing is allocated once it's grown)
+	//Returns : Number of collisions appended
+	int SphereHeightmap(int body, const XMVECTOR& position, float radius, std::vector<PhysicsStaticCollision>& collisionList);
+
+	//Sets the debug collision colour on a face and remembers it for ResetVertexColours
+	void MarkFaceCollided(int faceIndex);
 
 	bool RayCollision(XMVECTOR& rayPos, XMVECTOR rayDir, float speed, XMVECTOR& colPos, XMVECTOR& colNormN);
+
+	//Finds the nearest face a ray hits, walking only the cells under the ray and skipping those where it
+	//passes above or below the cell's block. Only reads the heightmap, so several threads can call it at once
+	//Params : World space ray start and normalised direction, furthest distance to look, distance along the
+	//ray, world position, normal and index of the face hit to fill in
+	//Returns : True if a face was hit within the distance
+	bool Raycast(const XMVECTOR& origin, const XMVECTOR& direction, float maxDistance, float& hitDistance, XMVECTOR& hitPosition, XMVECTOR& hitNormal, int& hitFace) const;
 	bool SphereTriangle(const XMVECTOR& centre, const float radius, XMVECTOR& colPos, XMVECTOR& colNormN, float& colDist);
 	int DisableBelowLevel(float fY);
 	int EnableAll(void);
 
+	//Disables (punches a hole in) or re-enables every face in a rectangle of cells (inclusive grid coordinates)
+	//Params : Min/max cell column, min/max cell row, whether the faces should be disabled
+	//Returns : Number of faces whose state changed
+	int SetRegionDisabled(int cx0, int cz0, int cx1, int cz1, bool disabled);
+
+	//Returns : True if the face is currently part of a hole
+	bool IsFaceDisabled(int faceIndex) const { return ((m_pHoleMask[faceIndex >> 6] >> (faceIndex & 63)) & 1) != 0; }
+
+	//Adds the hole mask to a world snapshot
+	//Params : Writer, index of the heightmap's tile in the world
+	void WriteSnapshot(SnapshotWriter& writer, int tile) const;
+
+	//Checks a snapshot has a hole mask the size of this heightmap's for a tile
+	bool CheckSnapshot(const SnapshotReader& reader, int tile) const;
+
+	//Replaces the hole mask with a tile's from a snapshot that passed CheckSnapshot
+	void ReadSnapshot(const SnapshotReader& reader, int tile);
+
 	XMFLOAT3 GetPositionOnFace(int faceIndex, int vertIndex);
 
+	//Samples the terrain height and surface normal under many points, on the same triangle split as the
+	//collision faces. Runs 8 samples at a time with AVX2 when the CPU has it, giving the same results as
+	//the scalar loop. Points off the heightmap are clamped to its edge. Only reads the heightmap
+	//Params : World space X and Z of each point, heights to fill in, normals to fill in (nullptr to skip), number of points
+	void SampleHeights(const float* xs, const float* zs, float* outY, XMFLOAT3* outN, int count) const;
+
+	//Set/Get the instruction set SampleHeights uses (clamped to what the CPU supports)
+	void SetSimdLevel(SimdLevel level);
+	SimdLevel GetSimdLevel() const { return m_eSimdLevel; }
+
+	//Places the heightmap in the world. All collision queries and drawing take world space
+	//positions and are translated by this offset
+	//Params : World position of the heightmap's centre
+	void SetWorldOffset(const XMFLOAT3& offset);
+	const XMFLOAT3& GetWorldOffset() const { return m_vWorldOffset; }
+
+	//Gets the world space X/Z extents covered by the heightmap
+	void GetWorldBoundsXZ(float& minX, float& minZ, float& maxX, float& maxZ) const;
+
+	//Which test SphereHeightmap uses for sphere contacts
+	enum ContactMode
+	{
+		CONTACT_TRIANGLES,
+		CONTACT_DISTANCE_FIELD,
+	};
+
+	//Selects the sphere contact test. Selecting the distance field bakes it from the current heights.
+	//The field stores the surface height and slope per sample, so a contact is one bilinear lookup instead of
+	//closest point tests against every face under the sphere, at the cost of memory and some accuracy on sharp ridges
+	//Params : Contact mode, distance field samples along each side of a cell, job system the rows are baked
+	//across (the world's, see PhysicsWorld::GetJobSystem), nullptr to bake on this thread
+	void SetContactMode(ContactMode mode, int samplesPerCell = 2, JobSystem* pJobSystem = nullptr);
+	ContactMode GetContactMode() const { return m_eContactMode; }
+
+	//Returns : Bytes used by the baked distance field (0 if not baked)
+	size_t GetDistanceFieldMemory() const;
+
+	//Returns : Bytes used by the face data the triangle contact test reads
+	size_t GetFaceDataMemory() const;
+
+	//Writes heights as a greyscale BMP the constructor can load, for generating terrain
+	//Params : File name, one height (0-255) per vertex in rows, vertices along each side (width a multiple of 4)
+	//Returns : False if the file couldn't be written
+	static bool SaveHeightMapBitmap(const char* filename, const unsigned char* heights, int width, int length);
+
+	//Fills heights with smooth rolling hills for SaveHeightMapBitmap, the same every time for a size
+	//Params : Heights to fill (width * length), vertices along each side
+	static void GenerateRollingHeights(unsigned char* heights, int width, int length);
+
 public :
 
 	int m_iFaceCount;
 
+	//Number of cells along each side of a min/max height block
+	static const int BLOCK_SIZE = 16;
+
 private:
 
 	struct FaceCollisionData
@@ -57,11 +179,15 @@ private:
 		XMFLOAT3 m_vCentre;
 		XMFLOAT3 m_vNormal;
 		bool m_bCollided; // Debug colouring
-		bool m_bDisabled;
 	};
 
 	bool LoadHeightMap(char* filename, float gridSize, float heightRange);
 	bool RayTriangle(int nFaceIndex, const XMVECTOR& rayPos, const XMVECTOR& rayDir, XMVECTOR& colPos, XMVECTOR& colNormN, float& colDist);
+
+	//Two sided ray vs face test (Moller-Trumbore)
+	//Params : Face, local space ray start and normalised direction, distance along the ray to fill in
+	//Returns : True if the ray hits the face in front of its start
+	bool RayFace(int faceIndex, const XMFLOAT3& origin, const XMFLOAT3& direction, float& distance) const;
 	
 
 	bool TestSphereTriangle(XMVECTOR centre, float radius, int nFaceIndex, XMVECTOR& p, XMVECTOR& colNormN);
@@ -71,12 +197,65 @@ private:
 	bool PointOverQuad(XMVECTOR& vPos, XMVECTOR& v0, XMVECTOR& v1, XMVECTOR& v2);
 	void BuildCollisionData(void);
 
+	//Rebuilds the two faces of a single grid cell from the current heights
+	void BuildCellCollisionData(int w, int l);
+
+	//Rebuilds the faces, block bounds and dirty flags for a rectangle of cells (inclusive)
+	void RebuildCollisionRegion(int cx0, int cz0, int cx1, int cz1);
+
+	//Recomputes the min/max height of a single block from the vertices of its faces
+	void UpdateBlockBounds(int bx, int bz);
+
+	//Writes the six vertices of a cell into the CPU-side vertex copy
+	void BuildCellVertices(int cellIndex);
+
+	//Flags a cell so its vertices are rebuilt on the next RebuildVertexData
+	void MarkCellDirty(int cellIndex);
+
+	//Sets or clears the hole bits for a contiguous run of faces (inclusive), a whole mask word at a time
+	//Returns : Number of faces whose state changed
+	int SetFaceRangeDisabled(int firstFace, int lastFace, bool disabled);
+
+	//Height of the terrain surface inside a cell, using the same triangle split as BuildCollisionData
+	//Params : Cell column and row, position inside the cell (0-1 on each axis)
+	float InterpolateHeight(int w, int l, float u, float v) const;
+
+	//Bakes the whole distance field, splitting the rows across a job system's workers (nullptr for this thread)
+	void BakeDistanceField(int samplesPerCell, JobSystem* pJobSystem);
+
+	//Bakes the heights, then the slopes, of a range of distance field rows (inclusive)
+	void BakeDistanceFieldHeights(int z0, int z1);
+	void BakeDistanceFieldSlopes(int z0, int z1);
+
+	//Job entry points, bake the heights or slopes of a run of distance field rows
+	static void BakeHeightsTask(void* context, int begin, int end, int worker);
+	static void BakeSlopesTask(void* context, int begin, int end, int worker);
+
+	//Rebakes the part of the distance field covering a rectangle of cells after an edit
+	void BakeDistanceFieldRegion(int cx0, int cz0, int cx1, int cz1);
+
+	//Sphere contact from a bilinear sample of the distance field
+	//Params : Local space sphere centre and radius, collision to fill in
+	//Returns : True if the sphere touches the surface
+	bool SphereDistanceField(const XMVECTOR& centre, float radius, PhysicsStaticCollision& collision);
+
+	//SampleHeights implementations. The scalar version also finishes off the samples left over
+	//after the AVX2 version, which returns where it stopped
+	void SampleHeightsScalar(int begin, int end, const float* xs, const float* zs, float* outY, XMFLOAT3* outN) const;
+	int SampleHeightsAVX2(int begin, int end, const float* xs, const float* zs, float* outY, XMFLOAT3* outN) const;
+
+	//Converts a local space X/Z rectangle into an inclusive, clamped range of cells
+	//Returns : False if the rectangle doesn't overlap the heightmap at all
+	bool GetCellRange(float minX, float minZ, float maxX, float maxZ, int& cx0, int& cz0, int& cx1, int& cz1);
+
 
 
 	XMFLOAT3 GetFaceNormal( int faceIndex, int offset );
 	XMFLOAT3 GetAveragedVertexNormal(int index, int row);
 	
+#if !defined(PHYSICS_STANDALONE)
 	ID3D11Buffer *m_pHeightMapBuffer;
+#endif
 
 	int m_HeightMapWidth;
 	int m_HeightMapLength;
@@ -84,8 +263,57 @@ private:
 	int m_HeightMapFaceCount;
 	XMFLOAT4* m_pHeightMap;
 	FaceCollisionData* m_pFaceData;
+#if !defined(PHYSICS_STANDALONE)
 	Vertex_Pos3fColour4ubNormal3fTex2f* m_pMapVtxs;
+#endif
+
+	//World position of the heightmap, added to the locally centred vertex positions
+	XMFLOAT3 m_vWorldOffset;
+
+	//Grid spacing and height scale passed to LoadHeightMap
+	float m_fGridSize;
+	float m_fHeightRange;
+
+	//Min (x) and max (y) face height of each BLOCK_SIZE x BLOCK_SIZE block of cells
+	int m_iBlockCountX;
+	int m_iBlockCountZ;
+	XMFLOAT2* m_pBlockMinMax;
+
+	//Cells whose vertices need rebuilding in m_pMapVtxs before the next upload
+	unsigned char* m_pCellDirty;
+	std::vector<int> m_dirtyCells;
+	bool m_bAllCellsDirty;
 
+	//Inclusive range of cells rebuilt by edits since the last TakeEditedBoundsXZ
+	bool m_bEdited;
+	int m_iEditedCellX0;
+	int m_iEditedCellZ0;
+	int m_iEditedCellX1;
+	int m_iEditedCellZ1;
+
+	//Packed hole mask, one bit per face (set = disabled). Faces of a cell row are contiguous,
+	//so collision loops can consume 64 faces per word and skip fully disabled runs
+	uint64_t* m_pHoleMask;
+	int m_iHoleMaskWords;
+	int m_iDisabledFaceCount;
+
+	//Contact test used by SphereHeightmap
+	ContactMode m_eContactMode;
+
+	//Instruction set used by SampleHeights
+	SimdLevel m_eSimdLevel;
+
+	//Baked 2.5D distance field. Per sample: surface height (x) and its slope along X (y) and Z (z)
+	XMFLOAT3* m_pDistanceField;
+	int m_iFieldSamplesPerCell;
+	int m_iFieldWidth;
+	int m_iFieldLength;
+	float m_fFieldSpacing;
+
+	//Faces currently flagged with m_bCollided, so they can be reset without a full scan
+	std::vector<int> m_collidedFaces;
+
+#if !defined(PHYSICS_STANDALONE)
 	Application::Shader m_shader;
 	
 	ID3D11Buffer *m_pPSCBuffer;
@@ -106,6 +334,7 @@ private:
 	ID3D11Texture2D *m_pTextures[NUM_TEXTURE_FILES];
 	ID3D11ShaderResourceView *m_pTextureViews[NUM_TEXTURE_FILES];
 	ID3D11SamplerState *m_pSamplerState;
+#endif
 
 };
 
@@ -5,7 +5,17 @@
 const int MAX_OBJECTS = 100;
 const float GRAVITY = -15.0f;
 
+//Bodies falling below this height are deactivated
+const float KILL_PLANE_Y = -10.0f;
+
+//Default fixed physics rate (steps per second) and cap on steps run per frame
+const float PHYSICS_STEP_RATE = 60.0f;
+const int PHYSICS_MAX_SUBSTEPS = 4;
+
 
 const int MAX_HEIGHTMAPS = 4;
 
+//Seed the random sphere positions start from, so every run drops the same spheres
+const unsigned int RANDOM_SEED = 12345;
+
 #endif
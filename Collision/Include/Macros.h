@@ -1,7 +1,14 @@
 #ifndef _MACROS_H_
 #define _MACROS_H_
 
+#if defined(_MSC_VER)
+#include <malloc.h>
 #define XMALIGN __declspec(align(16))
+#else
+#include <mm_malloc.h>
+//GCC and Clang align the classes to their vector members
+#define XMALIGN
+#endif
 
 #define XMNEW void* operator new(size_t i)	\
 		{									\
@@ -13,5 +20,25 @@
 			_mm_free(p);						\
 		}							
 
+//windows.h provides min and max as macros, builds without it use the std versions
+#if !defined(min) && !defined(max)
+#include <algorithm>
+using std::min;
+using std::max;
+#endif
+
+#include <vector>
+
+//Makes room for at least count elements, at least doubling the capacity when it has to grow. Once a
+//vector has shrunk, resize and assign only allocate exactly what they're asked for, so a buffer reused
+//every step would otherwise be reallocated every time it needs a little more than ever before
+template<typename T>
+inline void ReserveGrowth(std::vector<T>& values, size_t count)
+{
+	if (values.capacity() < count)
+	{
+		values.reserve(count > values.capacity() * 2 ? count : values.capacity() * 2);
+	}
+}
 
 #endif
@@ -22,18 +22,15 @@ public:
 	Sphere(CommonMesh* mMesh, float mRadius);
 	~Sphere();
 
-	void Update();
+	//Sets the world matrix to draw with, built from a published (and interpolated) position rather than the live body state
+	//Params : World matrix
+	void Update(const XMMATRIX& worldMatrix);
 	void Draw();
 
-private:
-	void UpdateMatrices();
-
 public :
 	
 private:
 
-	float m_fSpeed;
-
 	XMMATRIX m_mWorldMatrix;
 
 public:
@@ -0,0 +1,437 @@
+#include "JobSystem.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+//The job system (if any) the current thread is a worker of, and its index there
+static thread_local JobSystem* t_pJobSystem = nullptr;
+static thread_local int t_iWorker = 0;
+
+
+JobSystem::JobSystem()
+{
+	m_pJobRing = new Job[JOB_RING_SIZE];
+	m_iNextJob = 0;
+
+	m_iWorkerCount = 1;
+	m_bPinToCores = false;
+	m_iQueuedJobs = 0;
+	m_bStopping = false;
+
+	m_pTimingHook = nullptr;
+	m_pTimingUser = nullptr;
+	m_startTime = std::chrono::high_resolution_clock::now();
+
+	m_queues.push_back(new WorkerQueue());
+}
+
+JobSystem::~JobSystem()
+{
+	StopWorkers();
+
+	for (auto queue : m_queues)
+	{
+		delete queue;
+	}
+
+	delete[] m_pJobRing;
+}
+
+//Sets the number of workers (including the owning thread), restarting the worker threads
+//Params : Worker count, clamped to at least 1
+void JobSystem::SetWorkerCount(int count)
+{
+	if (count < 1)
+	{
+		count = 1;
+	}
+
+	if (count == m_iWorkerCount)
+	{
+		return;
+	}
+
+	StopWorkers();
+
+	for (auto queue : m_queues)
+	{
+		delete queue;
+	}
+
+	m_queues.clear();
+	m_iWorkerCount = count;
+
+	for (int i = 0; i < m_iWorkerCount; i++)
+	{
+		m_queues.push_back(new WorkerQueue());
+	}
+
+	StartWorkers();
+}
+
+//Set/Get whether worker threads are pinned to a core each (worker i to core i)
+void JobSystem::SetCorePinning(bool pin)
+{
+	if (pin == m_bPinToCores)
+	{
+		return;
+	}
+
+	m_bPinToCores = pin;
+
+	//Pinning happens as each thread starts
+	StopWorkers();
+	StartWorkers();
+}
+
+//Sets a function to be called with the timing of every job, nullptr to turn it off
+//Params : Hook function, user pointer passed to it
+void JobSystem::SetTimingHook(JobTimingHook hook, void* user)
+{
+	m_pTimingHook = hook;
+	m_pTimingUser = user;
+}
+
+//Creates a job, which won't run until it's submitted and its prerequisites are done
+//Params : Name (for timing), function, context, index range passed to the function
+//Returns : Handle of the job
+JobHandle JobSystem::CreateJob(const char* name, JobFunction function, void* context, int begin, int end)
+{
+	Job* job = &m_pJobRing[m_iNextJob++ % JOB_RING_SIZE];
+
+	job->function = function;
+	job->context = context;
+	job->begin = begin;
+	job->end = end;
+	job->name = name;
+	job->parent = nullptr;
+	job->unfinished = 1;
+	job->pendingDependencies = 1;
+	job->continuationCount = 0;
+
+	return job;
+}
+
+//Makes a job wait for another to finish. Both must be created but not yet submitted. Any number of
+//jobs can wait for one, past MAX_CONTINUATIONS they wait through empty relay jobs
+//Params : Job that waits, job it waits for
+void JobSystem::AddDependency(JobHandle job, JobHandle prerequisite)
+{
+	if (prerequisite->continuationCount >= Job::MAX_CONTINUATIONS)
+	{
+		JobHandle& last = prerequisite->continuations[Job::MAX_CONTINUATIONS - 1];
+
+		//The last slot goes to a relay waiting on the prerequisite, which takes over the job that was in it.
+		//That job still counts the one dependency, now released by the relay
+		if (last->function != RelayTask)
+		{
+			JobHandle relay = CreateJob("Relay", RelayTask, nullptr);
+			relay->continuations[relay->continuationCount++] = last;
+			relay->pendingDependencies++;
+			last = relay;
+
+			//Only drops the submit guard, the relay still waits for the prerequisite
+			Submit(relay);
+		}
+
+		//A relay that fills up relays again in turn
+		AddDependency(job, last);
+		return;
+	}
+
+	prerequisite->continuations[prerequisite->continuationCount++] = job;
+	job->pendingDependencies++;
+}
+
+//Queues a job to run once its prerequisites are done
+void JobSystem::Submit(JobHandle job)
+{
+	//Drop the submit guard, if nothing else is pending the job can go
+	if (job->pendingDependencies.fetch_sub(1) == 1)
+	{
+		Enqueue(job, GetCurrentWorker());
+	}
+}
+
+//Runs other jobs until a job (and its children) has finished
+void JobSystem::Wait(JobHandle job)
+{
+	int worker = GetCurrentWorker();
+
+	while (job->unfinished.load() > 0)
+	{
+		Job* next = FindJob(worker);
+
+		if (next != nullptr)
+		{
+			Execute(next, worker);
+		}
+		else
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+//Splits [0, count) into chunks of grainSize, runs them across the workers and waits for them.
+//Chunks always start at multiples of grainSize, so per-chunk outputs can be indexed by begin / grainSize
+//Params : Name, number of items, items per chunk, function, context
+void JobSystem::ParallelFor(const char* name, int count, int grainSize, JobFunction function, void* context)
+{
+	if (count <= 0)
+	{
+		return;
+	}
+
+	grainSize = grainSize < 1 ? 1 : grainSize;
+
+	//Every chunk takes a slot of the job ring, so very large ranges are split into whole multiples
+	//of the grain instead, leaving the rest of the ring to the jobs already alive
+	int chunkCount = (count + grainSize - 1) / grainSize;
+
+	if (chunkCount > MAX_PARALLEL_CHUNKS)
+	{
+		grainSize *= (chunkCount + MAX_PARALLEL_CHUNKS - 1) / MAX_PARALLEL_CHUNKS;
+	}
+
+	//A single chunk runs inline, still going through the timing hook
+	if (m_iWorkerCount == 1 || count <= grainSize)
+	{
+		for (int begin = 0; begin < count; begin += grainSize)
+		{
+			JobHandle job = CreateJob(name, function, context, begin, begin + grainSize < count ? begin + grainSize : count);
+			Execute(job, GetCurrentWorker());
+		}
+
+		return;
+	}
+
+	//Chunks are children of an empty root, which finishes when they all have
+	JobHandle root = CreateJob(name, EmptyJob, nullptr);
+
+	for (int begin = 0; begin < count; begin += grainSize)
+	{
+		JobHandle chunk = CreateJob(name, function, context, begin, begin + grainSize < count ? begin + grainSize : count);
+		chunk->parent = root;
+		root->unfinished++;
+
+		Submit(chunk);
+	}
+
+	Submit(root);
+	Wait(root);
+}
+
+//Starts taking jobs from the front of the ring again. Only done with a single worker, where nothing
+//can still be reading a job once the owner's waits have returned. Must be called with no jobs alive
+void JobSystem::Rewind()
+{
+	if (m_iWorkerCount != 1)
+	{
+		return;
+	}
+
+	m_iNextJob = 0;
+	m_queues[0]->head = 0;
+	m_queues[0]->tail = 0;
+}
+
+//Loop run by each worker thread
+//Params : Index of the worker (1 upwards, 0 is the owning thread)
+void JobSystem::WorkerLoop(int worker)
+{
+	t_pJobSystem = this;
+	t_iWorker = worker;
+
+	if (m_bPinToCores)
+	{
+		unsigned int cores = std::thread::hardware_concurrency();
+		unsigned int core = cores > 0 ? worker % cores : 0;
+
+#if defined(_WIN32)
+		SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << core);
+#elif defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(core, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+	}
+
+	while (true)
+	{
+		Job* job = FindJob(worker);
+
+		if (job != nullptr)
+		{
+			Execute(job, worker);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_wakeMutex);
+		m_wakeCondition.wait(lock, [this]() { return m_bStopping || m_iQueuedJobs.load() > 0; });
+
+		if (m_bStopping)
+		{
+			return;
+		}
+	}
+}
+
+//Starts a thread for each worker after the first
+void JobSystem::StartWorkers()
+{
+	m_bStopping = false;
+
+	for (int i = 1; i < m_iWorkerCount; i++)
+	{
+		m_workers.push_back(std::thread(&JobSystem::WorkerLoop, this, i));
+	}
+}
+
+//Stops and joins all worker threads
+void JobSystem::StopWorkers()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_wakeMutex);
+		m_bStopping = true;
+	}
+
+	m_wakeCondition.notify_all();
+
+	for (auto& worker : m_workers)
+	{
+		worker.join();
+	}
+
+	m_workers.clear();
+}
+
+//Takes a job off the worker's own deque, or steals one from another worker
+//Params : Index of the worker looking for work
+//Returns : Job to run, nullptr if there wasn't one
+Job* JobSystem::FindJob(int worker)
+{
+	if (m_iQueuedJobs.load() == 0)
+	{
+		return nullptr;
+	}
+
+	//Own work first, newest first while it's still in cache
+	{
+		WorkerQueue* queue = m_queues[worker];
+		std::lock_guard<std::mutex> lock(queue->mutex);
+
+		if (queue->tail != queue->head)
+		{
+			Job* job = queue->jobs[--queue->tail % JOB_RING_SIZE];
+			m_iQueuedJobs--;
+
+			return job;
+		}
+	}
+
+	//Steal the oldest job from the next worker that has any
+	for (int i = 1; i < m_iWorkerCount; i++)
+	{
+		WorkerQueue* queue = m_queues[(worker + i) % m_iWorkerCount];
+		std::lock_guard<std::mutex> lock(queue->mutex);
+
+		if (queue->tail != queue->head)
+		{
+			Job* job = queue->jobs[queue->head++ % JOB_RING_SIZE];
+			m_iQueuedJobs--;
+
+			return job;
+		}
+	}
+
+	return nullptr;
+}
+
+//Pushes a job whose prerequisites are done onto a worker's deque
+//Params : Job, index of the worker pushing it
+void JobSystem::Enqueue(Job* job, int worker)
+{
+	{
+		WorkerQueue* queue = m_queues[worker];
+		std::lock_guard<std::mutex> lock(queue->mutex);
+
+		queue->jobs[queue->tail++ % JOB_RING_SIZE] = job;
+		m_iQueuedJobs++;
+	}
+
+	//Taking the lock means a worker can't miss this between checking and sleeping
+	{
+		std::lock_guard<std::mutex> lock(m_wakeMutex);
+	}
+
+	m_wakeCondition.notify_one();
+}
+
+//Runs a job and releases whatever was waiting on it
+//Params : Job, index of the worker running it
+void JobSystem::Execute(Job* job, int worker)
+{
+	if (m_pTimingHook != nullptr)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+		job->function(job->context, job->begin, job->end, worker);
+
+		std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+
+		m_pTimingHook(m_pTimingUser, job->name, worker,
+			std::chrono::duration<double, std::milli>(start - m_startTime).count(),
+			std::chrono::duration<double, std::milli>(end - m_startTime).count());
+	}
+	else
+	{
+		job->function(job->context, job->begin, job->end, worker);
+	}
+
+	Finish(job, worker);
+}
+
+//Marks one piece of a job as finished, releasing its continuations and parent once all are
+//Params : Job, index of the worker that finished it
+void JobSystem::Finish(Job* job, int worker)
+{
+	if (job->unfinished.fetch_sub(1) != 1)
+	{
+		return;
+	}
+
+	Job* parent = job->parent;
+
+	for (int i = 0; i < job->continuationCount; i++)
+	{
+		Job* continuation = job->continuations[i];
+
+		if (continuation->pendingDependencies.fetch_sub(1) == 1)
+		{
+			Enqueue(continuation, worker);
+		}
+	}
+
+	if (parent != nullptr)
+	{
+		Finish(parent, worker);
+	}
+}
+
+//Job entry point of a relay, which does nothing but release its continuations when its prerequisite is done
+void JobSystem::RelayTask(void* context, int begin, int end, int worker)
+{
+}
+
+//Index of the calling thread in this system (0 for the owning thread)
+int JobSystem::GetCurrentWorker() const
+{
+	return t_pJobSystem == this ? t_iWorker : 0;
+}
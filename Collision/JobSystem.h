@@ -0,0 +1,192 @@
+#ifndef _JOB_SYSTEM_H_
+#define _JOB_SYSTEM_H_
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+
+//Function run by a job over a range of indices
+//Params : User context, first index, one past the last index, worker running the job
+typedef void(*JobFunction)(void* context, int begin, int end, int worker);
+
+//Called after each job runs, for profiling
+//Params : User pointer, job name, worker that ran it, start and end time in milliseconds since the job system was created
+typedef void(*JobTimingHook)(void* user, const char* name, int worker, double startTime, double endTime);
+
+struct Job;
+
+//Reference to a job created by a JobSystem
+typedef Job* JobHandle;
+
+//**********************************************************************************
+// Struct : Job
+// Description : A unit of work: a function over an index range, with a count of
+// prerequisites still to finish and the jobs waiting on this one. Jobs come from a
+// fixed ring in the JobSystem, nothing is allocated per job.
+//**********************************************************************************
+struct Job
+{
+	//Most jobs that can wait on a single job
+	static const int MAX_CONTINUATIONS = 8;
+
+	JobFunction function;
+	void* context;
+	int begin;
+	int end;
+	const char* name;
+
+	//Job to notify when this one (and its children) are done
+	Job* parent;
+
+	//This job plus any children still running, the job is finished at zero
+	std::atomic<int> unfinished;
+
+	//Prerequisites still running, plus one until the job is submitted
+	std::atomic<int> pendingDependencies;
+
+	//Jobs to release once this one finishes
+	Job* continuations[MAX_CONTINUATIONS];
+	int continuationCount;
+};
+
+//**********************************************************************************
+// Class : JobSystem
+// Description : Work stealing task scheduler. Each worker has its own deque, pushing
+// and popping work at the back, and idle workers steal from the front of the others'.
+// Jobs can depend on other jobs and ranges can be split across workers with
+// ParallelFor. The thread that owns the system is worker 0 and runs jobs while it
+// waits, so a system with one worker runs everything inline.
+//**********************************************************************************
+class JobSystem
+{
+public:
+
+	JobSystem();
+	~JobSystem();
+
+	//Sets the number of workers (including the owning thread), restarting the worker threads
+	//Params : Worker count, clamped to at least 1
+	void SetWorkerCount(int count);
+	int GetWorkerCount() const { return m_iWorkerCount; }
+
+	//Set/Get whether worker threads are pinned to a core each (worker i to core i)
+	void SetCorePinning(bool pin);
+	bool GetCorePinning() const { return m_bPinToCores; }
+
+	//Sets a function to be called with the timing of every job, nullptr to turn it off
+	//Params : Hook function, user pointer passed to it
+	void SetTimingHook(JobTimingHook hook, void* user);
+
+	//Creates a job, which won't run until it's submitted and its prerequisites are done
+	//Params : Name (for timing), function, context, index range passed to the function
+	//Returns : Handle of the job
+	JobHandle CreateJob(const char* name, JobFunction function, void* context, int begin = 0, int end = 1);
+
+	//Makes a job wait for another to finish. Both must be created but not yet submitted. Any number of
+	//jobs can wait for one, past MAX_CONTINUATIONS they wait through empty relay jobs
+	//Params : Job that waits, job it waits for
+	void AddDependency(JobHandle job, JobHandle prerequisite);
+
+	//Queues a job to run once its prerequisites are done
+	void Submit(JobHandle job);
+
+	//Runs other jobs until a job (and its children) has finished
+	void Wait(JobHandle job);
+
+	//Splits [0, count) into chunks of grainSize, runs them across the workers and waits for them.
+	//Chunks always start at multiples of grainSize, so per-chunk outputs can be indexed by begin / grainSize.
+	//Very large ranges get chunks of a whole multiple of grainSize, so some of those outputs go unwritten
+	//and the caller has to empty them all itself rather than leave it to each chunk
+	//Params : Name, number of items, items per chunk, function, context
+	void ParallelFor(const char* name, int count, int grainSize, JobFunction function, void* context);
+
+	//Starts taking jobs from the front of the ring again, so a system that runs the same few jobs
+	//over and over keeps reusing the same slots rather than touching the whole ring. Only done with
+	//a single worker, where nothing can still be reading a job once the owner's waits have returned.
+	//Must be called with no jobs alive (all submitted jobs finished, none created but not submitted)
+	void Rewind();
+
+private:
+
+	//Loop run by each worker thread
+	//Params : Index of the worker (1 upwards, 0 is the owning thread)
+	void WorkerLoop(int worker);
+
+	//Stops and joins all worker threads
+	void StopWorkers();
+
+	//Starts a thread for each worker after the first
+	void StartWorkers();
+
+	//Takes a job off the worker's own deque, or steals one from another worker
+	//Params : Index of the worker looking for work
+	//Returns : Job to run, nullptr if there wasn't one
+	Job* FindJob(int worker);
+
+	//Pushes a job whose prerequisites are done onto a worker's deque
+	//Params : Job, index of the worker pushing it
+	void Enqueue(Job* job, int worker);
+
+	//Runs a job and releases whatever was waiting on it
+	//Params : Job, index of the worker running it
+	void Execute(Job* job, int worker);
+
+	//Marks one piece of a job as finished, releasing its continuations and parent once all are
+	//Params : Job, index of the worker that finished it
+	void Finish(Job* job, int worker);
+
+	//Job entry point of a relay, which does nothing but release its continuations when its prerequisite is done
+	static void RelayTask(void* context, int begin, int end, int worker);
+
+	//Index of the calling thread in this system (0 for the owning thread)
+	int GetCurrentWorker() const;
+
+	//Empty job used as the parent of a ParallelFor's chunks
+	static void EmptyJob(void* context, int begin, int end, int worker) {}
+
+private:
+
+	//Jobs are taken from this ring in turn, it must be larger than the number of jobs alive at once
+	static const int JOB_RING_SIZE = 4096;
+
+	//Each worker's deque of jobs ready to run. A fixed ring rather than a std::deque, which
+	//allocates and frees blocks as it grows and shrinks. It can't hold more jobs than are alive
+	struct WorkerQueue
+	{
+		std::mutex mutex;
+		Job* jobs[JOB_RING_SIZE];
+
+		//Oldest job and one past the newest, the difference is the number queued
+		unsigned int head;
+		unsigned int tail;
+
+		WorkerQueue() : head(0), tail(0) {}
+	};
+
+	//Most chunks a ParallelFor splits its range into
+	static const int MAX_PARALLEL_CHUNKS = JOB_RING_SIZE / 4;
+
+	Job* m_pJobRing;
+	std::atomic<unsigned int> m_iNextJob;
+
+	std::vector<WorkerQueue*> m_queues;
+	std::vector<std::thread> m_workers;
+	int m_iWorkerCount;
+	bool m_bPinToCores;
+
+	//Sleeping when there's nothing queued
+	std::mutex m_wakeMutex;
+	std::condition_variable m_wakeCondition;
+	std::atomic<int> m_iQueuedJobs;
+	bool m_bStopping;
+
+	JobTimingHook m_pTimingHook;
+	void* m_pTimingUser;
+	std::chrono::high_resolution_clock::time_point m_startTime;
+};
+
+#endif
@@ -0,0 +1,256 @@
+#include "Lz4.h"
+
+#include <string.h>
+#include <stdint.h>
+
+//Shortest match worth encoding
+static const int MIN_MATCH = 4;
+
+//The format requires the last 5 bytes to be literals and the last match to start at least
+//12 bytes before the end, so decoders can copy in whole words without checking every byte
+static const int LAST_LITERALS = 5;
+static const int MATCH_FIND_LIMIT = 12;
+
+//Furthest back a match can be, offsets are 16 bits
+static const int MAX_OFFSET = 65535;
+
+//Size of the table of the last position each 4 byte sequence was seen at
+static const int HASH_BITS = 14;
+
+//Largest block the format allows
+static const int MAX_INPUT_SIZE = 0x7E000000;
+
+static uint32_t Read32(const unsigned char* p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static int Hash(uint32_t sequence)
+{
+	return (int)((sequence * 2654435761U) >> (32 - HASH_BITS));
+}
+
+//Writes the part of a length that doesn't fit in the token, as runs of 255 and a remainder
+//Returns : Output after the length
+static unsigned char* WriteLength(unsigned char* op, int length)
+{
+	while (length >= 255)
+	{
+		*op++ = 255;
+		length -= 255;
+	}
+
+	*op++ = (unsigned char)length;
+	return op;
+}
+
+//Writes a sequence: the literals since the last match, then the match (if any)
+//Params : Output, literals and their count, match offset and length (0 for the final, literal only, sequence)
+//Returns : Output after the sequence
+static unsigned char* WriteSequence(unsigned char* op, const unsigned char* literals, int literalCount, int offset, int matchLength)
+{
+	unsigned char* token = op++;
+	int matchCode = matchLength > 0 ? matchLength - MIN_MATCH : 0;
+
+	*token = (unsigned char)(((literalCount < 15 ? literalCount : 15) << 4) | (matchCode < 15 ? matchCode : 15));
+
+	if (literalCount >= 15)
+	{
+		op = WriteLength(op, literalCount - 15);
+	}
+
+	memcpy(op, literals, literalCount);
+	op += literalCount;
+
+	if (matchLength > 0)
+	{
+		*op++ = (unsigned char)(offset & 0xFF);
+		*op++ = (unsigned char)(offset >> 8);
+
+		if (matchCode >= 15)
+		{
+			op = WriteLength(op, matchCode - 15);
+		}
+	}
+
+	return op;
+}
+
+//Returns : Largest size Lz4Compress can produce for an input of the given size
+int Lz4CompressBound(int size)
+{
+	return size + (size / 255) + 16;
+}
+
+//Compresses a block
+//Params : Input and its size, output and its capacity (at least Lz4CompressBound of the input size)
+//Returns : Size of the compressed block, 0 if the output is too small
+int Lz4Compress(const unsigned char* src, int srcSize, unsigned char* dst, int dstCapacity)
+{
+	if (srcSize < 0 || srcSize > MAX_INPUT_SIZE || dstCapacity < Lz4CompressBound(srcSize))
+	{
+		return 0;
+	}
+
+	//Positions are relative to src, -1 for never seen
+	int hashTable[1 << HASH_BITS];
+	memset(hashTable, 0xFF, sizeof(hashTable));
+
+	unsigned char* op = dst;
+	int anchor = 0;
+	int ip = 0;
+
+	int matchLimit = srcSize - LAST_LITERALS;
+	int lastMatchStart = srcSize - MATCH_FIND_LIMIT;
+
+	while (ip <= lastMatchStart)
+	{
+		uint32_t sequence = Read32(src + ip);
+		int h = Hash(sequence);
+		int ref = hashTable[h];
+
+		hashTable[h] = ip;
+
+		if (ref < 0 || (ip - ref) > MAX_OFFSET || Read32(src + ref) != sequence)
+		{
+			//Step further the longer nothing has matched, so incompressible data goes through quickly
+			ip += 1 + ((ip - anchor) >> 6);
+			continue;
+		}
+
+		//Grow the match backwards into the pending literals, then forwards
+		while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1])
+		{
+			ip--;
+			ref--;
+		}
+
+		int length = MIN_MATCH;
+
+		while (ip + length < matchLimit && src[ip + length] == src[ref + length])
+		{
+			length++;
+		}
+
+		op = WriteSequence(op, src + anchor, ip - anchor, ip - ref, length);
+
+		ip += length;
+		anchor = ip;
+
+		//Remember a position inside the match too, it often starts the next one
+		if (ip - 2 <= lastMatchStart)
+		{
+			hashTable[Hash(Read32(src + ip - 2))] = ip - 2;
+		}
+	}
+
+	op = WriteSequence(op, src + anchor, srcSize - anchor, 0, 0);
+
+	return (int)(op - dst);
+}
+
+//Reads the part of a length that didn't fit in the token
+//Params : Input position (moved on), end of the input, length so far
+//Returns : False if the input ends first or the length is unreasonably large
+static bool ReadLength(const unsigned char*& ip, const unsigned char* end, int& length)
+{
+	unsigned char byte;
+
+	do
+	{
+		if (ip >= end || length > MAX_INPUT_SIZE)
+		{
+			return false;
+		}
+
+		byte = *ip++;
+		length += byte;
+	} while (byte == 255);
+
+	return true;
+}
+
+//Decompresses a block, checking every length and offset so a damaged block can't write out of bounds
+//Params : Compressed block and its size, output and its capacity
+//Returns : Size of the decompressed data, -1 if the block is malformed or doesn't fit the output
+int Lz4Decompress(const unsigned char* src, int srcSize, unsigned char* dst, int dstCapacity)
+{
+	const unsigned char* ip = src;
+	const unsigned char* end = src + srcSize;
+	unsigned char* op = dst;
+	unsigned char* outEnd = dst + dstCapacity;
+
+	while (ip < end)
+	{
+		unsigned char token = *ip++;
+		int literalCount = token >> 4;
+
+		if (literalCount == 15 && !ReadLength(ip, end, literalCount))
+		{
+			return -1;
+		}
+
+		if (literalCount > end - ip || literalCount > outEnd - op)
+		{
+			return -1;
+		}
+
+		memcpy(op, ip, literalCount);
+		ip += literalCount;
+		op += literalCount;
+
+		//The last sequence is literals only
+		if (ip == end)
+		{
+			return (int)(op - dst);
+		}
+
+		if (end - ip < 2)
+		{
+			return -1;
+		}
+
+		int offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+
+		if (offset == 0 || offset > op - dst)
+		{
+			return -1;
+		}
+
+		int length = token & 15;
+
+		if (length == 15 && !ReadLength(ip, end, length))
+		{
+			return -1;
+		}
+
+		length += MIN_MATCH;
+
+		if (length > outEnd - op)
+		{
+			return -1;
+		}
+
+		const unsigned char* match = op - offset;
+
+		//Matches can overlap what they're writing (a run repeats its first bytes), which has to go byte by byte
+		if (offset >= length)
+		{
+			memcpy(op, match, length);
+			op += length;
+		}
+		else
+		{
+			for (int i = 0; i < length; i++)
+			{
+				*op++ = *match++;
+			}
+		}
+	}
+
+	//An empty block is a single token, no input at all isn't a block
+	return -1;
+}
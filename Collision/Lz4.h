@@ -0,0 +1,22 @@
+#ifndef _LZ4_H_
+#define _LZ4_H_
+
+
+//Compression in the LZ4 block format (the raw blocks, without the frame around them), so
+//anything written here can be read by the reference LZ4 library and the other way round.
+//A small greedy compressor rather than the library, which the physics doesn't otherwise need.
+
+//Returns : Largest size Lz4Compress can produce for an input of the given size
+int Lz4CompressBound(int size);
+
+//Compresses a block
+//Params : Input and its size, output and its capacity (at least Lz4CompressBound of the input size)
+//Returns : Size of the compressed block, 0 if the output is too small
+int Lz4Compress(const unsigned char* src, int srcSize, unsigned char* dst, int dstCapacity);
+
+//Decompresses a block, checking every length and offset so a damaged block can't write out of bounds
+//Params : Compressed block and its size, output and its capacity
+//Returns : Size of the decompressed data, -1 if the block is malformed or doesn't fit the output
+int Lz4Decompress(const unsigned char* src, int srcSize, unsigned char* dst, int dstCapacity);
+
+#endif
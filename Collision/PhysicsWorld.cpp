@@ -1,396 +1,2337 @@
 #include "PhysicsWorld.h"
 #include "HeightMap.h"
+#include "WorldSnapshot.h"
 
+#include <float.h>
+#include <math.h>
+#include <string.h>
 
-PhysicsWorld::PhysicsWorld()
+//Speed below which a body counts as resting
+static const float SLEEP_SPEED = 0.2f;
+
+//How long every body in an island has to rest before the island goes to sleep
+static const float SLEEP_DELAY = 0.5f;
+
+//Bodies per chunk when testing against the terrain
+static const int STATIC_COLLISION_GRAIN = 16;
+
+//AABBs per chunk when updating bounds and sweeping for pairs
+static const int BROADPHASE_GRAIN = 64;
+
+//Bodies per chunk when integrating, a multiple of the widest SIMD batch
+static const int INTEGRATE_GRAIN = 256;
+
+//Rays per chunk when casting a batch
+static const int RAYCAST_GRAIN = 64;
+
+//Clock the step timings are taken with
+typedef std::chrono::high_resolution_clock StepClock;
+
+//Returns : Milliseconds since a time point
+static double MillisecondsSince(StepClock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(StepClock::now() - start).count();
+}
+
+//Ends a phase of the step timings and starts the next
+//Params : Start of the phase, moved on to now
+//Returns : Milliseconds the phase took
+static double NextPhase(StepClock::time_point& phaseStart)
+{
+	StepClock::time_point now = StepClock::now();
+	double milliseconds = std::chrono::duration<double, std::milli>(now - phaseStart).count();
+
+	phaseStart = now;
+	return milliseconds;
+}
+
+//Rays of a batch being cast by RaycastTask
+struct RaycastBatchContext
+{
+	const PhysicsWorld* world;
+	const XMFLOAT3* origins;
+	const XMFLOAT3* directions;
+	float maxDistance;
+	RaycastHit* hits;
+};
+
+//Empties the outputs of a ParallelFor's chunks and gives each the same room, so they don't
+//each grow on their own as contacts move from one chunk to another over the steps
+//Params : Outputs, number of chunks, room to give each
+template<typename T>
+static void ResetChunkOutputs(std::vector<std::vector<T>>& outputs, int chunkCount, size_t capacity)
+{
+	outputs.resize(max(chunkCount, (int)outputs.size()));
+
+	for (int c = 0; c < chunkCount; c++)
+	{
+		outputs[c].clear();
+		outputs[c].reserve(capacity);
+	}
+}
+
+//Makes sure the room given to each chunk's output is at least double the fullest one, doubling it
+//when it grows so a world still settling only has every chunk's output reallocated a few times
+//Params : Outputs, number of chunks, room to give each (updated)
+template<typename T>
+static void GrowChunkCapacity(const std::vector<std::vector<T>>& outputs, int chunkCount, size_t& capacity)
+{
+	size_t largest = 0;
+
+	for (int c = 0; c < chunkCount; c++)
+	{
+		largest = max(largest, outputs[c].size());
+	}
+
+	if (largest * 2 > capacity)
+	{
+		capacity = max(largest * 2, capacity * 2);
+	}
+}
+
+//The world's own values in a snapshot, everything else is arrays
+struct SnapshotWorldState
 {
-	m_pHeightMap = nullptr;
+	uint64_t stepCount;
+	uint64_t stateHash;
+	uint32_t registeredBodyCount;
+	uint32_t bodyCount;
+	uint32_t tileCount;
+	int32_t sortingAxis;
+	uint32_t proxiesSorted;
+	float maxProxyRadius;
+};
 
-	for (int i = 0; i < MAX_OBJECTS; i++)
+//Orders AABBs on their min point along an axis. Ties are broken on the body index so the order
+//(and so the pair order) only depends on the bodies, not on the order left by the last sort or
+//the library's sort
+struct AABBAxisLess
+{
+	int axis;
+
+	bool operator()(const AABB& a, const AABB& b) const
 	{
-		m_AABBArray[i] = nullptr;
+		if (a.minPoint[axis] != b.minPoint[axis])
+		{
+			return a.minPoint[axis] < b.minPoint[axis];
+		}
+
+		return a.body < b.body;
 	}
+};
+
+
+PhysicsWorld::PhysicsWorld()
+{
+	m_fTileGridMinX = m_fTileGridMinZ = 0.0f;
+	m_fTileGridCellSize = 1.0f;
+	m_iTileGridCountX = m_iTileGridCountZ = 0;
+
+	m_fFixedTimeStep = 1.0f / PHYSICS_STEP_RATE;
+	m_iMaxSubSteps = PHYSICS_MAX_SUBSTEPS;
+	m_dAccumulator = 0.0;
+	m_dDroppedTime = 0.0;
+	m_bClockStarted = false;
+
+	m_fInterpolationFactor = 1.0f;
+
+	m_bDeterministic = false;
+	m_iStepCount = 0;
+	m_iStateHash = 0;
+
+	m_bSleepingEnabled = true;
+	m_iIslandCount = 0;
+	m_iSleepingIslandCount = 0;
+	m_iLargestIslandSize = 0;
+
+	m_fStepTime = 0.0f;
+	m_stepTimings = StepTimings();
+	m_iKilledBodies = 0;
+	m_bContactEvents = true;
+	m_bProxiesSorted = false;
+	m_fMaxProxyRadius = 0.0f;
+	m_iStaticChunkCapacity = 0;
+	m_iDynamicChunkCapacity = 0;
+	m_bSnapshots = false;
+	m_bUpdateRequested = false;
+	m_bUpdateFinished = false;
+	m_bStopUpdateThread = false;
+	m_bUpdatePending = false;
+	m_iUpdateSteps = 0;
+	m_contactSolver.SetJobSystem(&m_jobSystem);
 }
 
 PhysicsWorld::PhysicsWorld(HeightMap * mHeightMap)
+	: PhysicsWorld()
 {
-	m_pHeightMap = mHeightMap;
+	SetHeightMapPtr(mHeightMap);
 }
 
 
 PhysicsWorld::~PhysicsWorld()
 {
-	m_pHeightMap = nullptr;
+	WaitForUpdate();
+	StopUpdateThread();
+
+	m_terrainTiles.clear();
+
+	//Hand the bodies their state back, they outlive the world
+	while (m_bodyStore.GetCount() > 0)
+	{
+		m_bodyStore.GetView(m_bodyStore.GetCount() - 1)->Detach();
+	}
+
+	for (auto body : m_bodies)
+	{
+		body->SetWorldId(-1);
+	}
 }
 
-//Sets the pointer of the heightmap to test static collisions against
+//Replaces all terrain with a single heightmap to test static collisions against
 //Params : Pointer of the heightmap to be tested against
 void PhysicsWorld::SetHeightMapPtr(HeightMap * pHeightMap)
 {
-	m_pHeightMap = pHeightMap;
+	m_terrainTiles.clear();
+
+	if (pHeightMap != nullptr)
+	{
+		AddHeightMap(pHeightMap, pHeightMap->GetWorldOffset());
+	}
+	else
+	{
+		RebuildTileGrid();
+	}
 }
 
-//Adds a body to the list of bodies within the physics world
-//Params : Pointer to the body to add
-void PhysicsWorld::AddBody(DynamicBody * body)
+//Places a heightmap tile in the world
+//Params : Pointer of the heightmap, world position of the tile's centre
+void PhysicsWorld::AddHeightMap(HeightMap * pHeightMap, const XMFLOAT3 & offset)
 {
-	//Push back the dynamic body pointer to the vector
-	m_dynamicBodyList.push_back(body);
+	pHeightMap->SetWorldOffset(offset);
 
-	//Also add a new body into the AABB array
-	m_AABBArray[m_AABBArrayIndx] = new AABB(body->GetPosition(), body->GetRadius(), body);
-	//Increment the AABB index for next insertion
-	m_AABBArrayIndx++;
+	TerrainTile tile;
+	tile.heightMap = pHeightMap;
+	pHeightMap->GetWorldBoundsXZ(tile.minX, tile.minZ, tile.maxX, tile.maxZ);
+
+	m_terrainTiles.push_back(tile);
 
+	RebuildTileGrid();
 }
 
-//Removes a body from the physics world
-//Params : Pointer to the body to remove
-void PhysicsWorld::RemoveBody(DynamicBody* mBody)
+//Removes a heightmap tile from the world
+//Params : Pointer of the heightmap to remove
+void PhysicsWorld::RemoveHeightMap(HeightMap * pHeightMap)
 {
-	//Iterate through the body vector
-	for (std::vector<DynamicBody*>::iterator it = m_dynamicBodyList.begin(); it < m_dynamicBodyList.end(); it++)
+	for (std::vector<TerrainTile>::iterator it = m_terrainTiles.begin(); it < m_terrainTiles.end(); it++)
 	{
-		//If the pointers match (i.e it's the same body)
-		if ((*it) == mBody)
+		if (it->heightMap == pHeightMap)
 		{
-			//Erase it from the vector
-			m_dynamicBodyList.erase(it);
-			//Break out the loop and exit function
+			m_terrainTiles.erase(it);
 			break;
 		}
 	}
+
+	RebuildTileGrid();
 }
 
-//Controls the update of all bodies within the scene
-//Main function to be called
-void PhysicsWorld::UpdateWorld()
+//Removes all heightmap tiles
+void PhysicsWorld::ClearHeightMaps()
 {
-	HandleStaticCollision();
-	HandleDynamicCollision();
-
+	m_terrainTiles.clear();
+	RebuildTileGrid();
+}
 
-	//Loop through all static collisions
-	for (auto collision : m_staticCollisionList)
+//Wakes the bodies over terrain edited since the last step, which may have moved out from under them
+void PhysicsWorld::WakeEditedTerrain()
+{
+	for (const TerrainTile& tile : m_terrainTiles)
 	{
-		//Resolve each collision on each body
-		collision.body->ResolveCollision(collision.collisionNormal);
+		XMFLOAT3 minPoint, maxPoint;
+
+		if (!tile.heightMap->TakeEditedBoundsXZ(minPoint.x, minPoint.z, maxPoint.x, maxPoint.z))
+		{
+			continue;
+		}
+
+		//Everything above or below the edited faces, however far
+		minPoint.y = -FLT_MAX;
+		maxPoint.y = FLT_MAX;
+
+		int count = OverlapAABB(minPoint, maxPoint, m_editedTerrainBodies.data(), (int)m_editedTerrainBodies.size());
+
+		if (count > (int)m_editedTerrainBodies.size())
+		{
+			m_editedTerrainBodies.resize(count);
+			OverlapAABB(minPoint, maxPoint, m_editedTerrainBodies.data(), count);
+		}
+
+		for (int i = 0; i < count; i++)
+		{
+			m_bodyStore.Wake(m_bodyStore.GetIndex(m_editedTerrainBodies[i]));
+		}
 	}
+}
+
+//Rebuilds the uniform grid over the X/Z bounds of all terrain tiles
+void PhysicsWorld::RebuildTileGrid()
+{
+	m_tileGridStart.clear();
+	m_tileGridIndices.clear();
+	m_iTileGridCountX = m_iTileGridCountZ = 0;
+
+	//The ground may have moved out from under resting bodies
+	WakeAllBodies();
 
-	//Loop through all dynamic collisions
-	for (auto collision : m_dynamicCollisionList)
+	unsigned long long faceCount = 0;
+
+	for (auto& tile : m_terrainTiles)
 	{
-		//Resolve each collison on each body
-		collision.bodyA->ResolveCollision(collision.collisionNormal);
-		collision.bodyB->ResolveCollision(collision.collisionNormal);
+		tile.firstFace = faceCount;
+		faceCount += (unsigned long long)tile.heightMap->m_iFaceCount;
 	}
 
-	//Loop through all static collisions again
-	for (auto collision : m_staticCollisionList)
+	if (m_terrainTiles.empty())
 	{
-		//Correct the positions of each collision
-		collision.body->PositionalCorrectionHeightmap(collision.penetrationDepth, collision.collisionNormal);
+		return;
 	}
 
-	//Loop through all dynamic collisions again
-	for (auto collision : m_dynamicCollisionList)
+	//Size the cells to the largest tile, so each tile only lands in a handful of cells
+	float minX = FLT_MAX, minZ = FLT_MAX, maxX = -FLT_MAX, maxZ = -FLT_MAX;
+	float cellSize = 0.0f;
+
+	for (auto& tile : m_terrainTiles)
 	{
-		//Correct the positions of each collision
-		PositionalCorrection(&collision);
+		minX = min(minX, tile.minX);
+		minZ = min(minZ, tile.minZ);
+		maxX = max(maxX, tile.maxX);
+		maxZ = max(maxZ, tile.maxZ);
+
+		cellSize = max(cellSize, max(tile.maxX - tile.minX, tile.maxZ - tile.minZ));
 	}
 
-	//Loop through each body in the physics world
-	for (auto body : m_dynamicBodyList)
+	m_fTileGridMinX = minX;
+	m_fTileGridMinZ = minZ;
+	m_fTileGridCellSize = max(cellSize, 1.0f);
+	m_iTileGridCountX = (int)((maxX - minX) / m_fTileGridCellSize) + 1;
+	m_iTileGridCountZ = (int)((maxZ - minZ) / m_fTileGridCellSize) + 1;
+
+	int cellCount = m_iTileGridCountX * m_iTileGridCountZ;
+
+	//Two passes, count then fill, so the grid is stored as flat arrays
+	m_tileGridStart.assign(cellCount + 1, 0);
+
+	for (int pass = 0; pass < 2; pass++)
 	{
-		//If the body is active (being rendered and active in the physics world)
-		if (body->GetActive())
+		std::vector<int> cursor(m_tileGridStart.begin(), m_tileGridStart.end() - 1);
+
+		for (int t = 0; t < (int)m_terrainTiles.size(); t++)
 		{
-			//Apply gravity
-			body->ApplyForce(XMVectorSet(0, GRAVITY, 0, 0));
-			
-			//Finally update the position of the body after all collisions have been resolved
-			body->IntegratePosition();
+			const TerrainTile& tile = m_terrainTiles[t];
+
+			int cx0 = (int)((tile.minX - minX) / m_fTileGridCellSize);
+			int cz0 = (int)((tile.minZ - minZ) / m_fTileGridCellSize);
+			int cx1 = min((int)((tile.maxX - minX) / m_fTileGridCellSize), m_iTileGridCountX - 1);
+			int cz1 = min((int)((tile.maxZ - minZ) / m_fTileGridCellSize), m_iTileGridCountZ - 1);
 
-			//If the Y position of the body is below a certain value (-10)
-			if (XMVectorGetY(body->GetPosition()) < -10.0f)
+			for (int cz = cz0; cz <= cz1; cz++)
 			{
-				//Deactivate this body
-				body->SetActive(false);
+				for (int cx = cx0; cx <= cx1; cx++)
+				{
+					int c = (cz * m_iTileGridCountX) + cx;
+
+					if (pass == 0)
+					{
+						m_tileGridStart[c + 1]++;
+					}
+					else
+					{
+						m_tileGridIndices[cursor[c]++] = t;
+					}
+				}
 			}
 		}
-	}
 
-	//Clear each collision vector for next frame
-	m_staticCollisionList.clear();
-	m_dynamicCollisionList.clear();
+		if (pass == 0)
+		{
+			//Prefix sum the counts into start offsets
+			for (int c = 0; c < cellCount; c++)
+			{
+				m_tileGridStart[c + 1] += m_tileGridStart[c];
+			}
+
+			m_tileGridIndices.resize(m_tileGridStart[cellCount]);
+		}
+	}
 }
 
-//Controls the collision between the dynamic bodies
-//and the static heightmap
-void PhysicsWorld::HandleStaticCollision()
+//Finds the terrain tiles overlapping an X/Z rectangle
+//Params : Rectangle bounds, vector to fill with tile indices (cleared first)
+void PhysicsWorld::QueryTiles(float minX, float minZ, float maxX, float maxZ, std::vector<int>& tiles) const
 {
-	//Make sure the heightmap pointer has been set
-	if (m_pHeightMap != nullptr)
+	tiles.clear();
+
+	if (m_iTileGridCountX == 0)
 	{
-		//Reset the colours of the heightmap (Get rid of the red collision colour)
-		m_pHeightMap->ResetVertexColours();
+		return;
+	}
 
-		//Loop through all bodies and check collision with heightmap
-		for (auto body : m_dynamicBodyList)
+	int cx0 = max((int)floorf((minX - m_fTileGridMinX) / m_fTileGridCellSize), 0);
+	int cz0 = max((int)floorf((minZ - m_fTileGridMinZ) / m_fTileGridCellSize), 0);
+	int cx1 = min((int)floorf((maxX - m_fTileGridMinX) / m_fTileGridCellSize), m_iTileGridCountX - 1);
+	int cz1 = min((int)floorf((maxZ - m_fTileGridMinZ) / m_fTileGridCellSize), m_iTileGridCountZ - 1);
+
+	for (int cz = cz0; cz <= cz1; cz++)
+	{
+		for (int cx = cx0; cx <= cx1; cx++)
 		{
-			//Only check the body against the heightmap if it's active
-			if (body->GetActive())
+			int c = (cz * m_iTileGridCountX) + cx;
+
+			for (int i = m_tileGridStart[c]; i < m_tileGridStart[c + 1]; i++)
 			{
-				//Create a new static collision vector for this body because the body could be colliding with more than one 
-				//face on the heightmap
-				std::vector<PhysicsStaticCollision>	bodyCollisionList = m_pHeightMap->SphereHeightmap(body);
+				const TerrainTile& tile = m_terrainTiles[m_tileGridIndices[i]];
+
+				if (maxX < tile.minX || minX > tile.maxX || maxZ < tile.minZ || minZ > tile.maxZ)
+				{
+					continue;
+				}
 
-				//Concatenate this vector with the static collision list for resolution at a future point
-				m_staticCollisionList.insert(m_staticCollisionList.end(), bodyCollisionList.begin(), bodyCollisionList.end());
+				//A tile spanning several cells is found once per cell, a body only overlaps a few tiles
+				//so a linear check is cheaper than stamping the tiles (and leaves them untouched for other threads)
+				if (std::find(tiles.begin(), tiles.end(), m_tileGridIndices[i]) != tiles.end())
+				{
+					continue;
+				}
+
+				tiles.push_back(m_tileGridIndices[i]);
 			}
 		}
-
-		//Rebuild the vertex data of the heightmap to get a red colour when colliding
-		m_pHeightMap->RebuildVertexData();
 	}
 }
 
-//Controls the collision between all dynamic bodies
-void PhysicsWorld::HandleDynamicCollision()
+//Adds a body to the physics world, moving its state into the world's body store
+//Params : Pointer to the body to add
+//Returns : Handle of the body in the world
+BodyHandle PhysicsWorld::AddBody(DynamicBody * body)
 {
-	SortAndSweepAABBArray();
-	//GeneratePairs();
+	//Slots are reused, so holding fewer bodies than there are slots keeps every slot in range
+	if (m_bodyStore.GetCount() >= MAX_BODY_SLOTS)
+	{
+		return INVALID_BODY_HANDLE;
+	}
+
+	RegisterBody(body);
+	body->Attach(&m_bodyStore);
+
+	//Also add a new body into the AABB array
+	m_bodyProxy.push_back((int)m_AABBArray.size());
+	m_AABBArray.push_back(AABB(body->GetPosition(), body->GetRadius(), body->GetWorldIndex()));
+	m_bProxiesSorted = false;
+
+	return body->GetHandle();
 }
 
-//void PhysicsWorld::GeneratePairs()
-//{
-//	for (auto bodyA : m_dynamicBodyList)
-//	{
-//		for (auto bodyB : m_dynamicBodyList)
-//		{
-//			if (bodyA == bodyB)
-//			{
-//				continue;
-//			}
-//
-//
-//			PhysicsDynamicCollision collisionPair(bodyA, bodyB);
-//
-//			if (CircleVsCircle(&collisionPair))
-//			{
-//				m_dynamicCollisionList.push_back(collisionPair);
-//			}
-//		}
-//	}
-//
-//
-//	for (auto collision : m_dynamicCollisionList)
-//	{
-//		collision.bodyA->ResolveCollision(collision.collisionNormal);
-//		collision.bodyB->ResolveCollision(collision.collisionNormal);
-//	}
-//
-//	for (auto collision : m_dynamicCollisionList)
-//	{
-//		PositionalCorrection(&collision);
-//	}
-//}
+//Removes a body from the physics world in O(1), handing its state back to it and
+//releasing its broadphase proxy
+//Params : Pointer to the body to remove
+void PhysicsWorld::RemoveBody(DynamicBody* mBody)
+{
+	if (DetachBody(mBody))
+	{
+		UnregisterBody(mBody);
+	}
+}
 
-//Corrects the position of overlapping bodies during a dynamic vs dynamic
-//body collision
-//Params : Collision pair to be tested 
-void PhysicsWorld::PositionalCorrection(PhysicsDynamicCollision * collisionPair)
+//Takes a body out of the body store and the broadphase, leaving it registered with the world
+//Returns : False if the body wasn't in the world
+bool PhysicsWorld::DetachBody(DynamicBody* mBody)
 {
-	//Percent to move position (high percent causes more jitter but stops overlap)
-	const float percent = 0.0015f;
+	int index = mBody->GetWorldIndex();
 
-	//If penetration is less than slop value then don't correct
-	const float slop = 0.001f;
+	if (index < 0 || index >= m_bodyStore.GetCount() || m_bodyStore.GetView(index) != mBody)
+	{
+		return false;
+	}
 
-	//Calulcate positional correction vector
-	XMVECTOR correction = max(collisionPair->penetrationDepth - slop, 0.0f) * percent * collisionPair->collisionNormal;
+	//The store moves its last body into the removed body's slot
+	int last = m_bodyStore.GetCount() - 1;
 
-	//Modify the positions of each body by this calculated correction amount (moving them away from each other)
-	collisionPair->bodyA->SetPosition(collisionPair->bodyA->GetPosition() - correction);
-	collisionPair->bodyB->SetPosition(collisionPair->bodyB->GetPosition() + correction);
-}
+	mBody->Detach();
 
-//Simple circle vs circle check (Taken from Real Time Collision Detection book)
-//Params : Collision pair to be tested
-//Returns : True if the two bodies are overlapping (colliding)
-bool PhysicsWorld::CircleVsCircle(PhysicsDynamicCollision * collisionPair)
-{
-	//Frame count test for CircleVsCircle
-	//-------------------------------------
-	//static int functionCallCount = 0;
-	//functionCallCount++;
-	//if (functionCallCount > 50000)
-	//{
-	//	int frameCount = Application::s_pApp->m_frameCount;
-	//}
-	//-------------------------------------
-	//dprintf("Function calls to CircleVSCircle : %i	\n", functionCallCount);
-
-	//Get pointers to each body
-	DynamicBody* bodyA = collisionPair->bodyA;
-	DynamicBody* bodyB = collisionPair->bodyB;
+	//Release the proxy by moving the last AABB into its place, the next sort puts it back in order
+	int proxy = m_bodyProxy[index];
 
-	//Get the distance between each body
-	XMVECTOR dist = bodyB->GetPosition() - bodyA->GetPosition();
+	m_AABBArray[proxy] = m_AABBArray.back();
+	m_bodyProxy[m_AABBArray[proxy].body] = proxy;
+	m_AABBArray.pop_back();
+	m_bProxiesSorted = false;
 
-	//Get the sum of radii of each body
-	float r = bodyA->GetRadius() + bodyB->GetRadius();
+	//Follow the store, the last body's proxy now belongs to the removed body's index
+	if (index != last)
+	{
+		m_bodyProxy[index] = m_bodyProxy[last];
+		m_AABBArray[m_bodyProxy[index]].body = index;
+	}
 
-	//Square the radius
-	r *= r;
+	m_bodyProxy.pop_back();
 
-	//Check the distance ^ 2 against the sum of radii ^ 2 
-	//to stop an expensive square root operation.
-	//If the distance is greater than the radius then there is 
-	//no collision
-	if (XMVectorGetX(XMVector3LengthSq(dist)) > r)
+	return true;
+}
+
+//Gives a body a world id if it doesn't have one in this world yet
+void PhysicsWorld::RegisterBody(DynamicBody* body)
+{
+	int id = body->GetWorldId();
+
+	if (id >= 0 && id < (int)m_bodies.size() && m_bodies[id] == body)
 	{
-		return false;
+		return;
 	}
 
-	//Circles have collided
+	body->SetWorldId((int)m_bodies.size());
+	m_bodies.push_back(body);
+}
 
-	//Get square rooted length of vector between bodies
-	float d = XMVectorGetX(XMVector3Length(dist));
+//Forgets a body that has left the world for good, moving the last registered body into its id
+void PhysicsWorld::UnregisterBody(DynamicBody* body)
+{
+	int id = body->GetWorldId();
 
-	if (d != 0)
+	if (id < 0 || id >= (int)m_bodies.size() || m_bodies[id] != body)
 	{
-		//Calculate penetration depth and collision normal
-		collisionPair->penetrationDepth = r - d;
-		collisionPair->collisionNormal = dist / d;
+		return;
+	}
 
-		return true;
+	m_bodies[id] = m_bodies.back();
+	m_bodies[id]->SetWorldId(id);
+	m_bodies.pop_back();
+
+	body->SetWorldId(-1);
+}
+
+//Removes a body by handle, does nothing if the handle is stale
+//Params : Handle of the body to remove
+void PhysicsWorld::RemoveBody(BodyHandle handle)
+{
+	DynamicBody* body = GetBody(handle);
+
+	if (body != nullptr)
+	{
+		RemoveBody(body);
 	}
+}
 
-	//Circles are on the same position
-	else
+//Gives the world a body to hand out with SpawnBody. It stays out of the simulation until spawned
+//Params : Pointer to the body, which must outlive the world
+void PhysicsWorld::AddToPool(DynamicBody* body)
+{
+	RegisterBody(body);
+	m_bodyPool.push_back(body);
+}
+
+//Takes a body from the pool and adds it to the world, active and awake, in O(1)
+//Params : Initial position and velocity
+//Returns : Handle of the body, INVALID_BODY_HANDLE if the pool is empty
+BodyHandle PhysicsWorld::SpawnBody(const XMVECTOR& position, const XMVECTOR& velocity)
+{
+	if (m_bodyPool.empty() || m_bodyStore.GetCount() >= MAX_BODY_SLOTS)
 	{
-		//Set generic values to penetration depth and normal if circles
-		//are on the exact same position
-		collisionPair->penetrationDepth = bodyA->GetRadius();
-		collisionPair->collisionNormal = XMVectorSet(1, 0, 0, 0);
-		return true;
+		return INVALID_BODY_HANDLE;
 	}
+
+	DynamicBody* body = m_bodyPool.back();
+	m_bodyPool.pop_back();
+
+	//Set while detached, so the state goes into the store in one go
+	body->SetPosition(position);
+	body->SetVelocity(velocity);
+	body->SetActive(true);
+
+	return AddBody(body);
 }
 
-//Simple AABB vs AABB check (Taken from Real Time Collision Detection book)
-//Params : Pointers to each AABB to check
-//Returns : 1 if two bounding boxes are overlapping, 0 if not
-int PhysicsWorld::AABBvsAABB(AABB * a, AABB * b)
+//Removes a body from the world in O(1) and puts it in the pool. Bodies falling below the
+//kill plane are despawned automatically at the end of the step, so only live bodies are
+//ever visited by the step
+//Params : Handle of the body, does nothing if the handle is stale
+void PhysicsWorld::DespawnBody(BodyHandle handle)
 {
-	if (a->maxPoint[0] < b->minPoint[0] || a->minPoint[0] > b->maxPoint[0]) return 0;
-	if (a->maxPoint[1] < b->minPoint[1] || a->minPoint[1] > b->maxPoint[1]) return 0;
-	if (a->maxPoint[2] < b->minPoint[2] || a->minPoint[2] > b->maxPoint[2]) return 0;
-	return 1;
+	DynamicBody* body = GetBody(handle);
+
+	if (body != nullptr)
+	{
+		DetachBody(body);
+		m_bodyPool.push_back(body);
+	}
 }
 
-//Updates all AABBs surrounding each dynamic body
-void PhysicsWorld::UpdateAABBs()
+//Despawns every body the kill plane caught this step
+void PhysicsWorld::DespawnKilledBodies()
 {
-	//Loop through all objects
-	for (int i = 0; i < MAX_OBJECTS; i++)
+	//Backwards, so the body swapped into a removed slot has already been checked
+	for (int i = m_bodyStore.GetCount() - 1; i >= 0; i--)
 	{
-		//If the body is active
-		if (m_AABBArray[i]->body->GetActive())
+		if (m_bodyStore.WasKilled(i))
 		{
-			//Then update it's bounds
-			m_AABBArray[i]->UpdatePosition(m_AABBArray[i]->body->GetPosition(), (m_AABBArray[i]->body->GetRadius()));
+			DynamicBody* body = m_bodyStore.GetView(i);
+
+			DetachBody(body);
+			m_bodyPool.push_back(body);
 		}
 	}
 }
 
-//Broadphase method used for dynamic collisions (Taken from Real Time Collision Detection book)
-//Sorts bodies on a specified axis and only checks those that are close together
-//Also calculates the variance of each axis and then decides which axis (X, Y, or Z) is best to sort against next
-void PhysicsWorld::SortAndSweepAABBArray()
+//Gets the body a handle refers to
+//Returns : Pointer to the body, nullptr if the handle is stale
+DynamicBody* PhysicsWorld::GetBody(BodyHandle handle) const
 {
-	//Update all bounds
-	UpdateAABBs();
+	int index = m_bodyStore.GetIndex(handle);
 
-	//Clear the old dynamic collision lit
-	m_dynamicCollisionList.clear();
+	return index >= 0 ? m_bodyStore.GetView(index) : nullptr;
+}
 
-	//Sort the array based on their min point position
-	std::sort(std::begin(m_AABBArray), std::end(m_AABBArray), [this](const void* a, const void* b) -> int
-	{
-		float minA = ((AABB *)a)->minPoint[m_sortingAxis];
-		float minB = ((AABB *)b)->minPoint[m_sortingAxis];
+//Captures the simulation state in a flat, versioned blob (see WorldSnapshot.h)
+//Params : Blob to fill in (reused, so it only grows), whether to LZ4 compress the payload
+void PhysicsWorld::SaveSnapshot(std::vector<unsigned char>& blob, bool compress)
+{
+	WaitForUpdate();
 
-		return minA > minB;
-	});
+	int bodyCount = m_bodyStore.GetCount();
 
-	float s[3] = { 0.0f, 0.0f, 0.0f }, s2[3] = { 0.0f, 0.0f, 0.0f }, v[3];
+	SnapshotWorldState state;
+	memset(&state, 0, sizeof(state));
+
+	state.stepCount = m_iStepCount;
+	state.stateHash = m_iStateHash;
+	state.registeredBodyCount = (uint32_t)m_bodies.size();
+	state.bodyCount = (uint32_t)bodyCount;
+	state.tileCount = (uint32_t)m_terrainTiles.size();
+	state.sortingAxis = m_sortingAxis;
+	state.proxiesSorted = m_bProxiesSorted ? 1 : 0;
+	state.maxProxyRadius = m_fMaxProxyRadius;
 
-	
-	for (int i = 0; i < MAX_OBJECTS; i++)
+	//Bodies are pointers, so they're saved as their world ids
+	m_snapshotBodyIds.resize(bodyCount);
+
+	for (int i = 0; i < bodyCount; i++)
 	{
-		//Determine the centre point of the AABB
-		Point p = { 0.5f * (m_AABBArray[i]->minPoint[0] + m_AABBArray[i]->maxPoint[0]), 0.5f * ( m_AABBArray[i]->minPoint[1] + m_AABBArray[i]->maxPoint[1]),  0.5f * (m_AABBArray[i]->minPoint[2] + m_AABBArray[i]->maxPoint[2]) };
+		m_snapshotBodyIds[i] = m_bodyStore.GetView(i)->GetWorldId();
+	}
 
-		//Update sum and sum2 for computing variance
-		for (int c = 0; c < 3; c++)
-		{
+	m_snapshotPoolIds.resize(m_bodyPool.size());
+
+	for (size_t i = 0; i < m_bodyPool.size(); i++)
+	{
+		m_snapshotPoolIds[i] = m_bodyPool[i]->GetWorldId();
+	}
+
+	SnapshotWriter writer;
+	writer.AddSection(SNAPSHOT_WORLD_STATE, 0, &state, sizeof(state), 1);
+
+	m_bodyStore.WriteSnapshot(writer);
+
+	writer.AddSection(SNAPSHOT_BODY_IDS, 0, m_snapshotBodyIds.data(), sizeof(int), m_snapshotBodyIds.size());
+	writer.AddSection(SNAPSHOT_BODY_POOL, 0, m_snapshotPoolIds.data(), sizeof(int), m_snapshotPoolIds.size());
+	writer.AddSection(SNAPSHOT_BROADPHASE_AABBS, 0, m_AABBArray.data(), sizeof(AABB), m_AABBArray.size());
+	writer.AddSection(SNAPSHOT_BROADPHASE_PROXIES, 0, m_bodyProxy.data(), sizeof(int), m_bodyProxy.size());
+
+	m_contactSolver.WriteSnapshot(writer);
+
+	writer.AddSection(SNAPSHOT_CONTACTS, 0, m_previousContacts.data(), sizeof(TrackedContact), m_previousContacts.size());
+
+	for (size_t t = 0; t < m_terrainTiles.size(); t++)
+	{
+		m_terrainTiles[t].heightMap->WriteSnapshot(writer, (int)t);
+	}
+
+	writer.Build(blob, compress, m_snapshotScratch, &m_jobSystem);
+}
+
+//Puts the world back in the state a snapshot was saved in, so stepping on gives the same results as
+//the saved world did. The world must have been given the same bodies and heightmap tiles, in the same order
+//Params : Blob and its size, which can be a file read into memory or mapped
+//Returns : False if the blob is damaged, another version or doesn't fit this world, which is left untouched
+bool PhysicsWorld::RestoreSnapshot(const void* data, size_t size)
+{
+	WaitForUpdate();
+
+	SnapshotReader reader;
+
+	if (!reader.Open(data, size, m_snapshotScratch, &m_jobSystem))
+	{
+		return false;
+	}
+
+	//Everything is checked before anything changes
+	const SnapshotWorldState* state = reader.FindArray<SnapshotWorldState>(SNAPSHOT_WORLD_STATE, 0, 1);
+
+	if (state == nullptr || state->registeredBodyCount != m_bodies.size() || state->tileCount != m_terrainTiles.size() ||
+		state->sortingAxis < 0 || state->sortingAxis > 2)
+	{
+		return false;
+	}
+
+	int bodyCount = m_bodyStore.CheckSnapshot(reader);
+
+	if (bodyCount < 0 || (uint32_t)bodyCount != state->bodyCount)
+	{
+		return false;
+	}
+
+	uint64_t poolCount = 0;
+	const int* bodyIds = reader.FindArray<int>(SNAPSHOT_BODY_IDS, 0, bodyCount);
+	const int* poolIds = (const int*)reader.FindSection(SNAPSHOT_BODY_POOL, 0, sizeof(int), poolCount);
+	const AABB* aabbs = reader.FindArray<AABB>(SNAPSHOT_BROADPHASE_AABBS, 0, bodyCount);
+	const int* proxies = reader.FindArray<int>(SNAPSHOT_BROADPHASE_PROXIES, 0, bodyCount);
+
+	uint64_t contactCount = 0;
+	const TrackedContact* contacts = (const TrackedContact*)reader.FindSection(SNAPSHOT_CONTACTS, 0, sizeof(TrackedContact), contactCount);
+
+	if (bodyIds == nullptr || poolIds == nullptr || aabbs == nullptr || proxies == nullptr || contacts == nullptr ||
+		bodyCount + poolCount != m_bodies.size() || !m_contactSolver.CheckSnapshot(reader))
+	{
+		return false;
+	}
+
+	//Each registered body has to be either in the world or in the pool, exactly once
+	std::vector<unsigned char> placed(m_bodies.size(), 0);
+
+	for (uint64_t i = 0; i < bodyCount + poolCount; i++)
+	{
+		int id = i < (uint64_t)bodyCount ? bodyIds[i] : poolIds[i - bodyCount];
+
+		if (id < 0 || id >= (int)m_bodies.size() || placed[id] != 0)
+		{
+			return false;
+		}
+
+		placed[id] = 1;
+	}
+
+	for (int i = 0; i < bodyCount; i++)
+	{
+		if (aabbs[i].body < 0 || aabbs[i].body >= bodyCount || proxies[i] < 0 || proxies[i] >= bodyCount)
+		{
+			return false;
+		}
+	}
+
+	for (size_t t = 0; t < m_terrainTiles.size(); t++)
+	{
+		if (!m_terrainTiles[t].heightMap->CheckSnapshot(reader, (int)t))
+		{
+			return false;
+		}
+	}
+
+	//Every body starts out detached, then the store and the views are pointed at each other again
+	for (auto body : m_bodies)
+	{
+		body->Rebind(nullptr, INVALID_BODY_HANDLE);
+	}
+
+	m_bodyStore.ReadSnapshot(reader);
+
+	for (int i = 0; i < bodyCount; i++)
+	{
+		DynamicBody* body = m_bodies[bodyIds[i]];
+
+		m_bodyStore.SetView(i, body);
+		body->Rebind(&m_bodyStore, m_bodyStore.GetHandle(i));
+	}
+
+	m_bodyPool.resize((size_t)poolCount);
+
+	for (uint64_t i = 0; i < poolCount; i++)
+	{
+		m_bodyPool[(size_t)i] = m_bodies[poolIds[i]];
+	}
+
+	m_AABBArray.assign(aabbs, aabbs + bodyCount);
+	m_bodyProxy.assign(proxies, proxies + bodyCount);
+	m_sortingAxis = state->sortingAxis;
+	m_bProxiesSorted = state->proxiesSorted != 0;
+	m_fMaxProxyRadius = state->maxProxyRadius;
+
+	m_contactSolver.ReadSnapshot(reader);
+
+	m_previousContacts.assign(contacts, contacts + contactCount);
+	m_currentContacts.clear();
+	m_contactEvents.Clear();
+
+	for (size_t t = 0; t < m_terrainTiles.size(); t++)
+	{
+		m_terrainTiles[t].heightMap->ReadSnapshot(reader, (int)t);
+	}
+
+	m_iStepCount = state->stepCount;
+	m_iStateHash = state->stateHash;
+
+	//Real time from before the restore shouldn't be simulated after it
+	ResetClock();
+
+	m_fInterpolationFactor = 1.0f;
+	PublishSnapshot(m_fInterpolationFactor);
+
+	return true;
+}
+
+//Controls the update of all bodies within the scene
+//Main function to be called. Accumulates real time and runs as many fixed steps as are due,
+//up to the substep cap. Any time over the cap is dropped rather than simulated later
+//Returns : Number of steps run
+int PhysicsWorld::UpdateWorld()
+{
+	//The real time clock would make the number of steps depend on the frame rate
+	if (m_bDeterministic)
+	{
+		Step(m_fFixedTimeStep);
+		return 1;
+	}
+
+	std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
+
+	//The first call only starts the clock, otherwise loading time would be simulated
+	if (!m_bClockStarted)
+	{
+		m_lastUpdateTime = now;
+		m_bClockStarted = true;
+
+		PublishSnapshot(1.0f);
+		return 0;
+	}
+
+	m_dAccumulator += std::chrono::duration<double>(now - m_lastUpdateTime).count();
+	m_lastUpdateTime = now;
+
+	int steps = 0;
+
+	//Events build up over every step of the update, each tagged with its step
+	m_contactEvents.Clear();
+
+	while (m_dAccumulator >= m_fFixedTimeStep && steps < m_iMaxSubSteps)
+	{
+		RunStep(m_fFixedTimeStep);
+
+		m_dAccumulator -= m_fFixedTimeStep;
+		steps++;
+	}
+
+	//After a hitch, drop whole steps we couldn't afford but keep the fraction of a step left over
+	if (m_dAccumulator >= m_fFixedTimeStep)
+	{
+		double leftover = fmod(m_dAccumulator, (double)m_fFixedTimeStep);
+
+		m_dDroppedTime += m_dAccumulator - leftover;
+		m_dAccumulator = leftover;
+	}
+
+	//Published every call, even without a step, as the blend moves on with real time
+	m_fInterpolationFactor = (float)(m_dAccumulator / m_fFixedTimeStep);
+	PublishSnapshot(m_fInterpolationFactor);
+
+	return steps;
+}
+
+//Restarts the real time clock used by UpdateWorld, discarding any accumulated time
+void PhysicsWorld::ResetClock()
+{
+	m_dAccumulator = 0.0;
+	m_bClockStarted = false;
+}
+
+//Starts UpdateWorld on the world's update thread (started by the first call and kept until the world
+//is deleted) and returns straight away. Nothing else may touch the world or its bodies until
+//WaitForUpdate, apart from reading snapshots with AcquireSnapshot
+void PhysicsWorld::UpdateWorldAsync()
+{
+	WaitForUpdate();
+
+	//One thread for the world's lifetime rather than one per frame
+	if (!m_updateThread.joinable())
+	{
+		m_bStopUpdateThread = false;
+		m_updateThread = std::thread(&PhysicsWorld::UpdateThreadLoop, this);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_updateMutex);
+		m_bUpdateRequested = true;
+		m_bUpdateFinished = false;
+	}
+
+	m_updateCondition.notify_all();
+	m_bUpdatePending = true;
+}
+
+//Waits for the update started by UpdateWorldAsync, if there is one
+//Returns : Number of steps it ran
+int PhysicsWorld::WaitForUpdate()
+{
+	if (!m_bUpdatePending)
+	{
+		return 0;
+	}
+
+	std::unique_lock<std::mutex> lock(m_updateMutex);
+	m_updateCondition.wait(lock, [this]() { return m_bUpdateFinished; });
+
+	m_bUpdatePending = false;
+
+	return m_iUpdateSteps;
+}
+
+//Loop run by the update thread, running UpdateWorld each time UpdateWorldAsync asks until the world is deleted
+void PhysicsWorld::UpdateThreadLoop()
+{
+	std::unique_lock<std::mutex> lock(m_updateMutex);
+
+	while (true)
+	{
+		m_updateCondition.wait(lock, [this]() { return m_bUpdateRequested || m_bStopUpdateThread; });
+
+		if (m_bStopUpdateThread)
+		{
+			return;
+		}
+
+		m_bUpdateRequested = false;
+
+		//The owner doesn't touch the world until it has seen finished, so the update runs unlocked
+		lock.unlock();
+		int steps = UpdateWorld();
+		lock.lock();
+
+		m_iUpdateSteps = steps;
+		m_bUpdateFinished = true;
+		m_updateCondition.notify_all();
+	}
+}
+
+//Stops and joins the update thread, if it was started
+void PhysicsWorld::StopUpdateThread()
+{
+	if (!m_updateThread.joinable())
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_updateMutex);
+		m_bStopUpdateThread = true;
+	}
+
+	m_updateCondition.notify_all();
+	m_updateThread.join();
+}
+
+//Set/Get the fixed step rate
+//Params : Steps per second
+void PhysicsWorld::SetStepRate(float stepsPerSecond)
+{
+	m_fFixedTimeStep = 1.0f / stepsPerSecond;
+}
+
+//Set/Get deterministic mode. UpdateWorld then runs exactly one fixed step per call rather than
+//following the real time clock, and the state hash is updated after every step, so a run can be
+//repeated and checked step by step. Contact order never depends on the clock or the worker count
+void PhysicsWorld::SetDeterministic(bool deterministic)
+{
+	m_bDeterministic = deterministic;
+
+	//Leaving deterministic mode mustn't simulate the time spent in it
+	ResetClock();
+
+	m_iStateHash = deterministic ? m_bodyStore.ComputeStateHash() : 0;
+}
+
+//Set/Get the maximum number of steps UpdateWorld will run in one call
+void PhysicsWorld::SetMaxSubSteps(int maxSubSteps)
+{
+	m_iMaxSubSteps = max(maxSubSteps, 1);
+}
+
+//Runs a single simulation step. Can be called directly to step faster (or slower) than real time
+//Params : Length of the step in seconds
+void PhysicsWorld::Step(float dt)
+{
+	m_contactEvents.Clear();
+
+	RunStep(dt);
+
+	m_fInterpolationFactor = 1.0f;
+	PublishSnapshot(m_fInterpolationFactor);
+}
+
+//Runs a step without publishing a snapshot
+//Params : Length of the step in seconds
+void PhysicsWorld::RunStep(float dt)
+{
+	StepClock::time_point stepStart = StepClock::now();
+	StepClock::time_point phaseStart = stepStart;
+
+	//Nothing from the last step is still running, so a single worker world can reuse the
+	//same few job slots every step. Keeps many small worlds stepped side by side compact
+	m_jobSystem.Rewind();
+
+	m_fStepTime = dt;
+
+	//Before the collision passes skip anything still asleep
+	WakeEditedTerrain();
+
+	//Where every body started the step, for interpolation
+	m_bodyStore.SavePreviousPositions();
+
+	//Terrain and body vs body collision only read the body store, so they run side by side.
+	//Building the islands wakes bodies, so it waits for both
+	JobHandle staticJob = m_jobSystem.CreateJob("StaticCollision", StaticCollisionJob, this);
+	JobHandle dynamicJob = m_jobSystem.CreateJob("DynamicCollision", DynamicCollisionJob, this);
+
+	//Group touching bodies, waking anything an awake body has run into
+	JobHandle islandsJob = m_jobSystem.CreateJob("BuildIslands", BuildIslandsJob, this);
+
+	m_jobSystem.AddDependency(islandsJob, staticJob);
+	m_jobSystem.AddDependency(islandsJob, dynamicJob);
+
+	m_jobSystem.Submit(islandsJob);
+	m_jobSystem.Submit(dynamicJob);
+	m_jobSystem.Submit(staticJob);
+	m_jobSystem.Wait(islandsJob);
+
+	m_stepTimings.collision = NextPhase(phaseStart);
+
+	int bodyCount = m_bodyStore.GetCount();
+
+	//Apply gravity and any other forces to every active, awake body.
+	//Forces go onto the velocity before solving, so the contacts can cancel them out this step
+	m_jobSystem.ParallelFor("IntegrateVelocities", bodyCount, INTEGRATE_GRAIN, IntegrateVelocitiesTask, this);
+
+	m_stepTimings.integrateVelocities = NextPhase(phaseStart);
+
+	//Resolve all static and dynamic collisions together
+	SolveContacts(dt);
+
+	m_stepTimings.solve = NextPhase(phaseStart);
+
+	if (m_bContactEvents)
+	{
+		RecordContactEvents();
+	}
+
+	m_stepTimings.contactEvents = NextPhase(phaseStart);
+
+	//Finally update the position of the bodies after all collisions have been resolved,
+	//deactivating any that have fallen out of the world
+	m_iKilledBodies = 0;
+	m_jobSystem.ParallelFor("IntegratePositions", bodyCount, INTEGRATE_GRAIN, IntegratePositionsTask, this);
+
+	m_stepTimings.integratePositions = NextPhase(phaseStart);
+
+	UpdateSleeping(dt);
+
+	m_stepTimings.sleeping = NextPhase(phaseStart);
+
+	//Clear each collision vector for next frame
+	m_staticCollisionList.clear();
+	m_dynamicCollisionList.clear();
+
+	//Bodies that fell out of the world go back to the pool, after the island data indexing them is done with
+	if (m_iKilledBodies > 0)
+	{
+		DespawnKilledBodies();
+	}
+
+	m_stepTimings.despawn = NextPhase(phaseStart);
+
+	//Sort the broadphase where the bodies ended up, for scene queries between steps.
+	//Unless something moves in between, the next step's sweep can use it as it is
+	UpdateAABBs();
+	SortAABBArray();
+
+	m_stepTimings.broadphase = NextPhase(phaseStart);
+
+	m_iStepCount++;
+
+	if (m_bDeterministic)
+	{
+		m_iStateHash = m_bodyStore.ComputeStateHash();
+	}
+
+	m_stepTimings.total = MillisecondsSince(stepStart);
+}
+
+//Copies the transforms of every active body into the snapshot buffer and publishes it, if snapshots are enabled
+//Params : Fraction of a step to blend the previous and current positions by
+void PhysicsWorld::PublishSnapshot(float alpha)
+{
+	if (!m_bSnapshots)
+	{
+		return;
+	}
+
+	BodySnapshot& snapshot = m_snapshots.GetWriteBuffer();
+
+	snapshot.step = m_iStepCount;
+	snapshot.alpha = alpha;
+	snapshot.handles.clear();
+	snapshot.views.clear();
+	snapshot.positions.clear();
+	snapshot.previousPositions.clear();
+
+	const float* posX = m_bodyStore.GetPositionX();
+	const float* posY = m_bodyStore.GetPositionY();
+	const float* posZ = m_bodyStore.GetPositionZ();
+	const float* prevX = m_bodyStore.GetPreviousPositionX();
+	const float* prevY = m_bodyStore.GetPreviousPositionY();
+	const float* prevZ = m_bodyStore.GetPreviousPositionZ();
+
+	for (int i = 0; i < m_bodyStore.GetCount(); i++)
+	{
+		if (m_bodyStore.IsActive(i))
+		{
+			snapshot.handles.push_back(m_bodyStore.GetHandle(i));
+			snapshot.views.push_back(m_bodyStore.GetView(i));
+			snapshot.positions.push_back(XMFLOAT3(posX[i], posY[i], posZ[i]));
+			snapshot.previousPositions.push_back(XMFLOAT3(prevX[i], prevY[i], prevZ[i]));
+		}
+	}
+
+	m_snapshots.Publish();
+}
+
+//Controls the collision between the dynamic bodies
+//and the static heightmap
+void PhysicsWorld::HandleStaticCollision()
+{
+	//Make sure there is some terrain to collide with
+	if (!m_terrainTiles.empty())
+	{
+		//Reset the colours of the heightmaps (Get rid of the red collision colour)
+		for (auto& tile : m_terrainTiles)
+		{
+			tile.heightMap->ResetVertexColours();
+		}
+
+		int bodyCount = m_bodyStore.GetCount();
+		int chunkCount = (bodyCount + STATIC_COLLISION_GRAIN - 1) / STATIC_COLLISION_GRAIN;
+
+		m_workerTileQuery.resize(m_jobSystem.GetWorkerCount());
+
+		//Very large ranges get chunks of several grains, which leaves some outputs unwritten, so every
+		//output is emptied here rather than by its chunk
+		ResetChunkOutputs(m_staticChunkCollisions, chunkCount, m_iStaticChunkCapacity);
+
+		//Loop through all bodies and check collision with the tiles they overlap
+		m_jobSystem.ParallelFor("StaticCollision", bodyCount, STATIC_COLLISION_GRAIN, StaticCollisionTask, this);
+
+		//Concatenate the chunks in body order, colouring the faces hit on the way
+		for (int c = 0; c < chunkCount; c++)
+		{
+			for (auto& collision : m_staticChunkCollisions[c])
+			{
+				m_terrainTiles[collision.tileIndex].heightMap->MarkFaceCollided(collision.faceIndex);
+			}
+
+			m_staticCollisionList.insert(m_staticCollisionList.end(), m_staticChunkCollisions[c].begin(), m_staticChunkCollisions[c].end());
+		}
+
+		GrowChunkCapacity(m_staticChunkCollisions, chunkCount, m_iStaticChunkCapacity);
+
+		//Only the CPU side colours are changed here, the step may be running on another thread
+		//than the one owning the device. The owner uploads them with RebuildVertexData
+	}
+}
+
+//Job entry point, tests a run of bodies against the terrain
+void PhysicsWorld::StaticCollisionTask(void* context, int begin, int end, int worker)
+{
+	PhysicsWorld* world = (PhysicsWorld*)context;
+	const BodyStore& store = world->m_bodyStore;
+
+	std::vector<PhysicsStaticCollision>& chunkCollisions = world->m_staticChunkCollisions[begin / STATIC_COLLISION_GRAIN];
+	std::vector<int>& tiles = world->m_workerTileQuery[worker];
+
+	for (int body = begin; body < end; body++)
+	{
+		//Only check the body against the heightmap if it's active
+		if (!store.IsActive(body))
+		{
+			continue;
+		}
+
+		XMVECTOR pos = store.GetPosition(body);
+		float radius = store.GetRadius(body);
+
+		world->QueryTiles(XMVectorGetX(pos) - radius, XMVectorGetZ(pos) - radius, XMVectorGetX(pos) + radius, XMVectorGetZ(pos) + radius, tiles);
+
+		for (auto t : tiles)
+		{
+			//The body could be colliding with more than one face on the heightmap, they're
+			//written straight onto the end of the chunk's list
+			int added = world->m_terrainTiles[t].heightMap->SphereHeightmap(body, pos, radius, chunkCollisions);
+
+			for (size_t i = chunkCollisions.size() - added; i < chunkCollisions.size(); i++)
+			{
+				chunkCollisions[i].tileIndex = t;
+			}
+		}
+	}
+}
+
+//Controls the collision between all dynamic bodies
+void PhysicsWorld::HandleDynamicCollision()
+{
+	SortAndSweepAABBArray();
+	//GeneratePairs();
+}
+
+//Job entry points for the stages of a step
+void PhysicsWorld::StaticCollisionJob(void* context, int begin, int end, int worker)
+{
+	PhysicsWorld* world = (PhysicsWorld*)context;
+	StepClock::time_point start = StepClock::now();
+
+	world->HandleStaticCollision();
+
+	world->m_stepTimings.staticCollision = MillisecondsSince(start);
+}
+
+void PhysicsWorld::DynamicCollisionJob(void* context, int begin, int end, int worker)
+{
+	PhysicsWorld* world = (PhysicsWorld*)context;
+	StepClock::time_point start = StepClock::now();
+
+	world->HandleDynamicCollision();
+
+	world->m_stepTimings.dynamicCollision = MillisecondsSince(start);
+}
+
+void PhysicsWorld::BuildIslandsJob(void* context, int begin, int end, int worker)
+{
+	PhysicsWorld* world = (PhysicsWorld*)context;
+	StepClock::time_point start = StepClock::now();
+
+	world->BuildIslands();
+
+	world->m_stepTimings.buildIslands = MillisecondsSince(start);
+}
+
+//Job entry points, integrate a run of bodies
+void PhysicsWorld::IntegrateVelocitiesTask(void* context, int begin, int end, int worker)
+{
+	PhysicsWorld* world = (PhysicsWorld*)context;
+
+	world->m_bodyStore.IntegrateVelocities(world->m_fStepTime, XMFLOAT3(0.0f, GRAVITY, 0.0f), begin, end);
+}
+
+void PhysicsWorld::IntegratePositionsTask(void* context, int begin, int end, int worker)
+{
+	PhysicsWorld* world = (PhysicsWorld*)context;
+
+	int killed = world->m_bodyStore.IntegratePositions(world->m_fStepTime, KILL_PLANE_Y, begin, end);
+
+	if (killed > 0)
+	{
+		world->m_iKilledBodies += killed;
+	}
+}
+
+//void PhysicsWorld::GeneratePairs()
+//{
+//	for (auto bodyA : m_dynamicBodyList)
+//	{
+//		for (auto bodyB : m_dynamicBodyList)
+//		{
+//			if (bodyA == bodyB)
+//			{
+//				continue;
+//			}
+//
+//
+//			PhysicsDynamicCollision collisionPair(bodyA, bodyB);
+//
+//			if (CircleVsCircle(&collisionPair))
+//			{
+//				m_dynamicCollisionList.push_back(collisionPair);
+//			}
+//		}
+//	}
+//
+//
+//	for (auto collision : m_dynamicCollisionList)
+//	{
+//		collision.bodyA->ResolveCollision(collision.collisionNormal);
+//		collision.bodyB->ResolveCollision(collision.collisionNormal);
+//	}
+//
+//	for (auto collision : m_dynamicCollisionList)
+//	{
+//		PositionalCorrection(&collision);
+//	}
+//}
+
+//Groups active bodies touching each other into islands with a union-find over the
+//dynamic collisions, waking any island that has an awake body in it
+void PhysicsWorld::BuildIslands()
+{
+	int bodyCount = m_bodyStore.GetCount();
+
+	ReserveGrowth(m_islandParent, bodyCount);
+	m_islandParent.resize(bodyCount);
+	for (int i = 0; i < bodyCount; i++)
+	{
+		m_islandParent[i] = i;
+	}
+
+	//Terrain contacts don't join islands, the terrain can't pass impulses between bodies
+	for (auto& collision : m_dynamicCollisionList)
+	{
+		int rootA = FindIslandRoot(collision.bodyA);
+		int rootB = FindIslandRoot(collision.bodyB);
+
+		//Lower index as the root keeps the result independent of pair order
+		if (rootA < rootB)
+		{
+			m_islandParent[rootB] = rootA;
+		}
+		else if (rootB < rootA)
+		{
+			m_islandParent[rootA] = rootB;
+		}
+	}
+
+	//Number the islands in body order, using the parent array to map roots to islands
+	ReserveGrowth(m_bodyIsland, bodyCount);
+	m_bodyIsland.assign(bodyCount, -1);
+	m_islandStart.clear();
+
+	int islandCount = 0;
+
+	for (int i = 0; i < bodyCount; i++)
+	{
+		if (!m_bodyStore.IsActive(i))
+		{
+			continue;
+		}
+
+		int root = FindIslandRoot(i);
+
+		if (m_bodyIsland[root] < 0)
+		{
+			m_bodyIsland[root] = islandCount++;
+			m_islandStart.push_back(0);
+		}
+
+		m_bodyIsland[i] = m_bodyIsland[root];
+		m_islandStart[m_bodyIsland[i]]++;
+	}
+
+	m_islandStart.push_back(0);
+
+	//Counts to offsets, then fill
+	int offset = 0;
+	for (int i = 0; i <= islandCount; i++)
+	{
+		int count = m_islandStart[i];
+		m_islandStart[i] = offset;
+		offset += count;
+	}
+
+	ReserveGrowth(m_islandBodies, offset);
+	m_islandBodies.resize(offset);
+	std::vector<int>& writeIndex = m_islandParent;
+	writeIndex.assign(m_islandStart.begin(), m_islandStart.end() - 1);
+
+	for (int i = 0; i < bodyCount; i++)
+	{
+		if (m_bodyIsland[i] >= 0)
+		{
+			m_islandBodies[writeIndex[m_bodyIsland[i]]++] = i;
+		}
+	}
+
+	//An island sleeps only if every body in it is asleep, otherwise the whole island wakes
+	ReserveGrowth(m_islandSleeping, islandCount);
+	m_islandSleeping.assign(islandCount, false);
+	m_islandSizeHistogram.clear();
+	m_iIslandCount = islandCount;
+	m_iSleepingIslandCount = 0;
+	m_iLargestIslandSize = 0;
+
+	for (int i = 0; i < islandCount; i++)
+	{
+		int begin = m_islandStart[i];
+		int end = m_islandStart[i + 1];
+
+		bool sleeping = true;
+		for (int b = begin; b < end && sleeping; b++)
+		{
+			sleeping = m_bodyStore.IsSleeping(m_islandBodies[b]);
+		}
+
+		if (!sleeping)
+		{
+			//Only the sleepers, waking restarts the sleep timer the awake bodies are building up
+			for (int b = begin; b < end; b++)
+			{
+				if (m_bodyStore.IsSleeping(m_islandBodies[b]))
+				{
+					m_bodyStore.Wake(m_islandBodies[b]);
+				}
+			}
+		}
+		else
+		{
+			m_iSleepingIslandCount++;
+		}
+
+		m_islandSleeping[i] = sleeping;
+
+		int size = end - begin;
+		m_iLargestIslandSize = max(m_iLargestIslandSize, size);
+
+		int bucket = 0;
+		while ((size >> (bucket + 1)) > 0)
+		{
+			bucket++;
+		}
+
+		if ((int)m_islandSizeHistogram.size() <= bucket)
+		{
+			m_islandSizeHistogram.resize(bucket + 1, 0);
+		}
+		m_islandSizeHistogram[bucket]++;
+	}
+}
+
+//Finds the root of a body's set in the union-find
+//Params : Index of the body
+//Returns : Index of the root body
+int PhysicsWorld::FindIslandRoot(int body)
+{
+	while (m_islandParent[body] != body)
+	{
+		//Path halving, keeps the trees flat
+		m_islandParent[body] = m_islandParent[m_islandParent[body]];
+		body = m_islandParent[body];
+	}
+
+	return body;
+}
+
+//Puts islands that have been resting long enough to sleep
+//Params : Length of the step in seconds
+void PhysicsWorld::UpdateSleeping(float dt)
+{
+	if (!m_bSleepingEnabled)
+	{
+		return;
+	}
+
+	for (int i = 0; i < m_iIslandCount; i++)
+	{
+		if (m_islandSleeping[i])
+		{
+			continue;
+		}
+
+		int begin = m_islandStart[i];
+		int end = m_islandStart[i + 1];
+
+		//The island is only as rested as its least rested body
+		float restTime = FLT_MAX;
+
+		for (int b = begin; b < end; b++)
+		{
+			int body = m_islandBodies[b];
+
+			//Bodies that fell out of the world this step are no longer part of it
+			if (m_bodyStore.IsActive(body))
+			{
+				restTime = min(restTime, m_bodyStore.UpdateSleepTime(body, dt, SLEEP_SPEED));
+			}
+		}
+
+		if (restTime >= SLEEP_DELAY && restTime != FLT_MAX)
+		{
+			for (int b = begin; b < end; b++)
+			{
+				m_bodyStore.Sleep(m_islandBodies[b]);
+			}
+		}
+	}
+}
+
+//Set/Get whether resting islands are put to sleep
+void PhysicsWorld::SetSleepingEnabled(bool enabled)
+{
+	m_bSleepingEnabled = enabled;
+
+	if (!enabled)
+	{
+		WakeAllBodies();
+	}
+}
+
+//Wakes every body, e.g. after the terrain has changed underneath them
+void PhysicsWorld::WakeAllBodies()
+{
+	for (int i = 0; i < m_bodyStore.GetCount(); i++)
+	{
+		m_bodyStore.Wake(i);
+	}
+}
+
+//Set/Get whether contact events are recorded
+void PhysicsWorld::SetContactEventsEnabled(bool enabled)
+{
+	m_bContactEvents = enabled;
+
+	//Contacts touching when recording restarts begin again rather than persisting from before
+	m_previousContacts.clear();
+	m_contactEvents.Clear();
+}
+
+//Compares this step's contacts with the last step's and records the begin, persist and end events
+void PhysicsWorld::RecordContactEvents()
+{
+	m_currentContacts.clear();
+
+	//Every contact found, including those in sleeping islands which the solver skipped (their impulse is 0)
+	for (auto& collision : m_staticCollisionList)
+	{
+		BodyHandle handle = m_bodyStore.GetHandle(collision.body);
+
+		TrackedContact contact;
+		contact.key = ContactSolver::MakeStaticKey(GetHandleSlot(handle), m_terrainTiles[collision.tileIndex].firstFace + collision.faceIndex);
+		contact.bodyA = INVALID_BODY_HANDLE;
+		contact.bodyB = handle;
+		contact.tile = collision.tileIndex;
+		contact.face = collision.faceIndex;
+
+		m_currentContacts.push_back(contact);
+	}
+
+	for (auto& collision : m_dynamicCollisionList)
+	{
+		BodyHandle handleA = m_bodyStore.GetHandle(collision.bodyA);
+		BodyHandle handleB = m_bodyStore.GetHandle(collision.bodyB);
+
+		//Same order as the key, so the pair matches whichever way round the broadphase found it
+		if (GetHandleSlot(handleA) > GetHandleSlot(handleB))
+		{
+			std::swap(handleA, handleB);
+		}
+
+		TrackedContact contact;
+		contact.key = ContactSolver::MakeDynamicKey(GetHandleSlot(handleA), GetHandleSlot(handleB));
+		contact.bodyA = handleA;
+		contact.bodyB = handleB;
+		contact.tile = -1;
+		contact.face = -1;
+
+		m_currentContacts.push_back(contact);
+	}
+
+	std::sort(m_currentContacts.begin(), m_currentContacts.end(), [](const TrackedContact& a, const TrackedContact& b)
+	{
+		return a.key < b.key;
+	});
+
+	//Merge the two sorted lists: in both persists, only in this step begins, only in the last ends.
+	//A key whose handles changed had its slot reused by another body, so it's a different contact
+	size_t current = 0;
+	size_t previous = 0;
+
+	while (current < m_currentContacts.size() || previous < m_previousContacts.size())
+	{
+		const TrackedContact* now = current < m_currentContacts.size() ? &m_currentContacts[current] : nullptr;
+		const TrackedContact* before = previous < m_previousContacts.size() ? &m_previousContacts[previous] : nullptr;
+
+		if (now != nullptr && before != nullptr && now->key == before->key && now->bodyA == before->bodyA && now->bodyB == before->bodyB)
+		{
+			m_contactEvents.Push(CONTACT_PERSIST, m_iStepCount, now->bodyA, now->bodyB, now->tile, now->face, m_contactSolver.GetSolvedImpulse(now->key));
+			current++;
+			previous++;
+		}
+		else if (before == nullptr || (now != nullptr && now->key < before->key))
+		{
+			m_contactEvents.Push(CONTACT_BEGIN, m_iStepCount, now->bodyA, now->bodyB, now->tile, now->face, m_contactSolver.GetSolvedImpulse(now->key));
+			current++;
+		}
+		else
+		{
+			m_contactEvents.Push(CONTACT_END, m_iStepCount, before->bodyA, before->bodyB, before->tile, before->face, 0.0f);
+			previous++;
+		}
+	}
+
+	m_previousContacts.swap(m_currentContacts);
+}
+
+//Feeds every collision found this step into the contact solver and copies
+//the solved velocities back onto the bodies
+//Params : Length of the step in seconds
+void PhysicsWorld::SolveContacts(float dt)
+{
+	int bodyCount = m_bodyStore.GetCount();
+
+	m_contactSolver.Begin(bodyCount);
+
+	for (int i = 0; i < bodyCount; i++)
+	{
+		SolverBody& solverBody = m_contactSolver.GetBody(i);
+
+		XMStoreFloat3(&solverBody.velocity, m_bodyStore.GetVelocity(i));
+
+		//Inactive and sleeping bodies can't be pushed around
+		solverBody.invMass = m_bodyStore.IsAwake(i) ? m_bodyStore.GetInverseMass(i) : 0.0f;
+
+		//Islands never share bodies, so the solver can work on each separately
+		solverBody.island = max(m_bodyIsland[i], 0);
+	}
+
+	//Terrain is the static A side of the contact, the normal points up out of it towards the body
+	for (auto& collision : m_staticCollisionList)
+	{
+		int body = collision.body;
+
+		//Sleeping islands are left exactly where they are
+		if (m_islandSleeping[m_bodyIsland[body]])
+		{
+			continue;
+		}
+
+		unsigned long long worldFace = m_terrainTiles[collision.tileIndex].firstFace + collision.faceIndex;
+		m_contactSolver.AddContact(ContactSolver::MakeStaticKey(GetHandleSlot(m_bodyStore.GetHandle(body)), worldFace), -1, body, collision.collisionNormal, collision.penetrationDepth);
+	}
+
+	for (auto& collision : m_dynamicCollisionList)
+	{
+		int bodyA = collision.bodyA;
+		int bodyB = collision.bodyB;
+
+		if (m_islandSleeping[m_bodyIsland[bodyA]])
+		{
+			continue;
+		}
+
+		m_contactSolver.AddContact(ContactSolver::MakeDynamicKey(GetHandleSlot(m_bodyStore.GetHandle(bodyA)), GetHandleSlot(m_bodyStore.GetHandle(bodyB))), bodyA, bodyB, collision.collisionNormal, collision.penetrationDepth);
+	}
+
+	m_contactSolver.Solve(dt);
+
+	for (int i = 0; i < bodyCount; i++)
+	{
+		if (m_bodyStore.IsAwake(i))
+		{
+			m_bodyStore.SetVelocity(i, XMLoadFloat3(&m_contactSolver.GetBody(i).velocity));
+		}
+	}
+}
+
+//Simple circle vs circle check (Taken from Real Time Collision Detection book)
+//Params : Collision pair to be tested
+//Returns : True if the two bodies are overlapping (colliding)
+bool PhysicsWorld::CircleVsCircle(PhysicsDynamicCollision * collisionPair) const
+{
+	//Get the index of each body
+	int bodyA = collisionPair->bodyA;
+	int bodyB = collisionPair->bodyB;
+
+	//Get the distance between each body
+	XMVECTOR dist = m_bodyStore.GetPosition(bodyB) - m_bodyStore.GetPosition(bodyA);
+
+	//Get the sum of radii of each body
+	float r = m_bodyStore.GetRadius(bodyA) + m_bodyStore.GetRadius(bodyB);
+
+	//Check the distance ^ 2 against the sum of radii ^ 2 
+	//to stop an expensive square root operation.
+	//If the distance is greater than the radius then there is 
+	//no collision
+	if (XMVectorGetX(XMVector3LengthSq(dist)) > r * r)
+	{
+		return false;
+	}
+
+	//Circles have collided
+
+	//Get square rooted length of vector between bodies
+	float d = XMVectorGetX(XMVector3Length(dist));
+
+	if (d != 0)
+	{
+		//Calculate penetration depth and collision normal
+		collisionPair->penetrationDepth = r - d;
+		collisionPair->collisionNormal = dist / d;
+
+		return true;
+	}
+
+	//Circles are on the same position
+	else
+	{
+		//Set generic values to penetration depth and normal if circles
+		//are on the exact same position
+		collisionPair->penetrationDepth = m_bodyStore.GetRadius(bodyA);
+		collisionPair->collisionNormal = XMVectorSet(1, 0, 0, 0);
+		return true;
+	}
+}
+
+//Simple AABB vs AABB check (Taken from Real Time Collision Detection book)
+//Params : Pointers to each AABB to check
+//Returns : 1 if two bounding boxes are overlapping, 0 if not
+int PhysicsWorld::AABBvsAABB(const AABB * a, const AABB * b) const
+{
+	if (a->maxPoint[0] < b->minPoint[0] || a->minPoint[0] > b->maxPoint[0]) return 0;
+	if (a->maxPoint[1] < b->minPoint[1] || a->minPoint[1] > b->maxPoint[1]) return 0;
+	if (a->maxPoint[2] < b->minPoint[2] || a->minPoint[2] > b->maxPoint[2]) return 0;
+	return 1;
+}
+
+//Updates all AABBs surrounding each dynamic body
+void PhysicsWorld::UpdateAABBs()
+{
+	m_jobSystem.ParallelFor("UpdateAABBs", (int)m_AABBArray.size(), BROADPHASE_GRAIN, UpdateAABBsTask, this);
+}
+
+//Job entry point, updates a run of AABBs
+void PhysicsWorld::UpdateAABBsTask(void* context, int begin, int end, int worker)
+{
+	PhysicsWorld* world = (PhysicsWorld*)context;
+	const BodyStore& store = world->m_bodyStore;
+
+	const float* posX = store.GetPositionX();
+	const float* posY = store.GetPositionY();
+	const float* posZ = store.GetPositionZ();
+	const float* radii = store.GetRadii();
+
+	//Loop through the run of objects
+	for (int i = begin; i < end; i++)
+	{
+		AABB& aabb = world->m_AABBArray[i];
+		int body = aabb.body;
+
+		//If the body is active
+		if (store.IsActive(body))
+		{
+			//Then update it's bounds
+			aabb.UpdatePosition(posX[body], posY[body], posZ[body], radii[body]);
+		}
+	}
+}
+
+//Broadphase method used for dynamic collisions (Taken from Real Time Collision Detection book)
+//Sorts bodies on a specified axis and only checks those that are close together
+//Also calculates the variance of each axis and then decides which axis (X, Y, or Z) is best to sort against next
+void PhysicsWorld::SortAndSweepAABBArray()
+{
+	//Update all bounds
+	UpdateAABBs();
+
+	//Clear the old dynamic collision lit
+	m_dynamicCollisionList.clear();
+
+	//The array is sorted at the end of every step, so it only needs sorting again if
+	//bodies were added, removed or moved by hand since
+	AABBAxisLess less = { m_sortingAxis };
+
+	if (!m_bProxiesSorted || !std::is_sorted(m_AABBArray.begin(), m_AABBArray.end(), less))
+	{
+		SortAABBArray();
+	}
+
+	int count = (int)m_AABBArray.size();
+	int chunkCount = (count + BROADPHASE_GRAIN - 1) / BROADPHASE_GRAIN;
+
+	//Each chunk of boxes sweeps forward on its own, the pairs are joined up in order afterwards
+	//Outputs are emptied here, not by their chunks, as very large ranges leave some of them unwritten
+	ResetChunkOutputs(m_dynamicChunkCollisions, chunkCount, m_iDynamicChunkCapacity);
+
+	m_jobSystem.ParallelFor("Sweep", count, BROADPHASE_GRAIN, SweepTask, this);
+
+	for (int c = 0; c < chunkCount; c++)
+	{
+		m_dynamicCollisionList.insert(m_dynamicCollisionList.end(), m_dynamicChunkCollisions[c].begin(), m_dynamicChunkCollisions[c].end());
+	}
+
+	GrowChunkCapacity(m_dynamicChunkCollisions, chunkCount, m_iDynamicChunkCapacity);
+
+	float s[3] = { 0.0f, 0.0f, 0.0f }, s2[3] = { 0.0f, 0.0f, 0.0f }, v[3];
+
+	for (int i = 0; i < count; i++)
+	{
+		const AABB* a = &m_AABBArray[i];
+
+		//Determine the centre point of the AABB
+		Point p = { 0.5f * (a->minPoint[0] + a->maxPoint[0]), 0.5f * (a->minPoint[1] + a->maxPoint[1]),  0.5f * (a->minPoint[2] + a->maxPoint[2]) };
+
+		//Update sum and sum2 for computing variance
+		for (int c = 0; c < 3; c++)
+		{
 			s[c] += p[c];
 			s2[c] += p[c] * p[c];
 		}
+	}
+
+	if (count > 0)
+	{
+		//Calculate variance
+		for (int c = 0; c < 3; c++)
+		{
+			v[c] = s2[c] - s[c] * s[c] / count;
+		}
+
+		//Update axis to test next
+		m_sortingAxis = 0;
+		if (v[1] > v[0])
+		{
+			m_sortingAxis = 1;
+		}
+		if (v[2] > v[m_sortingAxis])
+		{
+			m_sortingAxis = 2;
+		}
+	}
+}
+
+//Sorts the AABB array on the current sorting axis and points each body at its AABB
+void PhysicsWorld::SortAABBArray()
+{
+	//Sort the array based on their min point position (ascending)
+	AABBAxisLess less = { m_sortingAxis };
+	std::sort(m_AABBArray.begin(), m_AABBArray.end(), less);
+
+	m_fMaxProxyRadius = 0.0f;
+
+	for (int i = 0; i < (int)m_AABBArray.size(); i++)
+	{
+		const AABB& aabb = m_AABBArray[i];
+
+		m_bodyProxy[aabb.body] = i;
+		m_fMaxProxyRadius = max(m_fMaxProxyRadius, 0.5f * (aabb.maxPoint[m_sortingAxis] - aabb.minPoint[m_sortingAxis]));
+	}
+
+	m_bProxiesSorted = true;
+}
+
+//Finds the run of sorted AABBs that could overlap an interval on the sorted axis, all of them if
+//the array isn't sorted
+//Params : Interval on the sorted axis, first AABB and one past the last AABB to fill in
+void PhysicsWorld::GetProxyRange(float low, float high, int& begin, int& end) const
+{
+	if (!m_bProxiesSorted)
+	{
+		begin = 0;
+		end = (int)m_AABBArray.size();
+		return;
+	}
+
+	int axis = m_sortingAxis;
+
+	//A box starting further back than the widest box is long can't reach the interval
+	float first = low - 2.0f * m_fMaxProxyRadius;
+
+	begin = (int)(std::lower_bound(m_AABBArray.begin(), m_AABBArray.end(), first, [axis](const AABB& aabb, float value)
+	{
+		return aabb.minPoint[axis] < value;
+	}) - m_AABBArray.begin());
+
+	end = (int)(std::upper_bound(m_AABBArray.begin() + begin, m_AABBArray.end(), high, [axis](float value, const AABB& aabb)
+	{
+		return value < aabb.minPoint[axis];
+	}) - m_AABBArray.begin());
+}
+
+//Finds every body overlapping a sphere
+//Params : Centre and radius of the sphere, buffer for the handles of the bodies found, its length
+//Returns : Number of bodies found, can be more than the buffer holds (only that many are written)
+int PhysicsWorld::OverlapSphere(const XMVECTOR& centre, float radius, BodyHandle* results, int maxResults) const
+{
+	XMFLOAT3 c;
+	XMStoreFloat3(&c, centre);
+
+	const float* point[3] = { &c.x, &c.y, &c.z };
+	float axisCentre = *point[m_sortingAxis];
+
+	int begin, end;
+	GetProxyRange(axisCentre - radius, axisCentre + radius, begin, end);
+
+	const float* posX = m_bodyStore.GetPositionX();
+	const float* posY = m_bodyStore.GetPositionY();
+	const float* posZ = m_bodyStore.GetPositionZ();
+	const float* radii = m_bodyStore.GetRadii();
+
+	//Box around the sphere, to reject most candidates on the AABB array alone
+	AABB bounds(centre, radius, -1);
+
+	int found = 0;
+
+	for (int i = begin; i < end; i++)
+	{
+		if (!AABBvsAABB(&bounds, &m_AABBArray[i]))
+		{
+			continue;
+		}
+
+		int body = m_AABBArray[i].body;
+
+		if (!m_bodyStore.IsActive(body))
+		{
+			continue;
+		}
+
+		float dx = posX[body] - c.x;
+		float dy = posY[body] - c.y;
+		float dz = posZ[body] - c.z;
+		float r = radius + radii[body];
 
-		//Test collisions against all possible overlapping AABBs following current one
-		for (int j = 0; j < MAX_OBJECTS; j++)
+		if (dx * dx + dy * dy + dz * dz <= r * r)
 		{
-			//If it's the same body then skip over
-			if (m_AABBArray[j]->body == m_AABBArray[i]->body)
+			if (found < maxResults)
 			{
-				continue;
+				results[found] = m_bodyStore.GetHandle(body);
 			}
 
-			//If either body is inactive then skip over
-			if (!m_AABBArray[j]->body->GetActive() || !m_AABBArray[i]->body->GetActive())
+			found++;
+		}
+	}
+
+	return found;
+}
+
+//Finds every body overlapping a box
+//Params : Minimum and maximum corners of the box, buffer for the handles of the bodies found, its length
+//Returns : Number of bodies found, can be more than the buffer holds (only that many are written)
+int PhysicsWorld::OverlapAABB(const XMFLOAT3& minPoint, const XMFLOAT3& maxPoint, BodyHandle* results, int maxResults) const
+{
+	const float boxMin[3] = { minPoint.x, minPoint.y, minPoint.z };
+	const float boxMax[3] = { maxPoint.x, maxPoint.y, maxPoint.z };
+
+	int begin, end;
+	GetProxyRange(boxMin[m_sortingAxis], boxMax[m_sortingAxis], begin, end);
+
+	const float* posX = m_bodyStore.GetPositionX();
+	const float* posY = m_bodyStore.GetPositionY();
+	const float* posZ = m_bodyStore.GetPositionZ();
+	const float* radii = m_bodyStore.GetRadii();
+
+	AABB bounds(XMVectorSet(0, 0, 0, 0), 0.0f, -1);
+
+	for (int c = 0; c < 3; c++)
+	{
+		bounds.minPoint[c] = boxMin[c];
+		bounds.maxPoint[c] = boxMax[c];
+	}
+
+	int found = 0;
+
+	for (int i = begin; i < end; i++)
+	{
+		if (!AABBvsAABB(&bounds, &m_AABBArray[i]))
+		{
+			continue;
+		}
+
+		int body = m_AABBArray[i].body;
+
+		if (!m_bodyStore.IsActive(body))
+		{
+			continue;
+		}
+
+		//Distance from the sphere's centre to the closest point of the box (Real Time Collision Detection)
+		float dx = posX[body] - min(max(posX[body], minPoint.x), maxPoint.x);
+		float dy = posY[body] - min(max(posY[body], minPoint.y), maxPoint.y);
+		float dz = posZ[body] - min(max(posZ[body], minPoint.z), maxPoint.z);
+
+		if (dx * dx + dy * dy + dz * dz <= radii[body] * radii[body])
+		{
+			if (found < maxResults)
 			{
-				continue;
+				results[found] = m_bodyStore.GetHandle(body);
 			}
 
-			//If the minimum point of body B is greater than maximum point of body A then skip over as
-			//it's not close enough to bother checking collision
-			if (m_AABBArray[j]->minPoint[m_sortingAxis] > m_AABBArray[i]->maxPoint[m_sortingAxis])
+			found++;
+		}
+	}
+
+	return found;
+}
+
+//Finds the bodies whose centres are nearest a point, nearest first
+//Params : Point, number of bodies wanted, buffers of k entries for the handles and their distances
+//Returns : Number of bodies found, less than k if there aren't that many
+int PhysicsWorld::KNearest(const XMVECTOR& point, int k, BodyHandle* results, float* distances) const
+{
+	if (k <= 0)
+	{
+		return 0;
+	}
+
+	XMFLOAT3 p;
+	XMStoreFloat3(&p, point);
+
+	const float* coords[3] = { &p.x, &p.y, &p.z };
+	float axisPoint = *coords[m_sortingAxis];
+	int axis = m_sortingAxis;
+
+	const float* posX = m_bodyStore.GetPositionX();
+	const float* posY = m_bodyStore.GetPositionY();
+	const float* posZ = m_bodyStore.GetPositionZ();
+
+	int count = (int)m_AABBArray.size();
+	int found = 0;
+
+	//Squared distances are kept in the distance buffer until the end, sorted nearest first
+	auto consider = [&](int proxy)
+	{
+		const AABB& aabb = m_AABBArray[proxy];
+
+		//Once k bodies are found, anything whose box is further away than the kth can't be nearer
+		if (found == k)
+		{
+			float boxDistanceSq = 0.0f;
+
+			for (int c = 0; c < 3; c++)
 			{
-				continue;
+				float outside = max(max(aabb.minPoint[c] - *coords[c], *coords[c] - aabb.maxPoint[c]), 0.0f);
+				boxDistanceSq += outside * outside;
 			}
-			//If AABBS overlap 
-			if (AABBvsAABB(m_AABBArray[i], m_AABBArray[j]))
+
+			if (boxDistanceSq >= distances[k - 1])
 			{
-				//Create a dynamic collision pair using each body
-				PhysicsDynamicCollision collisionPair(m_AABBArray[i]->body, m_AABBArray[j]->body);
+				return;
+			}
+		}
 
-				//Finally do the proper collision check here
-				if (CircleVsCircle(&collisionPair))
+		int body = aabb.body;
+
+		if (!m_bodyStore.IsActive(body))
+		{
+			return;
+		}
+
+		float dx = posX[body] - p.x;
+		float dy = posY[body] - p.y;
+		float dz = posZ[body] - p.z;
+		float distanceSq = dx * dx + dy * dy + dz * dz;
+
+		if (found == k && distanceSq >= distances[k - 1])
+		{
+			return;
+		}
+
+		int slot = found < k ? found++ : k - 1;
+
+		while (slot > 0 && distances[slot - 1] > distanceSq)
+		{
+			distances[slot] = distances[slot - 1];
+			results[slot] = results[slot - 1];
+			slot--;
+		}
+
+		distances[slot] = distanceSq;
+		results[slot] = m_bodyStore.GetHandle(body);
+	};
+
+	if (!m_bProxiesSorted)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			consider(i);
+		}
+	}
+	else
+	{
+		//Walk out both ways from the point along the sorted axis, each side stopping once the
+		//boxes start too far along the axis for their centres to be nearer than the kth body
+		int right = (int)(std::lower_bound(m_AABBArray.begin(), m_AABBArray.end(), axisPoint, [axis](const AABB& aabb, float value)
+		{
+			return aabb.minPoint[axis] < value;
+		}) - m_AABBArray.begin());
+
+		int left = right - 1;
+
+		while (left >= 0 || right < count)
+		{
+			if (right < count)
+			{
+				float gap = m_AABBArray[right].minPoint[axis] - axisPoint;
+
+				if (found == k && gap > 0.0f && gap * gap > distances[k - 1])
 				{
-					//Add to list to resolve
-					m_dynamicCollisionList.push_back(collisionPair);
+					right = count;
+				}
+				else
+				{
+					consider(right++);
+				}
+			}
+
+			if (left >= 0)
+			{
+				float gap = axisPoint - (m_AABBArray[left].minPoint[axis] + m_fMaxProxyRadius);
+
+				if (found == k && gap > 0.0f && gap * gap > distances[k - 1])
+				{
+					left = -1;
+				}
+				else
+				{
+					consider(left--);
 				}
 			}
 		}
+	}
 
-		//Calculate variance
-		for (int c = 0; c < 3; c++)
+	for (int i = 0; i < found; i++)
+	{
+		distances[i] = sqrtf(distances[i]);
+	}
+
+	return found;
+}
+
+//Finds the nearest terrain face or body a ray hits
+//Params : Ray start and direction (needn't be normalised), furthest distance to look, hit to fill in
+//Returns : True if anything was hit
+bool PhysicsWorld::Raycast(const XMVECTOR& origin, const XMVECTOR& direction, float maxDistance, RaycastHit& hit) const
+{
+	XMVECTOR dir = XMVector3Normalize(direction);
+
+	hit.distance = maxDistance;
+	hit.body = INVALID_BODY_HANDLE;
+	hit.tile = -1;
+	hit.face = -1;
+
+	//Terrain first, as its hit shortens the ray the bodies have to be searched along
+	for (int t = 0; t < (int)m_terrainTiles.size(); t++)
+	{
+		float distance;
+		XMVECTOR position, normal;
+		int face;
+
+		if (m_terrainTiles[t].heightMap->Raycast(origin, dir, hit.distance, distance, position, normal, face))
 		{
-			v[c] = s2[c] - s[c] * s[c] / MAX_OBJECTS;
+			hit.distance = distance;
+			XMStoreFloat3(&hit.position, position);
+			XMStoreFloat3(&hit.normal, normal);
+			hit.tile = t;
+			hit.face = face;
 		}
+	}
 
-		//Update axis to test next
-		m_sortingAxis = 0;
-		if (v[1] > v[0])
+	RaycastBodies(origin, dir, hit);
+
+	return hit.IsHit();
+}
+
+//Finds the nearest body a ray hits, if it's nearer than the hit passed in
+//Params : Ray start, normalised direction, hit so far (its distance is the furthest to look)
+//Returns : True if a nearer body was hit
+bool PhysicsWorld::RaycastBodies(const XMVECTOR& origin, const XMVECTOR& direction, RaycastHit& hit) const
+{
+	XMFLOAT3 o, d;
+	XMStoreFloat3(&o, origin);
+	XMStoreFloat3(&d, direction);
+
+	const float rayOrigin[3] = { o.x, o.y, o.z };
+	const float rayDirection[3] = { d.x, d.y, d.z };
+
+	int axis = m_sortingAxis;
+	float axisOrigin = rayOrigin[axis];
+	float axisDirection = rayDirection[axis];
+	float axisEnd = axisOrigin + (axisDirection * hit.distance);
+
+	int begin, end;
+	GetProxyRange(min(axisOrigin, axisEnd), max(axisOrigin, axisEnd), begin, end);
+
+	const float* posX = m_bodyStore.GetPositionX();
+	const float* posY = m_bodyStore.GetPositionY();
+	const float* posZ = m_bodyStore.GetPositionZ();
+	const float* radii = m_bodyStore.GetRadii();
+
+	bool found = false;
+
+	//Walk the boxes in the ray's direction along the sorted axis, so the walk can stop once they
+	//start beyond the nearest hit so far
+	bool forward = axisDirection >= 0.0f;
+
+	for (int n = 0; n < end - begin; n++)
+	{
+		const AABB& aabb = m_AABBArray[forward ? begin + n : end - 1 - n];
+
+		if (m_bProxiesSorted)
 		{
-			m_sortingAxis = 1;
+			if (forward && aabb.minPoint[axis] - axisOrigin > hit.distance * axisDirection)
+			{
+				break;
+			}
+
+			if (!forward && axisOrigin - (aabb.minPoint[axis] + 2.0f * m_fMaxProxyRadius) > hit.distance * -axisDirection)
+			{
+				break;
+			}
 		}
-		if (v[2] > v[m_sortingAxis])
+
+		//Ray vs box on the AABB array before touching the body store
+		float tEnter = 0.0f;
+		float tExit = hit.distance;
+		bool missed = false;
+
+		for (int c = 0; c < 3 && !missed; c++)
 		{
-			m_sortingAxis = 2;
+			if (rayDirection[c] == 0.0f)
+			{
+				missed = rayOrigin[c] < aabb.minPoint[c] || rayOrigin[c] > aabb.maxPoint[c];
+				continue;
+			}
+
+			float t0 = (aabb.minPoint[c] - rayOrigin[c]) / rayDirection[c];
+			float t1 = (aabb.maxPoint[c] - rayOrigin[c]) / rayDirection[c];
+
+			tEnter = max(tEnter, min(t0, t1));
+			tExit = min(tExit, max(t0, t1));
+			missed = tEnter > tExit;
+		}
+
+		int body = aabb.body;
+
+		if (missed || !m_bodyStore.IsActive(body))
+		{
+			continue;
+		}
+
+		//Ray vs sphere (Real Time Collision Detection), a ray starting inside the sphere hits it at 0
+		float mx = o.x - posX[body];
+		float my = o.y - posY[body];
+		float mz = o.z - posZ[body];
+
+		float b = (mx * d.x) + (my * d.y) + (mz * d.z);
+		float c = (mx * mx) + (my * my) + (mz * mz) - (radii[body] * radii[body]);
+
+		//Starting outside and pointing away
+		if (c > 0.0f && b > 0.0f)
+		{
+			continue;
+		}
+
+		float discriminant = (b * b) - c;
+
+		if (discriminant < 0.0f)
+		{
+			continue;
+		}
+
+		float distance = max(-b - sqrtf(discriminant), 0.0f);
+
+		if (distance < hit.distance)
+		{
+			XMVECTOR position = origin + (direction * distance);
+			XMVECTOR centre = XMVectorSet(posX[body], posY[body], posZ[body], 0.0f);
+
+			hit.distance = distance;
+			XMStoreFloat3(&hit.position, position);
+			XMStoreFloat3(&hit.normal, XMVector3Normalize(position - centre));
+			hit.body = m_bodyStore.GetHandle(body);
+			hit.tile = -1;
+			hit.face = -1;
+
+			found = true;
 		}
 	}
 
+	return found;
+}
+
+//Casts many rays, split across the job system's workers
+//Params : Ray starts, directions, number of rays, furthest distance to look, array of count hits to fill in
+//Returns : Number of rays that hit something
+int PhysicsWorld::RaycastBatch(const XMFLOAT3* origins, const XMFLOAT3* directions, int count, float maxDistance, RaycastHit* hits)
+{
+	RaycastBatchContext context = { this, origins, directions, maxDistance, hits };
+
+	m_jobSystem.ParallelFor("Raycast", count, RAYCAST_GRAIN, RaycastTask, &context);
+
+	int hitCount = 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		if (hits[i].IsHit())
+		{
+			hitCount++;
+		}
+	}
+
+	return hitCount;
+}
+
+//Job entry point, casts a run of the rays of a batch
+void PhysicsWorld::RaycastTask(void* context, int begin, int end, int worker)
+{
+	RaycastBatchContext* batch = (RaycastBatchContext*)context;
+
+	for (int i = begin; i < end; i++)
+	{
+		batch->world->Raycast(XMLoadFloat3(&batch->origins[i]), XMLoadFloat3(&batch->directions[i]), batch->maxDistance, batch->hits[i]);
+	}
+}
+
+//Job entry point, sweeps a run of the sorted AABBs for pairs
+void PhysicsWorld::SweepTask(void* context, int begin, int end, int worker)
+{
+	PhysicsWorld* world = (PhysicsWorld*)context;
+	const BodyStore& store = world->m_bodyStore;
+	const std::vector<AABB>& aabbs = world->m_AABBArray;
+
+	std::vector<PhysicsDynamicCollision>& chunkCollisions = world->m_dynamicChunkCollisions[begin / BROADPHASE_GRAIN];
+
+	int axis = world->m_sortingAxis;
+	int count = (int)aabbs.size();
+
+	for (int i = begin; i < end; i++)
+	{
+		const AABB* a = &aabbs[i];
+
+		//Inactive bodies don't collide
+		if (!store.IsActive(a->body))
+		{
+			continue;
+		}
+
+		//Test collisions against all possible overlapping AABBs following current one.
+		//Only later boxes are tested, so each pair is found once
+		for (int j = i + 1; j < count; j++)
+		{
+			const AABB* b = &aabbs[j];
+
+			//Once the minimum point of body B is greater than maximum point of body A then no later
+			//box can overlap either, as they're sorted on this axis
+			if (b->minPoint[axis] > a->maxPoint[axis])
+			{
+				break;
+			}
+
+			//If body B is inactive then skip over
+			if (!store.IsActive(b->body))
+			{
+				continue;
+			}
+
+			//If AABBS overlap 
+			if (world->AABBvsAABB(a, b))
+			{
+				//Create a dynamic collision pair using each body
+				PhysicsDynamicCollision collisionPair(a->body, b->body);
+
+				//Finally do the proper collision check here
+				if (world->CircleVsCircle(&collisionPair))
+				{
+					//Add to list to resolve
+					chunkCollisions.push_back(collisionPair);
+				}
+			}
+		}
+	}
 }
@@ -3,9 +3,21 @@
 
 #include <vector>
 #include <algorithm>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 #include "DynamicBody.h"
-#include "Application.h"
+#include "BodyStore.h"
+#include "ContactSolver.h"
+#include "JobSystem.h"
+#include "SnapshotBuffer.h"
+#include "ContactEvents.h"
+#include "VectorMath.h"
+#include "Macros.h"
+#include "Constants.h"
 
 class HeightMap;
 
@@ -18,16 +30,23 @@ class HeightMap;
 //**********************************************************************************
 XMALIGN struct PhysicsStaticCollision
 {
-	DynamicBody* body;
+	//Index of the body in the world's body store
+	int body;
 	XMVECTOR collisionNormal;
 	XMVECTOR collisionPosition;
 	float penetrationDepth;
 
-	PhysicsStaticCollision(DynamicBody* mBody)
+	//Terrain tile and face collided with, identifies the contact between steps
+	int tileIndex;
+	int faceIndex;
+
+	PhysicsStaticCollision(int mBody)
 	{
 		body = mBody;
 		collisionPosition = collisionNormal = XMVectorSet(0, 0, 0, 0);
 		penetrationDepth = 0;
+		tileIndex = 0;
+		faceIndex = 0;
 	}
 
 	XMNEW;
@@ -37,17 +56,17 @@ XMALIGN struct PhysicsStaticCollision
 //**********************************************************************************
 // Struct : PhysicsDynamicCollision
 // Description : Holds data to do with a dynamic collision (i.e between two dyanmic
-// bodies. Holds collision normal, collision position, penetration depth, and pointers
-// two both bodies involved in the collision
+// bodies. Holds collision normal, collision position, penetration depth, and the
+// body store indices of both bodies involved in the collision
 //**********************************************************************************
 XMALIGN struct PhysicsDynamicCollision
 {
-	DynamicBody* bodyA;
-	DynamicBody* bodyB;
+	int bodyA;
+	int bodyB;
 	XMVECTOR collisionNormal;
 	float penetrationDepth;
 
-	PhysicsDynamicCollision(DynamicBody* mBodyA, DynamicBody* mBodyB)
+	PhysicsDynamicCollision(int mBodyA, int mBodyB)
 	{
 		bodyA = mBodyA;
 		bodyB = mBodyB;
@@ -75,53 +94,115 @@ struct AABB
 	//Maximum bounds point
 	Point maxPoint;
 
-	//Body associated with this AABB boundary
-	DynamicBody* body;
-
-	AABB(XMFLOAT3 mMin, XMFLOAT3 mMax, DynamicBody* mBody)
-	{
-		minPoint[0] = mMin.x;
-		minPoint[1] = mMin.y;
-		minPoint[2] = mMin.z;
-
-		maxPoint[0] = mMax.x;
-		maxPoint[1] = mMax.y;
-		maxPoint[2] = mMax.z;
-
-		body = mBody;
-	}
+	//Index of the body (in the world's body store) associated with this AABB boundary
+	int body;
 
-	AABB(XMVECTOR centrePos, float radius, DynamicBody* mBody)
+	AABB(XMVECTOR centrePos, float radius, int mBody)
 	{
-		minPoint[0] = XMVectorGetX(centrePos) - radius;
-		minPoint[1] = XMVectorGetY(centrePos) - radius;
-		minPoint[2] = XMVectorGetZ(centrePos) - radius;
-
-		maxPoint[0] = XMVectorGetX(centrePos) + radius;
-		maxPoint[1] = XMVectorGetY(centrePos) + radius;
-		maxPoint[2] = XMVectorGetZ(centrePos) + radius;
+		UpdatePosition(XMVectorGetX(centrePos), XMVectorGetY(centrePos), XMVectorGetZ(centrePos), radius);
 
 		body = mBody;
 	}
 
 	//Updates the position of a bounding box
 	//Params : Position of centre of body, radius of body
-	void UpdatePosition(XMVECTOR centrePos, float radius)
+	void UpdatePosition(float x, float y, float z, float radius)
 	{
-		minPoint[0] = XMVectorGetX(centrePos) - radius;
-		minPoint[1] = XMVectorGetY(centrePos) - radius;
-		minPoint[2] = XMVectorGetZ(centrePos) - radius;
+		minPoint[0] = x - radius;
+		minPoint[1] = y - radius;
+		minPoint[2] = z - radius;
 
-		maxPoint[0] = XMVectorGetX(centrePos) + radius;
-		maxPoint[1] = XMVectorGetY(centrePos) + radius;
-		maxPoint[2] = XMVectorGetZ(centrePos) + radius;
+		maxPoint[0] = x + radius;
+		maxPoint[1] = y + radius;
+		maxPoint[2] = z + radius;
 	}
 };
 
+//**********************************************************************************
+// Struct : TerrainTile
+// Description : A heightmap placed in the world along with its X/Z bounds. Used by
+// the tile grid so bodies are only tested against the tiles they overlap.
+//**********************************************************************************
+struct TerrainTile
+{
+	HeightMap* heightMap;
+
+	//Faces of the tiles before this one, so each face in the world has its own index for contact keys
+	unsigned long long firstFace;
+
+	float minX;
+	float minZ;
+	float maxX;
+	float maxZ;
+};
+
+//**********************************************************************************
+// Struct : RaycastHit
+// Description : Nearest thing a ray hit, either a terrain face or a body.
+//**********************************************************************************
+struct RaycastHit
+{
+	//Distance along the ray, and the point and surface normal there
+	float distance;
+	XMFLOAT3 position;
+	XMFLOAT3 normal;
+
+	//Body hit, INVALID_BODY_HANDLE for the terrain or a miss
+	BodyHandle body;
+
+	//Terrain tile and face hit, -1 for a body or a miss
+	int tile;
+	int face;
+
+	bool IsHit() const { return body != INVALID_BODY_HANDLE || face >= 0; }
+};
+
+//**********************************************************************************
+// Struct : StepTimings
+// Description : Wall clock time in milliseconds spent in each phase of a step.
+// Terrain collision, body collision and island building are jobs that overlap
+// on the workers, so between them they can add up to more than the collision phase.
+//**********************************************************************************
+struct StepTimings
+{
+	//Collision jobs from submission until the islands are built, then each job on its own
+	double collision;
+	double staticCollision;
+	double dynamicCollision;
+	double buildIslands;
+
+	double integrateVelocities;
+	double solve;
+	double contactEvents;
+	double integratePositions;
+	double sleeping;
+
+	//Clearing the collision lists and despawning killed bodies
+	double despawn;
+
+	//Updating and sorting the broadphase for the scene queries
+	double broadphase;
+
+	//Whole step
+	double total;
+};
+
 //**********************************************************************************
 // Class : PhysicsWorld
 // Description : Controls and updates the physics of all bodies within the scene. Also handles
 // the broadphase for dyanmic collisions.
+// Every list a step fills (per chunk collisions, contacts, islands, snapshots) is a member
+// that is cleared rather than freed, acting as the per step arena, so once the lists have
+// grown to the scene's size a step makes no heap allocations.
+// Each step is scheduled on the world's job system: terrain collision and the broadphase
+// run side by side, islands are built once both are done, and the solver and integrator
+// split their work across the workers. Per chunk results are merged in chunk order, so
+// the outcome doesn't depend on the worker count.
+// The broadphase array is re-sorted at the end of each step, so scene queries between
+// steps can binary search it rather than visiting every body.
+// All state lives in the instance and the step length is passed in, so any number of
+// worlds can be stepped on different threads at once, as long as each has its own
+// heightmaps and bodies (a heightmap keeps its tile offset and collision colours).
 //**********************************************************************************
 class PhysicsWorld
 {
@@ -131,21 +212,216 @@ public:
 	PhysicsWorld(HeightMap* mHeightMap);
 	~PhysicsWorld();
 
-	//Sets the pointer of the heightmap to test static collisions against
+	//Replaces all terrain with a single heightmap to test static collisions against
 	//Params : Pointer of the heightmap to be tested against
 	void SetHeightMapPtr(HeightMap* pHeightMap);
 
-	//Adds a body to the list of bodies within the physics world
+	//Places a heightmap tile in the world
+	//Params : Pointer of the heightmap, world position of the tile's centre
+	void AddHeightMap(HeightMap* pHeightMap, const XMFLOAT3& offset);
+
+	//Removes a heightmap tile from the world
+	//Params : Pointer of the heightmap to remove
+	void RemoveHeightMap(HeightMap* pHeightMap);
+
+	//Removes all heightmap tiles
+	void ClearHeightMaps();
+
+	//Adds a body to the physics world, moving its state into the world's body store
 	//Params : Pointer to the body to add
-	void AddBody(DynamicBody* body);
+	//Returns : Handle of the body in the world, INVALID_BODY_HANDLE if the world already holds MAX_BODY_SLOTS bodies
+	BodyHandle AddBody(DynamicBody* body);
 
-	//Removes a body from the physics world
+	//Removes a body from the physics world in O(1), handing its state back to it and
+	//releasing its broadphase proxy
 	//Params : Pointer to the body to remove
 	void RemoveBody(DynamicBody* body);
 
+	//Removes a body by handle, does nothing if the handle is stale
+	//Params : Handle of the body to remove
+	void RemoveBody(BodyHandle handle);
+
+	//Gives the world a body to hand out with SpawnBody. It stays out of the simulation until spawned
+	//Params : Pointer to the body, which must outlive the world
+	void AddToPool(DynamicBody* body);
+
+	//Takes a body from the pool and adds it to the world, active and awake, in O(1)
+	//Params : Initial position and velocity
+	//Returns : Handle of the body, INVALID_BODY_HANDLE if the pool is empty or the world is full (MAX_BODY_SLOTS)
+	BodyHandle SpawnBody(const XMVECTOR& position, const XMVECTOR& velocity);
+
+	//Removes a body from the world in O(1) and puts it in the pool. Bodies falling below the
+	//kill plane are despawned automatically at the end of the step, so only live bodies are
+	//ever visited by the step
+	//Params : Handle of the body, does nothing if the handle is stale
+	void DespawnBody(BodyHandle handle);
+
+	//Returns : Number of bodies waiting in the pool
+	int GetPooledBodyCount() const { return (int)m_bodyPool.size(); }
+
+	//Returns : True if the handle refers to a body still in the world
+	bool IsBodyValid(BodyHandle handle) const { return m_bodyStore.IsValid(handle); }
+
+	//Gets the body a handle refers to
+	//Returns : Pointer to the body, nullptr if the handle is stale
+	DynamicBody* GetBody(BodyHandle handle) const;
+
+	//Returns : Number of bodies the world has been given (in it or in its pool)
+	int GetRegisteredBodyCount() const { return (int)m_bodies.size(); }
+
+	//Captures the simulation state in a flat, versioned blob (see WorldSnapshot.h): the body arrays and
+	//handle table, which bodies are in the world and which are pooled, the broadphase order, the solver's
+	//warm start cache, the last step's contacts and each tile's hole mask. Settings aren't included.
+	//Bodies are named by the order they were given to the world, heightmaps by their tile order
+	//Params : Blob to fill in (reused, so it only grows), whether to LZ4 compress the payload
+	void SaveSnapshot(std::vector<unsigned char>& blob, bool compress = false);
+
+	//Puts the world back in the state a snapshot was saved in, so stepping on gives the same results as
+	//the saved world did. The world must have been given the same number of bodies and the same heightmap
+	//tiles, in the same order. Pooled bodies keep their own radius and mass, only bodies in the world are saved
+	//Params : Blob and its size, which can be a file read into memory or mapped
+	//Returns : False if the blob is damaged, another version or doesn't fit this world, which is left untouched
+	bool RestoreSnapshot(const void* data, size_t size);
+
+	//Scene queries. They only read the broadphase as the last step left it, so any number of threads
+	//can query at once, but not while a step is running. Only active bodies are found, and results go
+	//into the caller's buffers. Bodies moved by hand since the last step are looked for where it left them
+
+	//Finds every body overlapping a sphere
+	//Params : Centre and radius of the sphere, buffer for the handles of the bodies found, its length
+	//Returns : Number of bodies found, can be more than the buffer holds (only that many are written)
+	int OverlapSphere(const XMVECTOR& centre, float radius, BodyHandle* results, int maxResults) const;
+
+	//Finds every body overlapping a box
+	//Params : Minimum and maximum corners of the box, buffer for the handles of the bodies found, its length
+	//Returns : Number of bodies found, can be more than the buffer holds (only that many are written)
+	int OverlapAABB(const XMFLOAT3& minPoint, const XMFLOAT3& maxPoint, BodyHandle* results, int maxResults) const;
+
+	//Finds the bodies whose centres are nearest a point, nearest first
+	//Params : Point, number of bodies wanted, buffers of k entries for the handles and their distances
+	//Returns : Number of bodies found, less than k if there aren't that many
+	int KNearest(const XMVECTOR& point, int k, BodyHandle* results, float* distances) const;
+
+	//Finds the nearest terrain face or body a ray hits. Bodies are found through the broadphase, walking
+	//only the AABBs along the ray, and tested with an exact ray vs sphere test. A query like the others above
+	//Params : Ray start and direction (needn't be normalised), furthest distance to look, hit to fill in
+	//Returns : True if anything was hit
+	bool Raycast(const XMVECTOR& origin, const XMVECTOR& direction, float maxDistance, RaycastHit& hit) const;
+
+	//Casts many rays, split across the job system's workers. Like the queries, only call it between steps
+	//Params : Ray starts, directions, number of rays, furthest distance to look, array of count hits to fill in
+	//Returns : Number of rays that hit something
+	int RaycastBatch(const XMFLOAT3* origins, const XMFLOAT3* directions, int count, float maxDistance, RaycastHit* hits);
+
+	//Gets the store holding the state of every body in the world
+	BodyStore& GetBodyStore() { return m_bodyStore; }
+
 	//Controls the update of all bodies within the scene
-	//Main function to be called
-	void UpdateWorld();
+	//Main function to be called. Accumulates real time and runs as many fixed steps as are due,
+	//up to the substep cap. Any time over the cap is dropped rather than simulated later
+	//Returns : Number of steps run
+	int UpdateWorld();
+
+	//Runs a single simulation step. Can be called directly to step faster (or slower) than real time.
+	//The snapshot it publishes (if enabled) is drawn at the end of the step (alpha 1)
+	//Params : Length of the step in seconds
+	void Step(float dt);
+
+	//Returns : Fraction of a fixed step of real time left over after the last UpdateWorld, which the
+	//snapshot blends between the previous and current positions by. Lets rendering run smoothly faster
+	//than the step rate. Only valid while no update is in flight, the snapshot carries its own copy
+	float GetInterpolationFactor() const { return m_fInterpolationFactor; }
+
+	//Restarts the real time clock used by UpdateWorld, discarding any accumulated time
+	void ResetClock();
+
+	//Starts UpdateWorld on the world's update thread (started by the first call and kept until the world
+	//is deleted) and returns straight away. Nothing else may touch the world or its bodies until
+	//WaitForUpdate, apart from reading snapshots with AcquireSnapshot
+	void UpdateWorldAsync();
+
+	//Waits for the update started by UpdateWorldAsync, if there is one
+	//Returns : Number of steps it ran
+	int WaitForUpdate();
+
+	//Returns : True if an update started by UpdateWorldAsync hasn't been waited for yet
+	bool IsUpdating() const { return m_bUpdatePending; }
+
+	//Gets the transforms published at the end of the latest step. Safe to call while the world
+	//is stepping on another thread, but only from one consumer thread
+	//Returns : Latest snapshot, unchanged until the next call (empty unless snapshots are enabled)
+	const BodySnapshot& AcquireSnapshot() { return m_snapshots.Acquire(); }
+
+	//Set/Get whether a snapshot is published after every step and update. Off by default, as it copies
+	//every active body, so only worlds read through AcquireSnapshot need it. Change it between updates
+	void SetSnapshotsEnabled(bool enabled) { m_bSnapshots = enabled; }
+	bool GetSnapshotsEnabled() const { return m_bSnapshots; }
+
+	//Set/Get the fixed step rate
+	//Params : Steps per second
+	void SetStepRate(float stepsPerSecond);
+	float GetFixedTimeStep() const { return m_fFixedTimeStep; }
+
+	//Set/Get the maximum number of steps UpdateWorld will run in one call
+	void SetMaxSubSteps(int maxSubSteps);
+	int GetMaxSubSteps() const { return m_iMaxSubSteps; }
+
+	//Returns : Total simulation time (seconds) dropped because the substep cap was hit
+	double GetDroppedTime() const { return m_dDroppedTime; }
+
+	//Set/Get deterministic mode. UpdateWorld then runs exactly one fixed step per call rather than
+	//following the real time clock, and the state hash is updated after every step, so a run can be
+	//repeated and checked step by step. Contact order never depends on the clock or the worker count
+	void SetDeterministic(bool deterministic);
+	bool GetDeterministic() const { return m_bDeterministic; }
+
+	//Number of steps run since the world was created (or the count was reset)
+	unsigned long long GetStepCount() const { return m_iStepCount; }
+	void ResetStepCount() { m_iStepCount = 0; }
+
+	//Hash of every body's state after the last step, only updated in deterministic mode
+	uint64_t GetStateHash() const { return m_iStateHash; }
+
+	//Hashes every body's state now
+	//Returns : 64 bit hash, equal between runs only if every body matches bit for bit
+	uint64_t ComputeStateHash() const { return m_bodyStore.ComputeStateHash(); }
+
+	//Gets the contact events of the last UpdateWorld or Step, from every step it ran. Set the capacity and
+	//filters here too. Only read or change it while no update is in flight
+	ContactEventBuffer& GetContactEvents() { return m_contactEvents; }
+
+	//Set/Get whether contact events are recorded
+	void SetContactEventsEnabled(bool enabled);
+	bool GetContactEventsEnabled() const { return m_bContactEvents; }
+
+	//Gets the contact solver, to configure iterations/tolerance or read its stats
+	ContactSolver& GetContactSolver() { return m_contactSolver; }
+
+	//Gets the job system each step is scheduled on, to set core pinning or a timing hook
+	JobSystem& GetJobSystem() { return m_jobSystem; }
+
+	//Set/Get the number of threads (including the calling thread) each step is spread across
+	void SetWorkerCount(int count) { m_jobSystem.SetWorkerCount(count); }
+	int GetWorkerCount() const { return m_jobSystem.GetWorkerCount(); }
+
+	//Set/Get whether resting islands are put to sleep
+	void SetSleepingEnabled(bool enabled);
+	bool GetSleepingEnabled() const { return m_bSleepingEnabled; }
+
+	//Wakes every body. Edits through HeightMap::ModifyHeights or ApplyBrush needn't call it, each step
+	//wakes just the bodies over the terrain edited since the last
+	void WakeAllBodies();
+
+	//Island stats from the last step
+	int GetIslandCount() const { return m_iIslandCount; }
+	int GetSleepingIslandCount() const { return m_iSleepingIslandCount; }
+	int GetLargestIslandSize() const { return m_iLargestIslandSize; }
+
+	//Returns : Island counts by size, entry i counts islands of 2^i to 2^(i+1) - 1 bodies
+	const std::vector<int>& GetIslandSizeHistogram() const { return m_islandSizeHistogram; }
+
+	//Returns : Time spent in each phase of the last step
+	const StepTimings& GetStepTimings() const { return m_stepTimings; }
 
 private:
 
@@ -156,28 +432,113 @@ private:
 	//Controls the collision between all dynamic bodies
 	void HandleDynamicCollision();
 
+	//Rebuilds the uniform grid over the X/Z bounds of all terrain tiles
+	void RebuildTileGrid();
+
+	//Wakes the bodies over terrain edited since the last step, which may have moved out from under them
+	void WakeEditedTerrain();
+
+	//Finds the terrain tiles overlapping an X/Z rectangle
+	//Params : Rectangle bounds, vector to fill with tile indices (cleared first)
+	void QueryTiles(float minX, float minZ, float maxX, float maxZ, std::vector<int>& tiles) const;
+
+	//Job entry points for the stages of a step
+	static void StaticCollisionJob(void* context, int begin, int end, int worker);
+	static void DynamicCollisionJob(void* context, int begin, int end, int worker);
+	static void BuildIslandsJob(void* context, int begin, int end, int worker);
+
+	//Job entry point, tests a run of bodies against the terrain
+	static void StaticCollisionTask(void* context, int begin, int end, int worker);
+
+	//Job entry points, update a run of AABBs and sweep a run of the sorted AABBs for pairs
+	static void UpdateAABBsTask(void* context, int begin, int end, int worker);
+	static void SweepTask(void* context, int begin, int end, int worker);
+
+	//Job entry points, integrate a run of bodies
+	static void IntegrateVelocitiesTask(void* context, int begin, int end, int worker);
+	static void IntegratePositionsTask(void* context, int begin, int end, int worker);
+
 	//Old function used to generate collision pairs for dynamic collisions
 	//Bruteforce method and generally slow
 	//void GeneratePairs();
 
-	//Corrects the position of overlapping bodies during a dynamic vs dynamic
-	//body collision
-	//Params : Collision pair to be tested 
-	void PositionalCorrection(PhysicsDynamicCollision* collisionPair);
+	//Groups active bodies touching each other into islands with a union-find over the
+	//dynamic collisions, waking any island that has an awake body in it
+	void BuildIslands();
+
+	//Finds the root of a body's set in the union-find
+	//Params : Index of the body
+	//Returns : Index of the root body
+	int FindIslandRoot(int body);
+
+	//Puts islands that have been resting long enough to sleep
+	//Params : Length of the step in seconds
+	void UpdateSleeping(float dt);
+
+	//Feeds every collision found this step into the contact solver and copies
+	//the solved velocities back onto the bodies
+	//Params : Length of the step in seconds
+	void SolveContacts(float dt);
+
+	//Runs a step without publishing a snapshot
+	//Params : Length of the step in seconds
+	void RunStep(float dt);
+
+	//Compares this step's contacts with the last step's and records the begin, persist and end events
+	void RecordContactEvents();
+
+	//Despawns every body the kill plane caught this step
+	void DespawnKilledBodies();
+
+	//Takes a body out of the body store and the broadphase, leaving it registered with the world
+	//Returns : False if the body wasn't in the world
+	bool DetachBody(DynamicBody* body);
+
+	//Gives a body a world id if it doesn't have one in this world yet
+	void RegisterBody(DynamicBody* body);
+
+	//Forgets a body that has left the world for good, moving the last registered body into its id
+	void UnregisterBody(DynamicBody* body);
+
+	//Copies the transforms of every active body into the snapshot buffer and publishes it, if snapshots are enabled
+	//Params : Fraction of a step to blend the previous and current positions by
+	void PublishSnapshot(float alpha);
+
+	//Loop run by the update thread, running UpdateWorld each time UpdateWorldAsync asks until the world is deleted
+	void UpdateThreadLoop();
+
+	//Stops and joins the update thread, if it was started
+	void StopUpdateThread();
 
 	//Simple circle vs circle check (Taken from Real Time Collision Detection book)
 	//Params : Collision pair to be tested
 	//Returns : True if the two bodies are overlapping (colliding)
-	bool CircleVsCircle(PhysicsDynamicCollision* collisionPair);
+	bool CircleVsCircle(PhysicsDynamicCollision* collisionPair) const;
 
 	//Simple AABB vs AABB check (Taken from Real Time Collision Detection book)
 	//Params : Pointers to each AABB to check
 	//Returns : 1 if two bounding boxes are overlapping, 0 if not
-	int AABBvsAABB(AABB* a, AABB* b);
+	int AABBvsAABB(const AABB* a, const AABB* b) const;
 
 	//Updates all AABBs surrounding each dynamic body
 	void UpdateAABBs();
 
+	//Sorts the AABB array on the current sorting axis and points each body at its AABB
+	void SortAABBArray();
+
+	//Finds the run of sorted AABBs that could overlap an interval on the sorted axis, all of them if
+	//the array isn't sorted
+	//Params : Interval on the sorted axis, first AABB and one past the last AABB to fill in
+	void GetProxyRange(float low, float high, int& begin, int& end) const;
+
+	//Finds the nearest body a ray hits, if it's nearer than the hit passed in
+	//Params : Ray start, normalised direction, hit so far (its distance is the furthest to look)
+	//Returns : True if a nearer body was hit
+	bool RaycastBodies(const XMVECTOR& origin, const XMVECTOR& direction, RaycastHit& hit) const;
+
+	//Job entry point, casts a run of the rays of a batch
+	static void RaycastTask(void* context, int begin, int end, int worker);
+
 	//Broadphase method used for dynamic collisions (Taken from Real Time Collision Detection book)
 	//Sorts bodies on a specified axis and only checks those that are close together
 	//Also calculates the variance of each axis and then decides which axis (X, Y, or Z) is best to sort against next
@@ -185,8 +546,8 @@ private:
 
 private:
 
-	//Vector of all bodies within the scene
-	std::vector<DynamicBody*> m_dynamicBodyList;
+	//State of all bodies within the scene
+	BodyStore m_bodyStore;
 
 	//Vector of all static collisions to be resolved every frame
 	std::vector<PhysicsStaticCollision> m_staticCollisionList;
@@ -194,17 +555,144 @@ private:
 	//Vector of all dynamic collisions to be resolved every frame
 	std::vector<PhysicsDynamicCollision> m_dynamicCollisionList;
 
-	//Pointer to the current heightmap to test against
-	HeightMap* m_pHeightMap;
+	//Iterative solver all collisions are resolved with
+	ContactSolver m_contactSolver;
+
+	//Scheduler every stage of a step runs on
+	JobSystem m_jobSystem;
+
+	//Length of the step being run, for the integration jobs
+	float m_fStepTime;
+
+	//Phase timings of the last step
+	StepTimings m_stepTimings;
+
+	//Bodies the kill plane caught this step, summed over the integration jobs
+	std::atomic<int> m_iKilledBodies;
+
+	//Bodies out of the world waiting to be spawned, used as a stack
+	std::vector<DynamicBody*> m_bodyPool;
+
+	//Every body given to the world, in the world or pooled, indexed by world id
+	std::vector<DynamicBody*> m_bodies;
+
+	//World id of each body and each pooled body when saving a snapshot, and the space a
+	//compressed snapshot is built or decompressed in, kept between snapshots
+	std::vector<int> m_snapshotBodyIds;
+	std::vector<int> m_snapshotPoolIds;
+	std::vector<unsigned char> m_snapshotScratch;
+
+	//A contact as remembered between steps to find which began and ended, body handles are
+	//stored in key order and bodyA is INVALID_BODY_HANDLE for the terrain
+	struct TrackedContact
+	{
+		unsigned long long key;
+		BodyHandle bodyA;
+		BodyHandle bodyB;
+		int tile;
+		int face;
+	};
+
+	//Contacts of this step and the last, sorted by key
+	std::vector<TrackedContact> m_currentContacts;
+	std::vector<TrackedContact> m_previousContacts;
+
+	ContactEventBuffer m_contactEvents;
+	bool m_bContactEvents;
+
+	//Collisions found by each chunk of bodies/AABBs, merged in chunk order once all are done
+	std::vector<std::vector<PhysicsStaticCollision>> m_staticChunkCollisions;
+	std::vector<std::vector<PhysicsDynamicCollision>> m_dynamicChunkCollisions;
+
+	//Room given to every chunk's collisions, double the most any chunk has needed
+	size_t m_iStaticChunkCapacity;
+	size_t m_iDynamicChunkCapacity;
+
+	//Scratch list of overlapped tiles per worker, kept to avoid reallocating each body
+	std::vector<std::vector<int>> m_workerTileQuery;
+
+	//Union-find parent of each body, then the island of each body (-1 if inactive)
+	std::vector<int> m_islandParent;
+	std::vector<int> m_bodyIsland;
+
+	//Bodies in each island, stored flat: island i is m_islandBodies[m_islandStart[i]] onwards
+	std::vector<int> m_islandStart;
+	std::vector<int> m_islandBodies;
+
+	//Whether each island is asleep this step
+	std::vector<bool> m_islandSleeping;
+
+	bool m_bSleepingEnabled;
+
+	int m_iIslandCount;
+	int m_iSleepingIslandCount;
+	int m_iLargestIslandSize;
+	std::vector<int> m_islandSizeHistogram;
+
+	//Heightmap tiles placed in the world
+	std::vector<TerrainTile> m_terrainTiles;
+
+	//Uniform X/Z grid over the tile bounds. Tiles overlapping cell c are
+	//m_tileGridIndices[m_tileGridStart[c]] to m_tileGridIndices[m_tileGridStart[c + 1] - 1]
+	float m_fTileGridMinX;
+	float m_fTileGridMinZ;
+	float m_fTileGridCellSize;
+	int m_iTileGridCountX;
+	int m_iTileGridCountZ;
+	std::vector<int> m_tileGridStart;
+	std::vector<int> m_tileGridIndices;
+
+	//Bodies found over edited terrain by WakeEditedTerrain, kept so it doesn't allocate once grown
+	std::vector<BodyHandle> m_editedTerrainBodies;
+
+	//Length of each fixed step and the cap on steps per UpdateWorld call
+	float m_fFixedTimeStep;
+	int m_iMaxSubSteps;
+
+	//Real time waiting to be simulated, and the total that has been thrown away
+	double m_dAccumulator;
+	double m_dDroppedTime;
+
+	//Real time of the last UpdateWorld call
+	std::chrono::high_resolution_clock::time_point m_lastUpdateTime;
+	bool m_bClockStarted;
+
+	//Leftover fraction of a step after the last UpdateWorld
+	float m_fInterpolationFactor;
+
+	bool m_bDeterministic;
+	unsigned long long m_iStepCount;
+	uint64_t m_iStateHash;
+
+	//Transforms published after each step, if enabled
+	SnapshotBuffer m_snapshots;
+	bool m_bSnapshots;
+
+	//Thread running the updates started by UpdateWorldAsync, and the handshake with it. Requested and
+	//finished are guarded by the mutex, pending is only touched by the thread that owns the world
+	std::thread m_updateThread;
+	std::mutex m_updateMutex;
+	std::condition_variable m_updateCondition;
+	bool m_bUpdateRequested;
+	bool m_bUpdateFinished;
+	bool m_bStopUpdateThread;
+	bool m_bUpdatePending;
+	int m_iUpdateSteps;
 
 	//Sorting axis used durign the SortAndSweep broadphase method
 	int m_sortingAxis = 0;
 
-	//Index used when inserting into the AABB array
-	int m_AABBArrayIndx = 0;
+	//Array of AABB boundaries for each body, kept sorted by the broadphase
+	std::vector<AABB> m_AABBArray;
+
+	//Index in m_AABBArray of each body's AABB, so a body's proxy can be released without a search
+	std::vector<int> m_bodyProxy;
+
+	//Whether m_AABBArray is sorted on m_sortingAxis, false once bodies are added or removed
+	bool m_bProxiesSorted;
 
-	//Array of AABB boundaries for each body
-	AABB *m_AABBArray[MAX_OBJECTS];
+	//Largest body radius when the AABBs were sorted, bounds how far before a point a box can start and still reach it
+	float m_fMaxProxyRadius;
 };
 
 #endif
@@ -0,0 +1,62 @@
+#include "Random.h"
+
+
+Random::Random()
+{
+	Seed(0);
+}
+
+Random::Random(uint64_t seed)
+{
+	Seed(seed);
+}
+
+//Restarts the sequence from a seed
+//Params : Seed, any value (zero included)
+void Random::Seed(uint64_t seed)
+{
+	//Run the seed through a splitmix step, so nearby seeds give unrelated sequences
+	//and the state is never zero (xorshift would be stuck there)
+	uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	z = z ^ (z >> 31);
+
+	m_iState = z != 0 ? z : 0x9E3779B97F4A7C15ULL;
+}
+
+//Returns : Next 32 random bits
+uint32_t Random::NextUInt()
+{
+	m_iState ^= m_iState >> 12;
+	m_iState ^= m_iState << 25;
+	m_iState ^= m_iState >> 27;
+
+	//The high bits of the product are the best mixed
+	return (uint32_t)((m_iState * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+//Returns : Random integer in [0, count)
+int Random::NextInt(int count)
+{
+	if (count <= 0)
+	{
+		return 0;
+	}
+
+	//Scale rather than mod, avoids favouring low values
+	return (int)(((uint64_t)NextUInt() * (uint64_t)count) >> 32);
+}
+
+//Returns : Random float in [0, 1)
+float Random::NextFloat()
+{
+	//24 bits fill the float mantissa exactly
+	return (float)(NextUInt() >> 8) * (1.0f / 16777216.0f);
+}
+
+//Returns : Random float in [min, max)
+float Random::NextRange(float min, float max)
+{
+	return min + ((max - min) * NextFloat());
+}
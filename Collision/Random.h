@@ -0,0 +1,41 @@
+#ifndef _RANDOM_H_
+#define _RANDOM_H_
+
+#include <stdint.h>
+
+
+//**********************************************************************************
+// Class : Random
+// Description : Small seeded random number generator (xorshift64*). Unlike rand()
+// its sequence is the same on every platform and standard library, and each
+// instance has its own state, so a run can be repeated exactly from its seed.
+//**********************************************************************************
+class Random
+{
+public:
+
+	Random();
+	Random(uint64_t seed);
+
+	//Restarts the sequence from a seed
+	//Params : Seed, any value (zero included)
+	void Seed(uint64_t seed);
+
+	//Returns : Next 32 random bits
+	uint32_t NextUInt();
+
+	//Returns : Random integer in [0, count)
+	int NextInt(int count);
+
+	//Returns : Random float in [0, 1)
+	float NextFloat();
+
+	//Returns : Random float in [min, max)
+	float NextRange(float min, float max);
+
+private:
+
+	uint64_t m_iState;
+};
+
+#endif
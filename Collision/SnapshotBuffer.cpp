@@ -0,0 +1,58 @@
+#include "SnapshotBuffer.h"
+
+
+SnapshotBuffer::SnapshotBuffer()
+{
+	for (auto& buffer : m_buffers)
+	{
+		buffer.step = 0;
+		buffer.alpha = 1.0f;
+	}
+
+	m_iWriteIndex = 0;
+	m_iMiddle = 1;
+	m_iReadIndex = 2;
+}
+
+SnapshotBuffer::~SnapshotBuffer()
+{
+}
+
+//Blends every body between its previous and current position by alpha and writes its world matrix
+//Params : Array to fill (at least GetCount() long)
+void BodySnapshot::BuildWorldMatrices(XMMATRIX* matrices) const
+{
+	int count = GetCount();
+
+	for (int i = 0; i < count; i++)
+	{
+		XMVECTOR previous = XMLoadFloat3(&previousPositions[i]);
+		XMVECTOR current = XMLoadFloat3(&positions[i]);
+
+		matrices[i] = XMMatrixTranslationFromVector(previous + ((current - previous) * alpha));
+	}
+}
+
+//Producer side. Hands the filled buffer over as the latest snapshot
+void SnapshotBuffer::Publish()
+{
+	//Release makes the writes to the buffer visible to the consumer that swaps it out
+	int previous = m_iMiddle.exchange(m_iWriteIndex | NEW_SNAPSHOT, std::memory_order_acq_rel);
+
+	//Whatever was in the middle (picked up or not) is free to be overwritten
+	m_iWriteIndex = previous & INDEX_MASK;
+}
+
+//Consumer side. Picks up the latest published snapshot, if there's a new one.
+//The returned snapshot stays untouched until the next call
+//Returns : Latest snapshot (empty until the first publish)
+const BodySnapshot& SnapshotBuffer::Acquire()
+{
+	if (HasNewSnapshot())
+	{
+		int previous = m_iMiddle.exchange(m_iReadIndex, std::memory_order_acq_rel);
+		m_iReadIndex = previous & INDEX_MASK;
+	}
+
+	return m_buffers[m_iReadIndex];
+}
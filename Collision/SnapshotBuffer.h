@@ -0,0 +1,86 @@
+#ifndef _SNAPSHOT_BUFFER_H_
+#define _SNAPSHOT_BUFFER_H_
+
+#include <vector>
+#include <atomic>
+
+#include "BodyStore.h"
+#include "VectorMath.h"
+
+
+//**********************************************************************************
+// Struct : BodySnapshot
+// Description : Transforms of every active body at the start and end of a step, in
+// dense order, along with how far real time has got between the two. Once published
+// it is never written again until the consumer has moved on to a newer one, so it can
+// be read without locks while the next step runs.
+//**********************************************************************************
+struct BodySnapshot
+{
+	//Step the snapshot was taken after
+	unsigned long long step;
+
+	//Fraction of a step of real time left over after the step, 0 draws the bodies at the
+	//start of the step and 1 at the end
+	float alpha;
+
+	//Handle and view of each body, to match the transforms back up with render objects
+	std::vector<BodyHandle> handles;
+	std::vector<DynamicBody*> views;
+
+	std::vector<XMFLOAT3> positions;
+	std::vector<XMFLOAT3> previousPositions;
+
+	int GetCount() const { return (int)handles.size(); }
+
+	//Blends every body between its previous and current position by alpha and writes its world matrix
+	//Params : Array to fill (at least GetCount() long)
+	void BuildWorldMatrices(XMMATRIX* matrices) const;
+};
+
+//**********************************************************************************
+// Class : SnapshotBuffer
+// Description : Lock free triple buffer of body snapshots between one producer (the
+// thread stepping the world) and one consumer (e.g. the render thread). The producer
+// always has a buffer to write into and the consumer always has the latest complete
+// one to read, so neither ever waits on the other. Intermediate snapshots the
+// consumer didn't get round to are simply skipped.
+//**********************************************************************************
+class SnapshotBuffer
+{
+public:
+
+	SnapshotBuffer();
+	~SnapshotBuffer();
+
+	//Producer side. Gets the buffer to fill, which nobody else is reading
+	BodySnapshot& GetWriteBuffer() { return m_buffers[m_iWriteIndex]; }
+
+	//Producer side. Hands the filled buffer over as the latest snapshot
+	void Publish();
+
+	//Consumer side. Picks up the latest published snapshot, if there's a new one.
+	//The returned snapshot stays untouched until the next call
+	//Returns : Latest snapshot (empty until the first publish)
+	const BodySnapshot& Acquire();
+
+	//Returns : True if a snapshot has been published since the last Acquire
+	bool HasNewSnapshot() const { return (m_iMiddle.load(std::memory_order_acquire) & NEW_SNAPSHOT) != 0; }
+
+private:
+
+	//Set in the middle index when it holds a snapshot the consumer hasn't picked up
+	static const int NEW_SNAPSHOT = 4;
+	static const int INDEX_MASK = 3;
+
+	BodySnapshot m_buffers[3];
+
+	//Buffer owned by each side, only ever touched by that side
+	int m_iWriteIndex;
+	int m_iReadIndex;
+
+	//Buffer between the two, swapped with either side's
+	std::atomic<int> m_iMiddle;
+};
+
+#endif
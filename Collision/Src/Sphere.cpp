@@ -21,32 +21,17 @@ Sphere::~Sphere()
 
 }
 
-void Sphere::Update()
+//Sets the world matrix to draw with, built from a published (and interpolated) position rather than the live body state
+//Params : World matrix
+void Sphere::Update(const XMMATRIX& worldMatrix)
 {
-	if (m_bIsActive)
-	{
-		m_fSpeed = XMVectorGetX(XMVector3Length(GetVelocity()));
-		UpdateMatrices();
-	}
-}
-
-
-
-void Sphere::UpdateMatrices()
-{
-	XMMATRIX mTrans;
-
-	mTrans = XMMatrixTranslationFromVector(GetPosition());
-
-	m_mWorldMatrix = mTrans;
+	m_mWorldMatrix = worldMatrix;
 }
 
+//Only reads the mesh and world matrix, so it's safe while the world is stepping
 void Sphere::Draw()
 {
-	if (m_bIsActive)
-	{
-		Application::s_pApp->SetWorldMatrix(m_mWorldMatrix);
-		Application::s_pApp->SetDepthStencilState(true, true);
-		m_pMesh->Draw();
-	}
+	Application::s_pApp->SetWorldMatrix(m_mWorldMatrix);
+	Application::s_pApp->SetDepthStencilState(true, true);
+	m_pMesh->Draw();
 }
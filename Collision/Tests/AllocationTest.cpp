@@ -0,0 +1,75 @@
+//**********************************************************************
+// File:			AllocationTest.cpp
+// Description:		Checks a warmed up step makes no heap allocations. Built
+//					with AllocationCounter.cpp and PHYSICS_COUNT_ALLOCATIONS,
+//					which replace the global operator new with a counting one.
+//					A pile of spheres is dropped and left to settle, then
+//					every step after must allocate nothing. Buffers kept between
+//					steps only grow when a step needs more than any before it,
+//					so a pile still landing (or a world being added to) does
+//					allocate, a few times at most for each doubling.
+//**********************************************************************
+
+#include <stdio.h>
+
+#include "TestScene.h"
+#include "AllocationCounter.h"
+
+static const int BODY_COUNT = 3000;
+static const int WARMUP_STEPS = 300;
+static const int CHECK_STEPS = 600;
+
+//Steps a pile and counts the allocations of each step after warming up
+//Params : Job system workers, whether resting islands go to sleep
+//Returns : Number of steps that allocated
+static int RunPile(int workers, bool sleeping)
+{
+	TestScene scene(BODY_COUNT, workers);
+	scene.world->SetSleepingEnabled(sleeping);
+
+	scene.SpawnLayers(BODY_COUNT, 2.0f, RANDOM_SEED);
+	scene.Step(WARMUP_STEPS);
+
+	int allocatingSteps = 0;
+	unsigned long long total = 0;
+
+	for (int s = 0; s < CHECK_STEPS; ++s)
+	{
+		unsigned long long before = GetAllocationCount();
+		scene.Step(1);
+		unsigned long long allocations = GetAllocationCount() - before;
+
+		if (allocations > 0)
+		{
+			//Only report the first few, a step that allocates usually does every step
+			if (allocatingSteps++ < 10)
+			{
+				printf("FAIL step %d allocated %llu times (%d workers, sleeping %s)\n", WARMUP_STEPS + s, allocations,
+					workers, sleeping ? "on" : "off");
+			}
+
+			total += allocations;
+		}
+	}
+
+	printf("%d workers, sleeping %s: %d of %d steps allocated, %llu allocations\n", workers, sleeping ? "on" : "off",
+		allocatingSteps, CHECK_STEPS, total);
+
+	return allocatingSteps;
+}
+
+int main()
+{
+	if (!IsAllocationCountingEnabled())
+	{
+		printf("FAIL built without PHYSICS_COUNT_ALLOCATIONS, nothing is counted\n");
+		return 1;
+	}
+
+	int failures = 0;
+
+	failures += RunPile(1, false);
+	failures += RunPile(3, true);
+
+	return failures == 0 ? 0 : 1;
+}
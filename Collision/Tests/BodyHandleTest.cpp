@@ -0,0 +1,180 @@
+//**********************************************************************
+// File:			BodyHandleTest.cpp
+// Description:		Checks handles of removed bodies go stale and stay stale
+//					once their slots are handed to new bodies, through
+//					AddBody and RemoveBody as well as SpawnBody and
+//					DespawnBody, over many rounds of reuse. Also checks a
+//					world ignores a body that belongs to another world.
+//**********************************************************************
+
+#include <stdio.h>
+
+#include <vector>
+
+#include "TestScene.h"
+
+static const int BODY_COUNT = 64;
+static const int ROUNDS = 100;
+
+static int failures = 0;
+
+static void Check(bool condition, const char* message)
+{
+	if (!condition)
+	{
+		printf("FAIL %s\n", message);
+		failures++;
+	}
+}
+
+//Checks none of the handles finds a body any more
+//Params : World, handles of removed bodies, name of the removal
+static void CheckStale(PhysicsWorld& world, const std::vector<BodyHandle>& handles, const char* name)
+{
+	int stale = 0;
+
+	for (BodyHandle handle : handles)
+	{
+		stale += !world.IsBodyValid(handle) && world.GetBody(handle) == nullptr ? 1 : 0;
+	}
+
+	if (stale != (int)handles.size())
+	{
+		printf("FAIL %s: %d of %d removed handles still find a body\n", name, (int)handles.size() - stale, (int)handles.size());
+		failures++;
+	}
+}
+
+//Removes every other body and adds them back, round after round, checking each round's handles
+//reuse the freed slots and every handle removed so far stays stale
+static void TestAddRemove()
+{
+	TestScene scene(0, 1, 0);
+	PhysicsWorld& world = *scene.world;
+
+	std::vector<BodyHandle> handles;
+
+	for (int i = 0; i < BODY_COUNT; ++i)
+	{
+		DynamicBody* body = new DynamicBody();
+		body->SetRadius(1.0f);
+		body->SetPosition(XMVectorSet(i * 3.0f, 10.0f, 0.0f, 0.0f));
+
+		scene.bodies.push_back(body);
+		handles.push_back(world.AddBody(body));
+	}
+
+	std::vector<BodyHandle> removed;
+	int reused = 0, found = 0;
+
+	for (int r = 0; r < ROUNDS; ++r)
+	{
+		std::vector<BodyHandle> round;
+
+		for (int i = r & 1; i < BODY_COUNT; i += 2)
+		{
+			round.push_back(handles[i]);
+			world.RemoveBody(handles[i]);
+		}
+
+		for (int i = r & 1; i < BODY_COUNT; i += 2)
+		{
+			handles[i] = world.AddBody(scene.bodies[i]);
+			found += world.IsBodyValid(handles[i]) && world.GetBody(handles[i]) == scene.bodies[i] ? 1 : 0;
+		}
+
+		//Slots are only reused, never added, so every new handle is in a slot a removed one had
+		for (int i = r & 1; i < BODY_COUNT; i += 2)
+		{
+			bool inRemovedSlot = false;
+
+			for (BodyHandle old : round)
+			{
+				inRemovedSlot = inRemovedSlot || GetHandleSlot(old) == GetHandleSlot(handles[i]);
+			}
+
+			reused += inRemovedSlot ? 1 : 0;
+		}
+
+		removed.insert(removed.end(), round.begin(), round.end());
+		world.Step(1.0f / PHYSICS_STEP_RATE);
+	}
+
+	int readded = ROUNDS * (BODY_COUNT / 2);
+
+	printf("AddBody/RemoveBody: %d bodies re-added over %d rounds, %d into a freed slot\n", readded, ROUNDS, reused);
+
+	Check(found == readded, "a re-added body's handle doesn't find it");
+	Check(reused == readded, "a re-added body didn't reuse a freed slot");
+	Check(world.GetBodyStore().GetCount() == BODY_COUNT, "the world lost or gained bodies");
+	CheckStale(world, removed, "AddBody/RemoveBody");
+}
+
+//The same through the pool, despawning bodies and spawning the pool back out
+static void TestSpawnDespawn()
+{
+	TestScene scene(BODY_COUNT, 1, 0);
+	PhysicsWorld& world = *scene.world;
+	BodyStore& store = world.GetBodyStore();
+
+	std::vector<BodyHandle> removed;
+
+	for (int r = 0; r < ROUNDS; ++r)
+	{
+		while (world.GetPooledBodyCount() > 0)
+		{
+			world.SpawnBody(XMVectorSet((float)store.GetCount() * 3.0f, 10.0f, 0.0f, 0.0f), XMVectorZero());
+		}
+
+		for (int i = 0; i < BODY_COUNT / 2; ++i)
+		{
+			BodyHandle handle = store.GetHandle(i);
+
+			removed.push_back(handle);
+			world.DespawnBody(handle);
+		}
+
+		world.Step(1.0f / PHYSICS_STEP_RATE);
+	}
+
+	printf("SpawnBody/DespawnBody: %d bodies despawned over %d rounds\n", (int)removed.size(), ROUNDS);
+
+	Check(store.GetCount() + world.GetPooledBodyCount() == BODY_COUNT, "the world and pool lost or gained bodies");
+	CheckStale(world, removed, "SpawnBody/DespawnBody");
+}
+
+//A world with a few bodies is asked to remove one at a higher index in another world
+static void TestOtherWorld()
+{
+	TestScene big(0, 1, 0);
+	TestScene small(0, 1, 0);
+
+	for (int i = 0; i < BODY_COUNT; ++i)
+	{
+		DynamicBody* body = new DynamicBody();
+		body->SetRadius(1.0f);
+
+		TestScene& scene = i < 2 ? small : big;
+		scene.bodies.push_back(body);
+		scene.world->AddBody(body);
+	}
+
+	DynamicBody* last = big.bodies.back();
+	BodyHandle handle = last->GetHandle();
+
+	small.world->RemoveBody(last);
+
+	Check(small.world->GetBodyStore().GetCount() == 2, "a world removed a body it doesn't have");
+	Check(big.world->GetBody(handle) == last, "removing a body from the wrong world took it out of its own");
+}
+
+int main()
+{
+	TestAddRemove();
+	TestSpawnDespawn();
+	TestOtherWorld();
+
+	printf("Body handles: %d failures\n", failures);
+
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,185 @@
+//**********************************************************************
+// File:			BodyStoreSimdTest.cpp
+// Description:		Checks the AVX2 and AVX-512 integration loops of
+//					BodyStore leave every body byte for byte the same as
+//					the scalar loop: awake, asleep and inactive lanes, zero
+//					inverse mass, lanes killed by the kill plane, ranges
+//					that don't start or end on a batch, and the scalar tail.
+//					Then times each level in bodies per second.
+//**********************************************************************
+
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+#include <chrono>
+
+#include "BodyStore.h"
+#include "Random.h"
+#include "Constants.h"
+
+static const float STEP_TIME = 1.0f / PHYSICS_STEP_RATE;
+
+static const int BENCHMARK_BODIES = 1 << 20;
+static const int BENCHMARK_STEPS = 50;
+
+static const char* LEVEL_NAMES[] = { "scalar", "AVX2", "AVX-512" };
+
+static int failures = 0;
+
+//Fills a store with bodies in every state, some close enough above the kill plane to fall through it in one step
+//Params : Store to fill, number of bodies, seed
+static void FillStore(BodyStore& store, int count, unsigned int seed)
+{
+	Random random(seed);
+
+	for (int i = 0; i < count; i++)
+	{
+		float y = (random.NextInt(4) == 0) ? KILL_PLANE_Y + random.NextRange(0.0f, 0.2f) : random.NextRange(-5.0f, 50.0f);
+
+		XMVECTOR position = XMVectorSet(random.NextRange(-100.0f, 100.0f), y, random.NextRange(-100.0f, 100.0f), 0.0f);
+		XMVECTOR velocity = XMVectorSet(random.NextRange(-20.0f, 20.0f), random.NextRange(-20.0f, 5.0f), random.NextRange(-20.0f, 20.0f), 0.0f);
+
+		float invMass = (random.NextInt(8) == 0) ? 0.0f : random.NextRange(0.1f, 2.0f);
+		int state = random.NextInt(6);
+
+		store.Add(nullptr, position, velocity, invMass, random.NextRange(0.5f, 1.5f), state != 0);
+
+		int index = store.GetCount() - 1;
+		store.AddForce(index, XMVectorSet(random.NextRange(-50.0f, 50.0f), random.NextRange(-50.0f, 50.0f), random.NextRange(-50.0f, 50.0f), 0.0f));
+
+		if (state == 1)
+		{
+			store.Sleep(index);
+		}
+	}
+}
+
+//Copies a float vector's bits, so comparisons are exact (and tell -0 from 0)
+static void AppendBits(std::vector<uint32_t>& bits, const XMVECTOR& value)
+{
+	XMFLOAT3 stored;
+	XMStoreFloat3(&stored, value);
+
+	uint32_t words[3];
+	memcpy(words, &stored, sizeof(words));
+	bits.insert(bits.end(), words, words + 3);
+}
+
+//Gets every bit of per body state the integration loops can write
+//Returns : Bits of the positions, velocities and forces, with the flags after them
+static std::vector<uint32_t> GetStateBits(const BodyStore& store)
+{
+	std::vector<uint32_t> bits;
+
+	for (int i = 0; i < store.GetCount(); i++)
+	{
+		AppendBits(bits, store.GetPosition(i));
+		AppendBits(bits, store.GetVelocity(i));
+		AppendBits(bits, store.GetForce(i));
+		bits.push_back(store.GetFlags()[i]);
+	}
+
+	return bits;
+}
+
+//Integrates a range of a fresh store at one level, twice so the second step sees the first's kills and zeroed forces
+//Params : Level, bodies in the store, first body, one past the last body, state to fill in
+//Returns : Bodies killed
+static int IntegrateAtLevel(SimdLevel level, int count, int begin, int end, std::vector<uint32_t>& bits)
+{
+	BodyStore store;
+	FillStore(store, count, RANDOM_SEED + count);
+	store.SetSimdLevel(level);
+
+	XMFLOAT3 gravity(0.0f, -9.81f, 0.0f);
+	int killed = 0;
+
+	for (int step = 0; step < 2; step++)
+	{
+		store.IntegrateVelocities(STEP_TIME, gravity, begin, end);
+		killed += store.IntegratePositions(STEP_TIME, KILL_PLANE_Y, begin, end);
+	}
+
+	bits = GetStateBits(store);
+
+	return killed;
+}
+
+//Checks every supported level against the scalar loop over a range
+static void CheckRange(int count, int begin, int end, int levelCount)
+{
+	std::vector<uint32_t> scalarBits;
+	int scalarKilled = IntegrateAtLevel(SIMD_SCALAR, count, begin, end, scalarBits);
+
+	for (int level = SIMD_AVX2; level < levelCount; level++)
+	{
+		std::vector<uint32_t> bits;
+		int killed = IntegrateAtLevel((SimdLevel)level, count, begin, end, bits);
+
+		if (killed != scalarKilled || bits != scalarBits)
+		{
+			printf("FAIL %s differs from scalar over bodies [%d, %d) of %d (killed %d vs %d)\n",
+				LEVEL_NAMES[level], begin, end, count, killed, scalarKilled);
+			failures++;
+		}
+	}
+}
+
+int main()
+{
+	//Levels the CPU can run, SetSimdLevel clamps anything above them
+	BodyStore probe;
+	probe.SetSimdLevel(SIMD_AVX512);
+	int levelCount = probe.GetSimdLevel() + 1;
+
+	for (int level = levelCount; level <= SIMD_AVX512; level++)
+	{
+		printf("CPU doesn't support %s, skipping it\n", LEVEL_NAMES[level]);
+	}
+
+	//Every count either side of one and two batches of each width, from the start and offset into the store
+	int ranges = 0;
+
+	for (int count = 0; count <= 40; count++)
+	{
+		for (int begin = 0; begin <= 3 && begin <= count; begin++)
+		{
+			CheckRange(count, begin, count, levelCount);
+			CheckRange(count, begin, count - ((count - begin) / 3), levelCount);
+			ranges += 2;
+		}
+	}
+
+	CheckRange(100003, 0, 100003, levelCount);
+	CheckRange(100003, 5, 99990, levelCount);
+	ranges += 2;
+
+	printf("BodyStore SIMD: %d ranges compared, %d failures\n\n", ranges, failures);
+
+	//Throughput of one step's two passes over a store larger than the caches
+	printf("%d bodies, %d steps\n", BENCHMARK_BODIES, BENCHMARK_STEPS);
+
+	for (int level = SIMD_SCALAR; level < levelCount; level++)
+	{
+		BodyStore store;
+		FillStore(store, BENCHMARK_BODIES, RANDOM_SEED);
+		store.SetSimdLevel((SimdLevel)level);
+
+		XMFLOAT3 gravity(0.0f, -9.81f, 0.0f);
+
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+		for (int step = 0; step < BENCHMARK_STEPS; step++)
+		{
+			store.IntegrateVelocities(STEP_TIME, gravity, 0, BENCHMARK_BODIES);
+			store.IntegratePositions(STEP_TIME, KILL_PLANE_Y, 0, BENCHMARK_BODIES);
+		}
+
+		double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+		printf("%-8s %8.1f Mbodies/s\n", LEVEL_NAMES[level], ((double)BENCHMARK_BODIES * BENCHMARK_STEPS / seconds) / 1e6);
+	}
+
+	return failures == 0 ? 0 : 1;
+}
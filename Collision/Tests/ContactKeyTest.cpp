@@ -0,0 +1,71 @@
+//**********************************************************************
+// File:			ContactKeyTest.cpp
+// Description:		Checks contact keys never alias: terrain keys for bodies
+//					and faces either side of the old 23 bit body and 8 bit
+//					tile fields, body pair keys, and the two kinds against
+//					each other. Keys match warm start impulses and contact
+//					events between steps, so two contacts sharing one would
+//					swap impulses or drop events.
+//**********************************************************************
+
+#include <stdio.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "ContactSolver.h"
+#include "BodyHandle.h"
+
+int main()
+{
+	//Faces of a 4096 x 4096 map, the largest a tile is expected to be
+	const unsigned long long tileFaces = 2ULL * 4095 * 4095;
+
+	const int bodies[] = { 0, 1, 255, 256, (1 << 23) - 1, 1 << 23, (1 << 23) + 1, MAX_BODY_SLOTS - 1 };
+	const unsigned long long tiles[] = { 0, 1, 255, 256, 257, 4095 };
+	const unsigned long long faces[] = { 0, 1, 1ULL << 23, tileFaces - 1 };
+
+	std::vector<unsigned long long> keys;
+
+	for (int body : bodies)
+	{
+		for (unsigned long long tile : tiles)
+		{
+			for (unsigned long long face : faces)
+			{
+				keys.push_back(ContactSolver::MakeStaticKey(body, (tile * tileFaces) + face));
+			}
+		}
+
+		for (int other : bodies)
+		{
+			if (other > body)
+			{
+				keys.push_back(ContactSolver::MakeDynamicKey(body, other));
+			}
+		}
+	}
+
+	int failures = 0;
+
+	//Either order of a pair gives the same key
+	if (ContactSolver::MakeDynamicKey(3, 1 << 23) != ContactSolver::MakeDynamicKey(1 << 23, 3))
+	{
+		printf("FAIL body pair keys depend on the order of the pair\n");
+		failures++;
+	}
+
+	size_t count = keys.size();
+	std::sort(keys.begin(), keys.end());
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+	if (keys.size() != count)
+	{
+		printf("FAIL %d of %d contact keys alias\n", (int)(count - keys.size()), (int)count);
+		failures++;
+	}
+
+	printf("Contact keys: %d keys, %d failures\n", (int)count, failures);
+
+	return failures == 0 ? 0 : 1;
+}
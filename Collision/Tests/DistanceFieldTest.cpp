@@ -0,0 +1,190 @@
+//**********************************************************************
+// File:			DistanceFieldTest.cpp
+// Description:		Compares the baked distance field's sphere contacts with
+//					the triangle path's on generated rolling terrain: how far
+//					apart the depths and normals are, contacts one finds and
+//					the other doesn't, memory, and contacts per second. The
+//					accuracy is checked against limits, the rest is printed.
+//					Bakes across a job system, the same as a world's tiles.
+//**********************************************************************
+
+#include <stdio.h>
+#include <math.h>
+
+#include <vector>
+#include <chrono>
+
+#include "HeightMap.h"
+#include "JobSystem.h"
+#include "Random.h"
+#include "Constants.h"
+
+static const int MAP_SIZE = 512;
+static const int SAMPLE_COUNT = 100000;
+static const float RADIUS = 1.0f;
+
+//Limits on how far the field's contacts can be from the triangles', in units of the radius and degrees.
+//Measured at 1 sample per cell (the coarsest): 0.009 mean and 0.09 worst depth, 2.2 degrees, 0.1% missed
+static const float MAX_MEAN_DEPTH_ERROR = 0.015f;
+static const float MAX_DEPTH_ERROR = 0.15f;
+static const float MAX_MEAN_NORMAL_ERROR = 3.0f;
+static const float MAX_MISSED_FRACTION = 0.005f;
+
+//Sphere centres resting a little way into the terrain, and the triangle path's deepest contact for each
+struct ContactSample
+{
+	XMFLOAT3 centre;
+	bool hit;
+	float depth;
+	XMFLOAT3 normal;
+};
+
+//Tests one sphere and keeps the deepest contact found
+//Returns : False if the sphere touches nothing
+static bool DeepestContact(HeightMap& heightMap, const XMFLOAT3& centre, std::vector<PhysicsStaticCollision>& collisions, float& depth, XMFLOAT3& normal)
+{
+	collisions.clear();
+	heightMap.SphereHeightmap(0, XMLoadFloat3(&centre), RADIUS, collisions);
+
+	depth = -1.0f;
+
+	for (auto& collision : collisions)
+	{
+		if (collision.penetrationDepth > depth)
+		{
+			depth = collision.penetrationDepth;
+			XMStoreFloat3(&normal, collision.collisionNormal);
+		}
+	}
+
+	return !collisions.empty();
+}
+
+int main()
+{
+	const char* fileName = "DistanceFieldTest.bmp";
+
+	std::vector<unsigned char> heights(MAP_SIZE * MAP_SIZE);
+	HeightMap::GenerateRollingHeights(heights.data(), MAP_SIZE, MAP_SIZE);
+
+	if (!HeightMap::SaveHeightMapBitmap(fileName, heights.data(), MAP_SIZE, MAP_SIZE))
+	{
+		printf("FAIL can't write %s\n", fileName);
+		return 1;
+	}
+
+	HeightMap triangles((char*)fileName, 2.0f, 0.75f);
+
+	float minX, minZ, maxX, maxZ;
+	triangles.GetWorldBoundsXZ(minX, minZ, maxX, maxZ);
+
+	//Spheres pushed between 0 and half a radius into the surface, away from the edges
+	Random random(RANDOM_SEED);
+	std::vector<ContactSample> samples(SAMPLE_COUNT);
+	std::vector<PhysicsStaticCollision> collisions;
+
+	for (auto& sample : samples)
+	{
+		sample.centre.x = random.NextRange(minX + 4.0f, maxX - 4.0f);
+		sample.centre.z = random.NextRange(minZ + 4.0f, maxZ - 4.0f);
+
+		float ground;
+		triangles.SampleHeights(&sample.centre.x, &sample.centre.z, &ground, nullptr, 1);
+
+		sample.centre.y = ground + RADIUS - random.NextRange(0.0f, 0.5f * RADIUS);
+		sample.hit = DeepestContact(triangles, sample.centre, collisions, sample.depth, sample.normal);
+	}
+
+	JobSystem jobs;
+	jobs.SetWorkerCount(2);
+
+	int failures = 0;
+	printf("%d x %d map, %d spheres of radius %g\n\n", MAP_SIZE, MAP_SIZE, SAMPLE_COUNT, RADIUS);
+	printf("%-16s %10s %10s %10s %10s %8s %10s %12s\n", "contacts", "memory MB", "bake ms", "mean depth", "max depth", "mean deg", "missed", "Mcontacts/s");
+
+	//The triangle path on its own first, for the throughput to compare against
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	for (auto& sample : samples)
+	{
+		collisions.clear();
+		triangles.SphereHeightmap(0, XMLoadFloat3(&sample.centre), RADIUS, collisions);
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	printf("%-16s %10.2f %10s %10s %10s %8s %10s %12.2f\n", "triangles", triangles.GetFaceDataMemory() / (1024.0 * 1024.0),
+		"-", "-", "-", "-", "-", (SAMPLE_COUNT / seconds) / 1e6);
+
+	const int samplesPerCell[] = { 1, 2, 4 };
+
+	for (int fieldSamples : samplesPerCell)
+	{
+		HeightMap field((char*)fileName, 2.0f, 0.75f);
+
+		start = std::chrono::high_resolution_clock::now();
+		field.SetContactMode(HeightMap::CONTACT_DISTANCE_FIELD, fieldSamples, &jobs);
+		double bakeMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		double depthError = 0.0, worstDepthError = 0.0, normalError = 0.0;
+		int compared = 0, missed = 0;
+
+		for (auto& sample : samples)
+		{
+			float depth;
+			XMFLOAT3 normal;
+			bool hit = DeepestContact(field, sample.centre, collisions, depth, normal);
+
+			if (hit != sample.hit)
+			{
+				missed++;
+				continue;
+			}
+
+			if (!hit)
+			{
+				continue;
+			}
+
+			float cosine = (normal.x * sample.normal.x) + (normal.y * sample.normal.y) + (normal.z * sample.normal.z);
+			double error = fabs(depth - sample.depth) / RADIUS;
+
+			depthError += error;
+			worstDepthError = max(worstDepthError, error);
+			normalError += acos(min(max(cosine, -1.0f), 1.0f)) * (180.0 / 3.14159265358979);
+			compared++;
+		}
+
+		start = std::chrono::high_resolution_clock::now();
+
+		for (auto& sample : samples)
+		{
+			collisions.clear();
+			field.SphereHeightmap(0, XMLoadFloat3(&sample.centre), RADIUS, collisions);
+		}
+
+		seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+		double meanDepthError = compared > 0 ? depthError / compared : 0.0;
+		double meanNormalError = compared > 0 ? normalError / compared : 0.0;
+
+		char name[32];
+		snprintf(name, sizeof(name), "field %d/cell", fieldSamples);
+
+		printf("%-16s %10.2f %10.2f %10.4f %10.4f %8.3f %10d %12.2f\n", name, field.GetDistanceFieldMemory() / (1024.0 * 1024.0),
+			bakeMilliseconds, meanDepthError, worstDepthError, meanNormalError, missed, (SAMPLE_COUNT / seconds) / 1e6);
+
+		if (compared == 0 || meanDepthError > MAX_MEAN_DEPTH_ERROR || worstDepthError > MAX_DEPTH_ERROR ||
+			meanNormalError > MAX_MEAN_NORMAL_ERROR || missed > SAMPLE_COUNT * MAX_MISSED_FRACTION)
+		{
+			printf("FAIL %s is further from the triangles than allowed\n", name);
+			failures++;
+		}
+	}
+
+	remove(fileName);
+
+	printf("\nDistance field: %d failures\n", failures);
+
+	return failures == 0 ? 0 : 1;
+}
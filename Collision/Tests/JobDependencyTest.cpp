@@ -0,0 +1,110 @@
+//**********************************************************************
+// File:			JobDependencyTest.cpp
+// Description:		Checks every job waiting on one prerequisite runs after
+//					it, including the jobs past MAX_CONTINUATIONS that wait
+//					through relays. The prerequisite is submitted first, so
+//					a worker popping its own deque would otherwise reach the
+//					dependents before it.
+//**********************************************************************
+
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "JobSystem.h"
+
+//Enough dependents to fill the prerequisite and a few relays after it
+static const int DEPENDENT_COUNT = 40;
+
+static int failures = 0;
+
+static void Check(bool condition, const char* message)
+{
+	if (!condition)
+	{
+		printf("FAIL %s\n", message);
+		failures++;
+	}
+}
+
+struct DependencyState
+{
+	std::atomic<bool> prerequisiteDone;
+	std::atomic<int> ranAfter;
+	std::atomic<int> ranBefore;
+};
+
+static void PrerequisiteTask(void* context, int begin, int end, int worker)
+{
+	DependencyState* state = (DependencyState*)context;
+
+	//Long enough for the other workers to reach any dependent that isn't waiting
+	std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	state->prerequisiteDone = true;
+}
+
+static void DependentTask(void* context, int begin, int end, int worker)
+{
+	DependencyState* state = (DependencyState*)context;
+
+	if (state->prerequisiteDone)
+	{
+		state->ranAfter++;
+	}
+	else
+	{
+		state->ranBefore++;
+	}
+}
+
+//Runs one prerequisite with DEPENDENT_COUNT jobs waiting on it
+//Params : Number of workers
+static void RunDependents(int workers)
+{
+	JobSystem jobs;
+	jobs.SetWorkerCount(workers);
+
+	DependencyState state;
+	state.prerequisiteDone = false;
+	state.ranAfter = 0;
+	state.ranBefore = 0;
+
+	JobHandle prerequisite = jobs.CreateJob("Prerequisite", PrerequisiteTask, &state);
+	std::vector<JobHandle> dependents;
+
+	for (int i = 0; i < DEPENDENT_COUNT; i++)
+	{
+		dependents.push_back(jobs.CreateJob("Dependent", DependentTask, &state));
+		jobs.AddDependency(dependents.back(), prerequisite);
+	}
+
+	jobs.Submit(prerequisite);
+
+	for (JobHandle dependent : dependents)
+	{
+		jobs.Submit(dependent);
+	}
+
+	for (JobHandle dependent : dependents)
+	{
+		jobs.Wait(dependent);
+	}
+
+	printf("%d workers: %d dependents ran after the prerequisite, %d before it\n", workers, state.ranAfter.load(), state.ranBefore.load());
+
+	Check(state.ranBefore == 0, "a dependent ran before its prerequisite");
+	Check(state.ranAfter == DEPENDENT_COUNT, "not every dependent ran");
+}
+
+int main()
+{
+	RunDependents(1);
+	RunDependents(4);
+
+	printf("Job dependencies: %d failures\n", failures);
+
+	return failures == 0 ? 0 : 1;
+}
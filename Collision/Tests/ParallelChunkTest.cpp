@@ -0,0 +1,65 @@
+//**********************************************************************
+// File:			ParallelChunkTest.cpp
+// Description:		Checks a world gives the same contacts once it has grown
+//					past the body counts where ParallelFor starts giving its
+//					chunks several grains each (16k bodies for the terrain
+//					tests, 64k for the sweep). A settled pile is stepped with
+//					bodies added far above it, which can't touch anything,
+//					once with too few to cross either count and once with
+//					enough to cross both.
+//**********************************************************************
+
+#include <stdio.h>
+
+#include <vector>
+
+#include "TestScene.h"
+
+static const int PILE_BODIES = 12000;
+static const int SETTLE_STEPS = 60;
+static const int CHECK_STEPS = 5;
+
+//Settles a pile, adds bodies high above it and records the contacts of each step after
+//Params : Bodies added above the pile, filled in with the contact count of each step
+static void RunPile(int addedBodies, std::vector<int>& contacts)
+{
+	TestScene scene(PILE_BODIES + addedBodies, 2);
+
+	scene.SpawnLayers(PILE_BODIES, 2.0f, RANDOM_SEED);
+	scene.Step(SETTLE_STEPS);
+
+	scene.SpawnLayers(addedBodies, 2000.0f, RANDOM_SEED + 1);
+
+	for (int s = 0; s < CHECK_STEPS; ++s)
+	{
+		scene.Step(1);
+		contacts.push_back(scene.world->GetContactSolver().GetContactCount());
+	}
+}
+
+int main()
+{
+	std::vector<int> below, above;
+
+	RunPile(4000, below);
+	RunPile(60000, above);
+
+	int failures = 0;
+
+	for (int s = 0; s < CHECK_STEPS; ++s)
+	{
+		printf("step %d: %d contacts below the chunk limits, %d above\n", s, below[s], above[s]);
+
+		failures += below[s] != above[s] ? 1 : 0;
+	}
+
+	if (below[0] == 0)
+	{
+		printf("FAIL the pile has no contacts to compare\n");
+		failures++;
+	}
+
+	printf("Parallel chunks: %d failures\n", failures);
+
+	return failures == 0 ? 0 : 1;
+}
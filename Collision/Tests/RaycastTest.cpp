@@ -0,0 +1,261 @@
+//**********************************************************************
+// File:			RaycastTest.cpp
+// Description:		Checks PhysicsWorld::Raycast and RaycastBatch against a
+//					brute force search of every terrain face and every body,
+//					on a square of tiles with a settled pile and bodies still
+//					falling. Rays come from above, from inside bodies, along
+//					the axes and at grazing angles, with the broadphase both
+//					sorted and freshly added to (unsorted).
+//**********************************************************************
+
+#include <stdio.h>
+#include <math.h>
+
+#include <vector>
+
+#include "TestScene.h"
+
+static const int BODY_COUNT = 3000;
+static const int RAY_COUNT = 20000;
+static const float MAX_DISTANCE = 500.0f;
+
+//How far apart the two distances can be, and how close two surfaces must be for either to count as the nearest
+static const float DISTANCE_TOLERANCE = 1e-3f;
+
+static int failures = 0;
+
+//Two sided ray vs triangle (Moller-Trumbore)
+//Returns : True if the ray hits the triangle in front of its start, with the distance filled in
+static bool RayTriangle(const XMFLOAT3& o, const XMFLOAT3& d, const XMFLOAT3& v0, const XMFLOAT3& v1, const XMFLOAT3& v2, float& distance)
+{
+	XMFLOAT3 e1(v1.x - v0.x, v1.y - v0.y, v1.z - v0.z);
+	XMFLOAT3 e2(v2.x - v0.x, v2.y - v0.y, v2.z - v0.z);
+
+	XMFLOAT3 p((d.y * e2.z) - (d.z * e2.y), (d.z * e2.x) - (d.x * e2.z), (d.x * e2.y) - (d.y * e2.x));
+	float det = (e1.x * p.x) + (e1.y * p.y) + (e1.z * p.z);
+
+	if (fabsf(det) < 1e-12f)
+	{
+		return false;
+	}
+
+	float invDet = 1.0f / det;
+	XMFLOAT3 s(o.x - v0.x, o.y - v0.y, o.z - v0.z);
+
+	float u = ((s.x * p.x) + (s.y * p.y) + (s.z * p.z)) * invDet;
+
+	if (u < 0.0f || u > 1.0f)
+	{
+		return false;
+	}
+
+	XMFLOAT3 q((s.y * e1.z) - (s.z * e1.y), (s.z * e1.x) - (s.x * e1.z), (s.x * e1.y) - (s.y * e1.x));
+	float v = ((d.x * q.x) + (d.y * q.y) + (d.z * q.z)) * invDet;
+
+	if (v < 0.0f || u + v > 1.0f)
+	{
+		return false;
+	}
+
+	distance = ((e2.x * q.x) + (e2.y * q.y) + (e2.z * q.z)) * invDet;
+
+	return distance >= 0.0f;
+}
+
+//Finds the nearest hit by testing every face of every tile and every active body
+static RaycastHit BruteForceRaycast(TestScene& scene, const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance)
+{
+	XMFLOAT3 d;
+	XMStoreFloat3(&d, XMVector3Normalize(XMLoadFloat3(&direction)));
+
+	RaycastHit hit;
+	hit.distance = maxDistance;
+	hit.body = INVALID_BODY_HANDLE;
+	hit.tile = -1;
+	hit.face = -1;
+
+	for (int t = 0; t < (int)scene.tiles.size(); t++)
+	{
+		HeightMap* tile = scene.tiles[t];
+
+		for (int f = 0; f < tile->m_iFaceCount; f++)
+		{
+			float distance;
+
+			if (!tile->IsFaceDisabled(f) && RayTriangle(origin, d, tile->GetPositionOnFace(f, 1), tile->GetPositionOnFace(f, 2), tile->GetPositionOnFace(f, 3), distance) &&
+				distance <= hit.distance)
+			{
+				hit.distance = distance;
+				hit.tile = t;
+				hit.face = f;
+			}
+		}
+	}
+
+	BodyStore& store = scene.world->GetBodyStore();
+
+	for (int i = 0; i < store.GetCount(); i++)
+	{
+		if (!store.IsActive(i))
+		{
+			continue;
+		}
+
+		XMFLOAT3 centre;
+		XMStoreFloat3(&centre, store.GetPosition(i));
+
+		float mx = origin.x - centre.x;
+		float my = origin.y - centre.y;
+		float mz = origin.z - centre.z;
+
+		float b = (mx * d.x) + (my * d.y) + (mz * d.z);
+		float c = (mx * mx) + (my * my) + (mz * mz) - (store.GetRadius(i) * store.GetRadius(i));
+		float discriminant = (b * b) - c;
+
+		if ((c > 0.0f && b > 0.0f) || discriminant < 0.0f)
+		{
+			continue;
+		}
+
+		float distance = max(-b - sqrtf(discriminant), 0.0f);
+
+		if (distance < hit.distance)
+		{
+			hit.distance = distance;
+			hit.body = store.GetHandle(i);
+			hit.tile = -1;
+			hit.face = -1;
+		}
+	}
+
+	return hit;
+}
+
+//Builds rays of every kind over the scene
+static void MakeRays(TestScene& scene, Random& random, std::vector<XMFLOAT3>& origins, std::vector<XMFLOAT3>& directions)
+{
+	float minX, minZ, maxX, maxZ;
+	scene.GetBoundsXZ(minX, minZ, maxX, maxZ);
+
+	BodyStore& store = scene.world->GetBodyStore();
+
+	origins.resize(RAY_COUNT);
+	directions.resize(RAY_COUNT);
+
+	const XMFLOAT3 axes[] = { XMFLOAT3(1, 0, 0), XMFLOAT3(-1, 0, 0), XMFLOAT3(0, 1, 0), XMFLOAT3(0, -1, 0), XMFLOAT3(0, 0, 1), XMFLOAT3(0, 0, -1) };
+
+	for (int r = 0; r < RAY_COUNT; r++)
+	{
+		XMFLOAT3& o = origins[r];
+		XMFLOAT3& d = directions[r];
+
+		o = XMFLOAT3(random.NextRange(minX - 10.0f, maxX + 10.0f), random.NextRange(0.0f, 60.0f), random.NextRange(minZ - 10.0f, maxZ + 10.0f));
+		d = XMFLOAT3(random.NextRange(-1.0f, 1.0f), random.NextRange(-1.0f, 0.2f), random.NextRange(-1.0f, 1.0f));
+
+		switch (r % 5)
+		{
+		case 1:
+			//Straight along an axis, so some direction components are exactly zero
+			d = axes[random.NextInt(6)];
+			break;
+		case 2:
+			//From inside (or on the edge of) a body
+			if (store.GetCount() > 0)
+			{
+				XMStoreFloat3(&o, store.GetPosition(random.NextInt(store.GetCount())));
+				o.x += random.NextRange(-0.5f, 0.5f);
+			}
+			break;
+		case 3:
+			//Nearly level, skimming the terrain and the pile
+			d.y = random.NextRange(-0.05f, 0.05f);
+			o.y = random.NextRange(0.0f, 8.0f);
+			break;
+		default:
+			break;
+		}
+
+		if (d.x == 0.0f && d.y == 0.0f && d.z == 0.0f)
+		{
+			d.y = -1.0f;
+		}
+	}
+}
+
+//Casts every ray through the world, one at a time and batched, and compares both with the brute force search
+static void CheckRays(TestScene& scene, Random& random, const char* name)
+{
+	std::vector<XMFLOAT3> origins, directions;
+	MakeRays(scene, random, origins, directions);
+
+	std::vector<RaycastHit> batch(RAY_COUNT);
+	int batchHits = scene.world->RaycastBatch(origins.data(), directions.data(), RAY_COUNT, MAX_DISTANCE, batch.data());
+
+	int hits = 0, bodyHits = 0, wrong = 0, batchWrong = 0;
+
+	for (int r = 0; r < RAY_COUNT; r++)
+	{
+		RaycastHit hit;
+		bool found = scene.world->Raycast(XMLoadFloat3(&origins[r]), XMLoadFloat3(&directions[r]), MAX_DISTANCE, hit);
+		RaycastHit expected = BruteForceRaycast(scene, origins[r], directions[r], MAX_DISTANCE);
+
+		hits += found ? 1 : 0;
+		bodyHits += hit.body != INVALID_BODY_HANDLE ? 1 : 0;
+
+		//The surfaces hit can differ where two are the same distance away, the distances can't
+		bool sameDistance = fabsf(hit.distance - expected.distance) <= DISTANCE_TOLERANCE * max(1.0f, expected.distance);
+
+		if (found != expected.IsHit() || !sameDistance)
+		{
+			if (wrong < 5)
+			{
+				printf("  ray %d: world %s at %g, brute force %s at %g\n", r, found ? "hit" : "missed", hit.distance,
+					expected.IsHit() ? "hit" : "missed", expected.distance);
+			}
+
+			wrong++;
+		}
+
+		if (batch[r].IsHit() != found || batch[r].distance != hit.distance || batch[r].body != hit.body || batch[r].face != hit.face)
+		{
+			batchWrong++;
+		}
+	}
+
+	if (wrong > 0)
+	{
+		printf("FAIL %s: %d of %d rays disagree with the brute force search\n", name, wrong, RAY_COUNT);
+		failures++;
+	}
+
+	if (batchWrong > 0 || batchHits != hits)
+	{
+		printf("FAIL %s: %d batched rays differ from single ones\n", name, batchWrong);
+		failures++;
+	}
+
+	printf("%s: %d rays, %d hits (%d bodies)\n", name, RAY_COUNT, hits, bodyHits);
+}
+
+int main()
+{
+	TestScene scene(BODY_COUNT + 700, 2, 2);
+	Random random(RANDOM_SEED);
+
+	//A pile that has mostly settled, with a layer still falling onto it
+	scene.SpawnLayers(BODY_COUNT, 2.0f, RANDOM_SEED);
+	scene.Step(120);
+	scene.SpawnLayers(500, 30.0f, RANDOM_SEED + 1);
+	scene.Step(10);
+
+	CheckRays(scene, random, "sorted broadphase");
+
+	//Bodies added since the last step leave the broadphase unsorted until the next
+	scene.world->SetWorkerCount(1);
+	scene.SpawnLayers(200, 10.0f, RANDOM_SEED + 2);
+	CheckRays(scene, random, "unsorted broadphase");
+
+	printf("Raycast: %d failures\n", failures);
+
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,330 @@
+//**********************************************************************
+// File:			SampleHeightsTest.cpp
+// Description:		Checks HeightMap::SampleHeights gives bit identical
+//					heights and normals with AVX2 and the scalar loop:
+//					points inside, on cell edges and diagonals, off every
+//					side of the map (clamped to the edge), counts that
+//					leave a scalar tail, unaligned arrays, with and without
+//					normals. Heights are also checked against the plane of
+//					the collision face under each point, so both can't be
+//					wrong together. Then times both in samples per second.
+//**********************************************************************
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <vector>
+#include <chrono>
+
+#include "HeightMap.h"
+#include "Random.h"
+#include "Constants.h"
+
+static const int MAP_SIZE = 256;
+static const int BENCHMARK_MAP_SIZE = 1024;
+static const int BENCHMARK_SAMPLES = 1 << 20;
+static const int BENCHMARK_PASSES = 20;
+
+static int failures = 0;
+
+//Samples the same points at a level
+//Params : Heightmap, level, points, count, heights and normals to fill in (normals nullptr to skip)
+static void Sample(HeightMap& heightMap, SimdLevel level, const float* xs, const float* zs, int count, float* outY, XMFLOAT3* outN)
+{
+	heightMap.SetSimdLevel(level);
+	heightMap.SampleHeights(xs, zs, outY, outN, count);
+}
+
+//Checks AVX2 against scalar for points starting at an offset into the arrays, so loads aren't aligned
+static void CheckPoints(HeightMap& heightMap, const std::vector<float>& xs, const std::vector<float>& zs, int offset, int count, bool normals, const char* name)
+{
+	std::vector<float> scalarY(count + 1), simdY(count + 1);
+	std::vector<XMFLOAT3> scalarN(count + 1), simdN(count + 1);
+
+	Sample(heightMap, SIMD_SCALAR, xs.data() + offset, zs.data() + offset, count, scalarY.data(), normals ? scalarN.data() : nullptr);
+	Sample(heightMap, SIMD_AVX2, xs.data() + offset, zs.data() + offset, count, simdY.data(), normals ? simdN.data() : nullptr);
+
+	bool same = memcmp(scalarY.data(), simdY.data(), sizeof(float) * count) == 0;
+
+	if (normals)
+	{
+		same = same && memcmp(scalarN.data(), simdN.data(), sizeof(XMFLOAT3) * count) == 0;
+	}
+
+	if (!same)
+	{
+		printf("FAIL AVX2 differs from scalar for %s, %d points from %d%s\n", name, count, offset, normals ? " with normals" : "");
+		failures++;
+	}
+}
+
+//Collision faces in each cell, found once by the cell their centre falls in
+struct FaceGrid
+{
+	float minX, minZ, cell;
+	int cells;
+	std::vector<int> faces;
+};
+
+//Buckets every face of the heightmap by cell
+static FaceGrid BuildFaceGrid(HeightMap& heightMap, float cell)
+{
+	FaceGrid grid;
+	float maxX, maxZ;
+	heightMap.GetWorldBoundsXZ(grid.minX, grid.minZ, maxX, maxZ);
+
+	grid.cell = cell;
+	grid.cells = MAP_SIZE - 1;
+	grid.faces.assign(grid.cells * grid.cells * 2, -1);
+
+	for (int f = 0; f < heightMap.m_iFaceCount; f++)
+	{
+		XMFLOAT3 centre = heightMap.GetPositionOnFace(f, 0);
+		int column = (int)((centre.x - grid.minX) / cell);
+		int row = (int)((centre.z - grid.minZ) / cell);
+		int slot = ((row * grid.cells) + column) * 2;
+
+		grid.faces[grid.faces[slot] < 0 ? slot : slot + 1] = f;
+	}
+
+	return grid;
+}
+
+//Checks each height lies on the plane of the face under its point (clamped onto the map), found
+//from the face vertices rather than SampleHeights' own arithmetic
+//Returns : Number of points checked
+static int CheckAgainstFaces(HeightMap& heightMap, const FaceGrid& grid, const std::vector<float>& xs, const std::vector<float>& zs, const char* name)
+{
+	int count = (int)xs.size();
+	std::vector<float> ys(count);
+	Sample(heightMap, SIMD_AVX2, xs.data(), zs.data(), count, ys.data(), nullptr);
+
+	float maxX = grid.minX + (grid.cells * grid.cell);
+	float maxZ = grid.minZ + (grid.cells * grid.cell);
+	int wrong = 0;
+	float worst = 0.0f;
+
+	for (int i = 0; i < count; i++)
+	{
+		float x = min(max(xs[i], grid.minX), maxX);
+		float z = min(max(zs[i], grid.minZ), maxZ);
+		int column = min((int)((x - grid.minX) / grid.cell), grid.cells - 1);
+		int row = min((int)((z - grid.minZ) / grid.cell), grid.cells - 1);
+
+		//Whichever of the cell's two triangles holds the point, either will do on the diagonal
+		float expected = NAN;
+
+		for (int t = 0; t < 2 && isnan(expected); t++)
+		{
+			int f = grid.faces[(((row * grid.cells) + column) * 2) + t];
+			XMFLOAT3 a = heightMap.GetPositionOnFace(f, 1);
+			XMFLOAT3 b = heightMap.GetPositionOnFace(f, 2);
+			XMFLOAT3 c = heightMap.GetPositionOnFace(f, 3);
+
+			float d = ((b.x - a.x) * (c.z - a.z)) - ((c.x - a.x) * (b.z - a.z));
+			float u = (((x - a.x) * (c.z - a.z)) - ((c.x - a.x) * (z - a.z))) / d;
+			float v = (((b.x - a.x) * (z - a.z)) - ((x - a.x) * (b.z - a.z))) / d;
+
+			if (u >= -1e-4f && v >= -1e-4f && u + v <= 1.0f + 1e-4f)
+			{
+				expected = a.y + (u * (b.y - a.y)) + (v * (c.y - a.y));
+			}
+		}
+
+		float error = fabsf(ys[i] - expected);
+		worst = error > worst ? error : worst;
+		wrong += error <= 1e-3f ? 0 : 1;
+	}
+
+	if (wrong > 0)
+	{
+		printf("FAIL %d of %d %s are off their face's plane, by up to %g\n", wrong, count, name, worst);
+		failures++;
+	}
+
+	return count;
+}
+
+//Writes and loads generated terrain, placed away from the origin so the world offset is covered
+static HeightMap* LoadGenerated(const char* fileName, int size, const XMFLOAT3& offset)
+{
+	std::vector<unsigned char> heights(size * size);
+	HeightMap::GenerateRollingHeights(heights.data(), size, size);
+
+	if (!HeightMap::SaveHeightMapBitmap(fileName, heights.data(), size, size))
+	{
+		return nullptr;
+	}
+
+	HeightMap* heightMap = new HeightMap((char*)fileName, 2.0f, 0.75f);
+	heightMap->SetWorldOffset(offset);
+	remove(fileName);
+
+	return heightMap;
+}
+
+int main()
+{
+	HeightMap* heightMap = LoadGenerated("SampleHeightsTest.bmp", MAP_SIZE, XMFLOAT3(37.5f, -3.25f, -120.0f));
+
+	if (heightMap == nullptr)
+	{
+		printf("FAIL can't write the test heightmap\n");
+		return 1;
+	}
+
+	heightMap->SetSimdLevel(SIMD_AVX2);
+
+	if (heightMap->GetSimdLevel() < SIMD_AVX2)
+	{
+		printf("CPU doesn't support AVX2, skipping the checks\n");
+		delete heightMap;
+		return 0;
+	}
+
+	float minX, minZ, maxX, maxZ;
+	heightMap->GetWorldBoundsXZ(minX, minZ, maxX, maxZ);
+
+	float cell = (maxX - minX) / (MAP_SIZE - 1);
+
+	Random random(RANDOM_SEED);
+	const int pointCount = 4096;
+
+	//Anywhere on the map
+	std::vector<float> insideX(pointCount), insideZ(pointCount);
+
+	for (int i = 0; i < pointCount; i++)
+	{
+		insideX[i] = random.NextRange(minX, maxX);
+		insideZ[i] = random.NextRange(minZ, maxZ);
+	}
+
+	//Exactly on cell corners and edges, the far edges, and the diagonal of each cell (u + v == 1)
+	std::vector<float> edgeX(pointCount), edgeZ(pointCount);
+
+	for (int i = 0; i < pointCount; i++)
+	{
+		int w = random.NextInt(MAP_SIZE);
+		int l = random.NextInt(MAP_SIZE);
+		float u = (float)random.NextInt(5) * 0.25f;
+
+		switch (i % 4)
+		{
+		case 0:
+			edgeX[i] = minX + (w * cell);
+			edgeZ[i] = minZ + (l * cell);
+			break;
+		case 1:
+			edgeX[i] = minX + ((w + u) * cell);
+			edgeZ[i] = minZ + ((l + 1.0f - u) * cell);
+			break;
+		case 2:
+			edgeX[i] = maxX;
+			edgeZ[i] = minZ + (l * cell);
+			break;
+		default:
+			edgeX[i] = minX + ((w + u) * cell);
+			edgeZ[i] = maxZ;
+			break;
+		}
+	}
+
+	//Off each side and corner of the map, just past the edge and far away
+	std::vector<float> outsideX(pointCount), outsideZ(pointCount);
+
+	for (int i = 0; i < pointCount; i++)
+	{
+		float distance = (i % 2 == 0) ? random.NextRange(0.0f, cell) : random.NextRange(cell, 1e6f);
+		int side = (i / 2) % 8;
+
+		outsideX[i] = random.NextRange(minX, maxX);
+		outsideZ[i] = random.NextRange(minZ, maxZ);
+
+		if (side == 0 || side == 4 || side == 5)
+			outsideX[i] = minX - distance;
+		if (side == 1 || side == 6 || side == 7)
+			outsideX[i] = maxX + distance;
+		if (side == 2 || side == 4 || side == 6)
+			outsideZ[i] = minZ - distance;
+		if (side == 3 || side == 5 || side == 7)
+			outsideZ[i] = maxZ + distance;
+	}
+
+	int checks = 0;
+
+	for (int normals = 0; normals < 2; normals++)
+	{
+		CheckPoints(*heightMap, insideX, insideZ, 0, pointCount - 1, normals != 0, "points on the map");
+		CheckPoints(*heightMap, edgeX, edgeZ, 0, pointCount, normals != 0, "points on cell edges");
+		CheckPoints(*heightMap, outsideX, outsideZ, 0, pointCount, normals != 0, "points off the map");
+		checks += 3;
+
+		//Every tail length, from unaligned starts
+		for (int count = 0; count <= 40; count++)
+		{
+			for (int offset = 0; offset < 4; offset++)
+			{
+				CheckPoints(*heightMap, outsideX, outsideZ, offset, count, normals != 0, "tails off the map");
+				CheckPoints(*heightMap, edgeX, edgeZ, offset, count, normals != 0, "tails on cell edges");
+				checks += 2;
+			}
+		}
+	}
+
+	FaceGrid grid = BuildFaceGrid(*heightMap, cell);
+	int planeChecks = CheckAgainstFaces(*heightMap, grid, insideX, insideZ, "points on the map");
+	planeChecks += CheckAgainstFaces(*heightMap, grid, edgeX, edgeZ, "points on cell edges");
+	planeChecks += CheckAgainstFaces(*heightMap, grid, outsideX, outsideZ, "points off the map");
+
+	printf("SampleHeights: %d comparisons, %d points against the face planes, %d failures\n\n", checks, planeChecks, failures);
+	delete heightMap;
+
+	//Throughput over a map larger than the caches, random points so most gathers miss
+	HeightMap* large = LoadGenerated("SampleHeightsBenchmark.bmp", BENCHMARK_MAP_SIZE, XMFLOAT3(0.0f, 0.0f, 0.0f));
+
+	if (large == nullptr)
+	{
+		printf("FAIL can't write the benchmark heightmap\n");
+		return 1;
+	}
+
+	large->GetWorldBoundsXZ(minX, minZ, maxX, maxZ);
+
+	std::vector<float> xs(BENCHMARK_SAMPLES), zs(BENCHMARK_SAMPLES), ys(BENCHMARK_SAMPLES);
+	std::vector<XMFLOAT3> ns(BENCHMARK_SAMPLES);
+
+	for (int i = 0; i < BENCHMARK_SAMPLES; i++)
+	{
+		xs[i] = random.NextRange(minX, maxX);
+		zs[i] = random.NextRange(minZ, maxZ);
+	}
+
+	printf("%d x %d map, %d random points\n", BENCHMARK_MAP_SIZE, BENCHMARK_MAP_SIZE, BENCHMARK_SAMPLES);
+
+	const char* levelNames[] = { "scalar", "AVX2" };
+
+	for (int level = SIMD_SCALAR; level <= SIMD_AVX2; level++)
+	{
+		for (int normals = 0; normals < 2; normals++)
+		{
+			large->SetSimdLevel((SimdLevel)level);
+
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+			for (int pass = 0; pass < BENCHMARK_PASSES; pass++)
+			{
+				large->SampleHeights(xs.data(), zs.data(), ys.data(), normals != 0 ? ns.data() : nullptr, BENCHMARK_SAMPLES);
+			}
+
+			double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+			printf("%-7s %-15s %8.1f Msamples/s\n", levelNames[level], normals != 0 ? "with normals" : "heights only",
+				((double)BENCHMARK_SAMPLES * BENCHMARK_PASSES / seconds) / 1e6);
+		}
+	}
+
+	delete large;
+
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,274 @@
+//**********************************************************************
+// File:			SceneQueryTest.cpp
+// Description:		Checks OverlapSphere, OverlapAABB and KNearest against a
+//					brute force search of every body, with the broadphase
+//					sorted by a step and unsorted after spawning, including
+//					result buffers too small to hold everything found. Then
+//					runs the same queries from several threads at once and
+//					checks every thread gets the single threaded results.
+//**********************************************************************
+
+#include <stdio.h>
+
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include "TestScene.h"
+
+static const int BODY_COUNT = 3000;
+static const int QUERY_COUNT = 2000;
+static const int MAX_RESULTS = 4096;
+static const int READER_THREADS = 4;
+
+static int failures = 0;
+
+static void Check(bool condition, const char* name, const char* message)
+{
+	if (!condition)
+	{
+		printf("FAIL %s: %s\n", name, message);
+		failures++;
+	}
+}
+
+//A query of each kind around the same spot
+struct SceneQuery
+{
+	XMFLOAT3 centre;
+	float radius;
+	XMFLOAT3 boxMin;
+	XMFLOAT3 boxMax;
+	int k;
+};
+
+//Results of running a query of each kind, sorted where the order isn't defined
+struct QueryResults
+{
+	std::vector<BodyHandle> sphere;
+	std::vector<BodyHandle> box;
+	std::vector<BodyHandle> nearest;
+	std::vector<float> nearestDistances;
+
+	bool operator==(const QueryResults& other) const
+	{
+		return sphere == other.sphere && box == other.box && nearest == other.nearest && nearestDistances == other.nearestDistances;
+	}
+};
+
+//Runs a query of each kind through the world
+static void RunQuery(const PhysicsWorld& world, const SceneQuery& query, QueryResults& results)
+{
+	results.sphere.resize(MAX_RESULTS);
+	results.sphere.resize(min(world.OverlapSphere(XMLoadFloat3(&query.centre), query.radius, results.sphere.data(), MAX_RESULTS), MAX_RESULTS));
+	std::sort(results.sphere.begin(), results.sphere.end());
+
+	results.box.resize(MAX_RESULTS);
+	results.box.resize(min(world.OverlapAABB(query.boxMin, query.boxMax, results.box.data(), MAX_RESULTS), MAX_RESULTS));
+	std::sort(results.box.begin(), results.box.end());
+
+	results.nearest.resize(query.k);
+	results.nearestDistances.resize(query.k);
+	int found = world.KNearest(XMLoadFloat3(&query.centre), query.k, results.nearest.data(), results.nearestDistances.data());
+	results.nearest.resize(found);
+	results.nearestDistances.resize(found);
+}
+
+//Runs a query of each kind by testing every active body, with the same sums as the world
+static void RunBruteForce(BodyStore& store, const SceneQuery& query, QueryResults& results)
+{
+	results = QueryResults();
+
+	std::vector<std::pair<float, BodyHandle>> byDistance;
+
+	for (int i = 0; i < store.GetCount(); i++)
+	{
+		if (!store.IsActive(i))
+		{
+			continue;
+		}
+
+		XMFLOAT3 p;
+		XMStoreFloat3(&p, store.GetPosition(i));
+		float radius = store.GetRadius(i);
+
+		float dx = p.x - query.centre.x;
+		float dy = p.y - query.centre.y;
+		float dz = p.z - query.centre.z;
+		float reach = query.radius + radius;
+		float distanceSq = dx * dx + dy * dy + dz * dz;
+
+		if (distanceSq <= reach * reach)
+		{
+			results.sphere.push_back(store.GetHandle(i));
+		}
+
+		float bx = p.x - min(max(p.x, query.boxMin.x), query.boxMax.x);
+		float by = p.y - min(max(p.y, query.boxMin.y), query.boxMax.y);
+		float bz = p.z - min(max(p.z, query.boxMin.z), query.boxMax.z);
+
+		if (bx * bx + by * by + bz * bz <= radius * radius)
+		{
+			results.box.push_back(store.GetHandle(i));
+		}
+
+		byDistance.push_back(std::make_pair(distanceSq, store.GetHandle(i)));
+	}
+
+	std::sort(results.sphere.begin(), results.sphere.end());
+	std::sort(results.box.begin(), results.box.end());
+
+	int k = min(query.k, (int)byDistance.size());
+	std::partial_sort(byDistance.begin(), byDistance.begin() + k, byDistance.end());
+
+	for (int i = 0; i < k; i++)
+	{
+		results.nearest.push_back(byDistance[i].second);
+		results.nearestDistances.push_back(sqrtf(byDistance[i].first));
+	}
+}
+
+//Builds queries of every size over the scene, some well away from any body
+static std::vector<SceneQuery> MakeQueries(TestScene& scene, Random& random)
+{
+	float minX, minZ, maxX, maxZ;
+	scene.GetBoundsXZ(minX, minZ, maxX, maxZ);
+
+	const int ks[] = { 1, 2, 8, 33, BODY_COUNT * 2 };
+	std::vector<SceneQuery> queries(QUERY_COUNT);
+
+	for (int q = 0; q < QUERY_COUNT; q++)
+	{
+		SceneQuery& query = queries[q];
+
+		query.centre = XMFLOAT3(random.NextRange(minX - 20.0f, maxX + 20.0f), random.NextRange(-5.0f, 40.0f), random.NextRange(minZ - 20.0f, maxZ + 20.0f));
+		query.radius = (q % 10 == 0) ? random.NextRange(10.0f, 40.0f) : random.NextRange(0.0f, 6.0f);
+
+		float halfX = (q % 10 == 1) ? random.NextRange(10.0f, 40.0f) : random.NextRange(0.0f, 6.0f);
+		float halfY = random.NextRange(0.0f, 6.0f);
+		float halfZ = random.NextRange(0.0f, 6.0f);
+
+		query.boxMin = XMFLOAT3(query.centre.x - halfX, query.centre.y - halfY, query.centre.z - halfZ);
+		query.boxMax = XMFLOAT3(query.centre.x + halfX, query.centre.y + halfY, query.centre.z + halfZ);
+
+		query.k = ks[q % 5];
+	}
+
+	return queries;
+}
+
+//Compares every query against the brute force search
+static void CheckQueries(TestScene& scene, const std::vector<SceneQuery>& queries, const char* name)
+{
+	int sphereWrong = 0, boxWrong = 0, nearestWrong = 0;
+	long long found = 0;
+
+	QueryResults results, expected;
+
+	for (const SceneQuery& query : queries)
+	{
+		RunQuery(*scene.world, query, results);
+		RunBruteForce(scene.world->GetBodyStore(), query, expected);
+
+		sphereWrong += results.sphere != expected.sphere ? 1 : 0;
+		boxWrong += results.box != expected.box ? 1 : 0;
+
+		//Bodies the same distance away can come back in either order, the distances can't differ
+		nearestWrong += results.nearestDistances != expected.nearestDistances ? 1 : 0;
+
+		found += (long long)results.sphere.size() + results.box.size();
+	}
+
+	Check(sphereWrong == 0, name, "OverlapSphere differs from the brute force search");
+	Check(boxWrong == 0, name, "OverlapAABB differs from the brute force search");
+	Check(nearestWrong == 0, name, "KNearest differs from the brute force search");
+
+	//Buffers too small for what's found still get the full count, and a subset of the bodies
+	int truncatedWrong = 0;
+
+	for (const SceneQuery& query : queries)
+	{
+		RunBruteForce(scene.world->GetBodyStore(), query, expected);
+
+		if (expected.sphere.size() < 2)
+		{
+			continue;
+		}
+
+		BodyHandle few[2];
+		int count = scene.world->OverlapSphere(XMLoadFloat3(&query.centre), query.radius, few, 2);
+
+		truncatedWrong += count != (int)expected.sphere.size() ||
+			!std::binary_search(expected.sphere.begin(), expected.sphere.end(), few[0]) ||
+			!std::binary_search(expected.sphere.begin(), expected.sphere.end(), few[1]) ? 1 : 0;
+	}
+
+	Check(truncatedWrong == 0, name, "a short result buffer changed the count or got bodies that weren't found");
+
+	printf("%s: %d queries of each kind, %lld overlaps found\n", name, (int)queries.size(), found);
+}
+
+//Runs every query from several threads at once, each checking its results against the single threaded ones
+static void CheckConcurrentReaders(TestScene& scene, const std::vector<SceneQuery>& queries)
+{
+	std::vector<QueryResults> expected(queries.size());
+
+	for (size_t q = 0; q < queries.size(); q++)
+	{
+		RunQuery(*scene.world, queries[q], expected[q]);
+	}
+
+	std::vector<int> wrong(READER_THREADS, 0);
+	std::vector<std::thread> readers;
+
+	for (int t = 0; t < READER_THREADS; t++)
+	{
+		readers.push_back(std::thread([&scene, &queries, &expected, &wrong, t]()
+		{
+			QueryResults results;
+
+			//Each thread starts at a different query so they aren't all reading the same boxes at once
+			for (size_t n = 0; n < queries.size(); n++)
+			{
+				size_t q = (n + (t * queries.size() / READER_THREADS)) % queries.size();
+
+				RunQuery(*scene.world, queries[q], results);
+				wrong[t] += results == expected[q] ? 0 : 1;
+			}
+		}));
+	}
+
+	int totalWrong = 0;
+
+	for (int t = 0; t < READER_THREADS; t++)
+	{
+		readers[t].join();
+		totalWrong += wrong[t];
+	}
+
+	Check(totalWrong == 0, "concurrent readers", "a thread got different results from the single threaded run");
+
+	printf("concurrent readers: %d threads, %d queries each\n", READER_THREADS, (int)queries.size());
+}
+
+int main()
+{
+	TestScene scene(BODY_COUNT + 300, 2, 2);
+	Random random(RANDOM_SEED);
+
+	scene.SpawnLayers(BODY_COUNT, 2.0f, RANDOM_SEED);
+	scene.Step(90);
+
+	std::vector<SceneQuery> queries = MakeQueries(scene, random);
+
+	CheckQueries(scene, queries, "sorted broadphase");
+	CheckConcurrentReaders(scene, queries);
+
+	//Bodies added since the last step leave the broadphase unsorted until the next
+	scene.SpawnLayers(300, 15.0f, RANDOM_SEED + 1);
+	CheckQueries(scene, queries, "unsorted broadphase");
+
+	printf("Scene queries: %d failures\n", failures);
+
+	return failures == 0 ? 0 : 1;
+}
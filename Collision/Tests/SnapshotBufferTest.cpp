@@ -0,0 +1,169 @@
+//**********************************************************************
+// File:			SnapshotBufferTest.cpp
+// Description:		Producer/consumer checks of the snapshot triple buffer,
+//					meant to be run under ThreadSanitizer (the
+//					SnapshotBufferTestTSan target). A thread publishes
+//					snapshots whose every entry encodes its step while
+//					this one acquires them, then a world steps on its
+//					update thread while this one reads its snapshots.
+//					Any torn or out of order snapshot fails, and TSan
+//					reports any access the buffer doesn't order.
+//**********************************************************************
+
+#include <stdio.h>
+
+#include <thread>
+#include <atomic>
+
+#include "SnapshotBuffer.h"
+#include "TestScene.h"
+
+static const int PUBLISHED_SNAPSHOTS = 50000;
+static const int WORLD_UPDATES = 200;
+static const int WORLD_BODIES = 400;
+
+static int failures = 0;
+
+static void Check(bool condition, const char* message)
+{
+	if (!condition)
+	{
+		printf("FAIL %s\n", message);
+		failures++;
+	}
+}
+
+//Fills a snapshot for a step, every entry derived from the step so a torn read shows
+static void FillSnapshot(BodySnapshot& snapshot, unsigned long long step)
+{
+	int count = (int)(step % 64);
+	float value = (float)step;
+
+	snapshot.step = step;
+	snapshot.alpha = 1.0f;
+	snapshot.handles.assign(count, (BodyHandle)step);
+	snapshot.views.assign(count, nullptr);
+	snapshot.positions.assign(count, XMFLOAT3(value, -value, value));
+	snapshot.previousPositions.assign(count, XMFLOAT3(value - 1.0f, value, value + 1.0f));
+}
+
+//Returns : True if every entry of a snapshot came from its step
+static bool IsWhole(const BodySnapshot& snapshot)
+{
+	float value = (float)snapshot.step;
+
+	if (snapshot.GetCount() != (int)(snapshot.step % 64) || (int)snapshot.positions.size() != snapshot.GetCount() ||
+		(int)snapshot.previousPositions.size() != snapshot.GetCount())
+	{
+		return false;
+	}
+
+	for (int i = 0; i < snapshot.GetCount(); i++)
+	{
+		if (snapshot.handles[i] != (BodyHandle)snapshot.step || snapshot.positions[i].x != value ||
+			snapshot.positions[i].y != -value || snapshot.previousPositions[i].z != value + 1.0f)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//A thread publishing as fast as it can while this one acquires
+static void CheckBuffer()
+{
+	SnapshotBuffer buffer;
+	std::atomic<bool> done(false);
+
+	std::thread producer([&buffer, &done]()
+	{
+		for (int step = 1; step <= PUBLISHED_SNAPSHOTS; step++)
+		{
+			FillSnapshot(buffer.GetWriteBuffer(), step);
+			buffer.Publish();
+		}
+
+		done = true;
+	});
+
+	unsigned long long lastStep = 0;
+	int acquired = 0, torn = 0, backwards = 0;
+
+	while (!done || buffer.HasNewSnapshot())
+	{
+		const BodySnapshot& snapshot = buffer.Acquire();
+
+		if (snapshot.step == 0)
+		{
+			continue;
+		}
+
+		torn += IsWhole(snapshot) ? 0 : 1;
+		backwards += snapshot.step < lastStep ? 1 : 0;
+		lastStep = snapshot.step;
+		acquired++;
+	}
+
+	producer.join();
+
+	Check(torn == 0, "consumer read a snapshot that was being written");
+	Check(backwards == 0, "consumer went back to an older snapshot");
+	Check(buffer.Acquire().step == PUBLISHED_SNAPSHOTS, "consumer didn't end on the last snapshot");
+
+	printf("Buffer: %d snapshots published, %d acquired\n", PUBLISHED_SNAPSHOTS, acquired);
+}
+
+//A world updating on its update thread while this one reads its snapshots, as the application's render does
+static void CheckWorld()
+{
+	TestScene scene(WORLD_BODIES, 2);
+	scene.world->SetDeterministic(true);
+	scene.world->SetSnapshotsEnabled(true);
+	scene.SpawnLayers(WORLD_BODIES, 2.0f, RANDOM_SEED);
+
+	unsigned long long lastStep = 0;
+	int backwards = 0, wrongCount = 0, acquired = 0;
+
+	for (int update = 0; update < WORLD_UPDATES; update++)
+	{
+		scene.world->UpdateWorldAsync();
+
+		//Read a few while the step runs, however far it gets
+		for (int read = 0; read < 4; read++)
+		{
+			const BodySnapshot& snapshot = scene.world->AcquireSnapshot();
+
+			backwards += snapshot.step < lastStep ? 1 : 0;
+			wrongCount += snapshot.GetCount() > WORLD_BODIES || (int)snapshot.positions.size() != snapshot.GetCount() ? 1 : 0;
+			lastStep = snapshot.step;
+			acquired++;
+		}
+
+		Check(scene.world->WaitForUpdate() == 1, "a deterministic update ran other than one step");
+	}
+
+	Check(!scene.world->IsUpdating(), "world still updating after the wait");
+	Check(backwards == 0, "world snapshot went back to an older step");
+	Check(wrongCount == 0, "world snapshot had the wrong number of bodies");
+	Check(scene.world->AcquireSnapshot().step == scene.world->GetStepCount(), "last world snapshot isn't of the last step");
+
+	//Publishing is opt in, a world that didn't ask for snapshots leaves the buffer empty
+	TestScene quiet(WORLD_BODIES, 1);
+	quiet.SpawnLayers(WORLD_BODIES, 2.0f, RANDOM_SEED);
+	quiet.Step(5);
+
+	Check(quiet.world->AcquireSnapshot().step == 0 && quiet.world->AcquireSnapshot().GetCount() == 0, "world published snapshots without them enabled");
+
+	printf("World: %d updates, %d snapshots read\n", WORLD_UPDATES, acquired);
+}
+
+int main()
+{
+	CheckBuffer();
+	CheckWorld();
+
+	printf("Snapshot buffer: %d failures\n", failures);
+
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,173 @@
+//**********************************************************************
+// File:			TerrainEditTest.cpp
+// Description:		Checks a world wakes the bodies over terrain edited under
+//					them, and only those. A layer of spheres on flat ground,
+//					none touching, is left to fall asleep, then a crater is
+//					dug under some with ApplyBrush and a corner lowered under
+//					others with ModifyHeights. The bodies over each edit must
+//					wake on the next step and drop onto the new ground, the
+//					rest must stay asleep.
+//**********************************************************************
+
+#include <stdio.h>
+
+#include <vector>
+
+#include "TestScene.h"
+
+//Vertices along each side of the flat map, 10 x 10 columns of spheres 3 apart cover it
+static const int MAP_SIZE = 16;
+static const int BODY_COUNT = 100;
+static const int MAX_SETTLE_STEPS = 1200;
+static const int FALL_STEPS = 120;
+
+static const float CRATER_RADIUS = 6.0f;
+static const float CRATER_DEPTH = 4.0f;
+
+static int failures = 0;
+
+static void Check(bool condition, const char* message)
+{
+	if (!condition)
+	{
+		printf("FAIL %s\n", message);
+		failures++;
+	}
+}
+
+//Returns : Number of active bodies that are asleep
+static int CountSleeping(BodyStore& store)
+{
+	int sleeping = 0;
+
+	for (int i = 0; i < store.GetCount(); i++)
+	{
+		sleeping += store.IsActive(i) && store.IsSleeping(i) ? 1 : 0;
+	}
+
+	return sleeping;
+}
+
+//Returns : True if a body's sphere reaches over an X/Z rectangle
+static bool IsOver(BodyStore& store, int index, float minX, float minZ, float maxX, float maxZ)
+{
+	XMFLOAT3 p;
+	XMStoreFloat3(&p, store.GetPosition(index));
+	float radius = store.GetRadius(index);
+
+	return p.x + radius >= minX && p.x - radius <= maxX && p.z + radius >= minZ && p.z - radius <= maxZ;
+}
+
+//Checks the bodies over a rectangle woke and fell after an edit, and that the others stayed asleep
+//Params : Scene, edited rectangle (a margin either side of the faces changed), heights before the edit, name of the edit
+static void CheckEdit(TestScene& scene, float minX, float minZ, float maxX, float maxZ, const std::vector<float>& heights, const char* name)
+{
+	BodyStore& store = scene.world->GetBodyStore();
+	scene.Step(1);
+
+	int over = 0, overAsleep = 0, awayAwake = 0;
+
+	for (int i = 0; i < store.GetCount(); i++)
+	{
+		if (IsOver(store, i, minX, minZ, maxX, maxZ))
+		{
+			over++;
+			overAsleep += store.IsSleeping(i) ? 1 : 0;
+		}
+		else if (!IsOver(store, i, minX - 3.0f, minZ - 3.0f, maxX + 3.0f, maxZ + 3.0f))
+		{
+			awayAwake += store.IsSleeping(i) ? 0 : 1;
+		}
+	}
+
+	scene.Step(FALL_STEPS);
+
+	int fallen = 0;
+
+	for (int i = 0; i < store.GetCount(); i++)
+	{
+		fallen += IsOver(store, i, minX, minZ, maxX, maxZ) && XMVectorGetY(store.GetPosition(i)) < heights[i] - 1.0f ? 1 : 0;
+	}
+
+	printf("%s: %d bodies over the edit, %d asleep after it, %d fell, %d awake away from it\n", name, over, overAsleep, fallen, awayAwake);
+
+	Check(over > 0, "no bodies over the edit, the test isn't testing anything");
+	Check(overAsleep == 0, "a body over edited terrain was left asleep");
+	Check(fallen > 0, "nothing over the lowered terrain fell onto it");
+	Check(awayAwake == 0, "a body away from the edit was woken");
+}
+
+//Returns : Height of every body
+static std::vector<float> GetHeights(BodyStore& store)
+{
+	std::vector<float> heights(store.GetCount());
+
+	for (int i = 0; i < store.GetCount(); i++)
+	{
+		heights[i] = XMVectorGetY(store.GetPosition(i));
+	}
+
+	return heights;
+}
+
+int main()
+{
+	//Flat, so the spheres don't roll together into islands that never rest (as they do in heightmap_0's bowl)
+	std::vector<unsigned char> flat(MAP_SIZE * MAP_SIZE, 128);
+
+	if (!HeightMap::SaveHeightMapBitmap("TerrainEditTest.bmp", flat.data(), MAP_SIZE, MAP_SIZE))
+	{
+		printf("FAIL can't write the test heightmap\n");
+		return 1;
+	}
+
+	TestScene scene(BODY_COUNT, 1, 0);
+	scene.tiles.push_back(new HeightMap((char*)"TerrainEditTest.bmp", 2.0f, 0.75f));
+	scene.world->AddHeightMap(scene.tiles[0], XMFLOAT3(0.0f, 0.0f, 0.0f));
+	remove("TerrainEditTest.bmp");
+
+	//One layer of spheres 3 apart, so each rests on the terrain on its own island
+	scene.world->SetDeterministic(true);
+	scene.SpawnLayers(BODY_COUNT, 2.0f, RANDOM_SEED);
+
+	BodyStore& store = scene.world->GetBodyStore();
+	int steps = 0;
+
+	while (CountSleeping(store) < store.GetCount() && steps < MAX_SETTLE_STEPS)
+	{
+		scene.Step(1);
+		steps++;
+	}
+
+	Check(store.GetCount() == BODY_COUNT && CountSleeping(store) == BODY_COUNT, "the layer didn't all fall asleep");
+	printf("Layer of %d asleep after %d steps\n", BODY_COUNT, steps);
+
+	HeightMap* tile = scene.tiles[0];
+
+	float minX, minZ, maxX, maxZ;
+	tile->GetWorldBoundsXZ(minX, minZ, maxX, maxZ);
+
+	//A crater in the middle, the rectangle reaching a cell past the brush where faces are rebuilt
+	float centreX = (minX + maxX) * 0.5f;
+	float centreZ = (minZ + maxZ) * 0.5f;
+	std::vector<float> heights = GetHeights(store);
+
+	tile->ApplyBrush(XMVectorSet(centreX, 0.0f, centreZ, 0.0f), CRATER_RADIUS, -CRATER_DEPTH);
+	CheckEdit(scene, centreX - CRATER_RADIUS, centreZ - CRATER_RADIUS, centreX + CRATER_RADIUS, centreZ + CRATER_RADIUS, heights, "ApplyBrush");
+
+	//Let everything sleep again, then drop the corner of vertices 0 to 3 on each axis
+	for (steps = 0; CountSleeping(store) < store.GetCount() && steps < MAX_SETTLE_STEPS; steps++)
+	{
+		scene.Step(1);
+	}
+
+	Check(CountSleeping(store) == store.GetCount(), "the layer didn't fall asleep again after the crater");
+
+	heights = GetHeights(store);
+	tile->ModifyHeights(0, 0, 3, 3, -CRATER_DEPTH, HeightMap::HEIGHT_EDIT_ADD);
+	CheckEdit(scene, minX, minZ, minX + 6.0f, minZ + 6.0f, heights, "ModifyHeights");
+
+	printf("Terrain edits: %d failures\n", failures);
+
+	return failures == 0 ? 0 : 1;
+}
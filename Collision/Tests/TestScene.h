@@ -0,0 +1,149 @@
+//**********************************************************************
+// File:			TestScene.h
+// Description:		A world over heightmap tiles with a pool of spheres, and
+//					ways of dropping them onto the terrain, shared by the tests
+//					that need a running world rather than a single class
+//**********************************************************************
+
+#ifndef _TEST_SCENE_H_
+#define _TEST_SCENE_H_
+
+#include <float.h>
+
+#include <vector>
+
+#include "PhysicsWorld.h"
+#include "HeightMap.h"
+#include "Random.h"
+#include "Constants.h"
+
+//**********************************************************************************
+// Struct : TestScene
+// Description : A world and the heightmaps and bodies it was given, which it owns.
+// The world is deleted first as it uses the rest.
+//**********************************************************************************
+struct TestScene
+{
+	PhysicsWorld* world;
+	std::vector<HeightMap*> tiles;
+	std::vector<DynamicBody*> bodies;
+
+	//Params : Spheres in the pool, job system workers, tiles along each side of a square of heightmap_0
+	TestScene(int bodyCount, int workers, int tilesPerSide = 1)
+	{
+		world = new PhysicsWorld();
+		world->SetWorkerCount(workers);
+		world->SetContactEventsEnabled(false);
+
+		for (int t = 0; t < tilesPerSide * tilesPerSide; ++t)
+		{
+			HeightMap* tile = new HeightMap((char*)TEST_RESOURCE_DIR "/heightmap_0.bmp", 2.0f, 0.75f);
+
+			float minX, minZ, maxX, maxZ;
+			tile->GetWorldBoundsXZ(minX, minZ, maxX, maxZ);
+
+			float x = ((t % tilesPerSide) - ((tilesPerSide - 1) * 0.5f)) * (maxX - minX);
+			float z = ((t / tilesPerSide) - ((tilesPerSide - 1) * 0.5f)) * (maxZ - minZ);
+
+			world->AddHeightMap(tile, XMFLOAT3(x, 0.0f, z));
+			tiles.push_back(tile);
+		}
+
+		for (int i = 0; i < bodyCount; ++i)
+		{
+			DynamicBody* body = new DynamicBody();
+			body->SetRadius(1.0f);
+
+			world->AddToPool(body);
+			bodies.push_back(body);
+		}
+	}
+
+	~TestScene()
+	{
+		delete world;
+
+		for (DynamicBody* body : bodies)
+		{
+			delete body;
+		}
+
+		for (HeightMap* tile : tiles)
+		{
+			delete tile;
+		}
+	}
+
+	//Gets the X/Z extents of all the tiles together
+	void GetBoundsXZ(float& minX, float& minZ, float& maxX, float& maxZ) const
+	{
+		minX = minZ = FLT_MAX;
+		maxX = maxZ = -FLT_MAX;
+
+		for (HeightMap* tile : tiles)
+		{
+			float tileMinX, tileMinZ, tileMaxX, tileMaxZ;
+			tile->GetWorldBoundsXZ(tileMinX, tileMinZ, tileMaxX, tileMaxZ);
+
+			minX = min(minX, tileMinX);
+			minZ = min(minZ, tileMinZ);
+			maxX = max(maxX, tileMaxX);
+			maxZ = max(maxZ, tileMaxZ);
+		}
+	}
+
+	//Spawns spheres from the pool in layers of a grid of columns, 3 radii apart
+	//Params : Number of spheres, height of the first layer above the ground under each column, seed for the jitter
+	void SpawnLayers(int count, float height, unsigned int seed)
+	{
+		float minX, minZ, maxX, maxZ;
+		GetBoundsXZ(minX, minZ, maxX, maxZ);
+
+		const float spacing = 3.0f;
+		int columnsX = max((int)((maxX - minX) / spacing), 1);
+		int columnsZ = max((int)((maxZ - minZ) / spacing), 1);
+		int columnCount = columnsX * columnsZ;
+
+		std::vector<float> columnX(columnCount), columnZ(columnCount), columnY(columnCount, -FLT_MAX), tileY(columnCount);
+
+		for (int c = 0; c < columnCount; ++c)
+		{
+			columnX[c] = minX + ((c % columnsX) + 0.5f) * spacing;
+			columnZ[c] = minZ + ((c / columnsX) + 0.5f) * spacing;
+		}
+
+		for (HeightMap* tile : tiles)
+		{
+			tile->SampleHeights(columnX.data(), columnZ.data(), tileY.data(), nullptr, columnCount);
+
+			for (int c = 0; c < columnCount; ++c)
+			{
+				columnY[c] = max(columnY[c], tileY[c]);
+			}
+		}
+
+		Random random(seed);
+
+		for (int i = 0; i < count; ++i)
+		{
+			int column = i % columnCount;
+			int layer = i / columnCount;
+
+			float x = columnX[column] + random.NextRange(-0.25f, 0.25f);
+			float z = columnZ[column] + random.NextRange(-0.25f, 0.25f);
+			float y = columnY[column] + height + (layer * spacing);
+
+			world->SpawnBody(XMVectorSet(x, y, z, 0.0f), XMVectorZero());
+		}
+	}
+
+	void Step(int steps)
+	{
+		for (int s = 0; s < steps; ++s)
+		{
+			world->Step(1.0f / PHYSICS_STEP_RATE);
+		}
+	}
+};
+
+#endif
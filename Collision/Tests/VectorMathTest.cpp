@@ -0,0 +1,202 @@
+//**********************************************************************
+// File:			VectorMathTest.cpp
+// Description:		Checks the SIMD vector maths backend (SSE, or AVX when built
+//					with PHYSICS_MATH_AVX) gives bit identical results to the
+//					scalar backend, over random and special case inputs
+//**********************************************************************
+
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+
+#include "VectorMath.h"
+#include "CpuFeatures.h"
+#include "Random.h"
+#include "Constants.h"
+
+#if !defined(PHYSICS_MATH_SCALAR)
+
+namespace Scalar = VectorMathScalar;
+namespace SIMD = VectorMathSIMD;
+
+static int s_iChecks = 0;
+static int s_iFailures = 0;
+
+//Compares the four lanes of each backend's result bit for bit
+//Params : Name of the operation, lanes from the scalar and SIMD backends, inputs for the error message
+static void CheckLanes(const char* name, const float* expected, const float* actual, const XMFLOAT4& a, const XMFLOAT4& b)
+{
+	s_iChecks++;
+
+	if (memcmp(expected, actual, sizeof(float) * 4) != 0)
+	{
+		//Only report the first few, a broken operation fails on every input
+		if (s_iFailures++ < 20)
+		{
+			printf("FAIL %s a=(%g, %g, %g, %g) b=(%g, %g, %g, %g)\n  scalar (%.9g, %.9g, %.9g, %.9g)\n  simd   (%.9g, %.9g, %.9g, %.9g)\n",
+				name, a.x, a.y, a.z, a.w, b.x, b.y, b.z, b.w,
+				expected[0], expected[1], expected[2], expected[3], actual[0], actual[1], actual[2], actual[3]);
+		}
+	}
+}
+
+static void Check(const char* name, const Scalar::XMVECTOR& expected, const SIMD::XMVECTOR& actual, const XMFLOAT4& a, const XMFLOAT4& b)
+{
+	XMFLOAT4 lanes;
+	SIMD::XMStoreFloat4(&lanes, actual);
+
+	CheckLanes(name, expected.f, &lanes.x, a, b);
+}
+
+static void Check(const char* name, float expected, float actual, const XMFLOAT4& a, const XMFLOAT4& b)
+{
+	float expectedLanes[4] = { expected, 0.0f, 0.0f, 0.0f };
+	float actualLanes[4] = { actual, 0.0f, 0.0f, 0.0f };
+
+	CheckLanes(name, expectedLanes, actualLanes, a, b);
+}
+
+static void Check(const char* name, const XMFLOAT3& expected, const XMFLOAT3& actual, const XMFLOAT4& a, const XMFLOAT4& b)
+{
+	float expectedLanes[4] = { expected.x, expected.y, expected.z, 0.0f };
+	float actualLanes[4] = { actual.x, actual.y, actual.z, 0.0f };
+
+	CheckLanes(name, expectedLanes, actualLanes, a, b);
+}
+
+//Runs every operation on both backends and compares them
+//Params : Two input vectors
+static void CheckAll(const XMFLOAT4& a, const XMFLOAT4& b)
+{
+	Scalar::XMVECTOR sa = Scalar::XMLoadFloat4(&a);
+	Scalar::XMVECTOR sb = Scalar::XMLoadFloat4(&b);
+	SIMD::XMVECTOR va = SIMD::XMLoadFloat4(&a);
+	SIMD::XMVECTOR vb = SIMD::XMLoadFloat4(&b);
+
+	XMFLOAT3 a3(a.x, a.y, a.z);
+
+	Check("XMVectorSet", Scalar::XMVectorSet(a.x, a.y, a.z, a.w), SIMD::XMVectorSet(a.x, a.y, a.z, a.w), a, b);
+	Check("XMVectorReplicate", Scalar::XMVectorReplicate(a.y), SIMD::XMVectorReplicate(a.y), a, b);
+	Check("XMLoadFloat3", Scalar::XMLoadFloat3(&a3), SIMD::XMLoadFloat3(&a3), a, b);
+
+	Check("XMVectorGetX", Scalar::XMVectorGetX(sa), SIMD::XMVectorGetX(va), a, b);
+	Check("XMVectorGetY", Scalar::XMVectorGetY(sa), SIMD::XMVectorGetY(va), a, b);
+	Check("XMVectorGetZ", Scalar::XMVectorGetZ(sa), SIMD::XMVectorGetZ(va), a, b);
+	Check("XMVectorGetW", Scalar::XMVectorGetW(sa), SIMD::XMVectorGetW(va), a, b);
+
+	float scalarFloat, simdFloat;
+	Scalar::XMStoreFloat(&scalarFloat, sb);
+	SIMD::XMStoreFloat(&simdFloat, vb);
+	Check("XMStoreFloat", scalarFloat, simdFloat, a, b);
+
+	XMFLOAT3 scalarFloat3, simdFloat3;
+	Scalar::XMStoreFloat3(&scalarFloat3, sb);
+	SIMD::XMStoreFloat3(&simdFloat3, vb);
+	Check("XMStoreFloat3", scalarFloat3, simdFloat3, a, b);
+
+	Check("operator+", sa + sb, va + vb, a, b);
+	Check("operator-", sa - sb, va - vb, a, b);
+	Check("operator*", sa * sb, va * vb, a, b);
+	Check("operator/", sa / sb, va / vb, a, b);
+	Check("operator*(float)", sa * b.x, va * b.x, a, b);
+	Check("operator*(float, v)", b.y * sa, b.y * va, a, b);
+	Check("operator/(float)", sa / b.z, va / b.z, a, b);
+	Check("negate", -sa, -va, a, b);
+
+	Scalar::XMVECTOR scalarAccumulate = sa;
+	SIMD::XMVECTOR simdAccumulate = va;
+	scalarAccumulate += sb;
+	simdAccumulate += vb;
+	scalarAccumulate *= b.w;
+	simdAccumulate *= b.w;
+	scalarAccumulate -= sb;
+	simdAccumulate -= vb;
+	scalarAccumulate /= a.x;
+	simdAccumulate /= a.x;
+	Check("compound assignment", scalarAccumulate, simdAccumulate, a, b);
+
+	Check("XMVector3Dot", Scalar::XMVector3Dot(sa, sb), SIMD::XMVector3Dot(va, vb), a, b);
+	Check("XMVector3Cross", Scalar::XMVector3Cross(sa, sb), SIMD::XMVector3Cross(va, vb), a, b);
+	Check("XMVector3LengthSq", Scalar::XMVector3LengthSq(sa), SIMD::XMVector3LengthSq(va), a, b);
+	Check("XMVector3Length", Scalar::XMVector3Length(sa), SIMD::XMVector3Length(va), a, b);
+	Check("XMVector3Normalize", Scalar::XMVector3Normalize(sa), SIMD::XMVector3Normalize(va), a, b);
+
+	Scalar::XMMATRIX scalarMatrix = Scalar::XMMatrixTranslationFromVector(sa);
+	SIMD::XMMATRIX simdMatrix = SIMD::XMMatrixTranslationFromVector(va);
+
+	for (int row = 0; row < 4; ++row)
+	{
+		Check("XMMatrixTranslationFromVector", scalarMatrix.r[row], simdMatrix.r[row], a, b);
+	}
+}
+
+//Returns : Random vector with lanes in [-range, range)
+static XMFLOAT4 RandomVector(Random& random, float range)
+{
+	return XMFLOAT4(random.NextRange(-range, range), random.NextRange(-range, range), random.NextRange(-range, range), random.NextRange(-range, range));
+}
+
+int main()
+{
+#if defined(PHYSICS_MATH_AVX)
+	//Every CPU with AVX2 has AVX, so this only skips very old machines
+	if (GetSupportedSimdLevel() < SIMD_AVX2)
+	{
+		printf("CPU doesn't support AVX, skipping the AVX backend checks\n");
+		return 0;
+	}
+
+	const char* backend = "AVX";
+#else
+	const char* backend = "SSE";
+#endif
+
+	//Zero, negative zero, unit and degenerate vectors
+	const XMFLOAT4 specialCases[] = {
+		XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f),
+		XMFLOAT4(-0.0f, -0.0f, -0.0f, -0.0f),
+		XMFLOAT4(1.0f, 0.0f, 0.0f, 0.0f),
+		XMFLOAT4(0.0f, -1.0f, 0.0f, 1.0f),
+		XMFLOAT4(0.0f, 0.0f, 1.0f, 0.0f),
+		XMFLOAT4(-0.0f, 2.0f, -0.0f, 0.0f),
+		XMFLOAT4(FLT_MIN, -FLT_MIN, FLT_MIN, 1.0f),
+		XMFLOAT4(1e19f, -1e19f, 1e19f, 1.0f),
+		XMFLOAT4(3.0f, 4.0f, 12.0f, -5.0f),
+	};
+
+	const int specialCaseCount = sizeof(specialCases) / sizeof(specialCases[0]);
+
+	for (int i = 0; i < specialCaseCount; ++i)
+	{
+		for (int j = 0; j < specialCaseCount; ++j)
+		{
+			CheckAll(specialCases[i], specialCases[j]);
+		}
+	}
+
+	//Random vectors over a spread of magnitudes
+	Random random(RANDOM_SEED);
+	const float ranges[] = { 1e-3f, 1.0f, 100.0f, 1e6f };
+
+	for (float range : ranges)
+	{
+		for (int i = 0; i < 100000; ++i)
+		{
+			CheckAll(RandomVector(random, range), RandomVector(random, range));
+		}
+	}
+
+	printf("%s backend against scalar: %d checks, %d failures\n", backend, s_iChecks, s_iFailures);
+
+	return s_iFailures == 0 ? 0 : 1;
+}
+
+#else
+
+int main()
+{
+	printf("Built with the scalar backend only, nothing to compare\n");
+	return 0;
+}
+
+#endif
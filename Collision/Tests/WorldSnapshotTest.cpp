@@ -0,0 +1,190 @@
+//**********************************************************************
+// File:			WorldSnapshotTest.cpp
+// Description:		Checks LZ4 blocks survive a round trip, and that a world
+//					restored from a snapshot (raw or compressed, into itself or
+//					into a freshly built world) steps on to exactly the same
+//					state as the world it was saved from. Damaged or mismatched
+//					blobs must be refused without touching the world.
+//**********************************************************************
+
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include "TestScene.h"
+#include "Lz4.h"
+#include "WorldSnapshot.h"
+
+static const int SPHERE_COUNT = 400;
+
+static int s_iChecks = 0;
+static int s_iFailures = 0;
+
+static void Check(bool passed, const char* what)
+{
+	s_iChecks++;
+
+	if (!passed)
+	{
+		s_iFailures++;
+		printf("FAIL %s\n", what);
+	}
+}
+
+//Compresses and decompresses a buffer, checking it comes back the same
+static void CheckLz4RoundTrip(const std::vector<unsigned char>& input, const char* what)
+{
+	int size = (int)input.size();
+
+	std::vector<unsigned char> compressed(Lz4CompressBound(size));
+	std::vector<unsigned char> output(size + 1);
+
+	int compressedSize = Lz4Compress(input.data(), size, compressed.data(), (int)compressed.size());
+	int outputSize = Lz4Decompress(compressed.data(), compressedSize, output.data(), (int)output.size());
+
+	Check(compressedSize > 0 && outputSize == size && memcmp(input.data(), output.data(), size) == 0, what);
+
+	//Every truncation has to be refused or decode to something shorter, never run off the end
+	if (compressedSize > 1)
+	{
+		int truncated = Lz4Decompress(compressed.data(), compressedSize - 1, output.data(), size);
+		Check(truncated < size, what);
+	}
+}
+
+static void TestLz4()
+{
+	Random random(RANDOM_SEED);
+
+	const int sizes[] = { 0, 1, 12, 13, 100, 65536, 300000 };
+
+	for (int size : sizes)
+	{
+		std::vector<unsigned char> noise(size), runs(size), floats(size);
+
+		for (int i = 0; i < size; ++i)
+		{
+			noise[i] = (unsigned char)random.NextRange(0.0f, 256.0f);
+			runs[i] = (unsigned char)((i / 37) & 3);
+		}
+
+		//Slowly changing floats, like the body arrays
+		for (int i = 0; i + 4 <= size; i += 4)
+		{
+			float value = 10.0f + (i / 64) * 0.5f;
+			memcpy(&floats[i], &value, sizeof(value));
+		}
+
+		CheckLz4RoundTrip(noise, "lz4 round trip of noise");
+		CheckLz4RoundTrip(runs, "lz4 round trip of runs");
+		CheckLz4RoundTrip(floats, "lz4 round trip of floats");
+	}
+}
+
+//Returns : Number of faces of a heightmap with a hole punched in them
+static int CountDisabledFaces(const HeightMap& heightMap)
+{
+	int count = 0;
+
+	for (int f = 0; f < heightMap.m_iFaceCount; ++f)
+	{
+		count += heightMap.IsFaceDisabled(f) ? 1 : 0;
+	}
+
+	return count;
+}
+
+//Steps a scene on and hashes its world
+static uint64_t StepAndHash(TestScene& scene, int steps)
+{
+	scene.Step(steps);
+
+	return scene.world->GetStateHash();
+}
+
+static void TestWorldSnapshots()
+{
+	TestScene source(SPHERE_COUNT, 2);
+	source.world->SetDeterministic(true);
+
+	//Drop a grid of spheres just above the terrain and let them land and start colliding
+	float minX, minZ, maxX, maxZ;
+	source.tiles[0]->GetWorldBoundsXZ(minX, minZ, maxX, maxZ);
+
+	Random random(RANDOM_SEED);
+
+	for (int i = 0; i < SPHERE_COUNT; ++i)
+	{
+		float x = minX + (((i % 20) + 0.5f) * (maxX - minX) / 20.0f) + random.NextRange(-0.25f, 0.25f);
+		float z = minZ + (((i / 20) + 0.5f) * (maxZ - minZ) / 20.0f) + random.NextRange(-0.25f, 0.25f);
+		float y;
+
+		source.tiles[0]->SampleHeights(&x, &z, &y, nullptr, 1);
+		source.world->SpawnBody(XMVectorSet(x, y + 2.0f, z, 0.0f), XMVectorZero());
+	}
+
+	source.Step(90);
+
+	//Some in the pool and a hole in the terrain, so they're part of the snapshot too
+	for (int i = 0; i < 10; ++i)
+	{
+		source.world->DespawnBody(source.world->GetBodyStore().GetHandle(i * 7));
+	}
+
+	source.tiles[0]->SetRegionDisabled(4, 4, 12, 12, true);
+	source.Step(10);
+
+	std::vector<unsigned char> raw, compressed;
+	source.world->SaveSnapshot(raw, false);
+	source.world->SaveSnapshot(compressed, true);
+
+	Check(compressed.size() < raw.size(), "compressed snapshot is smaller");
+
+	uint64_t expected = StepAndHash(source, 60);
+
+	Check(source.world->RestoreSnapshot(raw.data(), raw.size()), "restore raw into the same world");
+	Check(StepAndHash(source, 60) == expected, "raw restore steps to the same state");
+
+	Check(source.world->RestoreSnapshot(compressed.data(), compressed.size()), "restore compressed into the same world");
+	Check(StepAndHash(source, 60) == expected, "compressed restore steps to the same state");
+
+	//A world built the same way but never stepped, like after a restart
+	TestScene fresh(SPHERE_COUNT, 2);
+	fresh.world->SetDeterministic(true);
+
+	Check(fresh.world->RestoreSnapshot(compressed.data(), compressed.size()), "restore into a fresh world");
+	Check(CountDisabledFaces(*fresh.tiles[0]) == CountDisabledFaces(*source.tiles[0]) && CountDisabledFaces(*fresh.tiles[0]) > 0, "restore brings the terrain holes back");
+	Check(StepAndHash(fresh, 60) == expected, "fresh world steps to the same state");
+
+	//Damaged blobs are refused and leave the world as it was
+	uint64_t before = source.world->GetBodyStore().ComputeStateHash();
+
+	Check(!source.world->RestoreSnapshot(raw.data(), raw.size() / 2), "truncated raw blob is refused");
+	Check(!source.world->RestoreSnapshot(compressed.data(), compressed.size() - 1), "truncated compressed blob is refused");
+	Check(!source.world->RestoreSnapshot(raw.data(), 16), "blob shorter than its header is refused");
+
+	std::vector<unsigned char> damaged = raw;
+	((WorldSnapshotHeader*)damaged.data())->version++;
+	Check(!source.world->RestoreSnapshot(damaged.data(), damaged.size()), "other version is refused");
+
+	damaged = raw;
+	((WorldSnapshotHeader*)damaged.data())->magic = 0;
+	Check(!source.world->RestoreSnapshot(damaged.data(), damaged.size()), "wrong magic is refused");
+
+	Check(source.world->GetBodyStore().ComputeStateHash() == before, "refused blobs leave the world untouched");
+
+	//A world given a different set of bodies can't take the snapshot
+	TestScene smaller(SPHERE_COUNT - 1, 2);
+	Check(!smaller.world->RestoreSnapshot(raw.data(), raw.size()), "world with other bodies is refused");
+}
+
+int main()
+{
+	TestLz4();
+	TestWorldSnapshots();
+
+	printf("World snapshots: %d checks, %d failures\n", s_iChecks, s_iFailures);
+
+	return s_iFailures == 0 ? 0 : 1;
+}
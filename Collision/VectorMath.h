@@ -0,0 +1,335 @@
+#ifndef _VECTOR_MATH_H_
+#define _VECTOR_MATH_H_
+
+//**********************************************************************
+// File:			VectorMath.h
+// Description:		Vector maths used by the physics. The D3D application build
+//					uses DirectXMath. Standalone builds of the physics
+//					(PHYSICS_STANDALONE, no Windows or D3D headers) use the
+//					portable version below, which has the same interface as the
+//					part of DirectXMath the physics uses, so the same source
+//					compiles against either. Its backend is picked at compile time:
+//					  PHYSICS_MATH_AVX    - SSE intrinsics plus the AVX only instructions (needs -mavx)
+//					  PHYSICS_MATH_SSE    - SSE2 intrinsics
+//					  PHYSICS_MATH_SCALAR - plain floats
+//					If none is defined the widest one the compiler targets is used.
+//					The scalar version is always compiled (as VectorMathScalar) so
+//					the others can be checked against it. Every backend does the same
+//					float operations in the same order, so they give the same results
+// Notes:			Build with FP contraction off (-ffp-contract=off), otherwise the
+//					compiler may fuse the scalar multiplies and adds
+//**********************************************************************
+
+#if !defined(PHYSICS_STANDALONE)
+
+#include <DirectXMath.h>
+using namespace DirectX;
+
+#else
+
+#include <math.h>
+
+#if !defined(PHYSICS_MATH_SCALAR) && !defined(PHYSICS_MATH_SSE) && !defined(PHYSICS_MATH_AVX)
+#if defined(__AVX__)
+#define PHYSICS_MATH_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PHYSICS_MATH_SSE
+#else
+#define PHYSICS_MATH_SCALAR
+#endif
+#endif
+
+#if defined(PHYSICS_MATH_AVX) && !defined(__AVX__)
+#error PHYSICS_MATH_AVX needs the compiler to target AVX (-mavx or /arch:AVX)
+#endif
+
+//Storage types, shared by every backend
+struct XMFLOAT2
+{
+	float x;
+	float y;
+
+	XMFLOAT2() = default;
+	XMFLOAT2(float _x, float _y) : x(_x), y(_y) {}
+};
+
+struct XMFLOAT3
+{
+	float x;
+	float y;
+	float z;
+
+	XMFLOAT3() = default;
+	XMFLOAT3(float _x, float _y, float _z) : x(_x), y(_y), z(_z) {}
+};
+
+struct XMFLOAT4
+{
+	float x;
+	float y;
+	float z;
+	float w;
+
+	XMFLOAT4() = default;
+	XMFLOAT4(float _x, float _y, float _z, float _w) : x(_x), y(_y), z(_z), w(_w) {}
+};
+
+//**********************************************************************************
+// Plain float backend
+//**********************************************************************************
+namespace VectorMathScalar
+{
+	struct alignas(16) XMVECTOR
+	{
+		float f[4];
+	};
+
+	//Row major, translation in the last row, as DirectXMath
+	struct XMMATRIX
+	{
+		XMVECTOR r[4];
+	};
+
+	inline XMVECTOR XMVectorSet(float x, float y, float z, float w)
+	{
+		XMVECTOR result = { { x, y, z, w } };
+		return result;
+	}
+
+	inline XMVECTOR XMVectorZero() { return XMVectorSet(0.0f, 0.0f, 0.0f, 0.0f); }
+	inline XMVECTOR XMVectorReplicate(float value) { return XMVectorSet(value, value, value, value); }
+
+	inline float XMVectorGetX(const XMVECTOR& v) { return v.f[0]; }
+	inline float XMVectorGetY(const XMVECTOR& v) { return v.f[1]; }
+	inline float XMVectorGetZ(const XMVECTOR& v) { return v.f[2]; }
+	inline float XMVectorGetW(const XMVECTOR& v) { return v.f[3]; }
+
+	inline XMVECTOR XMLoadFloat3(const XMFLOAT3* source) { return XMVectorSet(source->x, source->y, source->z, 0.0f); }
+	inline XMVECTOR XMLoadFloat4(const XMFLOAT4* source) { return XMVectorSet(source->x, source->y, source->z, source->w); }
+
+	inline void XMStoreFloat(float* destination, const XMVECTOR& v) { *destination = v.f[0]; }
+	inline void XMStoreFloat3(XMFLOAT3* destination, const XMVECTOR& v) { *destination = XMFLOAT3(v.f[0], v.f[1], v.f[2]); }
+	inline void XMStoreFloat4(XMFLOAT4* destination, const XMVECTOR& v) { *destination = XMFLOAT4(v.f[0], v.f[1], v.f[2], v.f[3]); }
+
+	inline XMVECTOR operator+(const XMVECTOR& a, const XMVECTOR& b) { return XMVectorSet(a.f[0] + b.f[0], a.f[1] + b.f[1], a.f[2] + b.f[2], a.f[3] + b.f[3]); }
+	inline XMVECTOR operator-(const XMVECTOR& a, const XMVECTOR& b) { return XMVectorSet(a.f[0] - b.f[0], a.f[1] - b.f[1], a.f[2] - b.f[2], a.f[3] - b.f[3]); }
+	inline XMVECTOR operator*(const XMVECTOR& a, const XMVECTOR& b) { return XMVectorSet(a.f[0] * b.f[0], a.f[1] * b.f[1], a.f[2] * b.f[2], a.f[3] * b.f[3]); }
+	inline XMVECTOR operator/(const XMVECTOR& a, const XMVECTOR& b) { return XMVectorSet(a.f[0] / b.f[0], a.f[1] / b.f[1], a.f[2] / b.f[2], a.f[3] / b.f[3]); }
+	inline XMVECTOR operator*(const XMVECTOR& v, float s) { return v * XMVectorReplicate(s); }
+	inline XMVECTOR operator*(float s, const XMVECTOR& v) { return XMVectorReplicate(s) * v; }
+	inline XMVECTOR operator/(const XMVECTOR& v, float s) { return v / XMVectorReplicate(s); }
+	inline XMVECTOR operator-(const XMVECTOR& v) { return XMVectorSet(-v.f[0], -v.f[1], -v.f[2], -v.f[3]); }
+	inline XMVECTOR operator+(const XMVECTOR& v) { return v; }
+
+	inline XMVECTOR& operator+=(XMVECTOR& a, const XMVECTOR& b) { a = a + b; return a; }
+	inline XMVECTOR& operator-=(XMVECTOR& a, const XMVECTOR& b) { a = a - b; return a; }
+	inline XMVECTOR& operator*=(XMVECTOR& a, const XMVECTOR& b) { a = a * b; return a; }
+	inline XMVECTOR& operator/=(XMVECTOR& a, const XMVECTOR& b) { a = a / b; return a; }
+	inline XMVECTOR& operator*=(XMVECTOR& v, float s) { v = v * s; return v; }
+	inline XMVECTOR& operator/=(XMVECTOR& v, float s) { v = v / s; return v; }
+
+	//3D products and lengths are replicated into every lane
+	inline XMVECTOR XMVector3Dot(const XMVECTOR& a, const XMVECTOR& b)
+	{
+		return XMVectorReplicate(((a.f[0] * b.f[0]) + (a.f[1] * b.f[1])) + (a.f[2] * b.f[2]));
+	}
+
+	inline XMVECTOR XMVector3Cross(const XMVECTOR& a, const XMVECTOR& b)
+	{
+		return XMVectorSet((a.f[1] * b.f[2]) - (a.f[2] * b.f[1]), (a.f[2] * b.f[0]) - (a.f[0] * b.f[2]), (a.f[0] * b.f[1]) - (a.f[1] * b.f[0]), 0.0f);
+	}
+
+	inline XMVECTOR XMVector3LengthSq(const XMVECTOR& v) { return XMVector3Dot(v, v); }
+	inline XMVECTOR XMVector3Length(const XMVECTOR& v) { return XMVectorReplicate(sqrtf(XMVectorGetX(XMVector3Dot(v, v)))); }
+
+	//Zero length vectors normalise to zero
+	inline XMVECTOR XMVector3Normalize(const XMVECTOR& v)
+	{
+		float length = sqrtf(XMVectorGetX(XMVector3Dot(v, v)));
+
+		if (length == 0.0f)
+		{
+			return XMVectorZero();
+		}
+
+		return v / XMVectorReplicate(length);
+	}
+
+	inline XMMATRIX XMMatrixTranslation(float x, float y, float z)
+	{
+		XMMATRIX m;
+		m.r[0] = XMVectorSet(1.0f, 0.0f, 0.0f, 0.0f);
+		m.r[1] = XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
+		m.r[2] = XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f);
+		m.r[3] = XMVectorSet(x, y, z, 1.0f);
+		return m;
+	}
+
+	inline XMMATRIX XMMatrixTranslationFromVector(const XMVECTOR& offset)
+	{
+		return XMMatrixTranslation(offset.f[0], offset.f[1], offset.f[2]);
+	}
+}
+
+#if defined(PHYSICS_MATH_SSE) || defined(PHYSICS_MATH_AVX)
+
+#include <immintrin.h>
+
+//**********************************************************************************
+// SSE/AVX backend, one vector per register
+//**********************************************************************************
+namespace VectorMathSIMD
+{
+	struct XMVECTOR
+	{
+		__m128 v;
+	};
+
+	//Row major, translation in the last row, as DirectXMath
+	struct XMMATRIX
+	{
+		XMVECTOR r[4];
+	};
+
+	inline XMVECTOR MakeVector(__m128 v)
+	{
+		XMVECTOR result = { v };
+		return result;
+	}
+
+	//Copies one lane into all four
+#if defined(PHYSICS_MATH_AVX)
+#define VECTOR_MATH_SPLAT(v, lane) _mm_permute_ps((v), _MM_SHUFFLE(lane, lane, lane, lane))
+#else
+#define VECTOR_MATH_SPLAT(v, lane) _mm_shuffle_ps((v), (v), _MM_SHUFFLE(lane, lane, lane, lane))
+#endif
+
+	inline XMVECTOR XMVectorSet(float x, float y, float z, float w) { return MakeVector(_mm_setr_ps(x, y, z, w)); }
+	inline XMVECTOR XMVectorZero() { return MakeVector(_mm_setzero_ps()); }
+	inline XMVECTOR XMVectorReplicate(float value) { return MakeVector(_mm_set1_ps(value)); }
+
+	inline float XMVectorGetX(const XMVECTOR& v) { return _mm_cvtss_f32(v.v); }
+	inline float XMVectorGetY(const XMVECTOR& v) { return _mm_cvtss_f32(VECTOR_MATH_SPLAT(v.v, 1)); }
+	inline float XMVectorGetZ(const XMVECTOR& v) { return _mm_cvtss_f32(VECTOR_MATH_SPLAT(v.v, 2)); }
+	inline float XMVectorGetW(const XMVECTOR& v) { return _mm_cvtss_f32(VECTOR_MATH_SPLAT(v.v, 3)); }
+
+	inline XMVECTOR XMLoadFloat3(const XMFLOAT3* source)
+	{
+		//x and y in one 64 bit load, z on its own (which clears w). Through __m64, which may alias
+		//the floats, a double* load lets GCC move it past stores to them under strict aliasing
+		__m128 xy = _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)source);
+		__m128 z = _mm_load_ss(&source->z);
+		return MakeVector(_mm_movelh_ps(xy, z));
+	}
+
+	inline XMVECTOR XMLoadFloat4(const XMFLOAT4* source) { return MakeVector(_mm_loadu_ps(&source->x)); }
+
+	inline void XMStoreFloat(float* destination, const XMVECTOR& v) { _mm_store_ss(destination, v.v); }
+
+	inline void XMStoreFloat3(XMFLOAT3* destination, const XMVECTOR& v)
+	{
+		//Through __m64 for the same reason as the load, a double* store can sink below reads of x and y
+		_mm_storel_pi((__m64*)destination, v.v);
+		_mm_store_ss(&destination->z, _mm_movehl_ps(v.v, v.v));
+	}
+
+	inline void XMStoreFloat4(XMFLOAT4* destination, const XMVECTOR& v) { _mm_storeu_ps(&destination->x, v.v); }
+
+	inline XMVECTOR operator+(const XMVECTOR& a, const XMVECTOR& b) { return MakeVector(_mm_add_ps(a.v, b.v)); }
+	inline XMVECTOR operator-(const XMVECTOR& a, const XMVECTOR& b) { return MakeVector(_mm_sub_ps(a.v, b.v)); }
+	inline XMVECTOR operator*(const XMVECTOR& a, const XMVECTOR& b) { return MakeVector(_mm_mul_ps(a.v, b.v)); }
+	inline XMVECTOR operator/(const XMVECTOR& a, const XMVECTOR& b) { return MakeVector(_mm_div_ps(a.v, b.v)); }
+	inline XMVECTOR operator*(const XMVECTOR& v, float s) { return MakeVector(_mm_mul_ps(v.v, _mm_set1_ps(s))); }
+	inline XMVECTOR operator*(float s, const XMVECTOR& v) { return MakeVector(_mm_mul_ps(_mm_set1_ps(s), v.v)); }
+	inline XMVECTOR operator/(const XMVECTOR& v, float s) { return MakeVector(_mm_div_ps(v.v, _mm_set1_ps(s))); }
+
+	//Flips the sign bits, as the scalar negate does, so zero lanes become -0
+	inline XMVECTOR operator-(const XMVECTOR& v) { return MakeVector(_mm_xor_ps(v.v, _mm_set1_ps(-0.0f))); }
+	inline XMVECTOR operator+(const XMVECTOR& v) { return v; }
+
+	inline XMVECTOR& operator+=(XMVECTOR& a, const XMVECTOR& b) { a = a + b; return a; }
+	inline XMVECTOR& operator-=(XMVECTOR& a, const XMVECTOR& b) { a = a - b; return a; }
+	inline XMVECTOR& operator*=(XMVECTOR& a, const XMVECTOR& b) { a = a * b; return a; }
+	inline XMVECTOR& operator/=(XMVECTOR& a, const XMVECTOR& b) { a = a / b; return a; }
+	inline XMVECTOR& operator*=(XMVECTOR& v, float s) { v = v * s; return v; }
+	inline XMVECTOR& operator/=(XMVECTOR& v, float s) { v = v / s; return v; }
+
+	//3D products and lengths are replicated into every lane
+	inline XMVECTOR XMVector3Dot(const XMVECTOR& a, const XMVECTOR& b)
+	{
+		//Summed as (x + y) + z like the scalar version. _mm_dp_ps isn't used as it adds the masked
+		//out lane as +0, which turns a -0 sum into +0
+		__m128 products = _mm_mul_ps(a.v, b.v);
+		__m128 sum = _mm_add_ss(_mm_add_ss(products, VECTOR_MATH_SPLAT(products, 1)), VECTOR_MATH_SPLAT(products, 2));
+		return MakeVector(VECTOR_MATH_SPLAT(sum, 0));
+	}
+
+	inline XMVECTOR XMVector3Cross(const XMVECTOR& a, const XMVECTOR& b)
+	{
+#if defined(PHYSICS_MATH_AVX)
+		__m128 aYZX = _mm_permute_ps(a.v, _MM_SHUFFLE(3, 0, 2, 1));
+		__m128 bZXY = _mm_permute_ps(b.v, _MM_SHUFFLE(3, 1, 0, 2));
+		__m128 aZXY = _mm_permute_ps(a.v, _MM_SHUFFLE(3, 1, 0, 2));
+		__m128 bYZX = _mm_permute_ps(b.v, _MM_SHUFFLE(3, 0, 2, 1));
+		__m128 cross = _mm_sub_ps(_mm_mul_ps(aYZX, bZXY), _mm_mul_ps(aZXY, bYZX));
+
+		//w is a.w * b.w - a.w * b.w, cleared to 0 as the scalar version
+		return MakeVector(_mm_blend_ps(cross, _mm_setzero_ps(), 0x8));
+#else
+		__m128 aYZX = _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(3, 0, 2, 1));
+		__m128 bZXY = _mm_shuffle_ps(b.v, b.v, _MM_SHUFFLE(3, 1, 0, 2));
+		__m128 aZXY = _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(3, 1, 0, 2));
+		__m128 bYZX = _mm_shuffle_ps(b.v, b.v, _MM_SHUFFLE(3, 0, 2, 1));
+		__m128 cross = _mm_sub_ps(_mm_mul_ps(aYZX, bZXY), _mm_mul_ps(aZXY, bYZX));
+
+		//w is a.w * b.w - a.w * b.w, cleared to 0 as the scalar version
+		return MakeVector(_mm_and_ps(cross, _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0))));
+#endif
+	}
+
+	inline XMVECTOR XMVector3LengthSq(const XMVECTOR& v) { return XMVector3Dot(v, v); }
+	inline XMVECTOR XMVector3Length(const XMVECTOR& v) { return MakeVector(_mm_sqrt_ps(XMVector3Dot(v, v).v)); }
+
+	//Zero length vectors normalise to zero
+	inline XMVECTOR XMVector3Normalize(const XMVECTOR& v)
+	{
+		__m128 length = _mm_sqrt_ps(XMVector3Dot(v, v).v);
+		__m128 nonZero = _mm_cmpneq_ps(length, _mm_setzero_ps());
+
+		return MakeVector(_mm_and_ps(_mm_div_ps(v.v, length), nonZero));
+	}
+
+	inline XMMATRIX XMMatrixTranslation(float x, float y, float z)
+	{
+		XMMATRIX m;
+		m.r[0] = XMVectorSet(1.0f, 0.0f, 0.0f, 0.0f);
+		m.r[1] = XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
+		m.r[2] = XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f);
+		m.r[3] = XMVectorSet(x, y, z, 1.0f);
+		return m;
+	}
+
+	inline XMMATRIX XMMatrixTranslationFromVector(const XMVECTOR& offset)
+	{
+		//Keeps x, y, z and puts 1 in w
+		__m128 row = _mm_shuffle_ps(offset.v, _mm_unpackhi_ps(offset.v, _mm_set1_ps(1.0f)), _MM_SHUFFLE(3, 0, 1, 0));
+
+		XMMATRIX m = XMMatrixTranslation(0.0f, 0.0f, 0.0f);
+		m.r[3] = MakeVector(row);
+		return m;
+	}
+
+#undef VECTOR_MATH_SPLAT
+}
+
+using namespace VectorMathSIMD;
+
+#else
+
+using namespace VectorMathScalar;
+
+#endif
+
+#endif
+
+#endif
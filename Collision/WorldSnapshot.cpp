@@ -0,0 +1,432 @@
+#include "WorldSnapshot.h"
+#include "JobSystem.h"
+#include "Lz4.h"
+
+#include <stdio.h>
+#include <string.h>
+
+//Largest block size a blob may claim, anything bigger is treated as damage
+static const uint32_t MAX_BLOCK_SIZE = 1 << 28;
+
+//Rounds an offset up to the snapshot alignment
+static uint64_t AlignOffset(uint64_t offset)
+{
+	return (offset + WORLD_SNAPSHOT_ALIGNMENT - 1) & ~(uint64_t)(WORLD_SNAPSHOT_ALIGNMENT - 1);
+}
+
+//Blocks of a payload being compressed or decompressed by the job system
+struct SnapshotBlockContext
+{
+	const unsigned char* source;
+	unsigned char* destination;
+	uint64_t payloadSize;
+	uint32_t blockSize;
+
+	//Compressing: room given to each block's output. Decompressing: where each block starts in the source
+	int blockCapacity;
+	const uint64_t* blockOffsets;
+
+	//Compressed size of each block, or for decompressing, whether each block came out whole
+	uint32_t* blockSizes;
+	int* blockResults;
+};
+
+//Job entry points, compress or decompress a run of blocks
+static void CompressBlocksTask(void* context, int begin, int end, int worker)
+{
+	SnapshotBlockContext* blocks = (SnapshotBlockContext*)context;
+
+	for (int b = begin; b < end; b++)
+	{
+		uint64_t start = (uint64_t)b * blocks->blockSize;
+		uint64_t size = blocks->payloadSize - start < blocks->blockSize ? blocks->payloadSize - start : blocks->blockSize;
+
+		blocks->blockSizes[b] = (uint32_t)Lz4Compress(blocks->source + start, (int)size,
+			blocks->destination + ((uint64_t)b * blocks->blockCapacity), blocks->blockCapacity);
+	}
+}
+
+static void DecompressBlocksTask(void* context, int begin, int end, int worker)
+{
+	SnapshotBlockContext* blocks = (SnapshotBlockContext*)context;
+
+	for (int b = begin; b < end; b++)
+	{
+		uint64_t start = (uint64_t)b * blocks->blockSize;
+		uint64_t size = blocks->payloadSize - start < blocks->blockSize ? blocks->payloadSize - start : blocks->blockSize;
+
+		int written = Lz4Decompress(blocks->source + blocks->blockOffsets[b], (int)blocks->blockSizes[b], blocks->destination + start, (int)size);
+
+		blocks->blockResults[b] = written == (int)size ? 1 : 0;
+	}
+}
+
+//Runs a block task across a job system, or on this thread without one
+static void RunBlocks(JobSystem* pJobSystem, const char* name, int blockCount, JobFunction function, SnapshotBlockContext* context)
+{
+	if (pJobSystem != nullptr)
+	{
+		pJobSystem->ParallelFor(name, blockCount, 1, function, context);
+	}
+	else
+	{
+		function(context, 0, blockCount, 0);
+	}
+}
+
+SnapshotWriter::SnapshotWriter()
+{
+	m_iPayloadSize = 0;
+}
+
+//Adds an array to the snapshot, it must stay unchanged until Build
+//Params : Section id and index, first element, size of an element, number of elements
+void SnapshotWriter::AddSection(uint32_t id, uint32_t index, const void* data, uint32_t elementSize, uint64_t count)
+{
+	WorldSnapshotSection section;
+	memset(&section, 0, sizeof(section));
+
+	section.id = id;
+	section.index = index;
+	section.elementSize = elementSize;
+	section.count = count;
+	section.offset = AlignOffset(m_iPayloadSize);
+
+	m_iPayloadSize = section.offset + (count * elementSize);
+
+	m_sections.push_back(section);
+	m_sectionData.push_back(data);
+}
+
+//Copies every section into place in a payload, zeroing the padding between them so
+//the same state always gives the same bytes
+void SnapshotWriter::WritePayload(unsigned char* payload) const
+{
+	uint64_t written = 0;
+
+	for (size_t s = 0; s < m_sections.size(); s++)
+	{
+		const WorldSnapshotSection& section = m_sections[s];
+		uint64_t bytes = section.count * section.elementSize;
+
+		memset(payload + written, 0, (size_t)(section.offset - written));
+
+		if (bytes > 0)
+		{
+			memcpy(payload + section.offset, m_sectionData[s], (size_t)bytes);
+		}
+
+		written = section.offset + bytes;
+	}
+}
+
+//Lays the header, section table and payload out in a blob, optionally compressing the payload
+//Params : Blob to fill in (reused, so it only grows), whether to compress, scratch space for the
+//uncompressed payload (reused too), job system the blocks are compressed across (nullptr for this thread)
+void SnapshotWriter::Build(std::vector<unsigned char>& blob, bool compress, std::vector<unsigned char>& scratch, JobSystem* pJobSystem)
+{
+	WorldSnapshotHeader header;
+	memset(&header, 0, sizeof(header));
+
+	header.magic = WORLD_SNAPSHOT_MAGIC;
+	header.version = WORLD_SNAPSHOT_VERSION;
+	header.sectionCount = (uint32_t)m_sections.size();
+	header.payloadSize = m_iPayloadSize;
+
+	uint64_t tablesSize = sizeof(WorldSnapshotHeader) + (m_sections.size() * sizeof(WorldSnapshotSection));
+
+	if (!compress)
+	{
+		header.payloadOffset = AlignOffset(tablesSize);
+		header.storedSize = m_iPayloadSize;
+
+		blob.resize((size_t)(header.payloadOffset + header.storedSize));
+		WritePayload(blob.data() + header.payloadOffset);
+	}
+	else
+	{
+		//Compressed blocks go straight into the blob, each given the most room it could need,
+		//then they're packed down behind each other
+		scratch.resize((size_t)m_iPayloadSize);
+		WritePayload(scratch.data());
+
+		header.flags = SNAPSHOT_COMPRESSED;
+		header.blockSize = WORLD_SNAPSHOT_BLOCK_SIZE;
+		header.blockCount = (uint32_t)((m_iPayloadSize + WORLD_SNAPSHOT_BLOCK_SIZE - 1) / WORLD_SNAPSHOT_BLOCK_SIZE);
+		header.payloadOffset = AlignOffset(tablesSize + (header.blockCount * sizeof(uint32_t)));
+
+		int blockCapacity = Lz4CompressBound(WORLD_SNAPSHOT_BLOCK_SIZE);
+		std::vector<uint32_t> blockSizes(header.blockCount);
+
+		blob.resize((size_t)(header.payloadOffset + ((uint64_t)header.blockCount * blockCapacity)));
+
+		SnapshotBlockContext context;
+		memset(&context, 0, sizeof(context));
+
+		context.source = scratch.data();
+		context.destination = blob.data() + header.payloadOffset;
+		context.payloadSize = m_iPayloadSize;
+		context.blockSize = WORLD_SNAPSHOT_BLOCK_SIZE;
+		context.blockCapacity = blockCapacity;
+		context.blockSizes = blockSizes.data();
+
+		RunBlocks(pJobSystem, "CompressSnapshot", (int)header.blockCount, CompressBlocksTask, &context);
+
+		uint64_t packed = 0;
+
+		for (uint32_t b = 0; b < header.blockCount; b++)
+		{
+			memmove(context.destination + packed, context.destination + ((uint64_t)b * blockCapacity), blockSizes[b]);
+			packed += blockSizes[b];
+		}
+
+		header.storedSize = packed;
+
+		blob.resize((size_t)(header.payloadOffset + packed));
+
+		if (header.blockCount > 0)
+		{
+			memcpy(blob.data() + tablesSize, blockSizes.data(), header.blockCount * sizeof(uint32_t));
+		}
+
+		tablesSize += header.blockCount * sizeof(uint32_t);
+	}
+
+	memcpy(blob.data(), &header, sizeof(header));
+
+	if (!m_sections.empty())
+	{
+		memcpy(blob.data() + sizeof(header), m_sections.data(), m_sections.size() * sizeof(WorldSnapshotSection));
+	}
+
+	memset(blob.data() + tablesSize, 0, (size_t)(header.payloadOffset - tablesSize));
+}
+
+SnapshotReader::SnapshotReader()
+{
+	m_pSections = nullptr;
+	m_iSectionCount = 0;
+	m_pPayload = nullptr;
+	m_iPayloadSize = 0;
+}
+
+//Checks the header and section table, decompressing the payload if needed
+//Params : Blob and its size, scratch space for a decompressed payload (must outlive the reader),
+//job system the blocks are decompressed across (nullptr for this thread)
+//Returns : False if the blob isn't a snapshot of this version, or is damaged or truncated
+bool SnapshotReader::Open(const void* data, size_t size, std::vector<unsigned char>& scratch, JobSystem* pJobSystem)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+
+	m_pSections = nullptr;
+	m_iSectionCount = 0;
+	m_pPayload = nullptr;
+	m_iPayloadSize = 0;
+
+	WorldSnapshotHeader header;
+
+	if (size < sizeof(header))
+	{
+		return false;
+	}
+
+	memcpy(&header, bytes, sizeof(header));
+
+	if (header.magic != WORLD_SNAPSHOT_MAGIC || header.version != WORLD_SNAPSHOT_VERSION || (header.flags & ~SNAPSHOT_COMPRESSED) != 0)
+	{
+		return false;
+	}
+
+	//Every size is checked against what's really there before it's used, so a damaged blob can't send reads out of it
+	bool compressed = (header.flags & SNAPSHOT_COMPRESSED) != 0;
+	uint64_t blockCount = compressed ? header.blockCount : 0;
+
+	if (header.sectionCount > size / sizeof(WorldSnapshotSection) || blockCount > size / sizeof(uint32_t))
+	{
+		return false;
+	}
+
+	uint64_t tablesSize = sizeof(header) + ((uint64_t)header.sectionCount * sizeof(WorldSnapshotSection)) + (blockCount * sizeof(uint32_t));
+
+	if (header.payloadOffset < tablesSize || header.payloadOffset > size || header.storedSize > size - header.payloadOffset)
+	{
+		return false;
+	}
+
+	const WorldSnapshotSection* sections = (const WorldSnapshotSection*)(bytes + sizeof(header));
+
+	for (uint32_t s = 0; s < header.sectionCount; s++)
+	{
+		const WorldSnapshotSection& section = sections[s];
+
+		if (section.elementSize == 0 || section.offset > header.payloadSize ||
+			section.count > (header.payloadSize - section.offset) / section.elementSize)
+		{
+			return false;
+		}
+	}
+
+	if (!compressed)
+	{
+		if (header.storedSize != header.payloadSize)
+		{
+			return false;
+		}
+
+		m_pPayload = bytes + header.payloadOffset;
+	}
+	else
+	{
+		//LZ4 can't expand data more than about 255 times, so a larger payload size is damage
+		//and mustn't be allowed to size the scratch space
+		if (header.blockSize == 0 || header.blockSize > MAX_BLOCK_SIZE ||
+			blockCount != (header.payloadSize + header.blockSize - 1) / header.blockSize ||
+			header.payloadSize > (header.storedSize * 256) + (blockCount * 16))
+		{
+			return false;
+		}
+
+		std::vector<uint32_t> blockSizes((size_t)blockCount);
+		std::vector<uint64_t> blockOffsets((size_t)blockCount);
+		std::vector<int> blockResults((size_t)blockCount);
+
+		if (blockCount > 0)
+		{
+			memcpy(blockSizes.data(), bytes + tablesSize - (blockCount * sizeof(uint32_t)), (size_t)(blockCount * sizeof(uint32_t)));
+		}
+
+		uint64_t stored = 0;
+
+		for (uint64_t b = 0; b < blockCount; b++)
+		{
+			blockOffsets[(size_t)b] = stored;
+			stored += blockSizes[(size_t)b];
+		}
+
+		if (stored != header.storedSize)
+		{
+			return false;
+		}
+
+		scratch.resize((size_t)header.payloadSize);
+
+		SnapshotBlockContext context;
+		memset(&context, 0, sizeof(context));
+
+		context.source = bytes + header.payloadOffset;
+		context.destination = scratch.data();
+		context.payloadSize = header.payloadSize;
+		context.blockSize = header.blockSize;
+		context.blockOffsets = blockOffsets.data();
+		context.blockSizes = blockSizes.data();
+		context.blockResults = blockResults.data();
+
+		RunBlocks(pJobSystem, "DecompressSnapshot", (int)blockCount, DecompressBlocksTask, &context);
+
+		for (uint64_t b = 0; b < blockCount; b++)
+		{
+			if (blockResults[(size_t)b] == 0)
+			{
+				return false;
+			}
+		}
+
+		m_pPayload = scratch.data();
+	}
+
+	m_pSections = sections;
+	m_iSectionCount = header.sectionCount;
+	m_iPayloadSize = header.payloadSize;
+
+	return true;
+}
+
+//Finds a section
+//Params : Section id and index, size each element must be, filled in with the number of elements
+//Returns : First element, nullptr if the section is missing or its elements are a different size
+const void* SnapshotReader::FindSection(uint32_t id, uint32_t index, uint32_t elementSize, uint64_t& count) const
+{
+	count = 0;
+
+	for (uint32_t s = 0; s < m_iSectionCount; s++)
+	{
+		const WorldSnapshotSection& section = m_pSections[s];
+
+		if (section.id == id && section.index == index)
+		{
+			if (section.elementSize != elementSize)
+			{
+				return nullptr;
+			}
+
+			count = section.count;
+			return m_pPayload + section.offset;
+		}
+	}
+
+	return nullptr;
+}
+
+//Writes a blob to a file with a single write
+//Returns : False if the file couldn't be written
+bool WriteSnapshotFile(const char* fileName, const std::vector<unsigned char>& blob)
+{
+	FILE* filePtr;
+
+#if defined(_MSC_VER)
+	if (fopen_s(&filePtr, fileName, "wb") != 0)
+	{
+		return false;
+	}
+#else
+	filePtr = fopen(fileName, "wb");
+
+	if (filePtr == NULL)
+	{
+		return false;
+	}
+#endif
+
+	size_t written = fwrite(blob.data(), 1, blob.size(), filePtr);
+
+	return (fclose(filePtr) == 0) && written == blob.size();
+}
+
+//Reads a whole file into a blob with a single read
+//Params : File name, blob to fill in (reused, so it only grows)
+//Returns : False if the file couldn't be read
+bool ReadSnapshotFile(const char* fileName, std::vector<unsigned char>& blob)
+{
+	FILE* filePtr;
+
+#if defined(_MSC_VER)
+	if (fopen_s(&filePtr, fileName, "rb") != 0)
+	{
+		return false;
+	}
+#else
+	filePtr = fopen(fileName, "rb");
+
+	if (filePtr == NULL)
+	{
+		return false;
+	}
+#endif
+
+	bool read = false;
+
+	if (fseek(filePtr, 0, SEEK_END) == 0)
+	{
+		long size = ftell(filePtr);
+
+		if (size >= 0 && fseek(filePtr, 0, SEEK_SET) == 0)
+		{
+			blob.resize((size_t)size);
+			read = fread(blob.data(), 1, (size_t)size, filePtr) == (size_t)size;
+		}
+	}
+
+	fclose(filePtr);
+
+	return read;
+}
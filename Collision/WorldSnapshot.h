@@ -0,0 +1,173 @@
+#ifndef _WORLD_SNAPSHOT_H_
+#define _WORLD_SNAPSHOT_H_
+
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+class JobSystem;
+
+
+//Identifies a blob as a world snapshot ("PWSN" when read as bytes)
+static const uint32_t WORLD_SNAPSHOT_MAGIC = 0x4E535750;
+
+//Bumped whenever the layout of a section changes, blobs of any other version are refused
+static const uint32_t WORLD_SNAPSHOT_VERSION = 1;
+
+//Bytes of payload compressed as one LZ4 block, blocks are compressed and decompressed in parallel
+static const uint32_t WORLD_SNAPSHOT_BLOCK_SIZE = 1 << 20;
+
+//Header and payload alignment, so an uncompressed blob read (or mapped) to an aligned address
+//has every section aligned for its element type
+static const uint32_t WORLD_SNAPSHOT_ALIGNMENT = 64;
+
+enum WorldSnapshotFlags
+{
+	//Payload is split into WORLD_SNAPSHOT_BLOCK_SIZE blocks, each LZ4 compressed
+	SNAPSHOT_COMPRESSED = 1
+};
+
+//What each section holds. The index tells apart sections of the same kind (arrays of a store, tiles)
+enum WorldSnapshotSectionId
+{
+	SNAPSHOT_WORLD_STATE = 1,
+	SNAPSHOT_BODY_FLOATS,
+	SNAPSHOT_BODY_FLAGS,
+	SNAPSHOT_BODY_HANDLES,
+	SNAPSHOT_BODY_SLOTS,
+	SNAPSHOT_BODY_IDS,
+	SNAPSHOT_BODY_POOL,
+	SNAPSHOT_BROADPHASE_AABBS,
+	SNAPSHOT_BROADPHASE_PROXIES,
+	SNAPSHOT_SOLVER_IMPULSES,
+	SNAPSHOT_CONTACTS,
+	SNAPSHOT_TERRAIN_HOLES
+};
+
+//**********************************************************************************
+// Struct : WorldSnapshotHeader
+// Description : Start of a snapshot blob. It's followed by the section table, then the
+// block table (compressed blobs only), then the payload at the next aligned offset.
+// Everything is stored in the byte order of the machine that wrote it.
+//**********************************************************************************
+struct WorldSnapshotHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t flags;
+	uint32_t sectionCount;
+
+	//Size of the payload once decompressed, and as stored in the blob
+	uint64_t payloadSize;
+	uint64_t storedSize;
+
+	//Offset of the payload from the start of the blob
+	uint64_t payloadOffset;
+
+	//Number of compressed blocks, 0 if the payload is stored as it is
+	uint32_t blockCount;
+	uint32_t blockSize;
+
+	uint32_t reserved[4];
+};
+
+//**********************************************************************************
+// Struct : WorldSnapshotSection
+// Description : One array in the payload: what it is, the size and number of its
+// elements, and where it starts (aligned, relative to the start of the payload).
+//**********************************************************************************
+struct WorldSnapshotSection
+{
+	uint32_t id;
+	uint32_t index;
+	uint32_t elementSize;
+	uint32_t reserved;
+	uint64_t count;
+	uint64_t offset;
+};
+
+//**********************************************************************************
+// Class : SnapshotWriter
+// Description : Collects the arrays making up a snapshot, then lays them out in one
+// contiguous blob so it can be written with a single I/O. Arrays are only referenced
+// until the blob is built, which copies each one with a single memcpy.
+//**********************************************************************************
+class SnapshotWriter
+{
+public:
+
+	SnapshotWriter();
+
+	//Adds an array to the snapshot, it must stay unchanged until Build
+	//Params : Section id and index, first element, size of an element, number of elements
+	void AddSection(uint32_t id, uint32_t index, const void* data, uint32_t elementSize, uint64_t count);
+
+	//Lays the header, section table and payload out in a blob, optionally compressing the payload
+	//Params : Blob to fill in (reused, so it only grows), whether to compress, scratch space for the
+	//uncompressed payload (reused too), job system the blocks are compressed across (nullptr for this thread)
+	void Build(std::vector<unsigned char>& blob, bool compress, std::vector<unsigned char>& scratch, JobSystem* pJobSystem);
+
+private:
+
+	//Copies every section into place in a payload
+	void WritePayload(unsigned char* payload) const;
+
+	std::vector<WorldSnapshotSection> m_sections;
+	std::vector<const void*> m_sectionData;
+
+	uint64_t m_iPayloadSize;
+};
+
+//**********************************************************************************
+// Class : SnapshotReader
+// Description : Checks a snapshot blob and finds the sections in it. An uncompressed
+// blob is read in place (so it can be a mapped file), a compressed one is decompressed
+// into scratch space first.
+//**********************************************************************************
+class SnapshotReader
+{
+public:
+
+	SnapshotReader();
+
+	//Checks the header and section table, decompressing the payload if needed
+	//Params : Blob and its size, scratch space for a decompressed payload (must outlive the reader),
+	//job system the blocks are decompressed across (nullptr for this thread)
+	//Returns : False if the blob isn't a snapshot of this version, or is damaged or truncated
+	bool Open(const void* data, size_t size, std::vector<unsigned char>& scratch, JobSystem* pJobSystem);
+
+	//Finds a section
+	//Params : Section id and index, size each element must be, filled in with the number of elements
+	//Returns : First element, nullptr if the section is missing or its elements are a different size
+	const void* FindSection(uint32_t id, uint32_t index, uint32_t elementSize, uint64_t& count) const;
+
+	//Finds a section that must have an exact number of elements
+	//Returns : First element, nullptr if the section is missing or the wrong size
+	template<typename T>
+	const T* FindArray(uint32_t id, uint32_t index, uint64_t count) const
+	{
+		uint64_t found = 0;
+		const void* data = FindSection(id, index, sizeof(T), found);
+
+		return found == count ? (const T*)data : nullptr;
+	}
+
+private:
+
+	const WorldSnapshotSection* m_pSections;
+	uint32_t m_iSectionCount;
+
+	const unsigned char* m_pPayload;
+	uint64_t m_iPayloadSize;
+};
+
+//Writes a blob to a file with a single write
+//Returns : False if the file couldn't be written
+bool WriteSnapshotFile(const char* fileName, const std::vector<unsigned char>& blob);
+
+//Reads a whole file into a blob with a single read
+//Params : File name, blob to fill in (reused, so it only grows)
+//Returns : False if the file couldn't be read
+bool ReadSnapshotFile(const char* fileName, std::vector<unsigned char>& blob);
+
+#endif